@@ -0,0 +1,246 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/analysis_cache.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+// Beatrice
+#include "common/cache_directory.h"
+#include "common/hasher.h"
+
+namespace beatrice::common {
+
+namespace {
+
+constexpr auto kMagic =
+    std::array<char, 8>{'B', 'T', 'R', 'A', 'N', 'L', 'Y', 0};
+// レイアウトを変えた場合はこれを上げる
+constexpr std::uint32_t kFormatVersion = 1;
+// 1 つのモデルで記録するホップ数の上限。
+// 10 ms のホップで約 87 分、音素 128 次元のモデルで約 290 MB になる
+constexpr std::uint64_t kMaxNRecords = std::uint64_t{1} << 19;
+// 記録から返したまま保持しておく入力のホップ数の上限。
+// 10 ms のホップで約 44 分、約 170 MB になる。超えた場合は解析し直す
+constexpr std::size_t kMaxNSkippedHops = std::size_t{1} << 18;
+
+struct FileHeader {
+  std::array<char, 8> magic;
+  std::uint32_t format_version;
+  std::uint32_t record_size;
+  // モデルのファイルの大きさと更新日時のハッシュ
+  std::uint64_t model_stamp;
+  // 解析に影響する設定のハッシュ
+  std::uint64_t settings;
+  std::uint64_t n_records;
+};
+
+// モデルの内容ではなく、大きさと更新日時で変更を検出する
+auto GetModelStamp(const std::vector<std::filesystem::path>& model_files)
+    -> std::uint64_t {
+  auto hasher = Hasher();
+  for (const auto& file : model_files) {
+    auto ec = std::error_code();
+    auto size = std::uint64_t{0};
+    if (const auto n = std::filesystem::file_size(file, ec); !ec) {
+      size = static_cast<std::uint64_t>(n);
+    }
+    auto mtime = std::int64_t{0};
+    if (const auto time = std::filesystem::last_write_time(file, ec); !ec) {
+      mtime = static_cast<std::int64_t>(time.time_since_epoch().count());
+    }
+    hasher.Update(reinterpret_cast<const std::byte*>(&size), sizeof(size));
+    hasher.Update(reinterpret_cast<const std::byte*>(&mtime), sizeof(mtime));
+  }
+  return hasher.Get();
+}
+
+// キャッシュディレクトリが得られない場合は空のパスを返す
+auto GetCachePath(const std::filesystem::path& model_file)
+    -> std::filesystem::path {
+  const auto dir = GetCacheDirectory();
+  if (dir.empty()) {
+    return {};
+  }
+  auto ec = std::error_code();
+  auto source = std::filesystem::weakly_canonical(model_file, ec);
+  if (ec) {
+    source = model_file;
+  }
+  const auto source_u8 = source.u8string();
+  auto hasher = Hasher();
+  hasher.Update(reinterpret_cast<const std::byte*>(source_u8.data()),
+                source_u8.size());
+  return dir / (hasher.GetHex() + ".anacache");
+}
+
+}  // namespace
+
+AnalysisCache::AnalysisCache(
+    const std::vector<std::filesystem::path>& model_files,
+    const std::size_t record_size)
+    : path_(model_files.empty() ? std::filesystem::path()
+                                : GetCachePath(model_files.front())),
+      model_stamp_(GetModelStamp(model_files)),
+      record_size_(record_size) {
+  Load();
+}
+
+AnalysisCache::~AnalysisCache() { Save(); }
+
+auto AnalysisCache::IsEnabled() -> bool {
+  static const auto enabled = [] {
+    // NOLINTNEXTLINE(concurrency-mt-unsafe)
+    const auto* const value = std::getenv("BEATRICE_ANALYSIS_CACHE");
+    return value && std::string_view(value) == "1";
+  }();
+  return enabled;
+}
+
+void AnalysisCache::Rewind() {
+  history_ = 0;
+  is_tracking_ = true;
+  is_key_valid_ = false;
+  skipped_inputs_.clear();
+}
+
+void AnalysisCache::SetSettings(const std::optional<std::uint64_t> settings) {
+  is_cacheable_ = settings.has_value();
+  if (settings && *settings != settings_) {
+    settings_ = *settings;
+    Clear();
+  }
+}
+
+auto AnalysisCache::Find(const std::span<const float> input,
+                         const std::span<std::byte> record) -> bool {
+  is_key_valid_ = false;
+  if (!is_tracking_) {
+    return false;
+  }
+  if (!is_cacheable_) {
+    is_tracking_ = false;
+    return false;
+  }
+  auto hasher = Hasher();
+  hasher.Update(reinterpret_cast<const std::byte*>(&history_),
+                sizeof(history_));
+  hasher.Update(reinterpret_cast<const std::byte*>(&settings_),
+                sizeof(settings_));
+  hasher.Update(reinterpret_cast<const std::byte*>(input.data()),
+                input.size_bytes());
+  history_ = hasher.Get();
+  key_ = history_;
+  is_key_valid_ = true;
+  const auto it = index_.find(key_);
+  if (it == index_.end() || record.size() != record_size_ ||
+      skipped_inputs_.size() >= kMaxNSkippedHops * input.size()) {
+    return false;
+  }
+  std::memcpy(record.data(), entries_.data() + it->second + sizeof(key_),
+              record_size_);
+  skipped_inputs_.insert(skipped_inputs_.end(), input.begin(), input.end());
+  return true;
+}
+
+void AnalysisCache::Insert(const std::span<const std::byte> record) {
+  if (!is_key_valid_ || record.size() != record_size_ ||
+      index_.size() >= kMaxNRecords || index_.contains(key_)) {
+    return;
+  }
+  const auto offset = entries_.size();
+  entries_.resize(offset + GetEntrySize());
+  std::memcpy(entries_.data() + offset, &key_, sizeof(key_));
+  std::memcpy(entries_.data() + offset + sizeof(key_), record.data(),
+              record_size_);
+  index_.emplace(key_, offset);
+  is_modified_ = true;
+}
+
+void AnalysisCache::Save() {
+  if (!is_modified_ || path_.empty()) {
+    return;
+  }
+  auto ec = std::error_code();
+  std::filesystem::create_directories(path_.parent_path(), ec);
+  if (ec) {
+    return;
+  }
+  const auto header = FileHeader{
+      .magic = kMagic,
+      .format_version = kFormatVersion,
+      .record_size = static_cast<std::uint32_t>(record_size_),
+      .model_stamp = model_stamp_,
+      .settings = settings_,
+      .n_records = static_cast<std::uint64_t>(index_.size()),
+  };
+  if (WriteFileAtomically(path_, [this, &header](std::ofstream& ofs) {
+        ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        ofs.write(reinterpret_cast<const char*>(entries_.data()),
+                  static_cast<std::streamsize>(entries_.size()));
+        return static_cast<bool>(ofs);
+      })) {
+    is_modified_ = false;
+  }
+}
+
+auto AnalysisCache::GetMemoryUsage() const -> std::size_t {
+  return entries_.capacity() + skipped_inputs_.capacity() * sizeof(float) +
+         index_.size() * (sizeof(std::uint64_t) + sizeof(std::size_t));
+}
+
+void AnalysisCache::Load() {
+  if (path_.empty()) {
+    return;
+  }
+  auto ifs = std::ifstream(path_, std::ios::binary);
+  if (!ifs) {
+    return;
+  }
+  auto header = FileHeader();
+  ifs.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!ifs || header.magic != kMagic ||
+      header.format_version != kFormatVersion ||
+      header.record_size != record_size_ ||
+      header.model_stamp != model_stamp_ || header.n_records > kMaxNRecords) {
+    // モデルが更新されていれば、次に保存する際に上書きされる
+    return;
+  }
+  auto entries = std::vector<std::byte>(header.n_records * GetEntrySize());
+  ifs.read(reinterpret_cast<char*>(entries.data()),
+           static_cast<std::streamsize>(entries.size()));
+  if (!ifs) {
+    return;
+  }
+  entries_ = std::move(entries);
+  index_.reserve(header.n_records);
+  for (auto offset = std::size_t{0}; offset < entries_.size();
+       offset += GetEntrySize()) {
+    auto key = std::uint64_t{0};
+    std::memcpy(&key, entries_.data() + offset, sizeof(key));
+    index_.emplace(key, offset);
+  }
+  settings_ = header.settings;
+}
+
+void AnalysisCache::Clear() {
+  if (!index_.empty()) {
+    is_modified_ = true;
+  }
+  entries_.clear();
+  index_.clear();
+}
+
+}  // namespace beatrice::common
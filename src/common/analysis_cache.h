@@ -0,0 +1,88 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_ANALYSIS_CACHE_H_
+#define BEATRICE_COMMON_ANALYSIS_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace beatrice::common {
+
+// オフラインでの書き出しで、ホップごとの解析結果 (音素、量子化したピッチ、
+// ピッチ特徴量) をキャッシュディレクトリに保存しておき、同じ音声を別の声や
+// ピッチシフトで書き出し直す際に、音素抽出とピッチ推定を省くためのクラス。
+// 環境変数 BEATRICE_ANALYSIS_CACHE=1 の場合のみ使われる。
+//
+// 解析結果はコンテキストを初期化してからの全ての入力に依存するので、
+// Rewind() からの各ホップの入力と解析に影響する設定を連鎖させたハッシュを
+// キーにする。
+// キャッシュはモデルごとに 1 つのファイルで、モデルのファイルが更新された場合や
+// 解析に影響する設定 (音源のピッチの範囲など) が変わった場合は破棄される。
+// 記録から返したホップでは解析側のコンテキストが進まないので、その入力を
+// 保持しておき、呼び出し側は次に自身で解析する前にそれらをコンテキストに
+// 通し直す。これにより、結果はキャッシュを使わない場合と一致する。
+class AnalysisCache {
+ public:
+  // model_files を読み込んだモデルで、1 ホップあたり record_size バイトの
+  // 解析結果を記録する。保存済みのものがあれば読み込む
+  AnalysisCache(const std::vector<std::filesystem::path>& model_files,
+                std::size_t record_size);
+  AnalysisCache(const AnalysisCache&) = delete;
+  auto operator=(const AnalysisCache&) -> AnalysisCache& = delete;
+  // 記録が変わっていれば保存する
+  ~AnalysisCache();
+  [[nodiscard]] static auto IsEnabled() -> bool;
+  // 解析側のコンテキストを初期化した時に呼び、入力の履歴を消す
+  void Rewind();
+  // 解析に影響する設定のハッシュ。変わった場合はそれまでの記録を捨てる。
+  // std::nullopt の場合は、次の Rewind() まで記録も参照もしない
+  void SetSettings(std::optional<std::uint64_t> settings);
+  // 1 ホップ分の入力を履歴に加え、記録があれば record に書き込んで true を返す。
+  // false を返した場合、呼び出し側は GetSkippedInputs() のホップを解析側の
+  // コンテキストに通してから、このホップを解析する
+  auto Find(std::span<const float> input, std::span<std::byte> record) -> bool;
+  // 直前の Find() で記録が無かったホップの解析結果を記録する
+  void Insert(std::span<const std::byte> record);
+  // 記録から返したが、まだ解析側のコンテキストに通していないホップの入力
+  [[nodiscard]] auto GetSkippedInputs() const -> std::span<const float> {
+    return skipped_inputs_;
+  }
+  void ClearSkippedInputs() { skipped_inputs_.clear(); }
+  // 記録が変わっていれば保存する
+  void Save();
+  [[nodiscard]] auto GetMemoryUsage() const -> std::size_t;
+
+ private:
+  std::filesystem::path path_;
+  std::uint64_t model_stamp_ = 0;
+  std::size_t record_size_;
+  std::uint64_t settings_ = 0;
+  bool is_cacheable_ = true;
+  // Rewind() からの入力と設定を連鎖させたハッシュ
+  std::uint64_t history_ = 0;
+  // 記録できない設定のホップがあった場合、Rewind() まで記録も参照もしない
+  bool is_tracking_ = true;
+  // 直前の Find() で求めたキー
+  std::uint64_t key_ = 0;
+  bool is_key_valid_ = false;
+  std::vector<float> skipped_inputs_;
+  // キーとレコードを並べたもの。index_ はキーから先頭の位置を引く
+  std::vector<std::byte> entries_;
+  std::unordered_map<std::uint64_t, std::size_t> index_;
+  bool is_modified_ = false;
+
+  [[nodiscard]] auto GetEntrySize() const -> std::size_t {
+    return sizeof(std::uint64_t) + record_size_;
+  }
+  void Load();
+  void Clear();
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_ANALYSIS_CACHE_H_
@@ -0,0 +1,105 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/async_audio_stream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Beatrice
+#include "common/delayed_output.h"
+#include "common/realtime_worker_pool.h"
+
+namespace beatrice::common {
+
+namespace {
+
+// ワーカーの処理がこのブロック数分遅れるまでは入力を溜めておける
+constexpr auto kNQueuedBlocks = 16;
+constexpr auto kMaxParameterChanges = 1024;
+
+}  // namespace
+
+AsyncAudioStream::AsyncAudioStream(Handler& handler,
+                                   std::shared_ptr<RealtimeWorkerPool> pool,
+                                   const int max_block_size)
+    : handler_(handler),
+      pool_(std::move(pool)),
+      max_block_size_(std::max(max_block_size, 1)),
+      buffer_(max_block_size_),
+      delayed_output_(max_block_size_) {
+  Reset();
+}
+
+AsyncAudioStream::~AsyncAudioStream() { pool_->Wait(*this); }
+
+void AsyncAudioStream::Reset() {
+  pool_->Wait(*this);
+  input_.Reset(static_cast<std::size_t>(max_block_size_) * kNQueuedBlocks);
+  blocks_.Reset(kNQueuedBlocks);
+  parameter_changes_.Reset(kMaxParameterChanges);
+  output_.Reset(static_cast<std::size_t>(max_block_size_) *
+                (kNQueuedBlocks + 1));
+  output_dropped_.store(0, std::memory_order_relaxed);
+  n_pending_parameter_changes_ = 0;
+  delayed_output_.Reset();
+}
+
+void AsyncAudioStream::PushParameterChange(const std::uint32_t id,
+                                           const double value) {
+  const auto change = ParameterChange{.id = id, .value = value};
+  if (parameter_changes_.Write(&change, 1)) {
+    ++n_pending_parameter_changes_;
+  }
+}
+
+void AsyncAudioStream::Process(float* const buffer, const int n_samples,
+                               const bool silent) {
+  // 入力を渡す
+  if (blocks_.GetWritable() >= 1) {
+    auto block = Block{.n_samples = n_samples,
+                       .n_parameter_changes = n_pending_parameter_changes_,
+                       .silent = silent};
+    if (!silent && !input_.Write(buffer, n_samples)) {
+      // ワーカーが大きく遅れている場合は、パラメータの変更だけを渡す
+      delayed_output_.DropInput(n_samples);
+      block.n_samples = 0;
+      block.silent = true;
+    }
+    blocks_.Write(&block, 1);
+    n_pending_parameter_changes_ = 0;
+  } else {
+    delayed_output_.DropInput(n_samples);
+  }
+  pool_->Schedule(*this);
+
+  // 遅延させた出力を受け取る
+  delayed_output_.DropOutput(
+      output_dropped_.exchange(0, std::memory_order_acquire));
+  delayed_output_.Read(output_, buffer, n_samples);
+}
+
+void AsyncAudioStream::Run() {
+  auto block = Block();
+  while (blocks_.Read(&block, 1)) {
+    for (auto i = 0; i < block.n_parameter_changes; ++i) {
+      auto change = ParameterChange();
+      if (parameter_changes_.Read(&change, 1)) {
+        handler_.OnParameterChange(change.id, change.value);
+      }
+    }
+    if (block.silent) {
+      std::fill_n(buffer_.begin(), block.n_samples, 0.0f);
+    } else {
+      input_.Read(buffer_.data(), block.n_samples);
+    }
+    handler_.ProcessBlock(buffer_.data(), block.n_samples, block.silent);
+    if (!output_.Write(buffer_.data(), block.n_samples)) {
+      output_dropped_.fetch_add(block.n_samples, std::memory_order_release);
+    }
+  }
+}
+
+}  // namespace beatrice::common
@@ -0,0 +1,91 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_ASYNC_AUDIO_STREAM_H_
+#define BEATRICE_COMMON_ASYNC_AUDIO_STREAM_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Beatrice
+#include "common/delayed_output.h"
+#include "common/realtime_worker_pool.h"
+#include "common/spsc_ring_buffer.h"
+
+namespace beatrice::common {
+
+// オーディオスレッドで受け取ったブロックを RealtimeWorkerPool で処理し、
+// 最大ブロックサイズ分の一定の遅延をつけて返すクラス。
+// オーディオスレッドとワーカーの間の受け渡しはロックフリーなリングバッファで行う。
+// ワーカーの処理が間に合わなかった分は無音になり、
+// 後から届いた出力は遅延が一定に保たれるよう読み捨てる。
+class AsyncAudioStream : public RealtimeWorkerPool::Job {
+ public:
+  // ワーカースレッドから呼ばれる処理
+  class Handler {
+   public:
+    Handler() = default;
+    Handler(const Handler&) = delete;
+    auto operator=(const Handler&) -> Handler& = delete;
+    virtual void OnParameterChange(std::uint32_t id, double value) = 0;
+    // buffer を in-place で処理する。silent の場合 buffer は 0 で埋められている。
+    // パラメータの変更だけを渡すために n_samples が 0 で呼ばれることもある
+    virtual void ProcessBlock(float* buffer, int n_samples, bool silent) = 0;
+
+   protected:
+    ~Handler() = default;
+  };
+
+  AsyncAudioStream(Handler& handler,
+                   std::shared_ptr<RealtimeWorkerPool> pool,
+                   int max_block_size);
+  AsyncAudioStream(const AsyncAudioStream&) = delete;
+  auto operator=(const AsyncAudioStream&) -> AsyncAudioStream& = delete;
+  ~AsyncAudioStream();
+
+  // 出力の遅延 [samples]
+  [[nodiscard]] auto GetLatency() const -> int {
+    return delayed_output_.GetLatency();
+  }
+  // 以下 2 つはオーディオスレッドから呼ぶ。
+  // パラメータの変更は次の Process() のブロックと一緒に渡される
+  void PushParameterChange(std::uint32_t id, double value);
+  // buffer を渡し、遅延させた出力で置き換える
+  void Process(float* buffer, int n_samples, bool silent);
+  // 処理中のものが終わるのを待ってから初期状態に戻す。
+  // オーディオスレッドが止まっている時に呼ぶ
+  void Reset();
+
+ private:
+  struct Block {
+    int n_samples;
+    int n_parameter_changes;
+    bool silent;
+  };
+  struct ParameterChange {
+    std::uint32_t id;
+    double value;
+  };
+
+  Handler& handler_;
+  std::shared_ptr<RealtimeWorkerPool> pool_;
+  const int max_block_size_;
+  SpscRingBuffer<float> input_;
+  SpscRingBuffer<Block> blocks_;
+  SpscRingBuffer<ParameterChange> parameter_changes_;
+  SpscRingBuffer<float> output_;
+  // ワーカーのみが触る
+  std::vector<float> buffer_;
+  // 出力のリングバッファに書き込めずに捨てた量
+  std::atomic<std::int64_t> output_dropped_ = 0;
+  // 以下はオーディオスレッドのみが触る
+  int n_pending_parameter_changes_ = 0;
+  DelayedOutput delayed_output_;
+
+  void Run() override;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_ASYNC_AUDIO_STREAM_H_
@@ -0,0 +1,230 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/async_processor_loader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "beatricelib/beatrice.h"
+
+namespace beatrice::common {
+
+namespace {
+// 破棄待ちのものがあるかを確認する間隔
+constexpr auto kRetireInterval = std::chrono::milliseconds(100);
+// 読み込み後、コンテキストを温めるために処理する無音のホップ数。
+// リサンプラの遅延があっても全ての段が数回ずつ動くようにする
+constexpr auto kNWarmUpHops = 8;
+constexpr auto kWarmUpDuration = static_cast<double>(kNWarmUpHops) *
+                                 BEATRICE_IN_HOP_LENGTH /
+                                 BEATRICE_IN_SAMPLE_RATE;
+// reload_requests_ に読み込み直しの要求があることを示すビット
+constexpr auto kReloadRequested = std::uint64_t{1} << 63;
+}  // namespace
+
+AsyncProcessorLoader::AsyncProcessorLoader()
+    : calibrator_(PerformanceCalibrator::Acquire()),
+      thread_([this] { Run(); }) {}
+
+AsyncProcessorLoader::~AsyncProcessorLoader() {
+  {
+    const auto lock = std::lock_guard<std::mutex>(mtx_);
+    exiting_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+  if (auto* const node = loaded_.exchange(nullptr)) {
+    PushRetired(node);
+  }
+  RetirePrevious();
+  DeleteRetired();
+}
+
+void AsyncProcessorLoader::Request(const ParameterState& parameter_state,
+                                   const double sample_rate,
+                                   const bool offline_rendering,
+                                   const bool multi_channel_allowed,
+                                   const SpeakerTableStorage
+                                       speaker_table_storage,
+                                   std::shared_ptr<StandbyCores>
+                                       standby_cores) {
+  {
+    const auto lock = std::lock_guard<std::mutex>(mtx_);
+    request_ = LoadRequest{.parameter_state = parameter_state,
+                           .sample_rate = sample_rate,
+                           .offline_rendering = offline_rendering,
+                           .multi_channel_allowed = multi_channel_allowed,
+                           .speaker_table_storage = speaker_table_storage,
+                           .standby_cores = std::move(standby_cores)};
+    ++generation_;
+  }
+  // 読み込み直しの要求は、この要求に含まれている
+  for (auto& reload_request : reload_requests_) {
+    reload_request.store(0, std::memory_order_relaxed);
+  }
+  // 古い要求の読み込み結果は使わない
+  if (auto* const node = loaded_.exchange(nullptr, std::memory_order_acq_rel)) {
+    PushRetired(node);
+  }
+  cv_.notify_one();
+}
+
+void AsyncProcessorLoader::SetOfflineRendering(const bool offline_rendering) {
+  const auto lock = std::lock_guard<std::mutex>(mtx_);
+  if (request_) {
+    request_->offline_rendering = offline_rendering;
+  }
+  if (last_request_) {
+    last_request_->offline_rendering = offline_rendering;
+  }
+}
+
+void AsyncProcessorLoader::SetMultiChannelAllowed(
+    const bool multi_channel_allowed) {
+  const auto lock = std::lock_guard<std::mutex>(mtx_);
+  if (request_) {
+    request_->multi_channel_allowed = multi_channel_allowed;
+  }
+  if (last_request_) {
+    last_request_->multi_channel_allowed = multi_channel_allowed;
+  }
+}
+
+void AsyncProcessorLoader::RequestReload(const ParameterID param_id,
+                                         const int value) {
+  const auto request =
+      kReloadRequested |
+      (static_cast<std::uint64_t>(static_cast<std::uint16_t>(param_id))
+       << 32) |
+      static_cast<std::uint32_t>(value);
+  // 書き込むのはオーディオスレッドのみなので、同じパラメータか空きの枠を
+  // 探して上書きすればよい。見つからなければ最初の枠を使う
+  auto* slot = &reload_requests_[0];
+  for (auto& reload_request : reload_requests_) {
+    const auto current = reload_request.load(std::memory_order_relaxed);
+    if (current == 0 || current >> 32 == request >> 32) {
+      slot = &reload_request;
+      break;
+    }
+  }
+  slot->store(request, std::memory_order_release);
+}
+
+auto AsyncProcessorLoader::Adopt(std::unique_ptr<ProcessorProxy>& current)
+    -> bool {
+  auto* const node = loaded_.exchange(nullptr, std::memory_order_acq_rel);
+  if (!node) {
+    return false;
+  }
+  RetirePrevious();
+  std::swap(node->proxy, current);
+  previous_ = node;
+  return true;
+}
+
+void AsyncProcessorLoader::RetirePrevious() {
+  if (previous_) {
+    PushRetired(std::exchange(previous_, nullptr));
+  }
+}
+
+void AsyncProcessorLoader::PushRetired(Node* const node) {
+  node->next = retired_.load(std::memory_order_relaxed);
+  while (!retired_.compare_exchange_weak(node->next, node,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed)) {
+  }
+}
+
+void AsyncProcessorLoader::DeleteRetired() {
+  auto* node = retired_.exchange(nullptr, std::memory_order_acquire);
+  while (node) {
+    delete std::exchange(node, node->next);
+  }
+}
+
+void AsyncProcessorLoader::Run() {
+  auto lock = std::unique_lock<std::mutex>(mtx_);
+  while (true) {
+    cv_.wait_for(lock, kRetireInterval,
+                 [this] { return exiting_ || request_.has_value(); });
+    lock.unlock();
+    DeleteRetired();
+    lock.lock();
+    if (exiting_) {
+      return;
+    }
+    if (request_) {
+      last_request_ = std::move(*request_);
+      request_.reset();
+    } else if (!ApplyReloadRequests()) {
+      continue;
+    }
+    const auto generation = generation_;
+    const auto request = *last_request_;
+    lock.unlock();
+    auto* const node = new Node{.proxy = Load(request)};
+    lock.lock();
+    if (generation != generation_) {
+      // 読み込み中に新しい要求が来た
+      PushRetired(node);
+      continue;
+    }
+    if (auto* const old = loaded_.exchange(node, std::memory_order_acq_rel)) {
+      PushRetired(old);
+    }
+  }
+}
+
+auto AsyncProcessorLoader::ApplyReloadRequests() -> bool {
+  auto requested = false;
+  for (auto& reload_request : reload_requests_) {
+    const auto reload = reload_request.exchange(0, std::memory_order_acquire);
+    if (reload == 0 || !last_request_) {
+      continue;
+    }
+    last_request_->parameter_state.SetValue(
+        static_cast<ParameterID>(static_cast<std::int16_t>(reload >> 32)),
+        static_cast<int>(static_cast<std::uint32_t>(reload)));
+    requested = true;
+  }
+  return requested;
+}
+
+auto AsyncProcessorLoader::Load(const LoadRequest& request) const
+    -> std::unique_ptr<ProcessorProxy> {
+  auto proxy = std::make_unique<ProcessorProxy>(
+      request.parameter_state, request.sample_rate,
+      request.speaker_table_storage, request.standby_cores,
+      request.multi_channel_allowed);
+  [[maybe_unused]] const auto offline_error_code =
+      proxy->SetOfflineRendering(request.offline_rendering);
+  // 無音を処理させておき、最初のブロックで
+  // 重みやコンテキストのページフォルトが起きないようにする
+  const auto n_samples =
+      std::max(1, static_cast<int>(request.sample_rate * kWarmUpDuration));
+  auto silence = std::vector<float>(n_samples);
+  [[maybe_unused]] const auto error_code =
+      proxy->ForEachCore([&silence, n_samples](ProcessorCoreBase& core) {
+        std::fill(silence.begin(), silence.end(), 0.0f);
+        return core.Process(silence.data(), silence.data(), n_samples);
+      });
+  // 計測結果が無ければ、次に読み込む時のために計測しておく
+  if (!proxy->GetLoadedModelFile().empty() &&
+      !proxy->GetPerformanceProfile()) {
+    calibrator_->Request(proxy->GetLoadedModelFile(),
+                         request.parameter_state, request.sample_rate,
+                         request.speaker_table_storage);
+  }
+  // オーディオスレッドに渡した後のモデルの変更は、同様に別スレッドで読み込む
+  proxy->SetModelLoadingDeferred(true);
+  return proxy;
+}
+
+}  // namespace beatrice::common
@@ -0,0 +1,115 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_ASYNC_PROCESSOR_LOADER_H_
+#define BEATRICE_COMMON_ASYNC_PROCESSOR_LOADER_H_
+
+#include <array>
+#include <atomic>
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <optional>
+#include <thread>  // NOLINT(build/c++11)
+
+// Beatrice
+#include "common/parameter_schema.h"
+#include "common/parameter_state.h"
+#include "common/performance_calibrator.h"
+#include "common/processor_proxy.h"
+#include "common/speaker_table.h"
+#include "common/standby_cores.h"
+
+namespace beatrice::common {
+
+// モデルの読み込みをバックグラウンドスレッドで行い、
+// 読み込み済みの ProcessorProxy をオーディオスレッドに受け渡すクラス。
+// オーディオスレッドから呼ばれる HasLoaded(), Adopt(), GetPrevious(),
+// RetirePrevious() はロックもメモリ確保も行わない。
+// 使わなくなった ProcessorProxy の破棄もバックグラウンドスレッドで行う。
+class AsyncProcessorLoader {
+ public:
+  AsyncProcessorLoader();
+  AsyncProcessorLoader(const AsyncProcessorLoader&) = delete;
+  auto operator=(const AsyncProcessorLoader&) -> AsyncProcessorLoader& = delete;
+  ~AsyncProcessorLoader();
+
+  // parameter_state の内容で新しい ProcessorProxy を用意するよう要求する。
+  // まだ受け取られていない以前の要求や読み込み結果は破棄される。
+  // standby_cores に待機しているモデルは読み込み直さずに使う。
+  // 処理モードの切り替えはスレッドの作成やファイルの読み書きを伴うので、
+  // 受け渡す前にバックグラウンドスレッドで offline_rendering に設定しておく。
+  // multi_channel_allowed は ProcessorProxy::SetMultiChannelAllowed() を参照
+  void Request(const ParameterState& parameter_state, double sample_rate,
+               bool offline_rendering, bool multi_channel_allowed,
+               SpeakerTableStorage speaker_table_storage,
+               std::shared_ptr<StandbyCores> standby_cores);
+  // 以降の RequestReload() で用意するものの処理モードを変える。
+  // オーディオスレッドからは呼ばない
+  void SetOfflineRendering(bool offline_rendering);
+  // 以降の RequestReload() で用意するものに、2 つ目以降のコアを用意するか。
+  // オーディオスレッドからは呼ばない
+  void SetMultiChannelAllowed(bool multi_channel_allowed);
+  // 直前の要求の内容のうち param_id の値だけを value に変えて、
+  // 読み込み直すよう要求する。ロックもメモリ確保も行わないので
+  // オーディオスレッドから呼べる。バックグラウンドスレッドが次に起きた時に処理される。
+  // 異なる param_id で続けて呼ぶと、kMaxNReloadParameters 個までまとめて反映される
+  void RequestReload(ParameterID param_id, int value);
+  [[nodiscard]] auto HasLoaded() const -> bool {
+    return loaded_.load(std::memory_order_acquire) != nullptr;
+  }
+  // 読み込みが完了していれば current と交換して true を返す。
+  // 交換前の ProcessorProxy は次に RetirePrevious() が呼ばれるまで
+  // GetPrevious() で参照できる。
+  auto Adopt(std::unique_ptr<ProcessorProxy>& current) -> bool;
+  [[nodiscard]] auto GetPrevious() const -> ProcessorProxy* {
+    return previous_ ? previous_->proxy.get() : nullptr;
+  }
+  void RetirePrevious();
+
+ private:
+  struct Node {
+    std::unique_ptr<ProcessorProxy> proxy;
+    Node* next = nullptr;
+  };
+  struct LoadRequest {
+    ParameterState parameter_state;
+    double sample_rate;
+    bool offline_rendering;
+    bool multi_channel_allowed;
+    SpeakerTableStorage speaker_table_storage;
+    std::shared_ptr<StandbyCores> standby_cores;
+  };
+
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  std::optional<LoadRequest> request_;
+  std::uint64_t generation_ = 0;
+  bool exiting_ = false;
+  std::atomic<Node*> loaded_ = nullptr;
+  // 破棄待ちのリスト。オーディオスレッドからも追加される
+  std::atomic<Node*> retired_ = nullptr;
+  // RequestReload() の要求。パラメータごとに 1 つずつ使い、空きは 0
+  static constexpr int kMaxNReloadParameters = 2;
+  std::array<std::atomic<std::uint64_t>, kMaxNReloadParameters>
+      reload_requests_ = {};
+  // 読み込み直しの元にする。mtx_ を取得して触る
+  std::optional<LoadRequest> last_request_;
+  // オーディオスレッドのみが触る
+  Node* previous_ = nullptr;
+  // 初めて使うモデルの処理時間を計測する
+  std::shared_ptr<PerformanceCalibrator> calibrator_;
+  std::thread thread_;
+
+  void Run();
+  // reload_requests_ を last_request_ に反映する。要求が無ければ false
+  auto ApplyReloadRequests() -> bool;
+  void PushRetired(Node* node);
+  void DeleteRetired();
+  auto Load(const LoadRequest& request) const
+      -> std::unique_ptr<ProcessorProxy>;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_ASYNC_PROCESSOR_LOADER_H_
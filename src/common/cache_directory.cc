@@ -0,0 +1,106 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/cache_directory.h"
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <ios>
+#include <random>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace beatrice::common {
+
+auto GetCacheDirectory() -> std::filesystem::path {
+#if defined(_WIN32)
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  if (const auto* const dir = _wgetenv(L"BEATRICE_CACHE_DIR"); dir && *dir) {
+    return dir;
+  }
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  if (const auto* const dir = _wgetenv(L"LOCALAPPDATA"); dir && *dir) {
+    return std::filesystem::path(dir) / L"Beatrice" / L"cache";
+  }
+#else
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  if (const auto* const dir = std::getenv("BEATRICE_CACHE_DIR"); dir && *dir) {
+    return dir;
+  }
+#if defined(__APPLE__)
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  if (const auto* const home = std::getenv("HOME"); home && *home) {
+    return std::filesystem::path(home) / "Library" / "Caches" / "Beatrice";
+  }
+#else
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  if (const auto* const dir = std::getenv("XDG_CACHE_HOME"); dir && *dir) {
+    return std::filesystem::path(dir) / "beatrice";
+  }
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  if (const auto* const home = std::getenv("HOME"); home && *home) {
+    return std::filesystem::path(home) / ".cache" / "beatrice";
+  }
+#endif
+#endif
+  return {};
+}
+
+auto GetPathsFromEnvironment(const std::string_view name)
+    -> std::vector<std::filesystem::path> {
+  auto paths = std::vector<std::filesystem::path>();
+#if defined(_WIN32)
+  const auto wide_name = std::wstring(name.begin(), name.end());
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  const auto* const value = _wgetenv(wide_name.c_str());
+  constexpr auto kSeparator = L';';
+  using Char = wchar_t;
+#else
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  const auto* const value = std::getenv(std::string(name).c_str());
+  constexpr auto kSeparator = ':';
+  using Char = char;
+#endif
+  if (!value) {
+    return paths;
+  }
+  auto list = std::basic_string_view<Char>(value);
+  while (!list.empty()) {
+    const auto pos = list.find(kSeparator);
+    if (const auto item = list.substr(0, pos); !item.empty()) {
+      paths.emplace_back(item);
+    }
+    if (pos == list.npos) {
+      break;
+    }
+    list.remove_prefix(pos + 1);
+  }
+  return paths;
+}
+
+auto WriteFileAtomically(const std::filesystem::path& file,
+                         const std::function<bool(std::ofstream&)>& write)
+    -> bool {
+  auto ec = std::error_code();
+  auto tmp_path = file;
+  tmp_path += "." + std::to_string(std::random_device{}()) + ".tmp";
+  {
+    auto ofs = std::ofstream(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!ofs || !write(ofs) || !ofs.flush()) {
+      ofs.close();
+      std::filesystem::remove(tmp_path, ec);
+      return false;
+    }
+  }
+  std::filesystem::rename(tmp_path, file, ec);
+  if (ec) {
+    std::filesystem::remove(tmp_path, ec);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace beatrice::common
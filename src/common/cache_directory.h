@@ -0,0 +1,31 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_CACHE_DIRECTORY_H_
+#define BEATRICE_COMMON_CACHE_DIRECTORY_H_
+
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+namespace beatrice::common {
+
+// 読み込み結果のキャッシュなどを置くユーザーごとのディレクトリを返す。
+// 環境変数 BEATRICE_CACHE_DIR で変更できる。
+// 得られない場合は空のパスを返す。
+auto GetCacheDirectory() -> std::filesystem::path;
+
+// 環境変数 name に OS の PATH と同じ区切りで並べられたパスを返す
+auto GetPathsFromEnvironment(std::string_view name)
+    -> std::vector<std::filesystem::path>;
+
+// 一時ファイルに write で書き込んでから file を置き換える。
+// 複数のインスタンスが同時に書き込んでも、不完全なファイルは見えない。
+auto WriteFileAtomically(const std::filesystem::path& file,
+                         const std::function<bool(std::ofstream&)>& write)
+    -> bool;
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_CACHE_DIRECTORY_H_
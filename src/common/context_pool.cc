@@ -0,0 +1,93 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/context_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>   // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+namespace beatrice::common {
+
+class ContextPoolBase::Worker {
+ public:
+  static auto Get() -> Worker& {
+    // プラグインのアンロード時の破棄順序の問題を避けるため、意図的に解放しない。
+    // スレッドは最後の ContextPool の破棄時に終了する。
+    static auto* const worker = new Worker();
+    return *worker;
+  }
+
+  void Register(ContextPoolBase* const pool) {
+    const auto lifecycle_lock = std::lock_guard<std::mutex>(lifecycle_mtx_);
+    {
+      const auto lock = std::lock_guard<std::mutex>(mtx_);
+      pools_.push_back(pool);
+      exiting_ = false;
+    }
+    if (!thread_.joinable()) {
+      thread_ = std::thread([this] { Run(); });
+    }
+    Wake();
+  }
+
+  void Unregister(ContextPoolBase* const pool) {
+    const auto lifecycle_lock = std::lock_guard<std::mutex>(lifecycle_mtx_);
+    auto empty = false;
+    {
+      // 補充中であれば、それが終わるまで待つことになる
+      const auto lock = std::lock_guard<std::mutex>(mtx_);
+      std::erase(pools_, pool);
+      empty = pools_.empty();
+      exiting_ = empty;
+    }
+    if (empty && thread_.joinable()) {
+      Wake();
+      thread_.join();
+    }
+  }
+
+  void Wake() {
+    signal_.fetch_add(1, std::memory_order_release);
+    signal_.notify_one();
+  }
+
+ private:
+  // Register(), Unregister() によるスレッドの開始と終了を直列化する
+  std::mutex lifecycle_mtx_;
+  std::mutex mtx_;
+  std::vector<ContextPoolBase*> pools_;
+  bool exiting_ = false;
+  std::atomic<std::uint32_t> signal_ = 0;
+  std::thread thread_;
+
+  Worker() = default;
+
+  void Run() {
+    auto observed = signal_.load(std::memory_order_acquire);
+    while (true) {
+      {
+        const auto lock = std::lock_guard<std::mutex>(mtx_);
+        if (exiting_) {
+          return;
+        }
+        for (auto* const pool : pools_) {
+          pool->Refill();
+        }
+      }
+      // Refill() 中に Wake() された場合はすぐに戻る
+      signal_.wait(observed, std::memory_order_acquire);
+      observed = signal_.load(std::memory_order_acquire);
+    }
+  }
+};
+
+void ContextPoolBase::Register() { Worker::Get().Register(this); }
+
+void ContextPoolBase::Unregister() { Worker::Get().Unregister(this); }
+
+void ContextPoolBase::Wake() { Worker::Get().Wake(); }
+
+}  // namespace beatrice::common
@@ -0,0 +1,122 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_CONTEXT_POOL_H_
+#define BEATRICE_COMMON_CONTEXT_POOL_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <utility>
+
+namespace beatrice::common {
+
+// ContextPool の予備をバックグラウンドスレッドで補充するための基底クラス。
+// 全ての ContextPool で 1 つのスレッドを共有し、
+// そのスレッドは ContextPool が 1 つでも存在する間だけ動く。
+class ContextPoolBase {
+ public:
+  ContextPoolBase(const ContextPoolBase&) = delete;
+  auto operator=(const ContextPoolBase&) -> ContextPoolBase& = delete;
+
+ protected:
+  ContextPoolBase() = default;
+  ~ContextPoolBase() = default;
+  // 派生クラスのコンストラクタの最後とデストラクタの最初で呼ぶ
+  void Register();
+  void Unregister();
+  // 補充を要求する。ロックを取らないのでオーディオスレッドから呼んでよい
+  static void Wake();
+  // バックグラウンドスレッドから呼ばれる
+  virtual void Refill() = 0;
+
+ private:
+  class Worker;
+};
+
+// ResetContext() でコンテキストを毎回作り直す代わりに、
+// バックグラウンドスレッドで作成・設定済みの予備と交換するためのクラス。
+// T のコンストラクタとデストラクタでコンテキストの作成と破棄を行う。
+// 予備は SetConfig() で指定した設定に合わせて prepare で設定される。
+// 設定は各 ProcessorCore が 64 bit に詰めて表現する。
+template <typename T>
+class ContextPool : public ContextPoolBase {
+ public:
+  // 設定が指定されていないことを表す。この場合 prepare は呼ばれない
+  static constexpr auto kNoConfig = std::numeric_limits<std::uint64_t>::max();
+  using Prepare = std::function<void(T& /*contexts*/, std::uint64_t)>;
+
+  explicit ContextPool(Prepare prepare = nullptr)
+      : prepare_(std::move(prepare)) {
+    Register();
+  }
+  ~ContextPool() {
+    Unregister();
+    delete ready_.load();
+    DeleteRetired();
+  }
+  // 次に用意する予備の設定を変更する。オーディオスレッドから呼んでよい。
+  // prepare から参照するメンバは、これを呼ぶ前に設定しておく必要がある。
+  void SetConfig(const std::uint64_t config) {
+    if (config_.exchange(config, std::memory_order_acq_rel) != config) {
+      Wake();
+    }
+  }
+  // 予備があれば contexts と交換し、予備が用意された時の設定を config に入れる。
+  // ロックもメモリ確保も行わないので、オーディオスレッドから呼んでよい。
+  // 交換された古いコンテキストはバックグラウンドスレッドで破棄される。
+  auto Swap(std::unique_ptr<T>& contexts, std::uint64_t& config) -> bool {
+    auto* const entry = ready_.exchange(nullptr, std::memory_order_acq_rel);
+    if (!entry) {
+      return false;
+    }
+    std::swap(entry->contexts, contexts);
+    config = entry->config;
+    entry->next = retired_.load(std::memory_order_relaxed);
+    while (!retired_.compare_exchange_weak(entry->next, entry,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+    }
+    Wake();
+    return true;
+  }
+
+ private:
+  struct Entry {
+    std::unique_ptr<T> contexts;
+    std::uint64_t config;
+    Entry* next = nullptr;
+  };
+
+  Prepare prepare_;
+  std::atomic<std::uint64_t> config_ = kNoConfig;
+  std::atomic<Entry*> ready_ = nullptr;
+  std::atomic<Entry*> retired_ = nullptr;
+
+  void Refill() override {
+    DeleteRetired();
+    const auto config = config_.load(std::memory_order_acquire);
+    if (const auto* const entry = ready_.load(std::memory_order_acquire);
+        entry && entry->config == config) {
+      return;
+    }
+    auto* const entry =
+        new Entry{.contexts = std::make_unique<T>(), .config = config};
+    if (prepare_ && config != kNoConfig) {
+      prepare_(*entry->contexts, config);
+    }
+    // 設定が古くなった予備は捨てる
+    delete ready_.exchange(entry, std::memory_order_acq_rel);
+  }
+  void DeleteRetired() {
+    auto* entry = retired_.exchange(nullptr, std::memory_order_acquire);
+    while (entry) {
+      delete std::exchange(entry, entry->next);
+    }
+  }
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_CONTEXT_POOL_H_
@@ -0,0 +1,134 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/deferred_task_scheduler.h"
+
+#include <algorithm>
+#include <chrono>  // NOLINT(build/c++11)
+#include <functional>
+#include <limits>
+#include <utility>
+
+namespace beatrice::common {
+
+namespace {
+
+// 1 フレームの長さのうち、本来の処理とタスクに使ってよい割合。
+// 残りはホストや他のプラグインのために空けておく
+constexpr auto kMaxLoad = 0.5;
+// 処理時間の移動平均の係数
+constexpr auto kSmoothing = 0.125;
+
+}  // namespace
+
+DeferredTaskScheduler::DeferredTaskScheduler(const double frame_seconds)
+    : frame_seconds_(frame_seconds) {}
+
+auto DeferredTaskScheduler::AddTask(const TaskConfig& config,
+                                    std::function<Status()> step) -> TaskId {
+  const auto id = static_cast<TaskId>(tasks_.size());
+  tasks_.push_back({.config = config,
+                    .step = std::move(step),
+                    .pending = false,
+                    .estimated_seconds = config.estimated_seconds,
+                    .n_waited_frames = 0});
+  // 優先度が同じものは登録順
+  const auto position = std::upper_bound(
+      order_.begin(), order_.end(), config.priority,
+      [this](const int priority, const TaskId other) {
+        return priority < tasks_[other].config.priority;
+      });
+  order_.insert(position, id);
+  return id;
+}
+
+void DeferredTaskScheduler::Schedule(const TaskId id) {
+  auto& task = tasks_[id];
+  if (!task.pending) {
+    task.pending = true;
+    task.n_waited_frames = 0;
+  }
+}
+
+void DeferredTaskScheduler::Cancel(const TaskId id) {
+  tasks_[id].pending = false;
+}
+
+auto DeferredTaskScheduler::IsPending(const TaskId id) const -> bool {
+  return tasks_[id].pending;
+}
+
+void DeferredTaskScheduler::SetMaxWaitFrames(const TaskId id,
+                                             const int max_wait_frames) {
+  tasks_[id].config.max_wait_frames = max_wait_frames;
+}
+
+void DeferredTaskScheduler::SetUnlimited(const bool unlimited) {
+  unlimited_ = unlimited;
+}
+
+void DeferredTaskScheduler::BeginFrame() {
+  frame_start_ = Clock::now();
+  suspended_seconds_ = 0.0;
+  task_seconds_ = 0.0;
+}
+
+void DeferredTaskScheduler::Suspend() {
+  suspended_seconds_ +=
+      std::chrono::duration<double>(Clock::now() - frame_start_).count();
+}
+
+void DeferredTaskScheduler::Resume() { frame_start_ = Clock::now(); }
+
+void DeferredTaskScheduler::Run() {
+  const auto start = Clock::now();
+  const auto budget =
+      unlimited_ ? std::numeric_limits<double>::infinity()
+                 : std::max(0.0, frame_seconds_ * kMaxLoad -
+                                     frame_cost_seconds_);
+  auto elapsed = 0.0;
+  for (const auto id : order_) {
+    auto& task = tasks_[id];
+    auto ran = false;
+    auto waiting = false;
+    while (task.pending) {
+      // 長く待たされているタスクは、予算を超えても 1 ステップは進める
+      const auto starved =
+          !ran && task.n_waited_frames >= task.config.max_wait_frames;
+      if (!starved && elapsed + task.estimated_seconds > budget) {
+        break;
+      }
+      const auto step_start = Clock::now();
+      const auto status = task.step();
+      const auto step_end = Clock::now();
+      elapsed = std::chrono::duration<double>(step_end - start).count();
+      if (status == Status::kWaiting) {
+        waiting = true;
+        break;
+      }
+      const auto step_seconds =
+          std::chrono::duration<double>(step_end - step_start).count();
+      task.estimated_seconds +=
+          kSmoothing * (step_seconds - task.estimated_seconds);
+      ran = true;
+      if (status == Status::kDone) {
+        task.pending = false;
+      }
+    }
+    if (ran || !task.pending) {
+      task.n_waited_frames = 0;
+    } else if (!waiting) {
+      ++task.n_waited_frames;
+    }
+  }
+  task_seconds_ += elapsed;
+}
+
+void DeferredTaskScheduler::EndFrame() {
+  const auto frame_seconds =
+      suspended_seconds_ +
+      std::chrono::duration<double>(Clock::now() - frame_start_).count() -
+      task_seconds_;
+  frame_cost_seconds_ += kSmoothing * (frame_seconds - frame_cost_seconds_);
+}
+
+}  // namespace beatrice::common
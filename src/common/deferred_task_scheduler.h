@@ -0,0 +1,98 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_DEFERRED_TASK_SCHEDULER_H_
+#define BEATRICE_COMMON_DEFERRED_TASK_SCHEDULER_H_
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <functional>
+#include <vector>
+
+namespace beatrice::common {
+
+// モーフィング結果の計算など、1 フレームで行うには重いが急ぎではない処理を、
+// オーディオスレッド上で複数フレームに分けて進めるスケジューラ。
+// 各タスクは小さなステップの繰り返しとして書き、毎フレーム Run() の中で
+// 優先度の高い順に、そのフレームの処理時間の予算に収まる分だけ実行される。
+// 予算は 1 フレームの長さから、実測した本来の処理の時間を引いたもので、
+// 各ステップの処理時間も実測して見積もりを更新する。
+// 予算が足りない状態が続いても、各タスクは指定したフレーム数に 1 回は
+// 少なくとも 1 ステップ進められる。
+class DeferredTaskScheduler {
+ public:
+  enum class Status {
+    // 全てのステップが終わった
+    kDone,
+    // 次のステップがある
+    kPending,
+    // 前提条件が満たされていないので何もしなかった。次のフレームで再び試す
+    kWaiting,
+  };
+  struct TaskConfig {
+    // 小さいほど先に実行される
+    int priority;
+    // 1 ステップの処理時間の初期の見積もり [s]
+    double estimated_seconds;
+    // 実行待ちのまま、この数のフレームで 1 ステップも実行されなかった場合は、
+    // 予算を超えても 1 ステップ実行する
+    int max_wait_frames;
+  };
+  using TaskId = int;
+
+  explicit DeferredTaskScheduler(double frame_seconds);
+  DeferredTaskScheduler(const DeferredTaskScheduler&) = delete;
+  auto operator=(const DeferredTaskScheduler&)
+      -> DeferredTaskScheduler& = delete;
+
+  // タスクを登録する。メモリを確保するので、オーディオスレッドからは呼ばない
+  auto AddTask(const TaskConfig& config, std::function<Status()> step)
+      -> TaskId;
+  // 実行待ちにする。既に実行待ちであれば、途中の状態はタスク側で管理する
+  void Schedule(TaskId id);
+  void Cancel(TaskId id);
+  [[nodiscard]] auto IsPending(TaskId id) const -> bool;
+  // 処理負荷に応じて、タスクを待たせてよいフレーム数を変える
+  void SetMaxWaitFrames(TaskId id, int max_wait_frames);
+  // true の場合は予算に関係なく、毎フレーム全てのタスクを終わるまで実行する。
+  // 書き出しの結果が処理時間に依存しないようにするために使う
+  void SetUnlimited(bool unlimited);
+
+  // 以下はオーディオスレッドから呼ぶ。
+  // 1 フレームの処理の最初と最後に呼び、その間に Run() を 1 回呼ぶ。
+  // 1 フレームの処理を複数回の呼び出しに分けて行う場合は、処理していない間を
+  // Suspend() と Resume() で挟み、処理時間に含めないようにする
+  void BeginFrame();
+  void Suspend();
+  void Resume();
+  void Run();
+  void EndFrame();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  struct Task {
+    TaskConfig config;
+    std::function<Status()> step;
+    bool pending;
+    // 1 ステップの処理時間の見積もり [s]
+    double estimated_seconds;
+    // 実行待ちのまま 1 ステップも実行されなかったフレーム数
+    int n_waited_frames;
+  };
+
+  double frame_seconds_;
+  std::vector<Task> tasks_;
+  // 優先度の順に並べた tasks_ の添字
+  std::vector<TaskId> order_;
+  bool unlimited_ = false;
+  // 現在のフレームで、Resume() などで処理を再開した時刻
+  Clock::time_point frame_start_;
+  // 現在のフレームで、Suspend() までに処理した時間 [s]
+  double suspended_seconds_ = 0.0;
+  // 現在のフレームでタスクに使った時間 [s]
+  double task_seconds_ = 0.0;
+  // タスクを除いた 1 フレームの処理時間の移動平均 [s]
+  double frame_cost_seconds_ = 0.0;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_DEFERRED_TASK_SCHEDULER_H_
@@ -0,0 +1,90 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_DELAYED_OUTPUT_H_
+#define BEATRICE_COMMON_DELAYED_OUTPUT_H_
+
+#include <algorithm>
+#include <cstdint>
+
+namespace beatrice::common {
+
+// 別のスレッドやプロセスで処理された出力を、一定の遅延をつけて受け取る。
+// 処理が間に合わなかった分は無音になり、後から届いた出力は
+// 遅延が一定に保たれるよう読み捨てる。
+// オーディオスレッドのみが触る。ロックもメモリ確保も行わない
+class DelayedOutput {
+ public:
+  explicit DelayedOutput(const int latency) : latency_(latency) {}
+
+  [[nodiscard]] auto GetLatency() const -> int { return latency_; }
+  void Reset() {
+    consumed_ = 0;
+    input_dropped_ = 0;
+    read_ = 0;
+  }
+  // 入力を処理する側に渡せずに捨てた
+  void DropInput(const int n_samples) { input_dropped_ += n_samples; }
+  // 処理する側が出力を書き込めずに捨てた
+  void DropOutput(const std::int64_t n_samples) { read_ += n_samples; }
+  // 次の Read() で n_samples 個を読み出すのに、readable 個に加えて
+  // まだ届いていない出力の量
+  [[nodiscard]] auto GetMissing(const int n_samples,
+                                const std::int64_t readable) const
+      -> std::int64_t {
+    return std::max<std::int64_t>(0, consumed_ + n_samples - latency_ -
+                                         input_dropped_ - read_ - readable);
+  }
+  // output から n_samples 個を buffer に読み出す。
+  // Ring は SpscRingBuffer<float> と同じく GetReadable() と Read() を持つ
+  template <typename Ring>
+  void Read(Ring& output, float* const buffer, const int n_samples) {
+    auto i = 0;
+    while (i < n_samples) {
+      // 出力のうち、次に buffer[i] に書き込むべきもの
+      const auto target = consumed_ + i - latency_ - input_dropped_;
+      if (read_ > target) {
+        // 遅延の分と、入力を捨てた分は無音にする
+        const auto n_zeros = static_cast<int>(
+            std::min<std::int64_t>(n_samples - i, read_ - target));
+        std::fill_n(buffer + i, n_zeros, 0.0f);
+        i += n_zeros;
+        continue;
+      }
+      auto readable = static_cast<std::int64_t>(output.GetReadable());
+      if (read_ < target) {
+        // 間に合わなかった分が後から届いていれば読み捨てる
+        const auto n_discarded = std::min(readable, target - read_);
+        output.Read(nullptr, n_discarded);
+        read_ += n_discarded;
+        readable -= n_discarded;
+        if (read_ < target) {
+          break;
+        }
+      }
+      const auto n_read =
+          static_cast<int>(std::min<std::int64_t>(n_samples - i, readable));
+      if (n_read == 0) {
+        break;
+      }
+      output.Read(buffer + i, n_read);
+      read_ += n_read;
+      i += n_read;
+    }
+    // 間に合わなかった分は無音にする
+    std::fill(buffer + i, buffer + n_samples, 0.0f);
+    consumed_ += n_samples;
+  }
+
+ private:
+  int latency_;
+  // Read() に渡された量
+  std::int64_t consumed_ = 0;
+  // 入力を処理する側に渡せずに捨てた量
+  std::int64_t input_dropped_ = 0;
+  // 出力のうち読み出した (読み捨てたものも含む) 量
+  std::int64_t read_ = 0;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_DELAYED_OUTPUT_H_
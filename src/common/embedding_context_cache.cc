@@ -0,0 +1,187 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/embedding_context_cache.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+#include "beatricelib/beatrice.h"
+
+namespace beatrice::common {
+
+EmbeddingContextCache::EmbeddingContextCache(RegisterSpeaker register_speaker)
+    : register_speaker_(std::move(register_speaker)) {
+  for (auto& speaker : wanted_speakers_) {
+    speaker.store(-1, std::memory_order_relaxed);
+  }
+  Register();
+}
+
+EmbeddingContextCache::~EmbeddingContextCache() {
+  Unregister();
+  for (auto& slot : slots_) {
+    if (slot.context) {
+      Beatrice20rc0_DestroyEmbeddingContext(slot.context);
+    }
+  }
+}
+
+void EmbeddingContextCache::SetWantedSpeakers(const int* const speakers,
+                                              const int n_speakers) {
+  auto changed = false;
+  for (auto i = 0; i < kNSlots; ++i) {
+    const auto speaker = i < n_speakers ? speakers[i] : -1;
+    if (wanted_speakers_[i].exchange(speaker, std::memory_order_acq_rel) !=
+        speaker) {
+      changed = true;
+    }
+  }
+  if (changed) {
+    Wake();
+  }
+}
+
+auto EmbeddingContextCache::Exchange(const int speaker,
+                                     Beatrice20rc0_EmbeddingContext*& context,
+                                     int& context_speaker) -> bool {
+  auto* slot = Find(speaker, kReady);
+  const auto found = slot != nullptr;
+  if (!found) {
+    // 登録済みのものが無ければ、手放す context をキャッシュに残すため
+    // 未登録のものと交換する
+    slot = Find(-1, kEmpty);
+    if (slot && !slot->context) {
+      slot->state.store(kEmpty, std::memory_order_release);
+      slot = nullptr;
+    }
+  }
+  if (!slot) {
+    return false;
+  }
+  auto* const new_context = slot->context;
+  Release(*slot, context, context_speaker);
+  context = new_context;
+  context_speaker = found ? speaker : -1;
+  Wake();
+  return found;
+}
+
+// state の状態で speaker を保持しているスロットを kBusy にして返す
+auto EmbeddingContextCache::Find(const int speaker, const int state)
+    -> Slot* {
+  for (auto& slot : slots_) {
+    if (slot.state.load(std::memory_order_acquire) != state ||
+        slot.speaker.load(std::memory_order_relaxed) != speaker) {
+      continue;
+    }
+    auto expected = state;
+    if (!slot.state.compare_exchange_strong(expected, kBusy,
+                                            std::memory_order_acquire)) {
+      continue;
+    }
+    if (slot.speaker.load(std::memory_order_relaxed) == speaker) {
+      return &slot;
+    }
+    slot.state.store(state, std::memory_order_release);
+  }
+  return nullptr;
+}
+
+// 新しい話者を登録するスロットを kBusy にして返す。
+// 空きが無ければ、指定されていない話者のうち最後に使われた時刻が最も古いものを返す。
+auto EmbeddingContextCache::FindVictim(
+    const std::array<int, kNSlots>& wanted_speakers) -> Slot* {
+  for (auto& slot : slots_) {
+    auto expected = static_cast<int>(kEmpty);
+    if (slot.state.compare_exchange_strong(expected, kBusy,
+                                           std::memory_order_acquire)) {
+      return &slot;
+    }
+  }
+  Slot* victim = nullptr;
+  auto oldest = std::numeric_limits<std::uint64_t>::max();
+  for (auto& slot : slots_) {
+    if (slot.state.load(std::memory_order_acquire) != kReady) {
+      continue;
+    }
+    const auto speaker = slot.speaker.load(std::memory_order_relaxed);
+    if (std::find(wanted_speakers.begin(), wanted_speakers.end(), speaker) !=
+        wanted_speakers.end()) {
+      continue;
+    }
+    if (const auto last_used =
+            slot.last_used.load(std::memory_order_relaxed);
+        last_used < oldest) {
+      victim = &slot;
+      oldest = last_used;
+    }
+  }
+  if (!victim) {
+    return nullptr;
+  }
+  auto expected = static_cast<int>(kReady);
+  if (!victim->state.compare_exchange_strong(expected, kBusy,
+                                             std::memory_order_acquire)) {
+    return nullptr;
+  }
+  return victim;
+}
+
+void EmbeddingContextCache::Release(Slot& slot,
+                                    Beatrice20rc0_EmbeddingContext* const
+                                        context,
+                                    const int speaker) {
+  slot.context = context;
+  slot.speaker.store(speaker, std::memory_order_relaxed);
+  slot.last_used.store(clock_.fetch_add(1, std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+  slot.state.store(speaker >= 0 ? kReady : kEmpty, std::memory_order_release);
+}
+
+void EmbeddingContextCache::Refill() {
+  // 空きスロットには未登録の EmbeddingContext を作っておく
+  for (auto& slot : slots_) {
+    auto expected = static_cast<int>(kEmpty);
+    if (!slot.state.compare_exchange_strong(expected, kBusy,
+                                            std::memory_order_acquire)) {
+      continue;
+    }
+    if (!slot.context) {
+      slot.context = Beatrice20rc0_CreateEmbeddingContext();
+    }
+    slot.state.store(kEmpty, std::memory_order_release);
+  }
+
+  auto wanted_speakers = std::array<int, kNSlots>();
+  for (auto i = 0; i < kNSlots; ++i) {
+    wanted_speakers[i] = wanted_speakers_[i].load(std::memory_order_acquire);
+  }
+  for (const auto speaker : wanted_speakers) {
+    if (speaker < 0) {
+      continue;
+    }
+    const auto is_cached =
+        std::any_of(slots_.begin(), slots_.end(), [speaker](const Slot& slot) {
+          return slot.state.load(std::memory_order_acquire) != kEmpty &&
+                 slot.speaker.load(std::memory_order_relaxed) == speaker;
+        });
+    if (is_cached) {
+      continue;
+    }
+    auto* const slot = FindVictim(wanted_speakers);
+    if (!slot) {
+      break;
+    }
+    if (!slot->context) {
+      slot->context = Beatrice20rc0_CreateEmbeddingContext();
+    }
+    register_speaker_(slot->context, speaker);
+    Release(*slot, slot->context, speaker);
+  }
+}
+
+}  // namespace beatrice::common
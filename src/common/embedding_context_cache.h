@@ -0,0 +1,74 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_EMBEDDING_CONTEXT_CACHE_H_
+#define BEATRICE_COMMON_EMBEDDING_CONTEXT_CACHE_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+#include "beatricelib/beatrice.h"
+
+// Beatrice
+#include "common/context_pool.h"
+
+namespace beatrice::common {
+
+// 2.0.0-rc.0 で、話者ごとに key-value speaker embedding を登録済みの
+// EmbeddingContext を保持しておくキャッシュ。
+// 目標話者の切り替え時に登録処理を行う代わりに、ポインタの交換で済ませる。
+// 登録はバックグラウンドスレッド (ContextPool と共有) で行われ、
+// SetWantedSpeakers() で指定された話者の分を優先して用意する。
+// 使われなくなった話者の分は、最後に使われた時刻が古いものから入れ替えられる。
+class EmbeddingContextCache : public ContextPoolBase {
+ public:
+  static constexpr int kNSlots = 8;
+  // context に speaker の key-value speaker embedding を登録する関数。
+  // バックグラウンドスレッドから呼ばれる。
+  using RegisterSpeaker =
+      std::function<void(Beatrice20rc0_EmbeddingContext* /*context*/,
+                         int /*speaker*/)>;
+
+  explicit EmbeddingContextCache(RegisterSpeaker register_speaker);
+  ~EmbeddingContextCache();
+
+  // 事前に用意しておく話者を指定する。負の値は無視される。
+  // オーディオスレッドから呼んでよい。
+  void SetWantedSpeakers(const int* speakers, int n_speakers);
+  // speaker を登録済みの EmbeddingContext があれば context と交換して true を返す。
+  // 無ければ、未登録の EmbeddingContext があればそれと交換して false を返す。
+  // 交換で手放した context は context_speaker の分としてキャッシュに残る。
+  // context_speaker には交換後の context に登録済みの話者 (無ければ -1) が入る。
+  // ロックもメモリ確保も行わないので、オーディオスレッドから呼んでよい。
+  auto Exchange(int speaker, Beatrice20rc0_EmbeddingContext*& context,
+                int& context_speaker) -> bool;
+
+ private:
+  enum SlotState : int {
+    kEmpty,  // 未登録
+    kReady,  // 登録済み
+    kBusy,   // いずれかのスレッドが操作中
+  };
+  struct Slot {
+    std::atomic<int> state = kEmpty;
+    std::atomic<int> speaker = -1;
+    std::atomic<std::uint64_t> last_used = 0;
+    Beatrice20rc0_EmbeddingContext* context = nullptr;
+  };
+
+  RegisterSpeaker register_speaker_;
+  std::array<Slot, kNSlots> slots_;
+  std::array<std::atomic<int>, kNSlots> wanted_speakers_;
+  std::atomic<std::uint64_t> clock_ = 0;
+
+  void Refill() override;
+  auto Find(int speaker, int state) -> Slot*;
+  auto FindVictim(const std::array<int, kNSlots>& wanted_speakers) -> Slot*;
+  void Release(Slot& slot, Beatrice20rc0_EmbeddingContext* context,
+               int speaker);
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_EMBEDDING_CONTEXT_CACHE_H_
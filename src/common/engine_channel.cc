@@ -0,0 +1,86 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/engine_channel.h"
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <string>
+
+namespace beatrice::common {
+
+void FutexWait(std::atomic<std::uint32_t>& word, const std::uint32_t expected,
+               const std::chrono::nanoseconds timeout) {
+#if defined(__linux__)
+  static_assert(sizeof(word) == sizeof(std::uint32_t));
+  const auto seconds =
+      std::chrono::duration_cast<std::chrono::seconds>(timeout);
+  const auto ts = timespec{
+      .tv_sec = static_cast<time_t>(seconds.count()),
+      .tv_nsec = static_cast<long>((timeout - seconds).count())};  // NOLINT
+  // 値が既に変わっていれば、すぐに戻る
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT,
+          expected, &ts, nullptr, 0);
+#else
+  (void)word;
+  (void)expected;
+  (void)timeout;
+#endif
+}
+
+void FutexWake(std::atomic<std::uint32_t>& word) {
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE, 1,
+          nullptr, nullptr, 0);
+#else
+  (void)word;
+#endif
+}
+
+#if defined(__linux__)
+namespace {
+
+// シンボリックリンクでない、自分が所有するディレクトリで、
+// 他のユーザーが読み書きできないものであれば true を返す
+auto IsPrivateDirectory(const std::string& path) -> bool {
+  struct stat st = {};
+  return lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode) &&
+         st.st_uid == getuid() && (st.st_mode & 077) == 0;
+}
+
+}  // namespace
+#endif
+
+auto GetEngineSocketPath() -> std::filesystem::path {
+#if defined(__linux__)
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  if (const auto* const dir = std::getenv("XDG_RUNTIME_DIR"); dir && *dir) {
+    if (!IsPrivateDirectory(dir)) {
+      return {};
+    }
+    return std::filesystem::path(dir) / "beatrice-engine.sock";
+  }
+  // 他のユーザーが先に同じ名前のものを作っていても使わないよう、
+  // 作成した後で所有者と権限を確かめる
+  const auto dir = "/tmp/beatrice-engine-" + std::to_string(getuid());
+  mkdir(dir.c_str(), 0700);
+  if (!IsPrivateDirectory(dir)) {
+    return {};
+  }
+  return std::filesystem::path(dir) / "engine.sock";
+#else
+  return {};
+#endif
+}
+
+}  // namespace beatrice::common
@@ -0,0 +1,166 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_ENGINE_CHANNEL_H_
+#define BEATRICE_COMMON_ENGINE_CHANNEL_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <type_traits>
+
+namespace beatrice::common {
+
+// 推論を別プロセスのエンジン (beatrice-engine) で行う場合に、
+// プラグインとエンジンの間で共有メモリに置くリングバッファ。
+// SpscRingBuffer と同じく 1 つの書き込み側と 1 つの読み出し側から使うが、
+// 共有メモリ上にそのまま置けるよう、容量はコンパイル時に決める
+template <typename T, std::size_t kCapacity>
+class SharedRingBuffer {
+  static_assert((kCapacity & (kCapacity - 1)) == 0);
+  static_assert(std::is_trivially_copyable_v<T>);
+  // プロセス間で共有するには、ロックを使わずに実装されている必要がある
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+ public:
+  // 読み書きする側が両方とも止まっている時に呼ぶ
+  void Reset() {
+    write_index_.store(0, std::memory_order_relaxed);
+    read_index_.store(0, std::memory_order_relaxed);
+  }
+  // 書き込む側から呼ぶ
+  [[nodiscard]] auto GetWritable() const -> std::size_t {
+    return kCapacity - static_cast<std::size_t>(
+                           write_index_.load(std::memory_order_relaxed) -
+                           read_index_.load(std::memory_order_acquire));
+  }
+  // 読み出す側から呼ぶ
+  [[nodiscard]] auto GetReadable() const -> std::size_t {
+    return static_cast<std::size_t>(
+        write_index_.load(std::memory_order_acquire) -
+        read_index_.load(std::memory_order_relaxed));
+  }
+  // n 個全てを書き込めない場合は何もせずに false を返す
+  auto Write(const T* const data, const std::size_t n) -> bool {
+    if (GetWritable() < n) {
+      return false;
+    }
+    const auto index = write_index_.load(std::memory_order_relaxed);
+    for (auto i = std::size_t{0}; i < n; ++i) {
+      buffer_[(index + i) & (kCapacity - 1)] = data[i];
+    }
+    write_index_.store(index + n, std::memory_order_release);
+    return true;
+  }
+  // n 個全てを読み出せない場合は何もせずに false を返す。
+  // data が nullptr の場合は読み捨てる
+  auto Read(T* const data, const std::size_t n) -> bool {
+    if (GetReadable() < n) {
+      return false;
+    }
+    const auto index = read_index_.load(std::memory_order_relaxed);
+    if (data) {
+      for (auto i = std::size_t{0}; i < n; ++i) {
+        data[i] = buffer_[(index + i) & (kCapacity - 1)];
+      }
+    }
+    read_index_.store(index + n, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  // プロセスごとに std::size_t の大きさが異なっても壊れないよう、幅を固定する
+  alignas(64) std::atomic<std::uint64_t> write_index_;
+  alignas(64) std::atomic<std::uint64_t> read_index_;
+  alignas(64) std::array<T, kCapacity> buffer_;
+};
+
+// エンジンに処理させるブロック
+struct EngineBlock {
+  std::int32_t n_samples;
+  bool silent;
+  bool offline;
+  double sample_rate;
+  // 往復の遅延を測るための、プラグインが書き込んだ時刻 [ns]
+  std::int64_t sent_ns;
+};
+
+// エンジンが処理を終えたブロック
+struct EngineResult {
+  std::int32_t n_samples;
+  std::int64_t sent_ns;
+  std::int64_t done_ns;
+};
+
+// 数値のパラメータの変更。値は正規化を戻したもの
+struct EngineParameterChange {
+  std::int32_t param_id;
+  bool is_int;
+  double value;
+};
+
+// プラグインのインスタンス 1 つとエンジンの間で共有するメモリの内容。
+// プラグインが作成して初期化し、Unix ドメインソケットで名前をエンジンに渡す。
+// 待機は futex で行い、プロセス間で共有されるよう FUTEX_PRIVATE_FLAG は付けない
+struct EngineChannel {
+  static constexpr std::uint32_t kMagic = 0x45525442;  // "BTRE"
+  // レイアウトを変えた場合はこれを上げる
+  static constexpr std::uint32_t kVersion = 1;
+  static constexpr std::size_t kAudioCapacity = 1 << 16;
+  static constexpr std::size_t kBlockCapacity = 64;
+  static constexpr std::size_t kParameterCapacity = 1024;
+  // ParameterState を直列化したもの
+  static constexpr std::size_t kStateCapacity = 1 << 16;
+
+  enum State : std::uint32_t {
+    kConnecting,
+    // エンジンが共有メモリを開き、処理を始められる
+    kReady,
+    // エンジンが共有メモリの内容を受け付けなかった
+    kRejected,
+  };
+
+  std::uint32_t magic;
+  std::uint32_t version;
+  alignas(64) std::atomic<std::uint32_t> state;
+  // プラグインが何かを書き込む度に増やし、エンジンはこれが変わるまで待つ
+  alignas(64) std::atomic<std::uint32_t> input_sequence;
+  // エンジンがブロックを処理する度に増やす。書き出し時はプラグインがこれを待つ
+  alignas(64) std::atomic<std::uint32_t> output_sequence;
+  // エンジンが出力のリングバッファに書き込めずに捨てた量
+  alignas(64) std::atomic<std::int64_t> output_dropped;
+  SharedRingBuffer<EngineBlock, kBlockCapacity> blocks;
+  SharedRingBuffer<float, kAudioCapacity> input;
+  SharedRingBuffer<EngineParameterChange, kParameterCapacity> parameters;
+  // 長さ (std::uint32_t) とその長さの内容の組
+  SharedRingBuffer<char, kStateCapacity> states;
+  SharedRingBuffer<EngineResult, kBlockCapacity> results;
+  SharedRingBuffer<float, kAudioCapacity> output;
+};
+
+// プロセスをまたいで比較できる時刻 [ns]。
+// Linux の steady_clock は CLOCK_MONOTONIC なので、同じマシンの全プロセスで共通
+inline auto GetMonotonicNanoseconds() -> std::int64_t {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// word の値が expected の間、最大 timeout 待つ。
+// 他のプロセスが FutexWake() で起こす
+void FutexWait(std::atomic<std::uint32_t>& word, std::uint32_t expected,
+               std::chrono::nanoseconds timeout);
+void FutexWake(std::atomic<std::uint32_t>& word);
+
+// エンジンが待ち受ける Unix ドメインソケットのパス。
+// XDG_RUNTIME_DIR があればその中、無ければ /tmp にユーザーごとのディレクトリを
+// 作ってその中に置く。いずれもシンボリックリンクでなく、自分が所有し
+// 他のユーザーが触れないディレクトリの場合のみ使い、そうでなければ空のパスを
+// 返すので、呼び出し側はプロセス内で処理する
+auto GetEngineSocketPath() -> std::filesystem::path;
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_ENGINE_CHANNEL_H_
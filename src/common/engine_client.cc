@@ -0,0 +1,344 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/engine_client.h"
+
+#if defined(__linux__)
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>  // NOLINT(build/c++11)
+#include <variant>
+#include <vector>
+
+namespace beatrice::common {
+
+namespace {
+
+// 往復の遅延の移動平均の係数
+constexpr auto kSmoothing = 0.05;
+// エンジンを起動してから接続できるようになるまで待つ時間
+constexpr auto kLaunchTimeout = std::chrono::seconds(5);
+constexpr auto kConnectRetryInterval = std::chrono::milliseconds(50);
+// 書き出し時に、1 ブロックの出力を待つ時間の上限。
+// エンジンが終了していても書き出しが止まらないようにする
+constexpr auto kOfflineTimeout = std::chrono::seconds(2);
+
+#if defined(__linux__)
+extern "C" char** environ;  // NOLINT(readability-redundant-declaration)
+
+// 環境変数 BEATRICE_ENGINE_PATH で指定されていなければ、
+// プラグインのバイナリと同じディレクトリの beatrice-engine を使う
+auto GetEnginePath() -> std::filesystem::path {
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  if (const auto* const path = std::getenv("BEATRICE_ENGINE_PATH");
+      path && *path) {
+    return path;
+  }
+  auto info = Dl_info();
+  if (dladdr(reinterpret_cast<const void*>(&GetEnginePath), &info) == 0 ||
+      !info.dli_fname) {
+    return {};
+  }
+  return std::filesystem::path(info.dli_fname).parent_path() /
+         "beatrice-engine";
+}
+
+// エンジンは起動するとすぐに自身をデーモン化して親プロセスを終了させるので、
+// ここでその終了を待てばゾンビプロセスは残らない
+auto LaunchEngine() -> bool {
+  const auto path = GetEnginePath();
+  if (path.empty()) {
+    return false;
+  }
+  auto path_string = path.string();
+  auto argv = std::array<char*, 2>{path_string.data(), nullptr};
+  auto pid = pid_t();
+  if (posix_spawn(&pid, path_string.c_str(), nullptr, nullptr, argv.data(),
+                  environ) != 0) {
+    return false;
+  }
+  auto status = 0;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+auto ConnectSocket() -> int {
+  const auto path = GetEngineSocketPath().string();
+  auto address = sockaddr_un();
+  address.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+    return -1;
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  const auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, reinterpret_cast<const sockaddr*>(&address),
+              sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+auto ConnectOrLaunch() -> int {
+  if (const auto fd = ConnectSocket(); fd >= 0) {
+    return fd;
+  }
+  if (!LaunchEngine()) {
+    return -1;
+  }
+  const auto deadline = std::chrono::steady_clock::now() + kLaunchTimeout;
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (const auto fd = ConnectSocket(); fd >= 0) {
+      return fd;
+    }
+    std::this_thread::sleep_for(kConnectRetryInterval);
+  }
+  return -1;
+}
+
+// 共有メモリを作成して EngineChannel を初期化する。失敗した場合は nullptr
+auto CreateChannel(const std::string& name) -> EngineChannel* {
+  const auto fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    return nullptr;
+  }
+  if (ftruncate(fd, sizeof(EngineChannel)) != 0) {
+    close(fd);
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+  auto* const memory = mmap(nullptr, sizeof(EngineChannel),
+                            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+  auto* const channel = new (memory) EngineChannel();
+  channel->magic = EngineChannel::kMagic;
+  channel->version = EngineChannel::kVersion;
+  channel->state.store(EngineChannel::kConnecting, std::memory_order_release);
+  return channel;
+}
+
+auto SendAll(const int fd, const void* const data, const std::size_t size)
+    -> bool {
+  const auto* const bytes = static_cast<const char*>(data);
+  auto sent = std::size_t{0};
+  while (sent < size) {
+    const auto n = send(fd, bytes + sent, size - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    sent += static_cast<std::size_t>(n);
+  }
+  return true;
+}
+#endif
+
+}  // namespace
+
+EngineClient::EngineClient(const int socket_fd, EngineChannel* const channel)
+    : socket_fd_(socket_fd), channel_(channel) {}
+
+EngineClient::~EngineClient() {
+#if defined(__linux__)
+  // ソケットを閉じると、エンジンは接続が終わったと判断する
+  close(socket_fd_);
+  munmap(channel_, sizeof(EngineChannel));
+#endif
+}
+
+auto EngineClient::IsEnabled() -> bool {
+  static const auto enabled = [] {
+    // NOLINTNEXTLINE(concurrency-mt-unsafe)
+    const auto* const value = std::getenv("BEATRICE_ENGINE");
+    return value && std::string_view(value) == "1";
+  }();
+  return enabled;
+}
+
+auto EngineClient::Connect() -> std::unique_ptr<EngineClient> {
+#if defined(__linux__)
+  static auto counter = std::atomic<int>(0);
+  const auto name = "/beatrice-" + std::to_string(getpid()) + "-" +
+                    std::to_string(counter.fetch_add(1));
+  auto* const channel = CreateChannel(name);
+  if (!channel) {
+    return nullptr;
+  }
+  const auto fd = ConnectOrLaunch();
+  const auto size = static_cast<std::uint32_t>(name.size());
+  auto accepted = fd >= 0 && SendAll(fd, &size, sizeof(size)) &&
+                  SendAll(fd, name.data(), name.size());
+  // エンジンが共有メモリを開くのを待つ
+  const auto deadline = std::chrono::steady_clock::now() + kLaunchTimeout;
+  while (accepted && channel->state.load(std::memory_order_acquire) ==
+                         EngineChannel::kConnecting) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      accepted = false;
+      break;
+    }
+    FutexWait(channel->state, EngineChannel::kConnecting,
+              kConnectRetryInterval);
+  }
+  accepted = accepted && channel->state.load(std::memory_order_acquire) ==
+                             EngineChannel::kReady;
+  // どちらかが異常終了しても残らないよう、開いた後はすぐに名前を消す
+  shm_unlink(name.c_str());
+  if (!accepted) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    munmap(channel, sizeof(EngineChannel));
+    return nullptr;
+  }
+  return std::unique_ptr<EngineClient>(new EngineClient(fd, channel));
+#else
+  return nullptr;
+#endif
+}
+
+void EngineClient::PushParameterChange(const ParameterID param_id,
+                                       const ParameterState::Value& value) {
+  auto change = EngineParameterChange();
+  change.param_id = static_cast<std::int32_t>(param_id);
+  if (const auto* const int_value = std::get_if<int>(&value)) {
+    change.is_int = true;
+    change.value = *int_value;
+  } else if (const auto* const double_value = std::get_if<double>(&value)) {
+    change.is_int = false;
+    change.value = *double_value;
+  } else {
+    return;
+  }
+  if (channel_->parameters.Write(&change, 1)) {
+    Notify();
+  }
+}
+
+void EngineClient::SendState(const ParameterState& parameter_state) {
+  auto oss = std::ostringstream(std::ios::binary);
+  if (parameter_state.Write(oss) != ErrorCode::kSuccess) {
+    return;
+  }
+  const auto state = oss.str();
+  const auto size = static_cast<std::uint32_t>(state.size());
+  // 長さと内容が別々に読まれないよう、まとめて書き込む
+  auto message = std::vector<char>(sizeof(size) + state.size());
+  std::memcpy(message.data(), &size, sizeof(size));
+  std::memcpy(message.data() + sizeof(size), state.data(), state.size());
+  if (channel_->states.Write(message.data(), message.size())) {
+    Notify();
+  }
+}
+
+void EngineClient::SetMaxBlockSize(const int max_block_size) {
+  delayed_output_ = DelayedOutput(std::max(max_block_size, 1));
+  // 遅延させている途中のものは捨てる
+  channel_->output.Read(nullptr, channel_->output.GetReadable());
+  channel_->results.Read(nullptr, channel_->results.GetReadable());
+  channel_->output_dropped.store(0, std::memory_order_relaxed);
+}
+
+void EngineClient::Process(float* const buffer, const int n_samples,
+                           const bool silent, const double sample_rate,
+                           const bool offline) {
+  // 入力を渡す
+  auto block = EngineBlock{.n_samples = n_samples,
+                           .silent = silent,
+                           .offline = offline,
+                           .sample_rate = sample_rate,
+                           .sent_ns = GetMonotonicNanoseconds()};
+  if (channel_->blocks.GetWritable() >= 1 &&
+      (silent || channel_->input.Write(buffer, n_samples))) {
+    channel_->blocks.Write(&block, 1);
+    Notify();
+  } else {
+    // エンジンが大きく遅れているか、終了している
+    delayed_output_.DropInput(n_samples);
+  }
+
+  // 書き出し時は、エンジンの処理が終わるのを待つ
+  if (offline) {
+    const auto deadline = std::chrono::steady_clock::now() + kOfflineTimeout;
+    while (true) {
+      const auto sequence =
+          channel_->output_sequence.load(std::memory_order_acquire);
+      if (delayed_output_.GetMissing(
+              n_samples, static_cast<std::int64_t>(
+                             channel_->output.GetReadable())) == 0 ||
+          std::chrono::steady_clock::now() >= deadline) {
+        break;
+      }
+      FutexWait(channel_->output_sequence, sequence, kOfflineTimeout);
+    }
+  }
+
+  // 往復の遅延を記録する
+  auto result = EngineResult();
+  while (channel_->results.Read(&result, 1)) {
+    const auto seconds = static_cast<double>(result.done_ns - result.sent_ns) *
+                         1e-9;
+    mean_round_trip_seconds_ +=
+        kSmoothing * (seconds - mean_round_trip_seconds_);
+    reported_mean_round_trip_seconds_.store(mean_round_trip_seconds_,
+                                            std::memory_order_relaxed);
+    if (seconds > peak_round_trip_seconds_.load(std::memory_order_relaxed)) {
+      peak_round_trip_seconds_.store(seconds, std::memory_order_relaxed);
+    }
+  }
+
+  // 遅延させた出力を受け取る
+  delayed_output_.DropOutput(
+      channel_->output_dropped.exchange(0, std::memory_order_acquire));
+  n_late_samples_.fetch_add(
+      delayed_output_.GetMissing(
+          n_samples,
+          static_cast<std::int64_t>(channel_->output.GetReadable())),
+      std::memory_order_relaxed);
+  delayed_output_.Read(channel_->output, buffer, n_samples);
+}
+
+void EngineClient::Notify() {
+  channel_->input_sequence.fetch_add(1, std::memory_order_release);
+  FutexWake(channel_->input_sequence);
+}
+
+auto EngineClient::GetReport() const -> std::string {
+  auto line = std::array<char, 128>();
+  std::snprintf(
+      line.data(), line.size(),
+      "engine round trip: mean %.2f ms, peak %.2f ms, late samples %lld\n",
+      reported_mean_round_trip_seconds_.load(std::memory_order_relaxed) * 1e3,
+      peak_round_trip_seconds_.load(std::memory_order_relaxed) * 1e3,
+      static_cast<long long>(  // NOLINT(runtime/int)
+          n_late_samples_.load(std::memory_order_relaxed)));
+  return line.data();
+}
+
+}  // namespace beatrice::common
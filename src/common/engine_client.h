@@ -0,0 +1,76 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_ENGINE_CLIENT_H_
+#define BEATRICE_COMMON_ENGINE_CLIENT_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Beatrice
+#include "common/delayed_output.h"
+#include "common/engine_channel.h"
+#include "common/parameter_schema.h"
+#include "common/parameter_state.h"
+
+namespace beatrice::common {
+
+// 推論を別プロセスのエンジン (beatrice-engine) で行う場合の、プラグイン側の接続。
+// 環境変数 BEATRICE_ENGINE=1 の場合に使う。Linux のみ対応。
+// エンジンはマシンごとに 1 つ起動され、全てのホストの全てのインスタンスが
+// 同じエンジンに接続するので、同じモデルの重みは 1 つだけ読み込まれる。
+// 音声とパラメータは共有メモリ上のロックフリーなリングバッファで受け渡し、
+// 出力は最大ブロックサイズ分遅れる。
+class EngineClient {
+ public:
+  EngineClient(const EngineClient&) = delete;
+  auto operator=(const EngineClient&) -> EngineClient& = delete;
+  ~EngineClient();
+
+  [[nodiscard]] static auto IsEnabled() -> bool;
+  // エンジンが起動していなければ起動し、接続する。
+  // 失敗した場合は nullptr を返すので、プロセス内で処理する。
+  // 起動を待つ間は数秒ブロックするので、ホストのスレッドからは呼ばない
+  static auto Connect() -> std::unique_ptr<EngineClient>;
+
+  // 以下 2 つは、呼び出し側で排他した上でどのスレッドから呼んでもよい。
+  // 数値のパラメータの変更を送る。ロックもメモリ確保も行わない
+  void PushParameterChange(ParameterID param_id,
+                           const ParameterState::Value& value);
+  // 文字列のパラメータの変更などは、状態全体を送る。
+  // メモリを確保するので、オーディオスレッドからは呼ばない
+  void SendState(const ParameterState& parameter_state);
+
+  // 出力の遅延 [samples]
+  [[nodiscard]] auto GetLatency() const -> int {
+    return delayed_output_.GetLatency();
+  }
+  // オーディオスレッドが止まっている時に呼ぶ
+  void SetMaxBlockSize(int max_block_size);
+  // オーディオスレッドから呼ぶ。buffer を渡し、遅延させた出力で置き換える。
+  // offline の場合は、出力が届くまで待つ
+  void Process(float* buffer, int n_samples, bool silent, double sample_rate,
+               bool offline);
+  // 往復の遅延を人が読める形式で返す
+  [[nodiscard]] auto GetReport() const -> std::string;
+
+ private:
+  EngineClient(int socket_fd, EngineChannel* channel);
+
+  int socket_fd_;
+  EngineChannel* channel_;
+  // 以下はオーディオスレッドのみが触る
+  DelayedOutput delayed_output_{1};
+  double mean_round_trip_seconds_ = 0.0;
+  // GetReport() から読む
+  std::atomic<double> reported_mean_round_trip_seconds_ = 0.0;
+  std::atomic<double> peak_round_trip_seconds_ = 0.0;
+  std::atomic<std::int64_t> n_late_samples_ = 0;
+
+  void Notify();
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_ENGINE_CLIENT_H_
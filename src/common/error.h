@@ -16,6 +16,7 @@ enum class [[nodiscard]] ErrorCode : std::uint8_t {
   kInvalidFileSize = Beatrice_kInvalidFileSize,
   kTOMLSyntaxError,
   kInvalidModelConfig,
+  kInvalidModelContainer,
   kSpeakerIDOutOfRange,
   kInvalidPitchCorrectionType,
   kModelNotLoaded,
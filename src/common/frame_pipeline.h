@@ -0,0 +1,93 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_FRAME_PIPELINE_H_
+#define BEATRICE_COMMON_FRAME_PIPELINE_H_
+
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <future>  // NOLINT(build/c++11)
+#include <memory>
+#include <vector>
+
+// Beatrice
+#include "common/thread_pool.h"
+
+namespace beatrice::common {
+
+// オフラインでの書き出しなど、リアルタイム性が求められない場合に、
+// まとめて渡された複数フレームの処理を解析と合成の 2 段に分けて
+// パイプライン化するクラス。
+// 解析はスレッドプールで、合成は呼び出し元のスレッドで順に行うので、
+// フレーム t の合成とフレーム t + 1 の解析が重なって実行される。
+// 解析と合成はそれぞれフレームの順に実行されるので、
+// 各段の内部状態は直列に処理した場合と同じになる。
+class FramePipeline {
+ public:
+  // 有効にするとスレッドプールを確保する。
+  // オーディオスレッドからは無効にする場合のみ呼んでよい
+  void SetEnabled(const bool enabled) {
+    if (!enabled) {
+      pool_.reset();
+    } else if (!pool_) {
+      pool_ = ThreadPool::Acquire();
+    }
+  }
+  [[nodiscard]] auto IsEnabled() const -> bool { return pool_ != nullptr; }
+
+  // kInputSize サンプルずつ区切られた n_frames フレームの input を処理し、
+  // kOutputSize サンプルずつ output に書き込む。
+  // analyze(input, analysis) と synthesize(analysis, output) には
+  // 64 バイト境界に揃えた 1 フレーム分の領域が渡される。
+  // 無効な場合は 1 フレームずつ解析と合成を続けて行う
+  template <int kInputSize, int kOutputSize, typename Analysis,
+            typename Analyze, typename Synthesize>
+  void Process(const float* const input, float* const output,
+               const int n_frames, std::vector<Analysis>& analyses,
+               Analyze&& analyze, Synthesize&& synthesize) {
+    const auto analyze_frame = [&](const int i, Analysis& analysis) {
+      alignas(64) auto frame = std::array<float, kInputSize>();
+      std::memcpy(frame.data(), input + i * kInputSize,
+                  sizeof(float) * kInputSize);
+      analyze(frame.data(), analysis);
+    };
+    const auto synthesize_frame = [&](const int i, Analysis& analysis) {
+      alignas(64) auto frame = std::array<float, kOutputSize>();
+      synthesize(analysis, frame.data());
+      std::memcpy(output + i * kOutputSize, frame.data(),
+                  sizeof(float) * kOutputSize);
+    };
+    if (!IsEnabled() || n_frames < 2) {
+      auto analysis = Analysis();
+      for (auto i = 0; i < n_frames; ++i) {
+        analyze_frame(i, analysis);
+        synthesize_frame(i, analysis);
+      }
+      return;
+    }
+    analyses.resize(n_frames);
+    auto n_analyzed = std::atomic<int>(0);
+    auto analysis_done = pool_->Submit([&] {
+      for (auto i = 0; i < n_frames; ++i) {
+        analyze_frame(i, analyses[i]);
+        n_analyzed.store(i + 1, std::memory_order_release);
+        n_analyzed.notify_one();
+      }
+    });
+    for (auto i = 0; i < n_frames; ++i) {
+      for (auto n = n_analyzed.load(std::memory_order_acquire); n <= i;
+           n = n_analyzed.load(std::memory_order_acquire)) {
+        n_analyzed.wait(n, std::memory_order_acquire);
+      }
+      synthesize_frame(i, analyses[i]);
+    }
+    analysis_done.wait();
+  }
+
+ private:
+  std::shared_ptr<ThreadPool> pool_;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_FRAME_PIPELINE_H_
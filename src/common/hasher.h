@@ -0,0 +1,55 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_HASHER_H_
+#define BEATRICE_COMMON_HASHER_H_
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace beatrice::common {
+
+// キャッシュやコンテナの内容の変化を検出するための 64 bit ハッシュ。
+// 暗号学的な強度は不要で、内容の変化を検出できれば良い
+class Hasher {
+ public:
+  void Update(const std::byte* const data, const std::size_t size) {
+    auto i = std::size_t{0};
+    for (; i + 8 <= size; i += 8) {
+      std::uint64_t word;
+      std::memcpy(&word, data + i, 8);
+      Mix(word);
+    }
+    auto tail = std::uint64_t{0};
+    for (auto j = 0; i < size; ++i, ++j) {
+      tail |= static_cast<std::uint64_t>(data[i]) << (8 * j);
+    }
+    Mix(tail ^ (static_cast<std::uint64_t>(size) << 56));
+  }
+  [[nodiscard]] auto Get() const -> std::uint64_t { return state_; }
+  // ファイル名に使える 16 桁の 16 進表記
+  [[nodiscard]] auto GetHex() const -> std::string {
+    auto hex = std::string(16, '0');
+    auto hash = state_;
+    for (auto i = 15; i >= 0; --i, hash >>= 4) {
+      hex[i] = "0123456789abcdef"[hash & 0xf];
+    }
+    return hex;
+  }
+
+ private:
+  std::uint64_t state_ = 0x9e3779b97f4a7c15ULL;
+
+  void Mix(std::uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    state_ = std::rotl(state_ ^ x, 27) * 0x9e3779b97f4a7c15ULL;
+  }
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_HASHER_H_
@@ -0,0 +1,45 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_LOAD_LEVELING_H_
+#define BEATRICE_COMMON_LOAD_LEVELING_H_
+
+#include <cmath>
+#include <cstdlib>
+#include <string_view>
+
+namespace beatrice::common {
+
+// ホストのブロックサイズがモデルの 1 ブロック (48kHz で 480 サンプル) の
+// 約数でない場合、呼び出しごとに処理するブロック数が 0, 1, 2, ... と
+// ばらつき、最も重い呼び出しに合わせて CPU の余裕を確保する必要がある。
+// 環境変数 BEATRICE_LOAD_LEVELING=1 の場合は、リアルタイム処理で遅延を
+// 1 ブロック分増やす代わりに、1 ブロックの処理 (ピッチ推定、音素抽出、
+// 波形生成) を次の 1 ブロック分の入力が来るまでの呼び出しに均等に分散させる
+inline auto IsLoadLevelingEnabled() -> bool {
+  static const auto enabled = [] {
+    // NOLINTNEXTLINE(concurrency-mt-unsafe)
+    const auto* const value = std::getenv("BEATRICE_LOAD_LEVELING");
+    return value && std::string_view(value) == "1";
+  }();
+  return enabled;
+}
+
+// ProcessorCore での負荷の平準化の仕方
+enum class LoadLevelingMode {
+  kDisabled,
+  // 遅延を 1 ブロック分増やし、処理を次のブロックの入力が来るまでの呼び出しに
+  // 分散させる
+  kSpread,
+  // 遅延は kSpread と同じだけ増やすが、処理は入力が揃った呼び出しで全て行う。
+  // 遅延をホストに報告済みで、処理を分散できない構成の場合に使う
+  kDelayOnly,
+};
+
+// 負荷の平準化によって増える遅延 [samples]
+inline auto GetLoadLevelingLatency(const double sample_rate) -> int {
+  return static_cast<int>(std::lround(sample_rate * 480.0 / 48000.0));
+}
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_LOAD_LEVELING_H_
@@ -0,0 +1,100 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/mapped_file.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+
+namespace beatrice::common {
+
+#if defined(_WIN32)
+
+MappedFile::~MappedFile() {
+  if (data_) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_handle_) {
+    CloseHandle(mapping_handle_);
+  }
+  if (file_handle_ && file_handle_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(file_handle_);
+  }
+}
+
+auto MappedFile::Open(const std::filesystem::path& file)
+    -> std::shared_ptr<const MappedFile> {
+  auto mapped = std::shared_ptr<MappedFile>(new MappedFile());
+  mapped->file_handle_ = CreateFileW(
+      file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (mapped->file_handle_ == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(mapped->file_handle_, &size) || size.QuadPart == 0) {
+    return nullptr;
+  }
+  mapped->mapping_handle_ = CreateFileMappingW(
+      mapped->file_handle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapped->mapping_handle_) {
+    return nullptr;
+  }
+  const auto* const view =
+      MapViewOfFile(mapped->mapping_handle_, FILE_MAP_READ, 0, 0, 0);
+  if (!view) {
+    return nullptr;
+  }
+  mapped->data_ = static_cast<const std::byte*>(view);
+  mapped->size_ = static_cast<std::size_t>(size.QuadPart);
+  return mapped;
+}
+
+#else
+
+MappedFile::~MappedFile() {
+  if (data_) {
+    munmap(const_cast<std::byte*>(data_), size_);
+  }
+}
+
+auto MappedFile::Open(const std::filesystem::path& file)
+    -> std::shared_ptr<const MappedFile> {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+  const auto fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return nullptr;
+  }
+  const auto size = static_cast<std::size_t>(st.st_size);
+  auto* const view = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  // マップ後はファイルディスクリプタを閉じても問題ない
+  close(fd);
+  if (view == MAP_FAILED) {
+    return nullptr;
+  }
+  auto mapped = std::shared_ptr<MappedFile>(new MappedFile());
+  mapped->data_ = static_cast<const std::byte*>(view);
+  mapped->size_ = size;
+  return mapped;
+}
+
+#endif
+
+}  // namespace beatrice::common
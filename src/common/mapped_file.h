@@ -0,0 +1,40 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_MAPPED_FILE_H_
+#define BEATRICE_COMMON_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+
+namespace beatrice::common {
+
+// ファイル全体を読み取り専用でメモリにマップする。
+// 同じファイルをマップしたプロセス同士では物理ページが共有される。
+class MappedFile {
+ public:
+  MappedFile(const MappedFile&) = delete;
+  auto operator=(const MappedFile&) -> MappedFile& = delete;
+  ~MappedFile();
+
+  // 失敗した場合は nullptr を返す
+  static auto Open(const std::filesystem::path& file)
+      -> std::shared_ptr<const MappedFile>;
+
+  [[nodiscard]] auto GetData() const -> const std::byte* { return data_; }
+  [[nodiscard]] auto GetSize() const -> std::size_t { return size_; }
+
+ private:
+  MappedFile() = default;
+
+  const std::byte* data_ = nullptr;
+  std::size_t size_ = 0;
+#if defined(_WIN32)
+  void* file_handle_ = nullptr;
+  void* mapping_handle_ = nullptr;
+#endif
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_MAPPED_FILE_H_
@@ -0,0 +1,105 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_MEMORY_FOOTPRINT_H_
+#define BEATRICE_COMMON_MEMORY_FOOTPRINT_H_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace beatrice::common {
+
+// インスタンスが使っているメモリの量を、構成要素ごとに集計する。
+// 同じモデルを使う他のインスタンスと共有しているものは shared として区別する。
+class MemoryFootprint {
+ public:
+  struct Item {
+    std::string component;
+    std::size_t bytes;
+    bool shared;
+  };
+
+  // 同じ構成要素に対して複数回呼んだ場合は合算する
+  void Add(std::string component, const std::size_t bytes,
+           const bool shared = false) {
+    const auto it = std::ranges::find_if(items_, [&](const Item& item) {
+      return item.component == component && item.shared == shared;
+    });
+    if (it != items_.end()) {
+      it->bytes += bytes;
+      return;
+    }
+    items_.push_back(
+        {.component = std::move(component), .bytes = bytes, .shared = shared});
+  }
+  void Merge(const MemoryFootprint& other) {
+    for (const auto& item : other.items_) {
+      Add(item.component, item.bytes, item.shared);
+    }
+  }
+  // 記録された順に返す
+  [[nodiscard]] auto GetItems() const -> const std::vector<Item>& {
+    return items_;
+  }
+  [[nodiscard]] auto GetTotal(const bool shared) const -> std::size_t {
+    auto total = std::size_t{0};
+    for (const auto& item : items_) {
+      if (item.shared == shared) {
+        total += item.bytes;
+      }
+    }
+    return total;
+  }
+  // 1 行に 1 つずつ、KiB 単位で並べた表にする
+  [[nodiscard]] auto ToString() const -> std::string {
+    auto text = std::string();
+    for (const auto shared : {false, true}) {
+      for (const auto& item : items_) {
+        if (item.shared == shared) {
+          AppendLine(text, item.component, item.bytes, shared);
+        }
+      }
+    }
+    AppendLine(text, "total", GetTotal(false), false);
+    AppendLine(text, "total", GetTotal(true), true);
+    return text;
+  }
+
+  // std::vector などが確保している領域の大きさ
+  template <typename Container>
+  static auto SizeOf(const Container& container) -> std::size_t {
+    return container.capacity() * sizeof(typename Container::value_type);
+  }
+  // 中身が見えないネットワークの重みは、ファイルの大きさで見積もる
+  static auto FileSizeOf(const std::filesystem::path& file) -> std::size_t {
+    auto ec = std::error_code();
+    const auto size = std::filesystem::file_size(file, ec);
+    return ec ? 0 : static_cast<std::size_t>(size);
+  }
+
+ private:
+  std::vector<Item> items_;
+
+  static void AppendLine(std::string& text, const std::string& component,
+                         const std::size_t bytes, const bool shared) {
+    auto buffer = std::array<char, 32>();
+    std::snprintf(buffer.data(), buffer.size(), "%10.1f KiB  ",
+                  static_cast<double>(bytes) / 1024.0);
+    text += buffer.data();
+    text += component;
+    if (shared) {
+      text += " (shared)";
+    }
+    text += '\n';
+  }
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_MEMORY_FOOTPRINT_H_
@@ -0,0 +1,155 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/memory_residency.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <span>
+#include <string_view>
+
+namespace beatrice::common {
+
+namespace {
+
+#if defined(__linux__)
+// transparent huge pages を要求する領域の下限
+constexpr auto kHugePageThreshold = std::size_t{2} << 20;
+
+auto IsHugePagesEnabled() -> bool {
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  const auto* const value = std::getenv("BEATRICE_HUGE_PAGES");
+  return !value || std::string_view(value) != "0";
+}
+#endif
+
+auto GetPageSize() -> std::size_t {
+#if defined(_WIN32)
+  auto info = SYSTEM_INFO();
+  GetSystemInfo(&info);
+  return info.dwPageSize;
+#else
+  return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+auto GetLockBudget() -> std::size_t {
+  static const auto budget = []() -> std::size_t {
+    // NOLINTNEXTLINE(concurrency-mt-unsafe)
+    const auto* const value = std::getenv("BEATRICE_MLOCK_BUDGET_MB");
+    if (!value) {
+      return 0;
+    }
+    const auto* const end = value + std::strlen(value);
+    auto megabytes = std::size_t{0};
+    const auto [ptr, ec] = std::from_chars(value, end, megabytes);
+    return ec == std::errc() && ptr == end ? megabytes << 20 : 0;
+  }();
+  return budget;
+}
+
+// プロセス内でロックしている量
+auto GetLockedTotal() -> std::atomic<std::size_t>& {
+  static auto locked_total = std::atomic<std::size_t>(0);
+  return locked_total;
+}
+
+// data に完全に含まれるページの領域。無ければ空
+auto GetInnerPages(const std::span<const std::byte> data)
+    -> std::span<const std::byte> {
+  const auto page_size = GetPageSize();
+  const auto begin =
+      (reinterpret_cast<std::uintptr_t>(data.data()) + page_size - 1) &
+      ~(page_size - 1);
+  const auto end =
+      (reinterpret_cast<std::uintptr_t>(data.data()) + data.size()) &
+      ~(page_size - 1);
+  if (end <= begin) {
+    return {};
+  }
+  return {reinterpret_cast<const std::byte*>(begin), end - begin};
+}
+
+auto Lock(const std::span<const std::byte> pages) -> bool {
+#if defined(_WIN32)
+  return VirtualLock(const_cast<std::byte*>(pages.data()), pages.size()) != 0;
+#else
+  return mlock(pages.data(), pages.size()) == 0;
+#endif
+}
+
+void Unlock(const std::span<const std::byte> pages) {
+#if defined(_WIN32)
+  VirtualUnlock(const_cast<std::byte*>(pages.data()), pages.size());
+#else
+  munlock(pages.data(), pages.size());
+#endif
+}
+
+}  // namespace
+
+MemoryResidency::~MemoryResidency() {
+  for (const auto pages : locked_regions_) {
+    Unlock(pages);
+  }
+  GetLockedTotal().fetch_sub(locked_size_, std::memory_order_relaxed);
+}
+
+void MemoryResidency::Add(const std::span<const std::byte> data,
+                          [[maybe_unused]] const bool file_backed) {
+  if (data.empty()) {
+    return;
+  }
+  const auto pages = GetInnerPages(data);
+#if defined(__linux__)
+  // 既に確保済みの領域なので、khugepaged によって後から集約される
+  if (!file_backed && pages.size() >= kHugePageThreshold &&
+      IsHugePagesEnabled()) {
+    madvise(const_cast<std::byte*>(pages.data()), pages.size(),
+            MADV_HUGEPAGE);
+  }
+#endif
+  // 各ページに触れて、ファイルからの読み込みや物理ページの割り当てを済ませる
+  const auto page_size = GetPageSize();
+  auto sum = std::byte{0};
+  for (auto offset = std::size_t{0}; offset < data.size();
+       offset += page_size) {
+    sum ^= data[offset];
+  }
+  sum ^= data.back();
+  [[maybe_unused]] volatile auto sink = sum;
+
+  const auto budget = GetLockBudget();
+  if (budget == 0 || pages.empty()) {
+    return;
+  }
+  auto& locked_total = GetLockedTotal();
+  auto total = locked_total.load(std::memory_order_relaxed);
+  do {
+    if (total + pages.size() > budget) {
+      return;
+    }
+  } while (!locked_total.compare_exchange_weak(total, total + pages.size(),
+                                               std::memory_order_relaxed));
+  if (!Lock(pages)) {
+    locked_total.fetch_sub(pages.size(), std::memory_order_relaxed);
+    return;
+  }
+  locked_regions_.push_back(pages);
+  locked_size_ += pages.size();
+}
+
+}  // namespace beatrice::common
@@ -0,0 +1,43 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_MEMORY_RESIDENCY_H_
+#define BEATRICE_COMMON_MEMORY_RESIDENCY_H_
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace beatrice::common {
+
+// 読み込んだモデルの大きなテーブルを、オーディオスレッドで
+// ページフォルトが起きないようにメモリに常駐させるためのクラス。
+// 登録した領域は全てのページに触れてフォルトさせておき、
+// 環境変数 BEATRICE_MLOCK_BUDGET_MB (既定値 0 で無効) で指定した
+// プロセス全体の上限の範囲でロックする。
+// Linux では大きな領域に transparent huge pages を要求する
+// (環境変数 BEATRICE_HUGE_PAGES=0 で無効)。
+// munlock() は回数を数えずにページ単位で解除するので、他の領域とページを
+// 共有しうる両端の部分的なページはロックせず、領域に完全に含まれるページのみ
+// ロックする。ロックは破棄時に解除される。
+class MemoryResidency {
+ public:
+  MemoryResidency() = default;
+  MemoryResidency(const MemoryResidency&) = delete;
+  auto operator=(const MemoryResidency&) -> MemoryResidency& = delete;
+  ~MemoryResidency();
+
+  // file_backed は data が読み込み専用のファイルのマッピングである場合に
+  // true にする。huge pages を使えないので要求しない
+  void Add(std::span<const std::byte> data, bool file_backed = false);
+  [[nodiscard]] auto GetLockedSize() const -> std::size_t {
+    return locked_size_;
+  }
+
+ private:
+  std::vector<std::span<const std::byte>> locked_regions_;
+  std::size_t locked_size_ = 0;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_MEMORY_RESIDENCY_H_
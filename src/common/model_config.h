@@ -4,11 +4,11 @@
 #define BEATRICE_COMMON_MODEL_CONFIG_H_
 
 #include <algorithm>
-#include <array>
 #include <cmath>
 #include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "toml11/single_include/toml.hpp"
 
@@ -44,19 +44,13 @@ struct ModelConfig {
     double average_pitch;
     Portrait portrait;
   };
-  std::array<Voice, kMaxNSpeakers> voices;
+  // ID 順に並んだ話者。要素数は 1 以上 kMaxNSpeakers 以下
+  std::vector<Voice> voices;
 };
 
 [[nodiscard]] inline auto GetVoiceCount(const ModelConfig& model_config)
     -> int {
-  for (auto i = 0; i < kMaxNSpeakers; ++i) {
-    const auto& voice = model_config.voices[i];
-    if (voice.name.empty() && voice.description.empty() &&
-        voice.portrait.path.empty() && voice.portrait.description.empty()) {
-      return i;
-    }
-  }
-  return kMaxNSpeakers;
+  return static_cast<int>(model_config.voices.size());
 }
 
 // TOML の表示文字列を読み込み、NUL を空白へ置き換える。
@@ -115,25 +109,27 @@ template <>
 struct from<ModelConfig> {
   // NOLINTNEXTLINE(readability-identifier-naming)
   static auto from_toml(const value& v) -> ModelConfig {
-    auto target_speakers =
-        std::array<ModelConfig::Voice, beatrice::common::kMaxNSpeakers>();
     const auto& voices = find<toml::table>(v, "voice");
+    auto target_speakers = std::vector<ModelConfig::Voice>(voices.size());
+    auto assigned = std::vector<bool>(voices.size());
     for (const auto& [key, value] : voices) {
       const auto id = std::stoi(key);
       if (id < 0 || id >= beatrice::common::kMaxNSpeakers) {
         throw std::out_of_range("speaker id out of range");
       }
+      if (std::cmp_greater_equal(id, voices.size()) || assigned[id]) {
+        throw std::invalid_argument(
+            "voice ids must start at zero and be contiguous");
+      }
       target_speakers[id] = get<ModelConfig::Voice>(value);
+      assigned[id] = true;
     }
-    auto model_config =
-        ModelConfig{.model = find<ModelConfig::Model>(v, "model"),
-                    .voices = target_speakers};
-    const auto voice_count = beatrice::common::GetVoiceCount(model_config);
-    if (voice_count == 0 || std::cmp_not_equal(voice_count, voices.size())) {
+    if (target_speakers.empty()) {
       throw std::invalid_argument(
           "voice ids must start at zero and be contiguous");
     }
-    return model_config;
+    return ModelConfig{.model = find<ModelConfig::Model>(v, "model"),
+                       .voices = std::move(target_speakers)};
   }
 };
 }  // namespace toml
@@ -0,0 +1,164 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/model_config_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "toml11/single_include/toml.hpp"
+
+// Beatrice
+#include "common/error.h"
+#include "common/model_config.h"
+#include "common/model_container.h"
+
+namespace beatrice::common {
+
+namespace {
+
+// 保持する ModelConfig の数
+constexpr auto kCapacity = std::size_t{8};
+
+struct Key {
+  std::u8string file;
+  std::int64_t last_write_time;
+  std::uintmax_t file_size;
+
+  auto operator==(const Key& rhs) const -> bool = default;
+};
+
+struct Entry {
+  Key key;
+  std::shared_ptr<const ModelConfig> config;
+};
+
+struct Entries {
+  std::mutex mtx;
+  // 後ろほど最近使われたもの
+  std::vector<Entry> configs;
+};
+
+auto GetEntries() -> Entries& {
+  // プラグインのアンロード時の破棄順序の問題を避けるため、意図的に解放しない
+  static auto* const entries = new Entries();
+  return *entries;
+}
+
+auto MakeKey(const std::filesystem::path& file, Key& key) -> bool {
+  auto ec = std::error_code();
+  auto canonical = std::filesystem::weakly_canonical(file, ec);
+  if (ec) {
+    canonical = file;
+  }
+  const auto last_write_time = std::filesystem::last_write_time(canonical, ec);
+  if (ec) {
+    return false;
+  }
+  const auto file_size = std::filesystem::file_size(canonical, ec);
+  if (ec) {
+    return false;
+  }
+  key = {.file = canonical.u8string(),
+         .last_write_time = static_cast<std::int64_t>(
+             last_write_time.time_since_epoch().count()),
+         .file_size = file_size};
+  return true;
+}
+
+auto Find(const Key& key) -> std::shared_ptr<const ModelConfig> {
+  auto& entries = GetEntries();
+  const auto lock = std::lock_guard<std::mutex>(entries.mtx);
+  const auto it = std::ranges::find(entries.configs, key, &Entry::key);
+  if (it == entries.configs.end()) {
+    return nullptr;
+  }
+  // 最近使われたものとして末尾に移す
+  std::rotate(it, it + 1, entries.configs.end());
+  return entries.configs.back().config;
+}
+
+auto Insert(const Key& key, std::shared_ptr<const ModelConfig> config)
+    -> std::shared_ptr<const ModelConfig> {
+  auto& entries = GetEntries();
+  const auto lock = std::lock_guard<std::mutex>(entries.mtx);
+  // 同時に同じファイルを解析した場合は、先に登録された方を使う
+  if (const auto it = std::ranges::find(entries.configs, key, &Entry::key);
+      it != entries.configs.end()) {
+    return it->config;
+  }
+  if (entries.configs.size() >= kCapacity) {
+    entries.configs.erase(entries.configs.begin());
+  }
+  entries.configs.push_back({.key = key, .config = config});
+  return config;
+}
+
+}  // namespace
+
+auto ModelConfigCache::Get(const std::filesystem::path& file,
+                           std::shared_ptr<const ModelConfig>& config,
+                           std::string* const error_message) -> ErrorCode {
+  auto key = Key();
+  if (!MakeKey(file, key)) {
+    return ErrorCode::kFileOpenError;
+  }
+  if (auto found = Find(key)) {
+    config = std::move(found);
+    return ErrorCode::kSuccess;
+  }
+  // 解析中はロックを保持しない
+  auto new_config = std::make_shared<ModelConfig>();
+  if (const auto err = ParseModelConfig(file, *new_config, error_message);
+      err != ErrorCode::kSuccess) {
+    return err;
+  }
+  config = Insert(key, std::move(new_config));
+  return ErrorCode::kSuccess;
+}
+
+auto ParseModelConfig(const std::filesystem::path& file, ModelConfig& config,
+                      std::string* const error_message) -> ErrorCode {
+  auto toml_text = std::string();
+  if (const auto err = ReadModelConfigText(file, toml_text);
+      err != ErrorCode::kSuccess) {
+    return err;
+  }
+  const auto fail = [error_message](const std::exception& e,
+                                    const ErrorCode error_code) {
+    if (error_message) {
+      *error_message = e.what();
+    }
+    return error_code;
+  };
+  try {
+    const auto source_path = file.u8string();
+    const auto source_name = std::string(
+        reinterpret_cast<const char*>(source_path.data()), source_path.size());
+    auto stream = std::istringstream(toml_text);
+    const auto toml_data = toml::parse(stream, source_name);
+    config = toml::get<ModelConfig>(toml_data);
+    return ErrorCode::kSuccess;
+  } catch (const toml::syntax_error& e) {
+    return fail(e, ErrorCode::kTOMLSyntaxError);
+  } catch (const toml::type_error& e) {
+    return fail(e, ErrorCode::kInvalidModelConfig);
+  } catch (const std::invalid_argument& e) {
+    return fail(e, ErrorCode::kInvalidModelConfig);
+  } catch (const std::out_of_range& e) {
+    return fail(e, ErrorCode::kInvalidModelConfig);
+  } catch (const std::exception& e) {
+    return fail(e, ErrorCode::kUnknownError);
+  }
+}
+
+}  // namespace beatrice::common
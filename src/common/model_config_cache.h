@@ -0,0 +1,37 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_MODEL_CONFIG_CACHE_H_
+#define BEATRICE_COMMON_MODEL_CONFIG_CACHE_H_
+
+#include <filesystem>
+#include <memory>
+#include <string>
+
+// Beatrice
+#include "common/error.h"
+#include "common/model_config.h"
+
+namespace beatrice::common {
+
+// 解析済みの ModelConfig をプロセス内で共有するためのキャッシュ。
+// 1 回のモデルの選択で Controller, Processor, Editor がそれぞれ
+// 同じ TOML を読み込むので、最初の 1 回だけ解析して残りはそれを使う。
+// ファイルの canonical path と最終更新日時、サイズで識別し、
+// 最近使われたものをいくつか保持する。
+class ModelConfigCache {
+ public:
+  // file はディレクトリ形式の beatrice_model.toml とコンテナのどちらでもよい。
+  // 解析に失敗した場合は、error_message があればそこに理由を入れる
+  static auto Get(const std::filesystem::path& file,
+                  std::shared_ptr<const ModelConfig>& config,
+                  std::string* error_message = nullptr) -> ErrorCode;
+};
+
+// キャッシュを使わずに解析する。
+// 解析に失敗した場合は、error_message があればそこに理由を入れる
+auto ParseModelConfig(const std::filesystem::path& file, ModelConfig& config,
+                      std::string* error_message = nullptr) -> ErrorCode;
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_MODEL_CONFIG_CACHE_H_
@@ -0,0 +1,352 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/model_container.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "toml11/single_include/toml.hpp"
+
+// Beatrice
+#include "common/cache_directory.h"
+#include "common/error.h"
+#include "common/hasher.h"
+#include "common/mapped_file.h"
+#include "common/model_config.h"
+
+namespace beatrice::common {
+
+namespace {
+
+constexpr auto kMagic =
+    std::array<char, 8>{'B', 'T', 'R', 'M', 'O', 'D', 'L', 0};
+// レイアウトを変えた場合はこれを上げる
+constexpr std::uint32_t kFormatVersion = 1;
+// セクションをそのままマップして使えるよう、ページ境界に揃える
+constexpr std::uint64_t kAlignment = 4096;
+constexpr std::uint32_t kMaxNSections = 4096;
+
+struct FileHeader {
+  std::array<char, 8> magic;
+  std::uint32_t format_version;
+  std::uint32_t n_sections;
+  std::uint64_t file_size;
+  // 索引全体のハッシュ。各セクションのハッシュを含むので内容の識別にも使う
+  std::uint64_t index_hash;
+};
+
+struct IndexEntry {
+  std::array<char, 232> name;  // NUL 終端
+  std::uint64_t offset;
+  std::uint64_t size;
+  std::uint64_t hash;
+};
+
+// ディレクトリ形式のモデルに含まれ得るファイル
+constexpr auto kModelFiles = std::array<std::string_view, 6>{
+    "phone_extractor.bin",    "pitch_estimator.bin",
+    "waveform_generator.bin", "embedding_setter.bin",
+    "speaker_embeddings.bin", "formant_shift_embeddings.bin",
+};
+
+auto AlignUp(const std::uint64_t n) -> std::uint64_t {
+  return (n + (kAlignment - 1)) & ~(kAlignment - 1);
+}
+
+auto Hash(const std::span<const std::byte> data) -> std::uint64_t {
+  auto hasher = Hasher();
+  hasher.Update(data.data(), data.size());
+  return hasher.Get();
+}
+
+auto ReadWholeFile(const std::filesystem::path& file, std::string& data)
+    -> bool {
+  auto ec = std::error_code();
+  if (!std::filesystem::is_regular_file(file, ec)) {
+    return false;
+  }
+  auto ifs = std::ifstream(file, std::ios::binary);
+  if (!ifs) {
+    return false;
+  }
+  data.assign(std::istreambuf_iterator<char>(ifs),
+              std::istreambuf_iterator<char>());
+  return !ifs.bad();
+}
+
+// 展開先に置いてよい名前か
+auto IsExtractable(const std::string_view name) -> bool {
+  return !name.empty() && name != "." && name != ".." &&
+         name.find_first_of("/\\:") == std::string_view::npos;
+}
+
+}  // namespace
+
+auto ModelContainer::IsContainer(const std::filesystem::path& file) -> bool {
+  const auto extension = file.extension().u8string();
+  return std::ranges::equal(
+      extension, kExtension, [](const char8_t a, const char b) {
+        return (a >= u8'A' && a <= u8'Z' ? a - u8'A' + u8'a' : a) ==
+               static_cast<char8_t>(b);
+      });
+}
+
+auto ModelContainer::Open(const std::filesystem::path& file,
+                          ErrorCode& error_code)
+    -> std::shared_ptr<const ModelContainer> {
+  auto mapped = MappedFile::Open(file);
+  if (!mapped) {
+    error_code = ErrorCode::kFileOpenError;
+    return nullptr;
+  }
+  const auto file_size = static_cast<std::uint64_t>(mapped->GetSize());
+  if (file_size < sizeof(FileHeader)) {
+    error_code = ErrorCode::kFileTooSmall;
+    return nullptr;
+  }
+  auto header = FileHeader();
+  std::memcpy(&header, mapped->GetData(), sizeof(FileHeader));
+  if (header.magic != kMagic || header.format_version != kFormatVersion ||
+      header.n_sections > kMaxNSections) {
+    error_code = ErrorCode::kInvalidModelContainer;
+    return nullptr;
+  }
+  if (header.file_size != file_size ||
+      file_size < sizeof(FileHeader) + header.n_sections * sizeof(IndexEntry)) {
+    error_code = ErrorCode::kInvalidFileSize;
+    return nullptr;
+  }
+  const auto index = std::span<const std::byte>(
+      mapped->GetData() + sizeof(FileHeader),
+      header.n_sections * sizeof(IndexEntry));
+  if (Hash(index) != header.index_hash) {
+    error_code = ErrorCode::kInvalidModelContainer;
+    return nullptr;
+  }
+
+  auto container = std::shared_ptr<ModelContainer>(new ModelContainer());
+  container->sections_.reserve(header.n_sections);
+  for (auto i = std::uint32_t{0}; i < header.n_sections; ++i) {
+    auto entry = IndexEntry();
+    std::memcpy(&entry, index.data() + i * sizeof(IndexEntry),
+                sizeof(IndexEntry));
+    const auto name_length = std::ranges::find(entry.name, '\0') -
+                             entry.name.begin();
+    if (std::cmp_equal(name_length, entry.name.size()) ||
+        entry.offset % kAlignment != 0 || entry.offset > file_size ||
+        entry.size > file_size - entry.offset) {
+      error_code = ErrorCode::kInvalidModelContainer;
+      return nullptr;
+    }
+    // 内容のハッシュは参照する時に検証する
+    container->sections_.push_back(
+        {.name = std::string(entry.name.data(), name_length),
+         .data = std::span<const std::byte>(mapped->GetData() + entry.offset,
+                                            entry.size),
+         .hash = entry.hash});
+  }
+  container->verified_ = std::vector<std::atomic<bool>>(header.n_sections);
+  container->file_ = std::move(mapped);
+  container->content_hash_ = header.index_hash;
+  error_code = ErrorCode::kSuccess;
+  return container;
+}
+
+auto ModelContainer::Pack(const std::filesystem::path& model_file,
+                          const std::filesystem::path& container_file)
+    -> ErrorCode {
+  struct PendingSection {
+    std::string name;
+    std::string data;
+  };
+  auto pending = std::vector<PendingSection>();
+  auto toml_text = std::string();
+  if (!ReadWholeFile(model_file, toml_text)) {
+    return ErrorCode::kFileOpenError;
+  }
+  auto model_config = ModelConfig();
+  try {
+    auto stream = std::istringstream(toml_text);
+    model_config = toml::get<ModelConfig>(
+        toml::parse(stream, std::string(kConfigSection)));
+  } catch (const toml::syntax_error&) {
+    return ErrorCode::kTOMLSyntaxError;
+  } catch (const std::exception&) {
+    return ErrorCode::kInvalidModelConfig;
+  }
+  pending.push_back(
+      {.name = std::string(kConfigSection), .data = std::move(toml_text)});
+
+  const auto d = model_file.parent_path();
+  for (const auto name : kModelFiles) {
+    auto data = std::string();
+    if (ReadWholeFile(d / name, data)) {
+      pending.push_back({.name = std::string(name), .data = std::move(data)});
+    }
+  }
+  for (auto i = 0; i < GetVoiceCount(model_config); ++i) {
+    const auto& path = model_config.voices[i].portrait.path;
+    auto name = std::string(kPortraitPrefix);
+    name.append(path.begin(), path.end());
+    if (path.empty() || std::ranges::any_of(pending, [&](const auto& s) {
+          return s.name == name;
+        })) {
+      continue;
+    }
+    auto data = std::string();
+    if (ReadWholeFile(d / path, data)) {
+      pending.push_back({.name = std::move(name), .data = std::move(data)});
+    }
+  }
+
+  // レイアウトを決める
+  auto header = FileHeader{
+      .magic = kMagic,
+      .format_version = kFormatVersion,
+      .n_sections = static_cast<std::uint32_t>(pending.size()),
+      .file_size = 0,
+      .index_hash = 0};
+  auto entries = std::vector<IndexEntry>(pending.size());
+  auto offset =
+      AlignUp(sizeof(FileHeader) + pending.size() * sizeof(IndexEntry));
+  for (auto i = std::size_t{0}; i < pending.size(); ++i) {
+    const auto& section = pending[i];
+    if (section.name.size() >= entries[i].name.size()) {
+      return ErrorCode::kInvalidModelConfig;
+    }
+    const auto data = std::as_bytes(std::span(section.data));
+    std::ranges::copy(section.name, entries[i].name.begin());
+    entries[i].offset = offset;
+    entries[i].size = data.size();
+    entries[i].hash = Hash(data);
+    offset = AlignUp(offset + data.size());
+  }
+  header.file_size = offset;
+  header.index_hash = Hash(std::as_bytes(std::span(entries)));
+
+  const auto written = WriteFileAtomically(
+      container_file, [&](std::ofstream& ofs) {
+        ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        ofs.write(reinterpret_cast<const char*>(entries.data()),
+                  static_cast<std::streamsize>(entries.size() *
+                                               sizeof(IndexEntry)));
+        for (auto i = std::size_t{0}; i < pending.size(); ++i) {
+          ofs.seekp(static_cast<std::streamoff>(entries[i].offset));
+          ofs.write(pending[i].data.data(),
+                    static_cast<std::streamsize>(pending[i].data.size()));
+        }
+        // 末尾の詰め物
+        ofs.seekp(static_cast<std::streamoff>(header.file_size - 1));
+        ofs.put('\0');
+        return static_cast<bool>(ofs);
+      });
+  return written ? ErrorCode::kSuccess : ErrorCode::kFileOpenError;
+}
+
+auto ModelContainer::Find(const std::string_view name) const
+    -> std::span<const std::byte> {
+  const auto it = std::ranges::find(sections_, name, &Section::name);
+  if (it == sections_.end() || !Verify(*it)) {
+    return {};
+  }
+  return it->data;
+}
+
+auto ModelContainer::Verify(const Section& section) const -> bool {
+  auto& verified =
+      verified_[static_cast<std::size_t>(&section - sections_.data())];
+  if (verified.load(std::memory_order_acquire)) {
+    return true;
+  }
+  if (Hash(section.data) != section.hash) {
+    return false;
+  }
+  verified.store(true, std::memory_order_release);
+  return true;
+}
+
+auto ModelContainer::Extract(std::filesystem::path& model_file) const
+    -> ErrorCode {
+  if (Find(kConfigSection).empty()) {
+    return ErrorCode::kInvalidModelContainer;
+  }
+  auto ec = std::error_code();
+  auto base = GetCacheDirectory();
+  if (base.empty()) {
+    base = std::filesystem::temp_directory_path(ec) / "beatrice";
+    if (ec) {
+      return ErrorCode::kFileOpenError;
+    }
+  }
+  auto hasher = Hasher();
+  hasher.Update(reinterpret_cast<const std::byte*>(&content_hash_),
+                sizeof(content_hash_));
+  const auto d = base / "models" / hasher.GetHex();
+  std::filesystem::create_directories(d, ec);
+  if (ec) {
+    return ErrorCode::kFileOpenError;
+  }
+  for (const auto& section : sections_) {
+    // 画像は GUI がコンテナから直接読むので展開しない
+    if (!IsExtractable(section.name)) {
+      continue;
+    }
+    const auto file = d / section.name;
+    // 内容は content_hash_ で決まるので、サイズが合っていれば展開済みとみなす
+    if (const auto size = std::filesystem::file_size(file, ec);
+        !ec && size == section.data.size()) {
+      continue;
+    }
+    if (!Verify(section)) {
+      return ErrorCode::kInvalidModelContainer;
+    }
+    const auto written =
+        WriteFileAtomically(file, [&section](std::ofstream& ofs) {
+          ofs.write(reinterpret_cast<const char*>(section.data.data()),
+                    static_cast<std::streamsize>(section.data.size()));
+          return static_cast<bool>(ofs);
+        });
+    if (!written) {
+      return ErrorCode::kFileOpenError;
+    }
+  }
+  model_file = d / kConfigSection;
+  return ErrorCode::kSuccess;
+}
+
+auto ReadModelConfigText(const std::filesystem::path& file, std::string& text)
+    -> ErrorCode {
+  if (!ModelContainer::IsContainer(file)) {
+    return ReadWholeFile(file, text) ? ErrorCode::kSuccess
+                                     : ErrorCode::kFileOpenError;
+  }
+  auto error_code = ErrorCode::kSuccess;
+  const auto container = ModelContainer::Open(file, error_code);
+  if (!container) {
+    return error_code;
+  }
+  const auto data = container->Find(ModelContainer::kConfigSection);
+  if (data.empty()) {
+    return ErrorCode::kInvalidModelContainer;
+  }
+  text.assign(reinterpret_cast<const char*>(data.data()), data.size());
+  return ErrorCode::kSuccess;
+}
+
+}  // namespace beatrice::common
@@ -0,0 +1,91 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_MODEL_CONTAINER_H_
+#define BEATRICE_COMMON_MODEL_CONTAINER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Beatrice
+#include "common/error.h"
+#include "common/mapped_file.h"
+
+namespace beatrice::common {
+
+// モデル一式を 1 つのファイルにまとめたコンテナ形式 (拡張子 .beatrice)。
+// 先頭にセクションの索引があり、各セクションはページ境界に揃えて置かれるので、
+// ファイル全体をマップしてそのまま参照できる。
+// 各セクションはハッシュを持ち、最初に Find() や Extract() で内容を参照する時に
+// 検証される。モデルの一覧を作る場合などは TOML のセクションしか読まないので、
+// 開く時には索引のみを検証する。
+//
+// 含まれるセクション:
+// - beatrice_model.toml
+// - phone_extractor.bin などのネットワークの重みと話者テーブル
+//   (ディレクトリ形式のモデルと同じ名前)
+// - portraits/<path>: TOML の portrait.path で参照される画像
+// - thumbnails/<path>: メニュー用に縮小済みの画像 (任意)
+class ModelContainer {
+ public:
+  static constexpr auto kExtension = std::string_view(".beatrice");
+  static constexpr auto kConfigSection =
+      std::string_view("beatrice_model.toml");
+  static constexpr auto kPortraitPrefix = std::string_view("portraits/");
+  static constexpr auto kThumbnailPrefix = std::string_view("thumbnails/");
+
+  struct Section {
+    std::string name;
+    std::span<const std::byte> data;
+    std::uint64_t hash;
+  };
+
+  ModelContainer(const ModelContainer&) = delete;
+  auto operator=(const ModelContainer&) -> ModelContainer& = delete;
+
+  // 拡張子で判定する
+  static auto IsContainer(const std::filesystem::path& file) -> bool;
+  // 開いて索引を検証する。失敗した場合は nullptr を返す
+  static auto Open(const std::filesystem::path& file, ErrorCode& error_code)
+      -> std::shared_ptr<const ModelContainer>;
+  // ディレクトリ形式のモデル (model_file は beatrice_model.toml) から
+  // コンテナを作る。縮小済みの画像は含めない。beatrice-pack から使われる
+  static auto Pack(const std::filesystem::path& model_file,
+                   const std::filesystem::path& container_file) -> ErrorCode;
+
+  // 無い場合や、内容がハッシュと一致しない場合は空の span を返す
+  [[nodiscard]] auto Find(std::string_view name) const
+      -> std::span<const std::byte>;
+  // 信号処理ライブラリはファイル名を受け取って重みを読むため、
+  // ネットワークの重みと TOML をキャッシュディレクトリに展開し、
+  // 展開した beatrice_model.toml のパスを返す。
+  // 同じ内容のコンテナが展開済みであれば、それをそのまま使う。
+  auto Extract(std::filesystem::path& model_file) const -> ErrorCode;
+
+ private:
+  ModelContainer() = default;
+  // 初回のみ内容のハッシュを計算する
+  [[nodiscard]] auto Verify(const Section& section) const -> bool;
+
+  std::shared_ptr<const MappedFile> file_;
+  std::vector<Section> sections_;
+  // sections_ の各要素のハッシュを検証済みか。複数のスレッドから参照される
+  mutable std::vector<std::atomic<bool>> verified_;
+  // 全セクションのハッシュから求めた、展開先のディレクトリ名
+  std::uint64_t content_hash_ = 0;
+};
+
+// モデルの TOML を読み込む。
+// file はディレクトリ形式の beatrice_model.toml とコンテナのどちらでもよい。
+auto ReadModelConfigText(const std::filesystem::path& file, std::string& text)
+    -> ErrorCode;
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_MODEL_CONTAINER_H_
@@ -0,0 +1,390 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/model_library.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <ios>
+#include <iterator>
+#include <locale>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>  // NOLINT(build/c++11)
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Beatrice
+#include "common/cache_directory.h"
+#include "common/model_config.h"
+#include "common/model_config_cache.h"
+#include "common/model_container.h"
+
+namespace beatrice::common {
+
+namespace {
+
+constexpr auto kIndexHeader = std::string_view("beatrice-model-index 1");
+// ホームディレクトリなどが登録された場合に走査が終わらなくならないよう、
+// 登録されたディレクトリからこの深さまでしか辿らない
+constexpr auto kMaxDepth = 3;
+
+auto GetIndexPath() -> std::filesystem::path {
+  const auto dir = GetCacheDirectory();
+  return dir.empty() ? dir : dir / "model_index.txt";
+}
+
+// 索引の 1 フィールドに収まるよう、タブと改行をエスケープする
+auto Escape(const std::u8string& text) -> std::string {
+  auto escaped = std::string();
+  escaped.reserve(text.size());
+  for (const auto c : text) {
+    switch (c) {
+      case u8'\\':
+        escaped += "\\\\";
+        break;
+      case u8'\t':
+        escaped += "\\t";
+        break;
+      case u8'\n':
+        escaped += "\\n";
+        break;
+      case u8'\r':
+        escaped += "\\r";
+        break;
+      default:
+        escaped += static_cast<char>(c);
+    }
+  }
+  return escaped;
+}
+
+auto Unescape(const std::string_view text) -> std::u8string {
+  auto unescaped = std::u8string();
+  unescaped.reserve(text.size());
+  for (auto i = std::size_t{0}; i < text.size(); ++i) {
+    if (text[i] != '\\' || i + 1 == text.size()) {
+      unescaped += static_cast<char8_t>(text[i]);
+      continue;
+    }
+    switch (text[++i]) {
+      case 't':
+        unescaped += u8'\t';
+        break;
+      case 'n':
+        unescaped += u8'\n';
+        break;
+      case 'r':
+        unescaped += u8'\r';
+        break;
+      default:
+        unescaped += static_cast<char8_t>(text[i]);
+    }
+  }
+  return unescaped;
+}
+
+auto Split(const std::string_view line) -> std::vector<std::string_view> {
+  auto fields = std::vector<std::string_view>();
+  auto rest = line;
+  while (true) {
+    const auto pos = rest.find('\t');
+    fields.push_back(rest.substr(0, pos));
+    if (pos == rest.npos) {
+      return fields;
+    }
+    rest.remove_prefix(pos + 1);
+  }
+}
+
+auto ReadModel(const std::filesystem::path& file,
+               const std::int64_t last_write_time,
+               const std::uintmax_t file_size) -> ModelLibrary::Model {
+  auto model = ModelLibrary::Model();
+  model.file = file;
+  model.last_write_time = last_write_time;
+  model.file_size = file_size;
+  auto config = ModelConfig();
+  if (ParseModelConfig(file, config) != ErrorCode::kSuccess ||
+      config.model.VersionInt() < 0) {
+    return model;
+  }
+  model.version = config.model.version;
+  model.name = config.model.name;
+  for (const auto& voice : config.voices) {
+    model.average_pitches.push_back(voice.average_pitch);
+    model.portrait_paths.push_back(voice.portrait.path);
+  }
+  return model;
+}
+
+}  // namespace
+
+ModelLibrary::ModelLibrary() : thread_([this] { Run(); }) {}
+
+ModelLibrary::~ModelLibrary() {
+  {
+    const auto lock = std::lock_guard<std::mutex>(mtx_);
+    exiting_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+auto ModelLibrary::Acquire() -> std::shared_ptr<ModelLibrary> {
+  // プラグインのアンロード時の破棄順序の問題を避けるため、意図的に解放しない
+  static auto* const mtx = new std::mutex();
+  static auto* const shared = new std::weak_ptr<ModelLibrary>();
+  const auto lock = std::lock_guard<std::mutex>(*mtx);
+  if (auto library = shared->lock()) {
+    return library;
+  }
+  auto library = std::shared_ptr<ModelLibrary>(new ModelLibrary());
+  *shared = library;
+  return library;
+}
+
+void ModelLibrary::AddDirectory(const std::filesystem::path& directory) {
+  auto ec = std::error_code();
+  auto canonical = std::filesystem::weakly_canonical(directory, ec);
+  if (ec || canonical.empty()) {
+    return;
+  }
+  {
+    const auto lock = std::lock_guard<std::mutex>(mtx_);
+    if (const auto it = std::ranges::find(directories_, canonical);
+        it != directories_.end()) {
+      std::rotate(it, std::next(it), directories_.end());
+      return;
+    }
+    directories_.push_back(std::move(canonical));
+    TrimDirectories();
+    rescan_requested_ = true;
+  }
+  cv_.notify_one();
+}
+
+void ModelLibrary::Rescan() {
+  {
+    const auto lock = std::lock_guard<std::mutex>(mtx_);
+    rescan_requested_ = true;
+  }
+  cv_.notify_one();
+}
+
+auto ModelLibrary::GetModels() const -> std::shared_ptr<const Models> {
+  const auto lock = std::lock_guard<std::mutex>(mtx_);
+  return models_;
+}
+
+void ModelLibrary::Run() {
+  // 前回の索引があれば、走査が終わるまではそれを使ってもらう
+  LoadIndex();
+  Publish();
+  auto lock = std::unique_lock<std::mutex>(mtx_);
+  while (true) {
+    cv_.wait(lock, [this] { return exiting_ || rescan_requested_; });
+    if (exiting_) {
+      return;
+    }
+    rescan_requested_ = false;
+    auto directories = directories_;
+    lock.unlock();
+    // 削除されたディレクトリは、走査も保存もしない
+    auto missing = std::vector<std::filesystem::path>();
+    std::erase_if(directories, [&missing](const std::filesystem::path& d) {
+      auto ec = std::error_code();
+      if (std::filesystem::is_directory(d, ec) || ec) {
+        return false;
+      }
+      missing.push_back(d);
+      return true;
+    });
+    auto scanned = directories;
+    std::ranges::copy(GetPathsFromEnvironment("BEATRICE_MODEL_LIBRARY"),
+                      std::back_inserter(scanned));
+    Scan(scanned);
+    SaveIndex(directories);
+    Publish();
+    lock.lock();
+    std::erase_if(directories_, [&missing](const std::filesystem::path& d) {
+      return std::ranges::find(missing, d) != missing.end();
+    });
+  }
+}
+
+void ModelLibrary::TrimDirectories() {
+  if (directories_.size() > kMaxNDirectories) {
+    directories_.erase(
+        directories_.begin(),
+        directories_.end() - static_cast<std::ptrdiff_t>(kMaxNDirectories));
+  }
+}
+
+void ModelLibrary::Scan(const std::vector<std::filesystem::path>& directories) {
+  auto new_index = std::map<std::u8string, Model>();
+  for (const auto& directory : directories) {
+    auto ec = std::error_code();
+    for (auto it = std::filesystem::recursive_directory_iterator(
+             directory,
+             std::filesystem::directory_options::skip_permission_denied, ec);
+         !ec && it != std::filesystem::recursive_directory_iterator();
+         it.increment(ec)) {
+      {
+        const auto lock = std::lock_guard<std::mutex>(mtx_);
+        if (exiting_) {
+          return;
+        }
+      }
+      if (it.depth() >= kMaxDepth) {
+        it.disable_recursion_pending();
+      }
+      auto entry_ec = std::error_code();
+      const auto& file = it->path();
+      if (!it->is_regular_file(entry_ec) ||
+          (file.filename() != "beatrice_model.toml" &&
+           !ModelContainer::IsContainer(file))) {
+        continue;
+      }
+      auto key = file.lexically_normal().u8string();
+      if (new_index.contains(key)) {
+        continue;
+      }
+      const auto last_write_time = static_cast<std::int64_t>(
+          it->last_write_time(entry_ec).time_since_epoch().count());
+      if (entry_ec) {
+        continue;
+      }
+      const auto file_size = it->file_size(entry_ec);
+      if (entry_ec) {
+        continue;
+      }
+      // 更新されていなければ前回の結果を使う
+      if (const auto found = index_.find(key);
+          found != index_.end() &&
+          found->second.last_write_time == last_write_time &&
+          found->second.file_size == file_size) {
+        new_index.emplace(std::move(key), found->second);
+        continue;
+      }
+      new_index.emplace(std::move(key),
+                        ReadModel(file, last_write_time, file_size));
+    }
+  }
+  index_ = std::move(new_index);
+}
+
+void ModelLibrary::Publish() {
+  auto models = std::make_shared<Models>();
+  for (const auto& [key, model] : index_) {
+    if (model.IsValid()) {
+      models->push_back(model);
+    }
+  }
+  std::ranges::sort(*models, [](const Model& a, const Model& b) {
+    return std::tie(a.name, a.file) < std::tie(b.name, b.file);
+  });
+  const auto lock = std::lock_guard<std::mutex>(mtx_);
+  models_ = std::move(models);
+}
+
+// 索引の形式 (1 行 1 レコード、フィールドはタブ区切り):
+//   beatrice-model-index 1
+//   directory <path>
+//   model <path> <last_write_time> <file_size> <version> <name>
+//   voice <average_pitch> <portrait_path>   (直前の model の話者)
+void ModelLibrary::LoadIndex() {
+  const auto index_path = GetIndexPath();
+  if (index_path.empty()) {
+    return;
+  }
+  auto ifs = std::ifstream(index_path, std::ios::binary);
+  auto line = std::string();
+  if (!ifs || !std::getline(ifs, line) || line != kIndexHeader) {
+    return;
+  }
+  auto directories = std::vector<std::filesystem::path>();
+  auto index = std::map<std::u8string, Model>();
+  auto* current = static_cast<Model*>(nullptr);
+  while (std::getline(ifs, line)) {
+    const auto fields = Split(line);
+    auto stream = std::istringstream();
+    stream.imbue(std::locale::classic());
+    if (fields[0] == "directory" && fields.size() == 2) {
+      directories.emplace_back(Unescape(fields[1]));
+    } else if (fields[0] == "model" && fields.size() == 6) {
+      auto model = Model();
+      model.file = std::filesystem::path(Unescape(fields[1]));
+      stream.str(std::string(fields[2]) + ' ' + std::string(fields[3]));
+      if (!(stream >> model.last_write_time >> model.file_size)) {
+        current = nullptr;
+        continue;
+      }
+      const auto version = Unescape(fields[4]);
+      model.version.assign(version.begin(), version.end());
+      model.name = Unescape(fields[5]);
+      auto key = model.file.u8string();
+      current = &(index[std::move(key)] = std::move(model));
+    } else if (fields[0] == "voice" && fields.size() == 3 && current) {
+      auto average_pitch = 0.0;
+      stream.str(std::string(fields[1]));
+      if (!(stream >> average_pitch)) {
+        continue;
+      }
+      current->average_pitches.push_back(average_pitch);
+      current->portrait_paths.push_back(Unescape(fields[2]));
+    }
+  }
+  index_ = std::move(index);
+  const auto lock = std::lock_guard<std::mutex>(mtx_);
+  // 保存されていたものは、起動後に追加されたものより古い
+  std::erase_if(directories, [this](const std::filesystem::path& d) {
+    return std::ranges::find(directories_, d) != directories_.end();
+  });
+  directories_.insert(directories_.begin(),
+                      std::make_move_iterator(directories.begin()),
+                      std::make_move_iterator(directories.end()));
+  TrimDirectories();
+}
+
+void ModelLibrary::SaveIndex(
+    const std::vector<std::filesystem::path>& directories) const {
+  const auto index_path = GetIndexPath();
+  if (index_path.empty()) {
+    return;
+  }
+  auto ec = std::error_code();
+  std::filesystem::create_directories(index_path.parent_path(), ec);
+  [[maybe_unused]] const auto written =
+      WriteFileAtomically(index_path, [&](std::ofstream& ofs) {
+        ofs.imbue(std::locale::classic());
+        ofs << kIndexHeader << '\n';
+        for (const auto& directory : directories) {
+          ofs << "directory\t" << Escape(directory.u8string()) << '\n';
+        }
+        for (const auto& [key, model] : index_) {
+          ofs << "model\t" << Escape(key) << '\t' << model.last_write_time
+              << '\t' << model.file_size << '\t'
+              << Escape(std::u8string(model.version.begin(),
+                                      model.version.end()))
+              << '\t' << Escape(model.name) << '\n';
+          for (auto i = std::size_t{0}; i < model.average_pitches.size();
+               ++i) {
+            ofs << "voice\t" << std::setprecision(17)
+                << model.average_pitches[i] << '\t'
+                << Escape(model.portrait_paths[i]) << '\n';
+          }
+        }
+        return static_cast<bool>(ofs);
+      });
+}
+
+}  // namespace beatrice::common
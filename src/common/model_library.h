@@ -0,0 +1,85 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_MODEL_LIBRARY_H_
+#define BEATRICE_COMMON_MODEL_LIBRARY_H_
+
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+namespace beatrice::common {
+
+// 登録されたディレクトリ以下のモデルを、バックグラウンドスレッドで走査して
+// 索引を作るクラス。GUI はファイルシステムに触れずに索引からモデルを選べる。
+// 索引はキャッシュディレクトリに保存され、次回以降は最終更新日時とサイズが
+// 変わったファイルだけを解析し直す。
+// 走査するディレクトリは AddDirectory() で追加したものと、
+// 環境変数 BEATRICE_MODEL_LIBRARY (パスの区切りは OS の PATH と同じ) のもの。
+class ModelLibrary {
+ public:
+  // 読み込んだモデルの場所は全て登録されるので、保持する数を制限する
+  static constexpr std::size_t kMaxNDirectories = 16;
+
+  struct Model {
+    // beatrice_model.toml かコンテナ
+    std::filesystem::path file;
+    std::int64_t last_write_time;
+    std::uintmax_t file_size;
+    // 解析できなかった、または未知のバージョンの場合は空
+    std::string version;
+    std::u8string name;
+    // 話者ごとの値。要素数が話者数になる
+    std::vector<double> average_pitches;
+    std::vector<std::u8string> portrait_paths;
+
+    [[nodiscard]] auto IsValid() const -> bool { return !version.empty(); }
+  };
+  using Models = std::vector<Model>;
+
+  ModelLibrary(const ModelLibrary&) = delete;
+  auto operator=(const ModelLibrary&) -> ModelLibrary& = delete;
+  ~ModelLibrary();
+
+  // 使っているものがあればそれを返す。スレッドは使われている間だけ動く
+  static auto Acquire() -> std::shared_ptr<ModelLibrary>;
+
+  // 走査するディレクトリを追加する。追加したディレクトリは索引と共に保存される。
+  // 最近追加したものから kMaxNDirectories 個までを残し、
+  // 存在しなくなったものは次の走査で外す
+  void AddDirectory(const std::filesystem::path& directory);
+  void Rescan();
+  // 有効なモデルを名前順に並べたもの。走査が終わるたびに差し替えられる
+  [[nodiscard]] auto GetModels() const -> std::shared_ptr<const Models>;
+
+ private:
+  mutable std::mutex mtx_;
+  std::condition_variable cv_;
+  bool exiting_ = false;
+  bool rescan_requested_ = true;
+  // 最近追加したものほど後ろにある
+  std::vector<std::filesystem::path> directories_;
+  std::shared_ptr<const Models> models_;
+  // バックグラウンドスレッドのみが触る。不正なものも含む前回の結果
+  std::map<std::u8string, Model> index_;
+  std::thread thread_;
+
+  ModelLibrary();
+  // mtx_ を取得した状態で呼ぶ
+  void TrimDirectories();
+  void Run();
+  void Scan(const std::vector<std::filesystem::path>& directories);
+  void Publish();
+  void LoadIndex();
+  void SaveIndex(const std::vector<std::filesystem::path>& directories) const;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_MODEL_LIBRARY_H_
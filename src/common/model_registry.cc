@@ -0,0 +1,98 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/model_registry.h"
+
+#include <algorithm>
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <system_error>
+#include <typeindex>
+#include <typeinfo>
+
+namespace beatrice::common {
+
+struct ModelRegistry::Entries {
+  struct Entry {
+    std::weak_ptr<const void> model;
+    // いずれかのスレッドが読み込み中
+    bool loading = false;
+  };
+  std::mutex mtx;
+  // 読み込みが終わる度に通知する
+  std::condition_variable cv;
+  std::map<Key, Entry> models;
+};
+
+auto ModelRegistry::GetEntries() -> Entries& {
+  // プラグインのアンロード時の破棄順序の問題を避けるため、意図的に解放しない
+  static auto* const entries = new Entries();
+  return *entries;
+}
+
+auto ModelRegistry::MakeKey(const std::type_info& type,
+                            const std::filesystem::path& model_directory,
+                            const std::string& variant) -> Key {
+  auto ec = std::error_code();
+  auto directory = std::filesystem::weakly_canonical(model_directory, ec);
+  if (ec) {
+    directory = model_directory;
+  }
+  // ディレクトリ内のいずれかのファイルが更新されていれば別のモデルとして扱う
+  auto last_write_time = 0LL;
+  for (auto it = std::filesystem::directory_iterator(directory, ec);
+       !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    auto entry_ec = std::error_code();
+    if (!it->is_regular_file(entry_ec)) {
+      continue;
+    }
+    const auto time = it->last_write_time(entry_ec);
+    if (!entry_ec) {
+      last_write_time = std::max<long long>(  // NOLINT(runtime/int)
+          last_write_time, time.time_since_epoch().count());
+    }
+  }
+  return {.type = std::type_index(type),
+          .directory = directory.u8string(),
+          .variant = variant,
+          .last_write_time = last_write_time};
+}
+
+auto ModelRegistry::FindOrReserve(const Key& key)
+    -> std::shared_ptr<const void> {
+  auto& entries = GetEntries();
+  auto lock = std::unique_lock<std::mutex>(entries.mtx);
+  while (true) {
+    auto& entry = entries.models[key];
+    if (auto model = entry.model.lock()) {
+      return model;
+    }
+    if (!entry.loading) {
+      entry.loading = true;
+      return nullptr;
+    }
+    // 待っている間にエントリが消されうるので、毎回引き直す
+    entries.cv.wait(lock);
+  }
+}
+
+void ModelRegistry::Complete(const Key& key,
+                             std::shared_ptr<const void> model) {
+  auto& entries = GetEntries();
+  {
+    const auto lock = std::lock_guard<std::mutex>(entries.mtx);
+    auto& entry = entries.models[key];
+    entry.model = std::move(model);
+    entry.loading = false;
+    // 使われなくなったエントリを掃除する
+    std::erase_if(entries.models, [](const auto& item) -> bool {
+      return !item.second.loading && item.second.model.expired();
+    });
+  }
+  entries.cv.notify_all();
+}
+
+}  // namespace beatrice::common
@@ -0,0 +1,87 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_MODEL_REGISTRY_H_
+#define BEATRICE_COMMON_MODEL_REGISTRY_H_
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <typeindex>
+#include <typeinfo>
+
+// Beatrice
+#include "common/error.h"
+
+namespace beatrice::common {
+
+// モデルのうち読み込み後に変更されない部分 (ネットワークの重みや話者テーブル) を
+// プロセス内の全インスタンスで共有するためのレジストリ。
+// モデルのディレクトリの canonical path と中のファイルの最終更新日時、
+// および読み込み方の違いを表す variant で識別し、
+// 使っているインスタンスが無くなった時点で解放される。
+// プロジェクトを開いた時などに同じモデルが同時に要求された場合は、
+// 最初の 1 つだけが読み込み、残りはその完了を待って同じものを使う。
+class ModelRegistry {
+ public:
+  // 同じモデルが既に読み込まれていればそれを、無ければ load で読み込んだものを返す
+  template <typename T>
+  static auto Acquire(const std::filesystem::path& model_directory,
+                      const std::string& variant,
+                      const std::function<ErrorCode(T&)>& load,
+                      std::shared_ptr<const T>& model) -> ErrorCode {
+    const auto key = MakeKey(typeid(T), model_directory, variant);
+    if (auto found = FindOrReserve(key)) {
+      model = std::static_pointer_cast<const T>(std::move(found));
+      return ErrorCode::kSuccess;
+    }
+    // 読み込み中はロックを保持しない
+    auto new_model = std::make_shared<T>();
+    auto error_code = ErrorCode::kSuccess;
+    try {
+      error_code = load(*new_model);
+    } catch (...) {
+      Complete(key, nullptr);
+      throw;
+    }
+    if (error_code != ErrorCode::kSuccess) {
+      Complete(key, nullptr);
+      return error_code;
+    }
+    model = new_model;
+    Complete(key, std::shared_ptr<const void>(std::move(new_model)));
+    return ErrorCode::kSuccess;
+  }
+
+ private:
+  struct Key {
+    std::type_index type;
+    std::u8string directory;
+    std::string variant;
+    long long last_write_time;  // NOLINT(runtime/int)
+
+    auto operator<(const Key& rhs) const -> bool {
+      return std::tie(type, directory, variant, last_write_time) <
+             std::tie(rhs.type, rhs.directory, rhs.variant,
+                      rhs.last_write_time);
+    }
+  };
+
+  struct Entries;
+
+  static auto GetEntries() -> Entries&;
+  static auto MakeKey(const std::type_info& type,
+                      const std::filesystem::path& model_directory,
+                      const std::string& variant) -> Key;
+  // key のモデルがあればそれを返す。他のスレッドが読み込み中であれば、
+  // 完了を待ってから確認し直す。どちらでもなければ読み込み中として登録して
+  // nullptr を返すので、呼び出し側は読み込んだ後に必ず Complete() を呼ぶ
+  static auto FindOrReserve(const Key& key) -> std::shared_ptr<const void>;
+  // 読み込みに失敗した場合は nullptr を渡す。待っていたスレッドが読み込み直す
+  static void Complete(const Key& key, std::shared_ptr<const void> model);
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_MODEL_REGISTRY_H_
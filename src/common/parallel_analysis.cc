@@ -0,0 +1,128 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/parallel_analysis.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+#include <atomic>
+#include <cstdlib>
+#include <optional>
+#include <string_view>
+
+// Beatrice
+#include "common/realtime_worker_pool.h"
+
+namespace beatrice::common {
+
+namespace {
+
+// ワーカーの処理の終了を待つ間、スピンしながら待つ回数の上限。
+// これを超えたら futex での待機に切り替える
+constexpr auto kMaxSpins = 1 << 16;
+
+// 環境変数で有効か無効かが指定されていればそれを返す
+auto GetForcedSetting() -> std::optional<bool> {
+  static const auto forced = []() -> std::optional<bool> {
+    // NOLINTNEXTLINE(concurrency-mt-unsafe)
+    const auto* const value = std::getenv("BEATRICE_PARALLEL_ANALYSIS");
+    if (value && std::string_view(value) == "1") {
+      return true;
+    }
+    if (value && std::string_view(value) == "0") {
+      return false;
+    }
+    return std::nullopt;
+  }();
+  return forced;
+}
+
+void CpuRelax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+  _mm_pause();
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#if defined(_MSC_VER)
+  __yield();
+#else
+  asm volatile("yield");
+#endif
+#endif
+}
+
+}  // namespace
+
+ParallelAnalysis::ParallelAnalysis() {
+  if (GetForcedSetting().value_or(false)) {
+    Start();
+  }
+}
+
+ParallelAnalysis::~ParallelAnalysis() { Stop(); }
+
+void ParallelAnalysis::SetEnabled(const bool enabled) {
+  if (GetForcedSetting() || enabled == IsEnabled()) {
+    return;
+  }
+  if (enabled) {
+    Start();
+  } else {
+    Stop();
+  }
+}
+
+void ParallelAnalysis::Start() {
+  state_.store(State::kIdle, std::memory_order_relaxed);
+  pool_ = RealtimeWorkerPool::Acquire();
+}
+
+void ParallelAnalysis::Stop() {
+  if (!pool_) {
+    return;
+  }
+  // 呼び出し元が引き取った後にキューに残っている依頼も、取り出されるまで待つ
+  pool_->Wait(*this);
+  pool_.reset();
+  state_.store(State::kIdle, std::memory_order_relaxed);
+}
+
+void ParallelAnalysis::Post(const Task task, void* const arg) {
+  task_ = task;
+  task_arg_ = arg;
+  state_.store(State::kPending, std::memory_order_release);
+  pool_->Schedule(*this);
+}
+
+void ParallelAnalysis::Join() {
+  // ワーカーがまだ処理を始めていなければ、こちらで実行する。
+  // キューに残った依頼は、後で取り出されても何もしない
+  if (auto expected = State::kPending; state_.compare_exchange_strong(
+          expected, State::kIdle, std::memory_order_acquire)) {
+    task_(task_arg_);
+    return;
+  }
+  // 処理中であれば終わるまで待つ。通常はもう一方の解析と同程度の時間で終わる
+  for (auto i = 0; i < kMaxSpins; ++i) {
+    if (state_.load(std::memory_order_acquire) == State::kDone) {
+      state_.store(State::kIdle, std::memory_order_relaxed);
+      return;
+    }
+    CpuRelax();
+  }
+  state_.wait(State::kRunning, std::memory_order_acquire);
+  state_.store(State::kIdle, std::memory_order_relaxed);
+}
+
+void ParallelAnalysis::Run() {
+  if (auto expected = State::kPending; !state_.compare_exchange_strong(
+          expected, State::kRunning, std::memory_order_acquire)) {
+    return;
+  }
+  task_(task_arg_);
+  state_.store(State::kDone, std::memory_order_release);
+  state_.notify_one();
+}
+
+}  // namespace beatrice::common
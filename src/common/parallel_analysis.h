@@ -0,0 +1,77 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_PARALLEL_ANALYSIS_H_
+#define BEATRICE_COMMON_PARALLEL_ANALYSIS_H_
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+#include "common/realtime_worker_pool.h"
+
+namespace beatrice::common {
+
+// Process1() のうち互いに独立な 2 つの解析 (音素抽出とピッチ推定) を、
+// オーディオスレッドと RealtimeWorkerPool のワーカーで同時に実行するためのクラス。
+// ワーカーは非同期モードと共有する、リアルタイム優先度のものなので、
+// コアごとにスレッドを作らず、待っている側より低い優先度で実行されることもない。
+// 環境変数 BEATRICE_PARALLEL_ANALYSIS=1 で常に有効、=0 で常に無効になり、
+// 指定が無い場合は SetEnabled() で切り替える。
+// ワーカーとの受け渡しはロックを取らず、待機にはスピンと
+// std::atomic::wait (Linux では futex) を使う。
+// ワーカーが処理を始める前にオーディオスレッドの処理が終わった場合は、
+// オーディオスレッドが残りの処理も引き取って直列に実行する。
+class ParallelAnalysis : public RealtimeWorkerPool::Job {
+ public:
+  ParallelAnalysis();
+  ParallelAnalysis(const ParallelAnalysis&) = delete;
+  auto operator=(const ParallelAnalysis&) -> ParallelAnalysis& = delete;
+  ~ParallelAnalysis();
+
+  [[nodiscard]] auto IsEnabled() const -> bool { return pool_ != nullptr; }
+  // 環境変数で指定されている場合は何もしない。
+  // ワーカーの処理が終わるのを待つので、オーディオスレッドからは呼ばない
+  void SetEnabled(bool enabled);
+  // helper_task をワーカーで、local_task を呼び出し元で実行し、
+  // 両方が終わるまで待つ。無効な場合は順番に実行する
+  template <typename HelperTask, typename LocalTask>
+  void Run(HelperTask& helper_task, LocalTask&& local_task) {
+    if (!IsEnabled()) {
+      std::forward<LocalTask>(local_task)();
+      helper_task();
+      return;
+    }
+    Post(&Invoke<HelperTask>, &helper_task);
+    std::forward<LocalTask>(local_task)();
+    Join();
+  }
+
+ private:
+  enum class State {
+    kIdle,
+    kPending,
+    kRunning,
+    kDone,
+  };
+  using Task = void (*)(void*);
+
+  std::atomic<State> state_ = State::kIdle;
+  Task task_ = nullptr;
+  void* task_arg_ = nullptr;
+  std::shared_ptr<RealtimeWorkerPool> pool_;
+
+  template <typename F>
+  static void Invoke(void* const f) {
+    (*static_cast<F*>(f))();
+  }
+  void Start();
+  void Stop();
+  void Post(Task task, void* arg);
+  void Join();
+  // ワーカーから呼ばれる
+  void Run() override;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_PARALLEL_ANALYSIS_H_
@@ -0,0 +1,62 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_PARAMETER_INBOX_H_
+#define BEATRICE_COMMON_PARAMETER_INBOX_H_
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+namespace beatrice::common {
+
+// ID が 0 以上 N 未満の数値パラメータの変更を、反映できるようになるまで
+// 溜めておく。Push() と Drain() はロックもメモリ確保も行わないので、
+// オーディオスレッドから呼んでよい。
+// 反映前に同じパラメータが何度も変更された場合は、最後の値だけが残る。
+// Push() は複数のスレッドから呼んでよいが、Drain() は同時に 1 つのスレッド
+// からのみ呼ぶ。
+template <std::size_t N>
+class ParameterInbox {
+  static_assert(std::atomic<double>::is_always_lock_free);
+
+ public:
+  ParameterInbox() = default;
+  ParameterInbox(const ParameterInbox&) = delete;
+  auto operator=(const ParameterInbox&) -> ParameterInbox& = delete;
+
+  // 範囲外の ID の場合は何もせずに false を返す
+  auto Push(const std::uint32_t id, const double value) -> bool {
+    if (id >= N) {
+      return false;
+    }
+    values_[id].store(value, std::memory_order_relaxed);
+    dirty_[id / 64].fetch_or(std::uint64_t{1} << (id % 64),
+                             std::memory_order_release);
+    return true;
+  }
+  // 溜まっている変更を ID の昇順に f(id, value) で取り出す。
+  // 取り出している間に Push() された値は、今回か次回に取り出される
+  template <typename F>
+  void Drain(F&& f) {
+    for (auto word = std::size_t{0}; word < dirty_.size(); ++word) {
+      auto bits = dirty_[word].exchange(0, std::memory_order_acquire);
+      while (bits != 0) {
+        const auto id = static_cast<std::uint32_t>(
+            word * 64 + static_cast<std::size_t>(std::countr_zero(bits)));
+        bits &= bits - 1;
+        f(id, values_[id].load(std::memory_order_relaxed));
+      }
+    }
+  }
+
+ private:
+  std::array<std::atomic<double>, N> values_ = {};
+  // 変更があった ID のビットを立てる
+  std::array<std::atomic<std::uint64_t>, (N + 63) / 64> dirty_ = {};
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_PARAMETER_INBOX_H_
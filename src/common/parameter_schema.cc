@@ -4,18 +4,16 @@
 
 #include <algorithm>
 #include <cmath>
-#include <exception>
 #include <filesystem>
-#include <stdexcept>
+#include <memory>
 #include <string>
 #include <vector>
 
-#include "toml11/single_include/toml.hpp"
-
 // Beatrice
 #include "common/controller_core.h"
 #include "common/error.h"
 #include "common/model_config.h"
+#include "common/model_config_cache.h"
 #include "common/processor_core.h"
 #include "common/processor_proxy.h"
 #include "common/voice_morph_parameter.h"
@@ -35,8 +33,11 @@ auto SetVoiceMorphParameterOnController(ControllerCore&, double) -> ErrorCode {
 
 auto SetVoiceMorphParameterOnProcessor(ProcessorProxy& processor, double)
     -> ErrorCode {
-  return processor.GetCore()->SetSpeakerMorphingWeights(
-      GetVoiceMorphState(processor.GetParameterState()).CalculateWeights());
+  const auto weights =
+      GetVoiceMorphState(processor.GetParameterState()).CalculateWeights();
+  return processor.ForEachCore([&weights](ProcessorCoreBase& core) {
+    return core.SetSpeakerMorphingWeights(weights);
+  });
 }
 
 }  // namespace
@@ -58,23 +59,14 @@ const ParameterSchema kSchema = [] {
              if (value.empty()) {
                return ErrorCode::kSuccess;
              }
-             ModelConfig model_config;
-             try {
-               const auto toml_data = toml::parse(std::filesystem::path(value));
-               model_config = toml::get<ModelConfig>(toml_data);
-             } catch (const toml::file_io_error&) {
-               return ErrorCode::kFileOpenError;
-             } catch (const toml::syntax_error&) {
-               return ErrorCode::kTOMLSyntaxError;
-             } catch (const toml::type_error&) {
-               return ErrorCode::kInvalidModelConfig;
-             } catch (const std::invalid_argument&) {
-               return ErrorCode::kInvalidModelConfig;
-             } catch (const std::out_of_range&) {
-               return ErrorCode::kInvalidModelConfig;
-             } catch (const std::exception&) {
-               return ErrorCode::kUnknownError;
+             // 解析結果は Processor や Editor と共有する
+             auto model_config_ptr = std::shared_ptr<const ModelConfig>();
+             if (const auto err = ModelConfigCache::Get(
+                     std::filesystem::path(value), model_config_ptr);
+                 err != ErrorCode::kSuccess) {
+               return err;
              }
+             const auto& model_config = *model_config_ptr;
              if (model_config.model.VersionInt() < 0) {
                return ErrorCode::kInvalidModelConfig;
              }
@@ -87,14 +79,35 @@ const ParameterSchema kSchema = [] {
                                                   0.0);
              controller.updated_parameters_.push_back(
                  ParameterID::kFormantShift);
+             // 2 チャンネル目の Voice と FormantShift
+             controller.parameter_state_.SetValue(ParameterID::kSecondVoice, 0);
+             controller.updated_parameters_.push_back(
+                 ParameterID::kSecondVoice);
+             controller.parameter_state_.SetValue(
+                 ParameterID::kSecondFormantShift, 0.0);
+             controller.updated_parameters_.push_back(
+                 ParameterID::kSecondFormantShift);
+             // Fan-Out の 3 つ目以降の声の Voice と FormantShift
+             for (const auto param_id :
+                  {ParameterID::kThirdVoice, ParameterID::kFourthVoice}) {
+               controller.parameter_state_.SetValue(param_id, 0);
+               controller.updated_parameters_.push_back(param_id);
+             }
+             for (const auto param_id : {ParameterID::kThirdFormantShift,
+                                         ParameterID::kFourthFormantShift}) {
+               controller.parameter_state_.SetValue(param_id, 0.0);
+               controller.updated_parameters_.push_back(param_id);
+             }
 
              // AverageTargetPitches
+             const auto voice_count = GetVoiceCount(model_config);
              for (auto i = 0; i < kMaxNSpeakers; ++i) {
                controller.parameter_state_.SetValue(
                    static_cast<ParameterID>(
                        static_cast<int>(ParameterID::kAverageTargetPitchBase) +
                        i),
-                   model_config.voices[i].average_pitch);
+                   i < voice_count ? model_config.voices[i].average_pitch
+                                   : 0.0);
                controller.updated_parameters_.push_back(
                    static_cast<ParameterID>(
                        static_cast<int>(ParameterID::kAverageTargetPitchBase) +
@@ -103,7 +116,6 @@ const ParameterSchema kSchema = [] {
 
              // Voice Morph の AverageTargetPitch を計算
              // 今のところは各 Voice の値の単純平均を採用することとする
-             const auto voice_count = GetVoiceCount(model_config);
              double morphed_average_pitch = 0;
              for (auto i = 0; i < voice_count; ++i) {
                morphed_average_pitch += model_config.voices[i].average_pitch;
@@ -323,7 +335,9 @@ const ParameterSchema kSchema = [] {
              return ErrorCode::kSuccess;
            },
            [](ProcessorProxy& vc, const double value) {
-             return vc.GetCore()->SetAverageSourcePitch(value);
+             return vc.ForEachCore([value](ProcessorCoreBase& core) {
+               return core.SetAverageSourcePitch(value);
+             });
            })},
       {ParameterID::kLock,
        ListParameter(
@@ -337,7 +351,9 @@ const ParameterSchema kSchema = [] {
            parameter_flag::kCanAutomate,
            [](ControllerCore&, double) { return ErrorCode::kSuccess; },
            [](ProcessorProxy& vc, const double value) {
-             return vc.GetCore()->SetInputGain(value);
+             return vc.ForEachCore([value](ProcessorCoreBase& core) {
+               return core.SetInputGain(value);
+             });
            })},
       {ParameterID::kOutputGain,
        NumberParameter(
@@ -345,7 +361,9 @@ const ParameterSchema kSchema = [] {
            parameter_flag::kCanAutomate,
            [](ControllerCore&, double) { return ErrorCode::kSuccess; },
            [](ProcessorProxy& vc, const double value) {
-             return vc.GetCore()->SetOutputGain(value);
+             return vc.ForEachCore([value](ProcessorCoreBase& core) {
+               return core.SetOutputGain(value);
+             });
            })},
       {ParameterID::kIntonationIntensity,
        NumberParameter(
@@ -353,7 +371,9 @@ const ParameterSchema kSchema = [] {
            parameter_flag::kCanAutomate,
            [](ControllerCore&, double) { return ErrorCode::kSuccess; },
            [](ProcessorProxy& vc, const double value) {
-             return vc.GetCore()->SetIntonationIntensity(value);
+             return vc.ForEachCore([value](ProcessorCoreBase& core) {
+               return core.SetIntonationIntensity(value);
+             });
            })},
       {ParameterID::kPitchCorrection,
        NumberParameter(
@@ -361,7 +381,9 @@ const ParameterSchema kSchema = [] {
            parameter_flag::kCanAutomate,
            [](ControllerCore&, double) { return ErrorCode::kSuccess; },
            [](ProcessorProxy& vc, const double value) {
-             return vc.GetCore()->SetPitchCorrection(value);
+             return vc.ForEachCore([value](ProcessorCoreBase& core) {
+               return core.SetPitchCorrection(value);
+             });
            })},
       {ParameterID::kPitchCorrectionType,
        ListParameter(
@@ -369,7 +391,9 @@ const ParameterSchema kSchema = [] {
            u8"CorTyp"s, parameter_flag::kCanAutomate,
            [](ControllerCore&, int) { return ErrorCode::kSuccess; },
            [](ProcessorProxy& vc, const int value) {
-             return vc.GetCore()->SetPitchCorrectionType(value);
+             return vc.ForEachCore([value](ProcessorCoreBase& core) {
+               return core.SetPitchCorrectionType(value);
+             });
            })},
       {ParameterID::kMinSourcePitch,
        NumberParameter(
@@ -377,7 +401,9 @@ const ParameterSchema kSchema = [] {
            u8"MinPit"s, parameter_flag::kCanAutomate,
            [](ControllerCore&, double) { return ErrorCode::kSuccess; },
            [](ProcessorProxy& vc, const double value) {
-             return vc.GetCore()->SetMinSourcePitch(value);
+             return vc.ForEachCore([value](ProcessorCoreBase& core) {
+               return core.SetMinSourcePitch(value);
+             });
            })},
       {ParameterID::kMaxSourcePitch,
        NumberParameter(
@@ -385,7 +411,9 @@ const ParameterSchema kSchema = [] {
            u8"MaxPit"s, parameter_flag::kCanAutomate,
            [](ControllerCore&, double) { return ErrorCode::kSuccess; },
            [](ProcessorProxy& vc, const double value) {
-             return vc.GetCore()->SetMaxSourcePitch(value);
+             return vc.ForEachCore([value](ProcessorCoreBase& core) {
+               return core.SetMaxSourcePitch(value);
+             });
            })},
       {ParameterID::kVQNumNeighbors,
        NumberParameter(
@@ -393,8 +421,10 @@ const ParameterSchema kSchema = [] {
            parameter_flag::kCanAutomate,
            [](ControllerCore&, double) { return ErrorCode::kSuccess; },
            [](ProcessorProxy& vc, const double value) {
-             return vc.GetCore()->SetVQNumNeighbors(
-                 static_cast<int>(std::round(value)));
+             return vc.ForEachCore([value](ProcessorCoreBase& core) {
+               return core.SetVQNumNeighbors(
+                   static_cast<int>(std::round(value)));
+             });
            })},
       {ParameterID::kVoiceMorphCursorX,
        NumberParameter(u8"Morph Cursor X"s, kDefaultVoiceMorphState.cursor_x,
@@ -422,6 +452,58 @@ const ParameterSchema kSchema = [] {
            u8"MrphCt"s, parameter_flag::kCanAutomate,
            SetVoiceMorphParameterOnController,
            SetVoiceMorphParameterOnProcessor)},
+      {ParameterID::kChannelMode,
+       ListParameter(
+           u8"Channel Mode"s, {u8"Mono Mix"s, u8"Dual Mono"s, u8"Fan-Out"s}, 0,
+           u8"ChMode"s, parameter_flag::kIsList,
+           [](ControllerCore&, int) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy& vc, const int value) {
+             return vc.SetChannelMode(value);
+           })},
+      {ParameterID::kSecondVoice,
+       ListParameter(
+           u8"Voice 2"s,
+           [] {
+             auto v = std::vector<std::u8string>();
+             for (auto i = 0; i < kMaxNSpeakers + 1; ++i) {
+               const auto i_ascii = std::to_string(i);
+               const auto i_u8 = std::u8string(i_ascii.begin(), i_ascii.end());
+               v.push_back(u8"ID "s + i_u8);
+             }
+             return v;
+           }(),
+           0, u8"Voi2"s, parameter_flag::kCanAutomate,
+           [](ControllerCore&, int) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy& vc, const int value) {
+             auto* const core = vc.GetChannelCore(1);
+             return core ? core->SetTargetSpeaker(value) : ErrorCode::kSuccess;
+           })},
+      {ParameterID::kSecondFormantShift,
+       NumberParameter(
+           u8"Formant Shift 2"s, 0.0, -2.0, 2.0, u8"st"s, 8, u8"For2"s,
+           parameter_flag::kCanAutomate,
+           [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy& vc, const double value) {
+             auto* const core = vc.GetChannelCore(1);
+             return core ? core->SetFormantShift(value) : ErrorCode::kSuccess;
+           })},
+      {ParameterID::kSecondPitchShift,
+       NumberParameter(
+           u8"Pitch Shift 2"s, 0.0, -kMaxAbsPitchShift, kMaxAbsPitchShift,
+           u8"st"s, 48 * 8, u8"Pit2"s, parameter_flag::kCanAutomate,
+           [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy& vc, const double value) {
+             auto* const core = vc.GetChannelCore(1);
+             return core ? core->SetPitchShift(value) : ErrorCode::kSuccess;
+           })},
+      {ParameterID::kFanOutVoices,
+       ListParameter(
+           u8"Fan-Out Voices"s, {u8"2"s, u8"3"s, u8"4"s}, 0, u8"FanOut"s,
+           parameter_flag::kIsList,
+           [](ControllerCore&, int) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy& vc, const int value) {
+             return vc.SetNFanOutVoices(value + 2);
+           })},
   });
 
   for (auto i = 0; i < kMaxNVoiceMorphMarkers; ++i) {
@@ -473,6 +555,57 @@ const ParameterSchema kSchema = [] {
               return ErrorCode::kSuccess;
             }));
   }
+
+  // Fan-Out の 3 つ目以降の声
+  for (auto channel = 2; channel < ProcessorProxy::kMaxNVoices; ++channel) {
+    const auto n_ascii = std::to_string(channel + 1);
+    const auto n_u8 = std::u8string(n_ascii.begin(), n_ascii.end());
+    const auto base =
+        static_cast<int>(ParameterID::kThirdVoice) + 3 * (channel - 2);
+    schema.AddParameter(
+        static_cast<ParameterID>(base),
+        ListParameter(
+            u8"Voice "s + n_u8,
+            [] {
+              auto v = std::vector<std::u8string>();
+              for (auto i = 0; i < kMaxNSpeakers + 1; ++i) {
+                const auto i_ascii = std::to_string(i);
+                const auto i_u8 =
+                    std::u8string(i_ascii.begin(), i_ascii.end());
+                v.push_back(u8"ID "s + i_u8);
+              }
+              return v;
+            }(),
+            0, u8"Voi"s + n_u8, parameter_flag::kCanAutomate,
+            [](ControllerCore&, int) { return ErrorCode::kSuccess; },
+            [channel](ProcessorProxy& vc, const int value) {
+              auto* const core = vc.GetChannelCore(channel);
+              return core ? core->SetTargetSpeaker(value)
+                          : ErrorCode::kSuccess;
+            }));
+    schema.AddParameter(
+        static_cast<ParameterID>(base + 1),
+        NumberParameter(
+            u8"Formant Shift "s + n_u8, 0.0, -2.0, 2.0, u8"st"s, 8,
+            u8"For"s + n_u8, parameter_flag::kCanAutomate,
+            [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+            [channel](ProcessorProxy& vc, const double value) {
+              auto* const core = vc.GetChannelCore(channel);
+              return core ? core->SetFormantShift(value)
+                          : ErrorCode::kSuccess;
+            }));
+    schema.AddParameter(
+        static_cast<ParameterID>(base + 2),
+        NumberParameter(
+            u8"Pitch Shift "s + n_u8, 0.0, -kMaxAbsPitchShift,
+            kMaxAbsPitchShift, u8"st"s, 48 * 8, u8"Pit"s + n_u8,
+            parameter_flag::kCanAutomate,
+            [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+            [channel](ProcessorProxy& vc, const double value) {
+              auto* const core = vc.GetChannelCore(channel);
+              return core ? core->SetPitchShift(value) : ErrorCode::kSuccess;
+            }));
+  }
   return schema;
 }();
 }  // namespace beatrice::common
@@ -66,7 +66,21 @@ enum class ParameterID : std::int16_t {
   kVoiceMorphMarkerXBase = kVoiceMorphMarkerVoiceBase + kMaxNVoiceMorphMarkers,
   kVoiceMorphMarkerYBase = kVoiceMorphMarkerXBase + kMaxNVoiceMorphMarkers,
   kAverageTargetPitchBase = 100,
-  kEnd = kAverageTargetPitchBase + kMaxNSpeakers + 1,
+  // 2 チャンネルを独立に変換する場合の、2 チャンネル目の設定
+  kChannelMode = kAverageTargetPitchBase + kMaxNSpeakers + 1,
+  kSecondVoice,
+  kSecondFormantShift,
+  kSecondPitchShift,
+  // Channel Mode が Fan-Out の場合の、声の数と 3 つ目以降の声の設定。
+  // 2 つ目の声には上の 2 チャンネル目の設定を使う
+  kFanOutVoices,
+  kThirdVoice,
+  kThirdFormantShift,
+  kThirdPitchShift,
+  kFourthVoice,
+  kFourthFormantShift,
+  kFourthPitchShift,
+  kEnd,
 };
 
 inline auto IsVoiceMorphParameter(const ParameterID param_id) -> bool {
@@ -243,6 +257,11 @@ class ParameterSchema {
       -> const ParameterVariant& {
     return parameters_.at(param_id);
   }
+  // ホストから届いた ID など、GetParameter() の前に存在を確かめる場合に使う。
+  // メモリ確保も例外の送出も行わない
+  [[nodiscard]] auto Contains(const ParameterID param_id) const -> bool {
+    return parameters_.find(param_id) != parameters_.end();
+  }
   // NOLINTBEGIN(readability-identifier-naming)
   [[nodiscard]] auto begin() const { return parameters_.begin(); }
   [[nodiscard]] auto end() const { return parameters_.end(); }
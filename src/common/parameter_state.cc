@@ -2,6 +2,7 @@
 
 #include "common/parameter_state.h"
 
+#include <cstddef>
 #include <memory>
 #include <string>
 
@@ -145,4 +146,18 @@ auto ParameterState::Write(std::ostream& os) const -> ErrorCode {
   }
   return ErrorCode::kSuccess;
 }
+
+auto ParameterState::GetMemoryUsage() const -> std::size_t {
+  // std::map のノードは値の他に 3 つのポインタと色を持つ
+  constexpr auto kNodeSize =
+      sizeof(decltype(states_)::value_type) + 4 * sizeof(void*);
+  auto bytes = states_.size() * kNodeSize;
+  for (const auto& [param_id, value] : states_) {
+    if (const auto* const pp =
+            std::get_if<std::unique_ptr<std::u8string>>(&value)) {
+      bytes += sizeof(std::u8string) + (*pp)->capacity();
+    }
+  }
+  return bytes;
+}
 }  // namespace beatrice::common
@@ -4,6 +4,7 @@
 #define BEATRICE_COMMON_PARAMETER_STATE_H_
 
 #include <cassert>
+#include <cstddef>
 #include <iostream>
 #include <map>
 #include <memory>
@@ -44,6 +45,8 @@ class ParameterState {
   auto ReadOrSetDefault(std::istream& is, const ParameterSchema& schema)
       -> ErrorCode;
   auto Write(std::ostream& os) const -> ErrorCode;
+  // 保持している値が使っている量の見積もり [bytes]
+  [[nodiscard]] auto GetMemoryUsage() const -> std::size_t;
 
  private:
   std::map<ParameterID, Value> states_;
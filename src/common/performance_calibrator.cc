@@ -0,0 +1,171 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/performance_calibrator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+// Beatrice
+#include "common/error.h"
+#include "common/quality_controller.h"
+
+namespace beatrice::common {
+
+namespace {
+// 計測の前に処理するホップ数。重みやコンテキストのページフォルトを除く
+constexpr auto kNWarmUpHops = 8;
+// 品質レベルごとに、Process() の時間を計測するホップ数
+constexpr auto kNProcessHops = 100;
+// 品質レベルごとに、段階ごとの時間を計測するホップ数
+constexpr auto kNStageHops = 50;
+// 1 ホップの長さ [s]
+constexpr auto kHopSeconds = 0.01;
+// ピークとみなすパーセンタイル
+constexpr auto kPeakPercentile = 0.95;
+}  // namespace
+
+PerformanceCalibrator::PerformanceCalibrator() : thread_([this] { Run(); }) {}
+
+PerformanceCalibrator::~PerformanceCalibrator() {
+  {
+    const auto lock = std::lock_guard<std::mutex>(mtx_);
+    exiting_.store(true, std::memory_order_relaxed);
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+auto PerformanceCalibrator::Acquire()
+    -> std::shared_ptr<PerformanceCalibrator> {
+  // プラグインのアンロード時の破棄順序の問題を避けるため、意図的に解放しない
+  static auto* const mtx = new std::mutex();
+  static auto* const shared = new std::weak_ptr<PerformanceCalibrator>();
+  const auto lock = std::lock_guard<std::mutex>(*mtx);
+  if (auto calibrator = shared->lock()) {
+    return calibrator;
+  }
+  auto calibrator = std::make_shared<PerformanceCalibrator>();
+  *shared = calibrator;
+  return calibrator;
+}
+
+void PerformanceCalibrator::Request(
+    const std::filesystem::path& model_file,
+    const ParameterState& parameter_state, const double sample_rate,
+    const SpeakerTableStorage speaker_table_storage) {
+  {
+    const auto lock = std::lock_guard<std::mutex>(mtx_);
+    auto key = std::pair(model_file, sample_rate);
+    if (std::find(requested_.begin(), requested_.end(), key) !=
+        requested_.end()) {
+      return;
+    }
+    requested_.push_back(std::move(key));
+    requests_.push_back({.model_file = model_file,
+                         .parameter_state = parameter_state,
+                         .sample_rate = sample_rate,
+                         .speaker_table_storage = speaker_table_storage});
+  }
+  cv_.notify_one();
+}
+
+void PerformanceCalibrator::Run() {
+  auto lock = std::unique_lock<std::mutex>(mtx_);
+  while (true) {
+    cv_.wait(lock, [this] {
+      return exiting_.load(std::memory_order_relaxed) || !requests_.empty();
+    });
+    if (exiting_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    const auto request = std::move(requests_.front());
+    requests_.pop_front();
+    lock.unlock();
+    Calibrate(request);
+    lock.lock();
+  }
+}
+
+void PerformanceCalibrator::Calibrate(const CalibrationRequest& request) {
+  // 他のインスタンスが先に計測を終えていることがある
+  if (auto profile = PerformanceProfile();
+      PerformanceProfile::Load(request.model_file, request.sample_rate,
+                               profile)) {
+    return;
+  }
+  // 本来の処理とは状態を共有しないよう、計測用に別に読み込む。
+  // 重みは ModelRegistry を介して共有されるので、読み込みは軽い
+  auto proxy = ProcessorProxy(request.parameter_state, request.sample_rate,
+                              request.speaker_table_storage);
+  if (proxy.GetLoadedModelFile() != request.model_file) {
+    return;
+  }
+  auto profile = PerformanceProfile();
+  for (auto level = 0; level <= QualityController::kMaxLevel; ++level) {
+    if (!MeasureLevel(proxy, level, profile.levels[level])) {
+      return;
+    }
+  }
+  [[maybe_unused]] const auto saved =
+      profile.Save(request.model_file, request.sample_rate);
+}
+
+auto PerformanceCalibrator::MeasureLevel(ProcessorProxy& proxy,
+                                         const int level,
+                                         PerformanceProfile::Level& result)
+    -> bool {
+  const auto& core = proxy.GetCore();
+  if (proxy.SetQualityLevel(level) != ErrorCode::kSuccess ||
+      core->ResetContext() != ErrorCode::kSuccess) {
+    return false;
+  }
+  // ホストから 1 ホップずつ渡される場合の、リサンプリングも含めた処理時間
+  const auto n_samples = std::max(
+      1, static_cast<int>(std::lround(proxy.GetSampleRate() * kHopSeconds)));
+  auto signal = CalibrationSignal(proxy.GetSampleRate());
+  auto buffer = std::vector<float>(n_samples);
+  auto hop_seconds = std::vector<double>();
+  hop_seconds.reserve(kNProcessHops);
+  for (auto i = 0; i < kNWarmUpHops + kNProcessHops; ++i) {
+    if (exiting_.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    signal.Generate(buffer.data(), n_samples);
+    const auto start = std::chrono::steady_clock::now();
+    if (core->Process(buffer.data(), buffer.data(), n_samples) !=
+        ErrorCode::kSuccess) {
+      return false;
+    }
+    const auto seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+    if (i >= kNWarmUpHops) {
+      hop_seconds.push_back(seconds);
+    }
+  }
+  auto sum = 0.0;
+  for (const auto seconds : hop_seconds) {
+    sum += seconds;
+  }
+  result.mean_seconds = sum / static_cast<double>(hop_seconds.size());
+  const auto peak = hop_seconds.begin() +
+                    static_cast<std::ptrdiff_t>(
+                        kPeakPercentile *
+                        static_cast<double>(hop_seconds.size() - 1));
+  std::nth_element(hop_seconds.begin(), peak, hop_seconds.end());
+  result.peak_seconds = *peak;
+  if (exiting_.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  return core->MeasureStageCosts(kNStageHops, result.stage_seconds) ==
+         ErrorCode::kSuccess;
+}
+
+}  // namespace beatrice::common
@@ -0,0 +1,73 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_PERFORMANCE_CALIBRATOR_H_
+#define BEATRICE_COMMON_PERFORMANCE_CALIBRATOR_H_
+
+#include <atomic>
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>   // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+// Beatrice
+#include "common/parameter_state.h"
+#include "common/performance_profile.h"
+#include "common/processor_proxy.h"
+#include "common/speaker_table.h"
+
+namespace beatrice::common {
+
+// 初めて使うモデルを、バックグラウンドスレッドで計測用に別途読み込み、
+// 合成した入力を数百ホップ処理させて PerformanceProfile を作って保存する。
+// 計測中も本来の処理は QualityController による調整で続けられ、
+// 次にそのモデルを読み込んだ時から計測結果が使われる。
+// 同時に複数の計測を行うと結果が不正確になるので、プロセス内で共有する。
+class PerformanceCalibrator {
+ public:
+  PerformanceCalibrator();
+  PerformanceCalibrator(const PerformanceCalibrator&) = delete;
+  auto operator=(const PerformanceCalibrator&)
+      -> PerformanceCalibrator& = delete;
+  // 計測中のものは途中で打ち切る
+  ~PerformanceCalibrator();
+
+  // プロセス内で共有するものを返す。
+  // 全ての参照が無くなった時点でスレッドも終了する。
+  static auto Acquire() -> std::shared_ptr<PerformanceCalibrator>;
+
+  // parameter_state で読み込まれる model_file の計測を要求する。
+  // 同じモデルとサンプリング周波数の計測をこのプロセスで既に要求していれば、
+  // 保存に失敗していたとしても何もしない
+  void Request(const std::filesystem::path& model_file,
+               const ParameterState& parameter_state, double sample_rate,
+               SpeakerTableStorage speaker_table_storage);
+
+ private:
+  struct CalibrationRequest {
+    std::filesystem::path model_file;
+    ParameterState parameter_state;
+    double sample_rate;
+    SpeakerTableStorage speaker_table_storage;
+  };
+
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  std::deque<CalibrationRequest> requests_;
+  std::vector<std::pair<std::filesystem::path, double>> requested_;
+  std::atomic<bool> exiting_ = false;
+  std::thread thread_;
+
+  void Run();
+  void Calibrate(const CalibrationRequest& request);
+  // 打ち切られた場合は false を返す
+  auto MeasureLevel(ProcessorProxy& proxy, int level,
+                    PerformanceProfile::Level& result) -> bool;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_PERFORMANCE_CALIBRATOR_H_
@@ -0,0 +1,233 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/performance_profile.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>
+#include <sys/types.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <numbers>
+#include <string>
+#include <system_error>
+#include <thread>  // NOLINT(build/c++11)
+
+// Beatrice
+#include "common/cache_directory.h"
+#include "common/hasher.h"
+
+namespace beatrice::common {
+
+namespace {
+
+constexpr auto kMagic =
+    std::array<char, 8>{'B', 'T', 'R', 'P', 'E', 'R', 'F', 0};
+// レイアウトを変えた場合はこれを上げる
+constexpr std::uint32_t kFormatVersion = 1;
+
+// 1 ホップの長さ [s]
+constexpr auto kHopSeconds = 0.01;
+// 推奨するレベルの、1 ホップの長さに対する処理時間の上限
+constexpr auto kMaxMeanLoad = 0.6;
+constexpr auto kMaxPeakLoad = 0.8;
+// 最高品質でこれを超える場合は非同期モードを勧める
+constexpr auto kAsyncPeakLoad = 0.8;
+// 並列化で短くなる時間 (ピッチ推定と音素抽出の短い方) がこれを超え、
+// ワーカーに使えるコアがある場合は並列化を勧める
+constexpr auto kMinParallelGain = 0.1;
+constexpr auto kMinParallelCores = 4U;
+
+struct ProfileFile {
+  std::array<char, 8> magic;
+  std::uint32_t format_version;
+  std::uint32_t n_levels;
+  // ハッシュの衝突で別の条件の結果を使わないよう、キーも保存する
+  std::uint64_t key;
+  std::array<PerformanceProfile::Level, QualityController::kMaxLevel + 1>
+      levels;
+};
+
+// x86 では CPUID のブランド文字列、macOS では sysctl の値。
+// 得られない場合は空文字列を返す
+auto GetCpuName() -> std::string {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  auto brand = std::array<int, 12>();
+  auto info = std::array<int, 4>();
+  __cpuid(info.data(), 0x80000000);
+  if (static_cast<unsigned>(info[0]) < 0x80000004U) {
+    return {};
+  }
+  for (auto i = 0; i < 3; ++i) {
+    __cpuid(brand.data() + 4 * i, 0x80000002 + i);
+  }
+  auto name = std::string(reinterpret_cast<const char*>(brand.data()), 48);
+#elif defined(__x86_64__) || defined(__i386__)
+  auto brand = std::array<unsigned, 12>();
+  if (__get_cpuid_max(0x80000000U, nullptr) < 0x80000004U) {
+    return {};
+  }
+  for (auto i = 0U; i < 3; ++i) {
+    __get_cpuid(0x80000002U + i, &brand[4 * i], &brand[4 * i + 1],
+                &brand[4 * i + 2], &brand[4 * i + 3]);
+  }
+  auto name = std::string(reinterpret_cast<const char*>(brand.data()), 48);
+#elif defined(__APPLE__)
+  auto buffer = std::array<char, 128>();
+  auto size = buffer.size();
+  if (sysctlbyname("machdep.cpu.brand_string", buffer.data(), &size, nullptr,
+                   0) != 0) {
+    return {};
+  }
+  auto name = std::string(buffer.data(), strnlen(buffer.data(), size));
+#else
+  auto name = std::string();
+#endif
+  name.resize(std::strlen(name.c_str()));
+  return name;
+}
+
+// 計測結果に影響する条件のハッシュ。
+// モデルの内容ではなく、大きさと更新日時で変更を検出する
+auto GetKey(const std::filesystem::path& model_file, const double sample_rate)
+    -> std::uint64_t {
+  static const auto cpu = GetCpuName() + "/" +
+                          std::to_string(std::thread::hardware_concurrency());
+  auto ec = std::error_code();
+  auto source = std::filesystem::weakly_canonical(model_file, ec);
+  if (ec) {
+    source = model_file;
+  }
+  const auto source_u8 = source.u8string();
+  auto size = std::uint64_t{0};
+  if (const auto n = std::filesystem::file_size(source, ec); !ec) {
+    size = static_cast<std::uint64_t>(n);
+  }
+  auto mtime = std::int64_t{0};
+  if (const auto time = std::filesystem::last_write_time(source, ec); !ec) {
+    mtime = static_cast<std::int64_t>(time.time_since_epoch().count());
+  }
+  const auto rate = static_cast<std::int64_t>(std::lround(sample_rate));
+  auto hasher = Hasher();
+  hasher.Update(reinterpret_cast<const std::byte*>(cpu.data()), cpu.size());
+  hasher.Update(reinterpret_cast<const std::byte*>(source_u8.data()),
+                source_u8.size());
+  hasher.Update(reinterpret_cast<const std::byte*>(&size), sizeof(size));
+  hasher.Update(reinterpret_cast<const std::byte*>(&mtime), sizeof(mtime));
+  hasher.Update(reinterpret_cast<const std::byte*>(&rate), sizeof(rate));
+  return hasher.Get();
+}
+
+// キャッシュディレクトリが得られない場合は空のパスを返す
+auto GetProfilePath(const std::uint64_t key) -> std::filesystem::path {
+  const auto dir = GetCacheDirectory();
+  if (dir.empty()) {
+    return {};
+  }
+  auto hasher = Hasher();
+  hasher.Update(reinterpret_cast<const std::byte*>(&key), sizeof(key));
+  return dir / (hasher.GetHex() + ".perfprofile");
+}
+
+}  // namespace
+
+auto PerformanceProfile::GetRecommendedQualityLevel() const -> int {
+  for (auto level = 0; level < QualityController::kMaxLevel; ++level) {
+    if (levels[level].mean_seconds < kHopSeconds * kMaxMeanLoad &&
+        levels[level].peak_seconds < kHopSeconds * kMaxPeakLoad) {
+      return level;
+    }
+  }
+  return QualityController::kMaxLevel;
+}
+
+auto PerformanceProfile::IsAsyncProcessingRecommended() const -> bool {
+  return levels[0].peak_seconds > kHopSeconds * kAsyncPeakLoad;
+}
+
+auto PerformanceProfile::IsParallelAnalysisRecommended() const -> bool {
+  const auto& stages = levels[0].stage_seconds;
+  return std::min(stages[0], stages[1]) > kHopSeconds * kMinParallelGain &&
+         std::thread::hardware_concurrency() >= kMinParallelCores;
+}
+
+auto PerformanceProfile::Load(const std::filesystem::path& model_file,
+                              const double sample_rate,
+                              PerformanceProfile& profile) -> bool {
+  const auto key = GetKey(model_file, sample_rate);
+  const auto path = GetProfilePath(key);
+  if (path.empty()) {
+    return false;
+  }
+  auto ifs = std::ifstream(path, std::ios::binary);
+  if (!ifs) {
+    return false;
+  }
+  auto file = ProfileFile();
+  ifs.read(reinterpret_cast<char*>(&file), sizeof(file));
+  if (!ifs || file.magic != kMagic || file.format_version != kFormatVersion ||
+      file.n_levels != file.levels.size() || file.key != key) {
+    return false;
+  }
+  profile.levels = file.levels;
+  return true;
+}
+
+auto PerformanceProfile::Save(const std::filesystem::path& model_file,
+                              const double sample_rate) const -> bool {
+  const auto key = GetKey(model_file, sample_rate);
+  const auto path = GetProfilePath(key);
+  if (path.empty()) {
+    return false;
+  }
+  auto ec = std::error_code();
+  std::filesystem::create_directories(path.parent_path(), ec);
+  if (ec) {
+    return false;
+  }
+  const auto file = ProfileFile{
+      .magic = kMagic,
+      .format_version = kFormatVersion,
+      .n_levels = static_cast<std::uint32_t>(levels.size()),
+      .key = key,
+      .levels = levels,
+  };
+  return WriteFileAtomically(path, [&file](std::ofstream& ofs) {
+    ofs.write(reinterpret_cast<const char*>(&file), sizeof(file));
+    return static_cast<bool>(ofs);
+  });
+}
+
+CalibrationSignal::CalibrationSignal(const double sample_rate)
+    : sample_rate_(sample_rate) {}
+
+void CalibrationSignal::Generate(float* const output, const int n_samples) {
+  constexpr auto kNHarmonics = 8;
+  auto noise = std::uniform_real_distribution<float>(-0.01F, 0.01F);
+  for (auto i = 0; i < n_samples; ++i) {
+    // 2 秒周期で 110 Hz から 330 Hz の間を往復する
+    const auto f0 =
+        220.0 + 110.0 * std::sin(2.0 * std::numbers::pi * 0.5 * time_);
+    phase_ = std::fmod(phase_ + f0 / sample_rate_, 1.0);
+    auto x = 0.0;
+    for (auto k = 1; k <= kNHarmonics; ++k) {
+      x += std::sin(2.0 * std::numbers::pi * k * phase_) / k;
+    }
+    output[i] = static_cast<float>(0.2 * x) + noise(rng_);
+    time_ += 1.0 / sample_rate_;
+  }
+}
+
+}  // namespace beatrice::common
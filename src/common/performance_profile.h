@@ -0,0 +1,93 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_PERFORMANCE_PROFILE_H_
+#define BEATRICE_COMMON_PERFORMANCE_PROFILE_H_
+
+#include <array>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+// Beatrice
+#include "common/quality_controller.h"
+
+namespace beatrice::common {
+
+// あるマシンで、あるモデルをあるサンプリング周波数で使った場合の処理時間。
+// 初めて使うモデルはバックグラウンドで計測し (PerformanceCalibrator)、
+// 結果を CPU、モデル、サンプリング周波数ごとにキャッシュディレクトリに保存する。
+// 次からは処理を始める前にこれを読み、品質や処理モードの初期値を決める。
+struct PerformanceProfile {
+  // ピッチ推定、音素抽出、合成
+  static constexpr int kNStages = 3;
+
+  // 品質レベルごとの、1 ホップ (10 ms) の処理時間 [s]
+  struct Level {
+    // Process() の平均と 95 パーセンタイル
+    double mean_seconds;
+    double peak_seconds;
+    // 各段階を順に処理した場合の平均
+    std::array<double, kNStages> stage_seconds;
+  };
+
+  std::array<Level, QualityController::kMaxLevel + 1> levels;
+
+  // 平均と最大の負荷に余裕がある最高品質のレベル
+  [[nodiscard]] auto GetRecommendedQualityLevel() const -> int;
+  // 最高品質ではホストのコールバック内に収まらないことがある
+  [[nodiscard]] auto IsAsyncProcessingRecommended() const -> bool;
+  // ピッチ推定と音素抽出を並列にすると、処理時間が十分に短くなる
+  [[nodiscard]] auto IsParallelAnalysisRecommended() const -> bool;
+
+  // 保存されていなければ false を返す
+  static auto Load(const std::filesystem::path& model_file, double sample_rate,
+                   PerformanceProfile& profile) -> bool;
+  auto Save(const std::filesystem::path& model_file, double sample_rate) const
+      -> bool;
+};
+
+// 計測用の入力。ピッチが緩やかに変化する倍音と少しの雑音からなり、
+// 無音とは異なり、各段階が実際の声に近い量の処理を行う
+class CalibrationSignal {
+ public:
+  explicit CalibrationSignal(double sample_rate);
+  void Generate(float* output, int n_samples);
+
+ private:
+  double sample_rate_;
+  double time_ = 0.0;
+  double phase_ = 0.0;
+  std::minstd_rand rng_;
+};
+
+// 計測用の入力を kInLength サンプルずつ与えて、run_stage(stage, input, output)
+// で各段階を n_frames 回ずつ処理し、各段階の平均の処理時間 [s] を返す
+template <int kInLength, int kOutLength, typename RunStage>
+auto MeasureStageSeconds(const int n_frames, const double sample_rate,
+                         RunStage&& run_stage)
+    -> std::array<double, PerformanceProfile::kNStages> {
+  auto signal = CalibrationSignal(sample_rate);
+  auto input = std::vector<float>(kInLength);
+  auto output = std::vector<float>(kOutLength);
+  auto seconds = std::array<double, PerformanceProfile::kNStages>();
+  for (auto i = 0; i < n_frames; ++i) {
+    signal.Generate(input.data(), kInLength);
+    for (auto stage = 0; stage < PerformanceProfile::kNStages; ++stage) {
+      const auto start = std::chrono::steady_clock::now();
+      run_stage(stage, input.data(), output.data());
+      seconds[stage] += std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+    }
+  }
+  for (auto& s : seconds) {
+    s /= static_cast<double>(n_frames);
+  }
+  return seconds;
+}
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_PERFORMANCE_PROFILE_H_
@@ -4,9 +4,15 @@
 #define BEATRICE_COMMON_PROCESSOR_CORE_H_
 
 #include <array>
+#include <vector>
 
+#include "common/deferred_task_scheduler.h"
 #include "common/error.h"
+#include "common/load_leveling.h"
+#include "common/memory_footprint.h"
 #include "common/model_config.h"
+#include "common/performance_profile.h"
+#include "common/stage_timings.h"
 
 namespace beatrice::common {
 
@@ -35,11 +41,57 @@ class ProcessorCoreBase {
                          const std::filesystem::path& /*file*/) -> ErrorCode {
     return ErrorCode::kSuccess;
   }
+  // 使っているメモリの量を構成要素ごとに footprint に加える。
+  // 信号処理ライブラリ内部のコンテキストは大きさが分からないので含まない
+  virtual void GetMemoryFootprint(MemoryFootprint& /*footprint*/) const {}
+  // 読み込んだモデルの各段階の読み込み時間。記録していなければ空
+  [[nodiscard]] virtual auto GetLoadTimings() const
+      -> std::vector<StageTimings::Stage> {
+    return {};
+  }
+  // 計測用の入力で 1 ホップの処理を段階ごとに n_frames 回行い、
+  // 各段階の平均の処理時間を stage_seconds に書き込む。
+  // コンテキストが変わるので、計測のために読み込んだものに対してのみ呼ぶ
+  virtual auto MeasureStageCosts(
+      int /*n_frames*/,
+      std::array<double, PerformanceProfile::kNStages>& /*stage_seconds*/)
+      -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
 
  protected:
   virtual auto SetSampleRate(double /*sample_rate*/) -> ErrorCode {
     return ErrorCode::kSuccess;
   }
+  // オフラインでの書き出しなど、リアルタイム性が求められない場合に true にする
+  virtual auto SetOfflineRendering(bool /*offline*/) -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+  // リアルタイム処理での負荷の平準化の仕方。
+  // kDisabled 以外では遅延が 1 ホップ増える
+  virtual auto SetLoadLeveling(LoadLevelingMode /*mode*/) -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+  // 処理が間に合わない場合に、負荷の大きい処理を省く度合い。
+  // 0 が最高品質で、最大は QualityController::kMaxLevel
+  virtual auto SetQualityLevel(int /*level*/) -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+  // 計測済みの処理時間に基づいて、解析を並列化するかなどを決める。
+  // ワーカーの処理が終わるのを待つので、オーディオスレッドからは呼ばない
+  virtual void ApplyPerformanceProfile(const PerformanceProfile& /*profile*/) {}
+  // Fan-Out で、自身では解析を行わず、source が直前の Process() で解析した
+  // 結果から合成するようにする。source は Process() を先に呼ばれ、
+  // このインスタンスより長く生存する必要がある。
+  // 解析結果を共有できない組み合わせでは false を返し、自身で解析を続ける
+  virtual auto FollowAnalysis(ProcessorCoreBase& /*source*/) -> bool {
+    return false;
+  }
+
+  // 1 フレーム (10 ms) で行うには重い処理を、数フレームに分けて進める。
+  // 子クラスはコンストラクタでタスクを登録し、フレームごとの処理の中で
+  // BeginFrame(), Run(), EndFrame() を呼ぶ
+  DeferredTaskScheduler deferred_tasks_{0.01};
 
  public:
   virtual auto SetTargetSpeaker(int /*target_speaker*/) -> ErrorCode {
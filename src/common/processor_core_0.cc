@@ -4,10 +4,16 @@
 
 #include <array>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 #include <filesystem>
+#include <memory>
+#include <string>
 
+#include "common/memory_footprint.h"
 #include "common/model_config.h"
+#include "common/model_registry.h"
+#include "common/performance_profile.h"
 #include "common/voice_morph_state.h"
 
 namespace beatrice::common {
@@ -47,14 +53,76 @@ auto ProcessorCore0::Process(const float* const input, float* const output,
   return ErrorCode::kSuccess;
 }
 
+void ProcessorCore0::ProcessBatch(const float* const input,
+                                  float* const output, const int n_blocks) {
+  frame_pipeline_.Process<BEATRICE_IN_HOP_LENGTH, BEATRICE_OUT_HOP_LENGTH>(
+      input, output, n_blocks, analyses_,
+      [this](const float* const frame, Analysis& analysis) {
+        Analyze1(frame, analysis);
+      },
+      [this](Analysis& analysis, float* const frame) {
+        Synthesize1(analysis, frame);
+      });
+}
+
 void ProcessorCore0::Process1(const float* const input, float* const output) {
-  std::array<float, BEATRICE_20A2_PHONE_CHANNELS> phone;
-  Beatrice20a2_ExtractPhone1(phone_extractor_, input, phone.data(),
-                             phone_context_);
-  int quantized_pitch;
-  std::array<float, 4> pitch_feature;
-  Beatrice20a2_EstimatePitch1(pitch_estimator_, input, &quantized_pitch,
-                              pitch_feature.data(), pitch_context_);
+  auto analysis = Analysis();
+  Analyze1(input, analysis);
+  Synthesize1(analysis, output);
+}
+
+void ProcessorCore0::Analyze1(const float* const input, Analysis& analysis) {
+  // 音素抽出とピッチ推定は同じ入力から独立に行えるので、並列に実行できる
+  auto estimate_pitch = [&] { EstimatePitch1(input, analysis); };
+  parallel_analysis_.Run(estimate_pitch,
+                         [&] { ExtractPhone1(input, analysis); });
+}
+
+void ProcessorCore0::EstimatePitch1(const float* const input,
+                                    Analysis& analysis) {
+  Beatrice20a2_EstimatePitch1(model_->pitch_estimator, input,
+                              &analysis.quantized_pitch,
+                              analysis.pitch_feature.data(), contexts_->pitch);
+}
+
+void ProcessorCore0::ExtractPhone1(const float* const input,
+                                   Analysis& analysis) {
+  Beatrice20a2_ExtractPhone1(model_->phone_extractor, input,
+                             analysis.phone.data(), contexts_->phone);
+}
+
+void ProcessorCore0::RunStage(const int stage, const float* const input,
+                              float* const output) {
+  switch (stage) {
+    case 0:
+      EstimatePitch1(input, staged_analysis_);
+      break;
+    case 1:
+      ExtractPhone1(input, staged_analysis_);
+      break;
+    default:
+      Synthesize1(staged_analysis_, output);
+      break;
+  }
+}
+
+auto ProcessorCore0::MeasureStageCosts(
+    const int n_frames,
+    std::array<double, PerformanceProfile::kNStages>& stage_seconds)
+    -> ErrorCode {
+  if (!IsLoaded()) {
+    return ErrorCode::kModelNotLoaded;
+  }
+  stage_seconds =
+      MeasureStageSeconds<BEATRICE_IN_HOP_LENGTH, BEATRICE_OUT_HOP_LENGTH>(
+          n_frames, BEATRICE_IN_SAMPLE_RATE,
+          [this](const int stage, const float* const input,
+                 float* const output) { RunStage(stage, input, output); });
+  return ErrorCode::kSuccess;
+}
+
+void ProcessorCore0::Synthesize1(Analysis& analysis, float* const output) {
+  auto& quantized_pitch = analysis.quantized_pitch;
   constexpr auto kPitchBinsPerSemitone =
       static_cast<double>(BEATRICE_PITCH_BINS_PER_OCTAVE) / 12.0;
   // PitchShift, IntonationIntensity
@@ -137,18 +205,18 @@ void ProcessorCore0::Process1(const float* const input, float* const output) {
              BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS +
          i];
   }
-  Beatrice20a2_GenerateWaveform1(waveform_generator_, phone.data(),
-                                 &quantized_pitch, pitch_feature.data(),
-                                 speaker.data(), output, waveform_context_);
+  Beatrice20a2_GenerateWaveform1(model_->waveform_generator,
+                                 analysis.phone.data(), &quantized_pitch,
+                                 analysis.pitch_feature.data(), speaker.data(),
+                                 output, contexts_->waveform);
 }
 
 auto ProcessorCore0::ResetContext() -> ErrorCode {
-  Beatrice20a2_DestroyPhoneContext1(phone_context_);
-  Beatrice20a2_DestroyPitchContext1(pitch_context_);
-  Beatrice20a2_DestroyWaveformContext1(waveform_context_);
-  phone_context_ = Beatrice20a2_CreatePhoneContext1();
-  pitch_context_ = Beatrice20a2_CreatePitchContext1();
-  waveform_context_ = Beatrice20a2_CreateWaveformContext1();
+  // 予備のコンテキストがあれば差し替えるだけで済ませる。
+  // 予備が無い場合のみその場で作り直す。
+  if (auto config = std::uint64_t{}; !context_pool_.Swap(contexts_, config)) {
+    contexts_ = std::make_unique<Contexts>();
+  }
   // パラメータを再設定
   auto error = ErrorCode::kSuccess;
   if (const auto err = SetMinSourcePitch(min_source_pitch_);
@@ -162,30 +230,71 @@ auto ProcessorCore0::ResetContext() -> ErrorCode {
   return error;
 }
 
-auto ProcessorCore0::LoadModel(const ModelConfig& /*config*/,
-                               const std::filesystem::path& new_model_file)
-    -> ErrorCode {
-  model_file_.clear();  // IsLoaded() が false を返すようにする
+ProcessorCore0::SharedModel::SharedModel()
+    : phone_extractor(Beatrice20a2_CreatePhoneExtractor()),
+      pitch_estimator(Beatrice20a2_CreatePitchEstimator()),
+      waveform_generator(Beatrice20a2_CreateWaveformGenerator()) {}
 
-  const auto d = new_model_file.parent_path();
+ProcessorCore0::SharedModel::~SharedModel() {
+  Beatrice20a2_DestroyPhoneExtractor(phone_extractor);
+  Beatrice20a2_DestroyPitchEstimator(pitch_estimator);
+  Beatrice20a2_DestroyWaveformGenerator(waveform_generator);
+}
+
+auto ProcessorCore0::SharedModel::Load(const std::filesystem::path& d)
+    -> ErrorCode {
   if (const auto err = Beatrice20a2_ReadPhoneExtractorParameters(
-          phone_extractor_,
+          phone_extractor,
           reinterpret_cast<const char*>(
               (d / "phone_extractor.bin").u8string().c_str()))) {
     return static_cast<ErrorCode>(err);
   }
   if (const auto err = Beatrice20a2_ReadPitchEstimatorParameters(
-          pitch_estimator_,
+          pitch_estimator,
           reinterpret_cast<const char*>(
               (d / "pitch_estimator.bin").u8string().c_str()))) {
     return static_cast<ErrorCode>(err);
   }
   if (const auto err = Beatrice20a2_ReadWaveformGeneratorParameters(
-          waveform_generator_,
+          waveform_generator,
           reinterpret_cast<const char*>(
               (d / "waveform_generator.bin").u8string().c_str()))) {
     return static_cast<ErrorCode>(err);
   }
+  return ErrorCode::kSuccess;
+}
+
+void ProcessorCore0::GetMemoryFootprint(MemoryFootprint& footprint) const {
+  footprint.Add("processor core", sizeof(*this));
+  footprint.Add("resampler", any_freq_in_out_.GetMemoryUsage());
+  footprint.Add("speaker embeddings",
+                MemoryFootprint::SizeOf(speaker_embeddings_) +
+                    MemoryFootprint::SizeOf(formant_shift_embeddings_));
+  footprint.Add("spherical average", sph_avg_.GetMemoryUsage());
+  if (model_) {
+    const auto d = model_file_.parent_path();
+    footprint.Add("network weights",
+                  MemoryFootprint::FileSizeOf(d / "phone_extractor.bin") +
+                      MemoryFootprint::FileSizeOf(d / "pitch_estimator.bin") +
+                      MemoryFootprint::FileSizeOf(d / "waveform_generator.bin"),
+                  true);
+  }
+}
+
+auto ProcessorCore0::LoadModel(const ModelConfig& /*config*/,
+                               const std::filesystem::path& new_model_file)
+    -> ErrorCode {
+  model_file_.clear();  // IsLoaded() が false を返すようにする
+
+  // ネットワークの重みは同じモデルを使う他のインスタンスと共有する
+  const auto d = new_model_file.parent_path();
+  if (const auto err = ModelRegistry::Acquire<SharedModel>(
+          d, std::string(),
+          [&d](SharedModel& model) -> ErrorCode { return model.Load(d); },
+          model_);
+      err != ErrorCode::kSuccess) {
+    return err;
+  }
   if (const auto err = Beatrice20a2_ReadNSpeakers(
           reinterpret_cast<const char*>(
               (d / "speaker_embeddings.bin").u8string().c_str()),
@@ -227,6 +336,22 @@ auto ProcessorCore0::SetSampleRate(const double new_sample_rate) -> ErrorCode {
   return ErrorCode::kSuccess;
 }
 
+auto ProcessorCore0::SetOfflineRendering(const bool offline) -> ErrorCode {
+  frame_pipeline_.SetEnabled(offline);
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorCore0::SetLoadLeveling(const LoadLevelingMode mode)
+    -> ErrorCode {
+  load_leveling_mode_ = mode;
+  return ErrorCode::kSuccess;
+}
+
+void ProcessorCore0::ApplyPerformanceProfile(
+    const PerformanceProfile& profile) {
+  parallel_analysis_.SetEnabled(profile.IsParallelAnalysisRecommended());
+}
+
 auto ProcessorCore0::SetTargetSpeaker(const int new_target_speaker_id)
     -> ErrorCode {
   if (new_target_speaker_id < 0) {
@@ -311,7 +436,7 @@ auto ProcessorCore0::SetMinSourcePitch(const double new_min_source_pitch)
     -> ErrorCode {
   min_source_pitch_ = std::clamp(new_min_source_pitch, 0.0, 128.0);
   Beatrice20a2_SetMinQuantizedPitch(
-      pitch_context_,
+      contexts_->pitch,
       std::clamp(
           static_cast<int>(std::round((min_source_pitch_ - 33.0) *
                                       (BEATRICE_PITCH_BINS_PER_OCTAVE / 12.0))),
@@ -323,7 +448,7 @@ auto ProcessorCore0::SetMaxSourcePitch(const double new_max_source_pitch)
     -> ErrorCode {
   max_source_pitch_ = std::clamp(new_max_source_pitch, 0.0, 128.0);
   Beatrice20a2_SetMaxQuantizedPitch(
-      pitch_context_,
+      contexts_->pitch,
       std::clamp(
           static_cast<int>(std::round((max_source_pitch_ - 33.0) *
                                       (BEATRICE_PITCH_BINS_PER_OCTAVE / 12.0))),
@@ -5,14 +5,19 @@
 
 #include <array>
 #include <filesystem>
+#include <memory>
 #include <vector>
 
 #include "beatricelib/beatrice.h"
 
 // Beatrice
+#include "common/context_pool.h"
 #include "common/error.h"
+#include "common/frame_pipeline.h"
 #include "common/gain.h"
 #include "common/model_config.h"
+#include "common/parallel_analysis.h"
+#include "common/performance_profile.h"
 #include "common/processor_core.h"
 #include "common/resample.h"
 #include "common/spherical_average.h"
@@ -25,31 +30,26 @@ class ProcessorCore0 : public ProcessorCoreBase {
   explicit ProcessorCore0(const double sample_rate)
       : ProcessorCoreBase(),
         any_freq_in_out_(sample_rate),
-        phone_extractor_(Beatrice20a2_CreatePhoneExtractor()),
-        pitch_estimator_(Beatrice20a2_CreatePitchEstimator()),
-        waveform_generator_(Beatrice20a2_CreateWaveformGenerator()),
         gain_(),
-        phone_context_(Beatrice20a2_CreatePhoneContext1()),
-        pitch_context_(Beatrice20a2_CreatePitchContext1()),
-        waveform_context_(Beatrice20a2_CreateWaveformContext1()),
+        contexts_(std::make_unique<Contexts>()),
         input_gain_context_(sample_rate),
         output_gain_context_(sample_rate),
         speaker_morphing_weights_() {}
-  ~ProcessorCore0() override {
-    Beatrice20a2_DestroyPhoneExtractor(phone_extractor_);
-    Beatrice20a2_DestroyPitchEstimator(pitch_estimator_);
-    Beatrice20a2_DestroyWaveformGenerator(waveform_generator_);
-    Beatrice20a2_DestroyPhoneContext1(phone_context_);
-    Beatrice20a2_DestroyPitchContext1(pitch_context_);
-    Beatrice20a2_DestroyWaveformContext1(waveform_context_);
-  }
   [[nodiscard]] auto GetVersion() const -> int override;
   auto Process(const float* input, float* output, int n_samples)
       -> ErrorCode override;
   auto ResetContext() -> ErrorCode override;
   auto LoadModel(const ModelConfig& /*config*/,
                  const std::filesystem::path& /*file*/) -> ErrorCode override;
+  void GetMemoryFootprint(MemoryFootprint& footprint) const override;
+  auto MeasureStageCosts(
+      int n_frames,
+      std::array<double, PerformanceProfile::kNStages>& stage_seconds)
+      -> ErrorCode override;
   auto SetSampleRate(double /*sample_rate*/) -> ErrorCode override;
+  auto SetOfflineRendering(bool /*offline*/) -> ErrorCode override;
+  auto SetLoadLeveling(LoadLevelingMode /*mode*/) -> ErrorCode override;
+  void ApplyPerformanceProfile(const PerformanceProfile& profile) override;
   auto SetTargetSpeaker(int /*target_speaker*/) -> ErrorCode override;
   auto SetFormantShift(double /*formant_shift*/) -> ErrorCode override;
   auto SetPitchShift(double /*pitch_shift*/) -> ErrorCode override;
@@ -70,6 +70,46 @@ class ProcessorCore0 : public ProcessorCoreBase {
       -> ErrorCode override;
 
  private:
+  // モデルのうち読み込み後に変更されないネットワークの重み。
+  // ModelRegistry を介して、同じモデルを使うインスタンス間で共有される。
+  struct SharedModel {
+    SharedModel();
+    SharedModel(const SharedModel&) = delete;
+    auto operator=(const SharedModel&) -> SharedModel& = delete;
+    ~SharedModel();
+    auto Load(const std::filesystem::path& directory) -> ErrorCode;
+
+    Beatrice20a2_PhoneExtractor* phone_extractor;
+    Beatrice20a2_PitchEstimator* pitch_estimator;
+    Beatrice20a2_WaveformGenerator* waveform_generator;
+  };
+
+  // ResetContext() で作り直される状態
+  struct Contexts {
+    Contexts()
+        : phone(Beatrice20a2_CreatePhoneContext1()),
+          pitch(Beatrice20a2_CreatePitchContext1()),
+          waveform(Beatrice20a2_CreateWaveformContext1()) {}
+    Contexts(const Contexts&) = delete;
+    auto operator=(const Contexts&) -> Contexts& = delete;
+    ~Contexts() {
+      Beatrice20a2_DestroyPhoneContext1(phone);
+      Beatrice20a2_DestroyPitchContext1(pitch);
+      Beatrice20a2_DestroyWaveformContext1(waveform);
+    }
+
+    Beatrice20a2_PhoneContext1* phone;
+    Beatrice20a2_PitchContext1* pitch;
+    Beatrice20a2_WaveformContext1* waveform;
+  };
+
+  // Process1() の前半の解析結果
+  struct Analysis {
+    std::array<float, BEATRICE_20A2_PHONE_CHANNELS> phone;
+    int quantized_pitch;
+    std::array<float, 4> pitch_feature;
+  };
+
   class ConvertWithModelBlockSize {
    public:
     ConvertWithModelBlockSize() = default;
@@ -77,6 +117,33 @@ class ProcessorCore0 : public ProcessorCoreBase {
                     ProcessorCore0& processor_core) const {
       processor_core.Process1(input, output);
     }
+    [[nodiscard]] auto IsBatchProcessing(
+        const ProcessorCore0& processor_core) const -> bool {
+      return processor_core.frame_pipeline_.IsEnabled();
+    }
+    void ProcessBatch(const float* const input, float* const output,
+                      const int n_blocks,
+                      ProcessorCore0& processor_core) const {
+      processor_core.ProcessBatch(input, output, n_blocks);
+    }
+    [[nodiscard]] auto IsLoadLeveling(
+        const ProcessorCore0& processor_core) const -> bool {
+      return processor_core.load_leveling_mode_ !=
+                 LoadLevelingMode::kDisabled &&
+             !processor_core.frame_pipeline_.IsEnabled();
+    }
+    [[nodiscard]] auto IsSpreadingStages(
+        const ProcessorCore0& processor_core) const -> bool {
+      return processor_core.load_leveling_mode_ == LoadLevelingMode::kSpread;
+    }
+    [[nodiscard]] auto GetNStages(
+        const ProcessorCore0& /*processor_core*/) const -> int {
+      return kNStages;
+    }
+    void RunStage(const int stage, const float* const input,
+                  float* const output, ProcessorCore0& processor_core) const {
+      processor_core.RunStage(stage, input, output);
+    }
   };
 
   std::filesystem::path model_file_;
@@ -94,26 +161,43 @@ class ProcessorCore0 : public ProcessorCoreBase {
   resampler::AnyFreqInOut<ConvertWithModelBlockSize> any_freq_in_out_;
 
   // モデル
-  Beatrice20a2_PhoneExtractor* phone_extractor_;
-  Beatrice20a2_PitchEstimator* pitch_estimator_;
-  Beatrice20a2_WaveformGenerator* waveform_generator_;
+  std::shared_ptr<const SharedModel> model_;
   AlignedVector<float, 64> speaker_embeddings_;
   std::vector<float> formant_shift_embeddings_;
   Gain gain_;
   // 状態
-  Beatrice20a2_PhoneContext1* phone_context_;
-  Beatrice20a2_PitchContext1* pitch_context_;
-  Beatrice20a2_WaveformContext1* waveform_context_;
+  std::unique_ptr<Contexts> contexts_;
   Gain::Context input_gain_context_;
   Gain::Context output_gain_context_;
+  // 音素抽出とピッチ推定の片方を、共有のワーカーで並列に実行する
+  ParallelAnalysis parallel_analysis_;
+  // オフラインでの書き出し時に、複数フレームをパイプライン化して処理する
+  FramePipeline frame_pipeline_;
+  std::vector<Analysis> analyses_;
+  // 負荷の平準化の仕方。オフラインでの書き出し中は平準化しない
+  LoadLevelingMode load_leveling_mode_ = LoadLevelingMode::kDisabled;
+  // 負荷の平準化のため、段階に分けて処理中のフレームの解析結果
+  Analysis staged_analysis_;
 
   // モデルマージ
   std::array<float, kMaxNSpeakers> speaker_morphing_weights_;
   SphericalAverage<float, BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS> sph_avg_;
 
+  // ResetContext() で差し替える予備のコンテキスト
+  ContextPool<Contexts> context_pool_;
+
   auto IsLoaded() -> bool { return !model_file_.empty(); }
   auto ApplySpeakerMorphingWeights() -> ErrorCode;
+  void ProcessBatch(const float* input, float* output, int n_blocks);
   void Process1(const float* input, float* output);
+  // Process1() を、フレーム間で独立に進められる解析と合成に分けたもの
+  void Analyze1(const float* input, Analysis& analysis);
+  void Synthesize1(Analysis& analysis, float* output);
+  // Process1() を、ピッチ推定、音素抽出、合成の段階に分けたもの
+  static constexpr int kNStages = 3;
+  void RunStage(int stage, const float* input, float* output);
+  void EstimatePitch1(const float* input, Analysis& analysis);
+  void ExtractPhone1(const float* input, Analysis& analysis);
 };
 
 }  // namespace beatrice::common
@@ -6,21 +6,53 @@
 #include <array>
 #include <cassert>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <filesystem>
 #include <limits>
+#include <memory>
 #include <numeric>
+#include <optional>
 #include <random>
+#include <span>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "beatricelib/beatrice.h"
+#include "common/analysis_cache.h"
 #include "common/error.h"
+#include "common/hasher.h"
+#include "common/memory_footprint.h"
+#include "common/memory_residency.h"
 #include "common/model_config.h"
+#include "common/model_registry.h"
+#include "common/performance_profile.h"
+#include "common/quality_controller.h"
+#include "common/speaker_embedding_cache.h"
+#include "common/speaker_table.h"
+#include "common/stage_timings.h"
+#include "common/spherical_average.h"
+#include "common/thread_pool.h"
 #include "common/voice_morph_state.h"
 
 namespace beatrice::common {
 
 auto ProcessorCore2::GetVersion() const -> int { return 2; }
+
+auto ProcessorCore2::GetLoadTimings() const
+    -> std::vector<StageTimings::Stage> {
+  if (!model_) {
+    return {};
+  }
+  auto stages = model_->load_timings.GetStages();
+  for (auto& stage : load_timings_.GetStages()) {
+    stages.push_back(std::move(stage));
+  }
+  return stages;
+}
+
 auto ProcessorCore2::Process(const float* const input, float* const output,
                              const int n_samples) -> ErrorCode {
   const auto fill_zero = [output, n_samples]() -> void {
@@ -41,13 +73,127 @@ auto ProcessorCore2::Process(const float* const input, float* const output,
   if (pitch_correction_type_ < 0 || pitch_correction_type_ > 1) {
     return fill_zero(), ErrorCode::kInvalidPitchCorrectionType;
   }
+  if (shared_analyses_) {
+    shared_analyses_->n_analyses = 0;
+  }
+  n_shared_analyses_read_ = 0;
   gain_.Process(input, output, n_samples, input_gain_context_);
   any_freq_in_out_(output, output, n_samples, *this);
   gain_.Process(output, output, n_samples, output_gain_context_);
   return ErrorCode::kSuccess;
 }
 
+void ProcessorCore2::ProcessBatch(const float* const input,
+                                  float* const output, const int n_blocks) {
+  frame_pipeline_.Process<BEATRICE_IN_HOP_LENGTH, BEATRICE_OUT_HOP_LENGTH>(
+      input, output, n_blocks, analyses_,
+      [this](const float* const frame, Analysis& analysis) {
+        Analyze1(frame, analysis);
+      },
+      [this](Analysis& analysis, float* const frame) {
+        // 解析は別スレッドで進むので含めないが、書き出しでは予算を使わない
+        deferred_tasks_.BeginFrame();
+        Synthesize1(analysis, frame);
+      });
+}
+
 void ProcessorCore2::Process1(const float* const input, float* const output) {
+  auto analysis = Analysis();
+  // 解析の処理時間も、タスクの予算から差し引く
+  deferred_tasks_.BeginFrame();
+  Analyze1(input, analysis);
+  Synthesize1(analysis, output);
+}
+
+void ProcessorCore2::Analyze1(const float* const input, Analysis& analysis) {
+  // 解析結果は Synthesize1() で渡し元から受け取る
+  if (analysis_source_) {
+    return;
+  }
+  if (analysis_cache_) {
+    analysis_cache_->SetSettings(GetAnalysisSettings());
+    if (analysis_cache_->Find(
+            std::span(input, BEATRICE_IN_HOP_LENGTH),
+            std::as_writable_bytes(std::span(&analysis, 1)))) {
+      return;
+    }
+    ReplaySkippedHops();
+  }
+  // 音素抽出とピッチ推定は同じ入力から独立に行えるので、並列に実行できる
+  auto estimate_pitch = [&] { EstimatePitch1(input, analysis); };
+  parallel_analysis_.Run(estimate_pitch,
+                         [&] { ExtractPhone1(input, analysis); });
+  if (analysis_cache_) {
+    analysis_cache_->Insert(std::as_bytes(std::span(&analysis, 1)));
+  }
+}
+
+// 解析結果に影響する設定のハッシュ。VQ を使う場合は音素が目標話者の
+// codebook で量子化されるので目標話者も含め、モーフィング中は codebook を
+// ホップごとに抽選するのでキャッシュしない
+auto ProcessorCore2::GetAnalysisSettings() const
+    -> std::optional<std::uint64_t> {
+  const auto vq_num_neighbors =
+      std::min(vq_num_neighbors_, max_vq_num_neighbors_);
+  if (vq_num_neighbors > 0 && target_speaker_ == n_speakers_) {
+    return std::nullopt;
+  }
+  const auto settings = std::array<double, 4>{
+      min_source_pitch_, max_source_pitch_,
+      static_cast<double>(vq_num_neighbors),
+      vq_num_neighbors > 0 ? static_cast<double>(target_speaker_) : -1.0};
+  auto hasher = Hasher();
+  hasher.Update(reinterpret_cast<const std::byte*>(settings.data()),
+                sizeof(settings));
+  return hasher.Get();
+}
+
+// キャッシュの記録から返したホップの入力を解析側のコンテキストに通し、
+// キャッシュを使わない場合と同じ状態にする。
+// 自身で解析する前と、解析側のコンテキストの設定を変える前に呼ぶ
+void ProcessorCore2::ReplaySkippedHops() {
+  if (!analysis_cache_) {
+    return;
+  }
+  const auto inputs = analysis_cache_->GetSkippedInputs();
+  auto discarded = Analysis();
+  for (auto offset = std::size_t{0}; offset < inputs.size();
+       offset += BEATRICE_IN_HOP_LENGTH) {
+    const auto* const hop = inputs.data() + offset;
+    auto estimate_pitch = [&] { EstimatePitch1(hop, discarded); };
+    parallel_analysis_.Run(estimate_pitch,
+                           [&] { ExtractPhone1(hop, discarded); });
+  }
+  analysis_cache_->ClearSkippedInputs();
+}
+
+// オフラインでの書き出し中で、自身で解析を行う場合のみキャッシュを使う
+void ProcessorCore2::UpdateAnalysisCache() {
+  if (!AnalysisCache::IsEnabled() || !frame_pipeline_.IsEnabled() ||
+      !IsLoaded() || analysis_source_) {
+    analysis_cache_.reset();
+    return;
+  }
+  if (!analysis_cache_) {
+    const auto directory = model_file_.parent_path();
+    analysis_cache_ = std::make_unique<AnalysisCache>(
+        std::vector{directory / "phone_extractor.bin",
+                    directory / "pitch_estimator.bin"},
+        sizeof(Analysis));
+  }
+}
+
+void ProcessorCore2::EstimatePitch1(const float* const input,
+                                    Analysis& analysis) {
+  Beatrice20rc0_EstimatePitch1(model_->pitch_estimator, input,
+                               &analysis.quantized_pitch,
+                               analysis.pitch_feature.data(), contexts_->pitch);
+}
+
+// モーフィングは音素抽出側のコンテキストだけを更新する。
+// speaker_morphing_state_counter_ は Synthesize1() で進める
+void ProcessorCore2::ExtractPhone1(const float* const input,
+                                   Analysis& analysis) {
   if (target_speaker_ == n_speakers_) {
     // モーフィング処理
     // codebookについては色々処理の候補があるのでマクロで分岐
@@ -69,30 +215,24 @@ void ProcessorCore2::Process1(const float* const input, float* const output) {
         }
         sph_avgs_c_[i].GetResult(
             BEATRICE_20RC0_PHONE_CHANNELS,
-            codebooks_.data() +
-                (n_speakers_ * BEATRICE_20RC0_CODEBOOK_SIZE + i) *
-                    BEATRICE_20RC0_PHONE_CHANNELS);
+            morphed_codebook_.data() + i * BEATRICE_20RC0_PHONE_CHANNELS);
       }
     } else if (speaker_morphing_state_counter_ == kSphAvgMaxNState) {
-      Beatrice20rc0_SetCodebook(
-          phone_context_,
-          codebooks_.data() + n_speakers_ * (BEATRICE_20RC0_CODEBOOK_SIZE *
-                                             BEATRICE_20RC0_PHONE_CHANNELS));
+      Beatrice20rc0_SetCodebook(contexts_->phone, morphed_codebook_.data());
     }
 #elif 0
     if (speaker_morphing_state_counter_ == 0) {
       // 最大重みを持つ話者の情報をそのまま採用する場合
-      // この場合 codebook のサイズは
-      // (n_speaker_+1)ではなくて(n_speaker_)で十分
+      // この場合 morphed_codebook_ は使わない
       Beatrice20rc0_SetCodebook(
-          phone_context_,
-          codebooks_.data() + speaker_morphing_weights_argsort_indices_[0] *
-                                  (BEATRICE_20RC0_CODEBOOK_SIZE *
-                                   BEATRICE_20RC0_PHONE_CHANNELS));
+          contexts_->phone,
+          model_->codebooks.GetSpeaker(
+              speaker_morphing_weights_argsort_indices_[0],
+              target_codebook_.data()));
     }
 #else
     // 重みを抽選確率として用いて毎フレームランダムな話者ののものを抽選で選ぶ場合
-    // この場合も codebook のサイズは (n_speaker_+1)ではなくて(n_speaker_)で十分
+    // この場合も morphed_codebook_ は使わない
     const auto n_weights = std::min(n_speakers_, kSphAvgMaxNSpeakers);
     auto weight_sum = 0.0f;
     for (auto i = 0; i < n_weights; ++i) {
@@ -115,78 +255,60 @@ void ProcessorCore2::Process1(const float* const input, float* const output) {
         }
       }
     }
-    Beatrice20rc0_SetCodebook(
-        phone_context_,
-        codebooks_.data() + idx * (BEATRICE_20RC0_CODEBOOK_SIZE *
-                                   BEATRICE_20RC0_PHONE_CHANNELS));
+    Beatrice20rc0_SetCodebook(contexts_->phone, GetLotteryCodebook(idx));
 #endif
+  }
+  Beatrice20rc0_ExtractPhone1(model_->phone_extractor, input,
+                              analysis.phone.data(), contexts_->phone);
+}
 
-    if (speaker_morphing_state_counter_ == 0) {
-      // additive_speaker_embeddings については
-      // 重みの更新があった次のフレームで一気に更新する
-      sph_avg_a_.SetWeights(n_speakers_,
-                            speaker_morphing_weights_pruned_.data(),
-                            speaker_morphing_weights_argsort_indices_.data());
-      for (int j = 0; j < kSphAvgMaxNUpdates; ++j) {
-        if (sph_avg_a_.Update()) break;
+void ProcessorCore2::RunStage(const int stage, const float* const input,
+                              float* const output) {
+  switch (stage) {
+    case 0:
+      // 段階の間の、他の処理をしている時間はフレームの処理時間に含めない
+      deferred_tasks_.BeginFrame();
+      if (!analysis_source_) {
+        EstimatePitch1(input, staged_analysis_);
       }
-      sph_avg_a_.GetResult(
-          BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
-          additive_speaker_embeddings_.data() +
-              n_speakers_ * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
-      Beatrice20rc0_SetAdditiveSpeakerEmbedding(
-          embedding_setter_,
-          additive_speaker_embeddings_.data() +
-              n_speakers_ * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
-          embedding_context_, waveform_context_);
-    }
-
-    if (speaker_morphing_state_counter_ < kSphAvgMaxNState) {
-      // key_value_speaker_embeddings_ の spherical average については
-      // 重めの処理なので数フレームに分けて計算する
-      auto start_idx = BEATRICE_20RC0_KV_LENGTH *
-                       speaker_morphing_state_counter_ / kSphAvgMaxNState;
-      auto end_idx = BEATRICE_20RC0_KV_LENGTH *
-                     (speaker_morphing_state_counter_ + 1) / kSphAvgMaxNState;
-      for (int i = start_idx; i < end_idx; ++i) {
-        sph_avgs_k_[i].SetWeights(
-            n_speakers_, speaker_morphing_weights_pruned_.data(),
-            speaker_morphing_weights_argsort_indices_.data());
-        for (int j = 0; j < kSphAvgMaxNUpdates; ++j) {
-          if (sph_avgs_k_[i].Update()) break;
-        }
-        sph_avgs_k_[i].GetResult(
-            BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
-            key_value_speaker_embeddings_.data() +
-                (n_speakers_ * BEATRICE_20RC0_KV_LENGTH + i) *
-                    BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS);
+      deferred_tasks_.Suspend();
+      break;
+    case 1:
+      deferred_tasks_.Resume();
+      if (!analysis_source_) {
+        ExtractPhone1(input, staged_analysis_);
       }
-    } else if (speaker_morphing_state_counter_ == kSphAvgMaxNState) {
-      Beatrice20rc0_RegisterKeyValueSpeakerEmbedding(
-          embedding_setter_,
-          key_value_speaker_embeddings_.data() +
-              n_speakers_ * (BEATRICE_20RC0_KV_LENGTH *
-                             BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS),
-          embedding_context_);
-      key_value_speaker_embedding_set_count_ = 0;
-    }
+      deferred_tasks_.Suspend();
+      break;
+    default:
+      deferred_tasks_.Resume();
+      Synthesize1(staged_analysis_, output);
+      break;
+  }
+}
 
-    if (speaker_morphing_state_counter_ <= kSphAvgMaxNState) {
-      ++speaker_morphing_state_counter_;
-    }
+auto ProcessorCore2::MeasureStageCosts(
+    const int n_frames,
+    std::array<double, PerformanceProfile::kNStages>& stage_seconds)
+    -> ErrorCode {
+  if (!IsLoaded()) {
+    return ErrorCode::kModelNotLoaded;
   }
+  stage_seconds =
+      MeasureStageSeconds<BEATRICE_IN_HOP_LENGTH, BEATRICE_OUT_HOP_LENGTH>(
+          n_frames, BEATRICE_IN_SAMPLE_RATE,
+          [this](const int stage, const float* const input,
+                 float* const output) { RunStage(stage, input, output); });
+  return ErrorCode::kSuccess;
+}
 
-  // Beatrice20rc0_SetKeyValueSpeakerEmbedding は重めの処理なので
-  // 4 フレームかけて処理する
-  SetKeyValueSpeakerEmbedding();
+// deferred_tasks_.BeginFrame() は解析の前に呼び出し側で呼ぶ
+void ProcessorCore2::Synthesize1(Analysis& analysis, float* const output) {
+  // モーフィングや話者の切り替えに伴う重い処理を、予算の範囲で進める
+  deferred_tasks_.Run();
+  ShareAnalysis(analysis);
 
-  std::array<float, BEATRICE_20RC0_PHONE_CHANNELS> phone;
-  Beatrice20rc0_ExtractPhone1(phone_extractor_, input, phone.data(),
-                              phone_context_);
-  int quantized_pitch;
-  std::array<float, 4> pitch_feature;
-  Beatrice20rc0_EstimatePitch1(pitch_estimator_, input, &quantized_pitch,
-                               pitch_feature.data(), pitch_context_);
+  auto& quantized_pitch = analysis.quantized_pitch;
   constexpr auto kPitchBinsPerSemitone =
       static_cast<double>(BEATRICE_PITCH_BINS_PER_OCTAVE) / 12.0;
   // PitchShift, IntonationIntensity
@@ -250,29 +372,156 @@ void ProcessorCore2::Process1(const float* const input, float* const output) {
   quantized_pitch =
       std::clamp(static_cast<int>(std::round(tmp_quantized_pitch)), 1,
                  BEATRICE_20RC0_PITCH_BINS - 1);
-  Beatrice20rc0_GenerateWaveform1(waveform_generator_, phone.data(),
-                                  &quantized_pitch, pitch_feature.data(),
-                                  output, waveform_context_);
+  Beatrice20rc0_GenerateWaveform1(model_->waveform_generator,
+                                  analysis.phone.data(), &quantized_pitch,
+                                  analysis.pitch_feature.data(), output,
+                                  contexts_->waveform);
+  deferred_tasks_.EndFrame();
+}
+
+void ProcessorCore2::ShareAnalysis(Analysis& analysis) {
+  if (analysis_source_) {
+    // リサンプラの位相のずれなどで渡し元よりホップ数が多い場合は、
+    // 最後に受け取ったものを繰り返す。
+    // 音素は渡し元の目標話者の codebook で量子化されている
+    const auto& shared = *analysis_source_->shared_analyses_;
+    if (shared.n_analyses > 0) {
+      analysis = shared.analyses[std::min(n_shared_analyses_read_++,
+                                          shared.n_analyses - 1)];
+    }
+    return;
+  }
+  if (shared_analyses_ &&
+      shared_analyses_->n_analyses < SharedAnalyses::kCapacity) {
+    shared_analyses_->analyses[shared_analyses_->n_analyses++] = analysis;
+  }
+}
+
+auto ProcessorCore2::FollowAnalysis(ProcessorCoreBase& source) -> bool {
+  auto* const source_core = dynamic_cast<ProcessorCore2*>(&source);
+  if (!source_core || source_core == this || source_core->analysis_source_) {
+    return false;
+  }
+  if (!source_core->shared_analyses_) {
+    source_core->shared_analyses_ = std::make_unique<SharedAnalyses>();
+  }
+  analysis_source_ = source_core;
+  UpdateAnalysisCache();
+  return true;
+}
+
+void ProcessorCore2::AddDeferredTasks() {
+  using Status = DeferredTaskScheduler::Status;
+  // additive_speaker_embeddings は軽いので、重みの更新があった次のフレームで
+  // 一気に更新する
+  morph_additive_speaker_embedding_task_ = deferred_tasks_.AddTask(
+      {.priority = 0, .estimated_seconds = 50e-6, .max_wait_frames = 0},
+      [this] { return MorphAdditiveSpeakerEmbedding(); });
+  // 目標話者の切り替えが遅れると聞こえ方に影響するので、
+  // 予算が無くても 1 フレームに 1 ブロックは設定する
+  set_key_value_speaker_embedding_task_ = deferred_tasks_.AddTask(
+      {.priority = 1, .estimated_seconds = 200e-6, .max_wait_frames = 0},
+      [this] {
+        SetKeyValueSpeakerEmbedding();
+        return key_value_speaker_embedding_set_count_ < BEATRICE_20RC0_N_BLOCKS
+                   ? Status::kPending
+                   : Status::kDone;
+      });
+  morph_key_value_speaker_embedding_task_ = deferred_tasks_.AddTask(
+      {.priority = 2, .estimated_seconds = 200e-6, .max_wait_frames = 1},
+      [this] { return MorphKeyValueSpeakerEmbedding(); });
+}
+
+auto ProcessorCore2::MorphAdditiveSpeakerEmbedding()
+    -> DeferredTaskScheduler::Status {
+  if (target_speaker_ != n_speakers_) {
+    return DeferredTaskScheduler::Status::kWaiting;
+  }
+  sph_avg_a_.SetWeights(n_speakers_, speaker_morphing_weights_pruned_.data(),
+                        speaker_morphing_weights_argsort_indices_.data());
+  for (int j = 0; j < sph_avg_max_n_updates_; ++j) {
+    if (sph_avg_a_.Update()) break;
+  }
+  sph_avg_a_.GetResult(BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
+                       morphed_additive_speaker_embedding_.data());
+  Beatrice20rc0_SetAdditiveSpeakerEmbedding(
+      model_->embedding_setter, morphed_additive_speaker_embedding_.data(),
+      contexts_->embedding, contexts_->waveform);
+  return DeferredTaskScheduler::Status::kDone;
+}
+
+// speaker_morphing_state_counter_ 番目の塊の spherical average を計算する。
+// 全ての塊を計算し終えたら登録し、各ブロックへの設定を始める
+auto ProcessorCore2::MorphKeyValueSpeakerEmbedding()
+    -> DeferredTaskScheduler::Status {
+  constexpr auto kNChunks =
+      (BEATRICE_20RC0_KV_LENGTH + kKeyValueMorphingChunkSize - 1) /
+      kKeyValueMorphingChunkSize;
+  if (target_speaker_ != n_speakers_) {
+    return DeferredTaskScheduler::Status::kWaiting;
+  }
+  if (speaker_morphing_state_counter_ < kNChunks) {
+    const auto start_idx =
+        kKeyValueMorphingChunkSize * speaker_morphing_state_counter_;
+    const auto end_idx = std::min(start_idx + kKeyValueMorphingChunkSize,
+                                  BEATRICE_20RC0_KV_LENGTH);
+    for (int i = start_idx; i < end_idx; ++i) {
+      sph_avgs_k_[i].SetWeights(
+          n_speakers_, speaker_morphing_weights_pruned_.data(),
+          speaker_morphing_weights_argsort_indices_.data());
+      for (int j = 0; j < sph_avg_max_n_updates_; ++j) {
+        if (sph_avgs_k_[i].Update()) break;
+      }
+      sph_avgs_k_[i].GetResult(
+          BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
+          morphed_key_value_speaker_embedding_.data() +
+              i * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS);
+    }
+    ++speaker_morphing_state_counter_;
+    return DeferredTaskScheduler::Status::kPending;
+  }
+  Beatrice20rc0_RegisterKeyValueSpeakerEmbedding(
+      model_->embedding_setter, morphed_key_value_speaker_embedding_.data(),
+      contexts_->embedding);
+  contexts_->embedding_speaker = -1;
+  key_value_speaker_embedding_set_count_ = 0;
+  deferred_tasks_.Schedule(set_key_value_speaker_embedding_task_);
+  return DeferredTaskScheduler::Status::kDone;
 }
 
 auto ProcessorCore2::ResetContext() -> ErrorCode {
-  Beatrice20rc0_DestroyPhoneContext1(phone_context_);
-  Beatrice20rc0_DestroyPitchContext1(pitch_context_);
-  Beatrice20rc0_DestroyWaveformContext1(waveform_context_);
-  Beatrice20rc0_DestroyEmbeddingContext(embedding_context_);
-  phone_context_ = Beatrice20rc0_CreatePhoneContext1();
-  pitch_context_ = Beatrice20rc0_CreatePitchContext1();
-  waveform_context_ = Beatrice20rc0_CreateWaveformContext1();
-  embedding_context_ = Beatrice20rc0_CreateEmbeddingContext();
-
-  // 目標話者を再設定
-  auto error = SetTargetSpeaker(target_speaker_);
-  while (SetKeyValueSpeakerEmbedding());
+  auto error = ErrorCode::kSuccess;
+  // 書き出しの度に同じ結果になるよう、抽選の乱数も初期化し直す
+  if (frame_pipeline_.IsEnabled()) {
+    speaker_morphing_codebook_lottery_engine_.seed(std::mt19937::default_seed);
+  }
+  if (analysis_cache_) {
+    analysis_cache_->Rewind();
+  }
+  // 予備のコンテキストがあれば差し替えるだけで済ませる。
+  // 予備が現在の目標話者とフォルマントシフトで設定済みであれば、
+  // それらの再設定も不要になる。
+  if (auto config = std::uint64_t{}; context_pool_.Swap(contexts_, config)) {
+    if (config != GetContextConfig() || target_speaker_ == n_speakers_) {
+      // key-value speaker embedding は Process1() で数フレームかけて設定される
+      error = SetTargetSpeaker(target_speaker_);
+      if (const auto err = SetFormantShift(formant_shift_);
+          error == ErrorCode::kSuccess) {
+        error = err;
+      }
+    }
+  } else {
+    contexts_ = std::make_unique<Contexts>();
 
-  // 各種パラメータを再設定
-  if (const auto err = SetFormantShift(formant_shift_);
-      error == ErrorCode::kSuccess) {
-    error = err;
+    // 目標話者を再設定
+    error = SetTargetSpeaker(target_speaker_);
+    while (SetKeyValueSpeakerEmbedding());
+
+    // 各種パラメータを再設定
+    if (const auto err = SetFormantShift(formant_shift_);
+        error == ErrorCode::kSuccess) {
+      error = err;
+    }
   }
   if (const auto err = SetMinSourcePitch(min_source_pitch_);
       error == ErrorCode::kSuccess) {
@@ -290,80 +539,366 @@ auto ProcessorCore2::ResetContext() -> ErrorCode {
   return error;
 }
 
-auto ProcessorCore2::LoadModel(const ModelConfig& /*config*/,
-                               const std::filesystem::path& new_model_file)
+auto ProcessorCore2::GetContextConfig() const -> std::uint64_t {
+  const auto formant_shift_index =
+      static_cast<int>(std::round(formant_shift_ * 2.0 + 4.0));
+  return (static_cast<std::uint64_t>(target_speaker_) << 8) |
+         static_cast<std::uint64_t>(formant_shift_index);
+}
+
+void ProcessorCore2::PrepareContexts(Contexts& contexts,
+                                     const std::uint64_t config) const {
+  const auto target_speaker = static_cast<int>(config >> 8);
+  const auto formant_shift_index = static_cast<int>(config & 0xff);
+  // モーフィング結果はオーディオスレッドで更新されるので、ここでは設定しない
+  if (target_speaker < model_->n_speakers) {
+    auto codebook = std::vector<float>();
+    if (!model_->codebooks.IsDirectlyAccessible()) {
+      codebook.resize(model_->codebooks.GetSpeakerSize());
+    }
+    Beatrice20rc0_SetCodebook(
+        contexts.phone,
+        model_->codebooks.GetSpeaker(target_speaker, codebook.data()));
+    Beatrice20rc0_SetAdditiveSpeakerEmbedding(
+        model_->embedding_setter,
+        model_->additive_speaker_embeddings.data() +
+            target_speaker * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
+        contexts.embedding, contexts.waveform);
+    RegisterKeyValueSpeakerEmbedding(contexts.embedding, target_speaker);
+    contexts.embedding_speaker = target_speaker;
+    for (auto i = 0; i < BEATRICE_20RC0_N_BLOCKS; ++i) {
+      Beatrice20rc0_SetKeyValueSpeakerEmbedding(model_->embedding_setter, i,
+                                                contexts.embedding,
+                                                contexts.waveform);
+    }
+  }
+  Beatrice20rc0_SetFormantShiftEmbedding(
+      model_->embedding_setter,
+      model_->formant_shift_embeddings.data() +
+          formant_shift_index * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
+      contexts.embedding, contexts.waveform);
+}
+
+void ProcessorCore2::RegisterKeyValueSpeakerEmbedding(
+    Beatrice20rc0_EmbeddingContext* const embedding_context,
+    const int speaker) const {
+  auto key_value_speaker_embedding = std::vector<float>();
+  if (!model_->key_value_speaker_embeddings.IsDirectlyAccessible()) {
+    key_value_speaker_embedding.resize(
+        model_->key_value_speaker_embeddings.GetSpeakerSize());
+  }
+  Beatrice20rc0_RegisterKeyValueSpeakerEmbedding(
+      model_->embedding_setter,
+      model_->key_value_speaker_embeddings.GetSpeaker(
+          speaker, key_value_speaker_embedding.data()),
+      embedding_context);
+}
+
+ProcessorCore2::SharedModel::SharedModel()
+    : phone_extractor(Beatrice20rc0_CreatePhoneExtractor()),
+      pitch_estimator(Beatrice20rc0_CreatePitchEstimator()),
+      waveform_generator(Beatrice20rc0_CreateWaveformGenerator()),
+      embedding_setter(Beatrice20rc0_CreateEmbeddingSetter()) {}
+
+ProcessorCore2::SharedModel::~SharedModel() {
+  Beatrice20rc0_DestroyPhoneExtractor(phone_extractor);
+  Beatrice20rc0_DestroyPitchEstimator(pitch_estimator);
+  Beatrice20rc0_DestroyWaveformGenerator(waveform_generator);
+  Beatrice20rc0_DestroyEmbeddingSetter(embedding_setter);
+}
+
+auto ProcessorCore2::SharedModel::Load(const std::filesystem::path& d,
+                                       const SpeakerTableStorage storage)
     -> ErrorCode {
-  // IsLoaded() が false を返すようにする
-  model_file_.clear();
-  is_ready_to_set_speaker_ = false;
+  const auto total_scope = StageTimings::Scope(load_timings, "total");
+  // 各ファイルは互いに独立しているので並列に読み込む
+  const auto pool = ThreadPool::Acquire();
+  const auto read_parameters = [this, &d, &pool](const char* const name,
+                                                 auto read) {
+    return pool->Submit([this, &d, name, read]() -> ErrorCode {
+      const auto scope = StageTimings::Scope(load_timings, name);
+      const auto file = (d / name).u8string();
+      return static_cast<ErrorCode>(
+          read(reinterpret_cast<const char*>(file.c_str())));
+    });
+  };
+  auto results = std::array{
+      read_parameters("phone_extractor.bin",
+                      [this](const char* const file) {
+                        return Beatrice20rc0_ReadPhoneExtractorParameters(
+                            phone_extractor, file);
+                      }),
+      read_parameters("pitch_estimator.bin",
+                      [this](const char* const file) {
+                        return Beatrice20rc0_ReadPitchEstimatorParameters(
+                            pitch_estimator, file);
+                      }),
+      read_parameters("waveform_generator.bin",
+                      [this](const char* const file) {
+                        return Beatrice20rc0_ReadWaveformGeneratorParameters(
+                            waveform_generator, file);
+                      }),
+      read_parameters("embedding_setter.bin",
+                      [this](const char* const file) {
+                        return Beatrice20rc0_ReadEmbeddingSetterParameters(
+                            embedding_setter, file);
+                      }),
+      // 話者埋め込みを読み込む
+      // 並べ替え・正規化済みのキャッシュがあればそれを使う
+      pool->Submit([this, &d, storage]() -> ErrorCode {
+        const auto scope =
+            StageTimings::Scope(load_timings, "speaker_embeddings.bin");
+        const auto speaker_embeddings_file = d / "speaker_embeddings.bin";
+        if (auto cache = SpeakerEmbeddingCache::Open(speaker_embeddings_file)) {
+          LoadSpeakerEmbeddingsFromCache(std::move(cache), storage);
+          return ErrorCode::kSuccess;
+        }
+        return ReadSpeakerEmbeddings(speaker_embeddings_file, storage);
+      }),
+  };
+  // 全て終わるのを待ってから、元の読み込み順で最初のエラーを返す
+  auto error_code = ErrorCode::kSuccess;
+  for (auto& result : results) {
+    if (const auto err = result.get();
+        error_code == ErrorCode::kSuccess) {
+      error_code = err;
+    }
+  }
+  if (error_code == ErrorCode::kSuccess) {
+    const auto scope = StageTimings::Scope(load_timings, "residency");
+    MakeResident();
+  }
+  return error_code;
+}
 
-  // 各種パラメータを読み込む
-  const auto d = new_model_file.parent_path();
-  if (const auto err = Beatrice20rc0_ReadPhoneExtractorParameters(
-          phone_extractor_,
-          reinterpret_cast<const char*>(
-              (d / "phone_extractor.bin").u8string().c_str()))) {
-    return static_cast<ErrorCode>(err);
+// オーディオスレッドで最初に参照した時や、しばらく使われなかった後に
+// ページフォルトが起きないよう、話者ごとのテーブルを常駐させる。
+// ネットワークの重みは信号処理ライブラリの内部にあるので、
+// 読み込み後の無音の処理でフォルトさせておく
+void ProcessorCore2::SharedModel::MakeResident() {
+  constexpr auto kKeyValueSpeakerEmbeddingSize =
+      BEATRICE_20RC0_KV_LENGTH * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS;
+  // 各 kv_index のブロックは連続して並んでいる
+  const auto n_key_value_elements =
+      static_cast<std::size_t>(n_speakers) * kKeyValueSpeakerEmbeddingSize;
+  // 前処理済みのキャッシュを参照しているものは、読み込み専用のファイルの
+  // マッピングにある
+  const auto is_cached = speaker_embedding_cache != nullptr;
+  residency.Add(codebooks.GetBytes(), codebooks.IsView());
+  residency.Add(key_value_speaker_embeddings.GetBytes(),
+                key_value_speaker_embeddings.IsView());
+  if (HasKeyValueBlocks()) {
+    residency.Add(
+        std::as_bytes(std::span(GetKeyValueBlock(0), n_key_value_elements)),
+        is_cached);
+    residency.Add(std::as_bytes(std::span(GetNormalizedKeyValueBlock(0),
+                                          n_key_value_elements)),
+                  is_cached);
   }
-  if (const auto err = Beatrice20rc0_ReadPitchEstimatorParameters(
-          pitch_estimator_,
-          reinterpret_cast<const char*>(
-              (d / "pitch_estimator.bin").u8string().c_str()))) {
+  residency.Add(std::as_bytes(std::span(additive_speaker_embeddings)));
+  residency.Add(std::as_bytes(std::span(formant_shift_embeddings)));
+}
+
+auto ProcessorCore2::SharedModel::ReadSpeakerEmbeddings(
+    const std::filesystem::path& speaker_embeddings_file,
+    const SpeakerTableStorage storage) -> ErrorCode {
+  const auto file_u8 = speaker_embeddings_file.u8string();
+  const auto* const file = reinterpret_cast<const char*>(file_u8.c_str());
+  if (const auto err = Beatrice20rc0_ReadNSpeakers(file, &n_speakers)) {
     return static_cast<ErrorCode>(err);
   }
-  if (const auto err = Beatrice20rc0_ReadWaveformGeneratorParameters(
-          waveform_generator_,
-          reinterpret_cast<const char*>(
-              (d / "waveform_generator.bin").u8string().c_str()))) {
-    return static_cast<ErrorCode>(err);
+  // codebook と key-value speaker embedding は一旦 float で読み込み、
+  // キャッシュを書き出してから指定された形式で保持する
+  constexpr auto kCodebookSize =
+      BEATRICE_20RC0_CODEBOOK_SIZE * BEATRICE_20RC0_PHONE_CHANNELS;
+  constexpr auto kKeyValueSpeakerEmbeddingSize =
+      BEATRICE_20RC0_KV_LENGTH * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS;
+  AlignedVector<float, 64> codebooks_f32(n_speakers * kCodebookSize);
+  AlignedVector<float, 64> key_value_speaker_embeddings_f32(
+      n_speakers * kKeyValueSpeakerEmbeddingSize);
+  additive_speaker_embeddings.resize(
+      n_speakers * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
+  formant_shift_embeddings.resize(9 *
+                                  BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
+  {
+    const auto scope =
+        StageTimings::Scope(load_timings, "speaker embeddings: read");
+    if (const auto err = Beatrice20rc0_ReadSpeakerEmbeddings(
+            file, codebooks_f32.data(), additive_speaker_embeddings.data(),
+            formant_shift_embeddings.data(),
+            key_value_speaker_embeddings_f32.data())) {
+      return static_cast<ErrorCode>(err);
+    }
   }
-  if (const auto err = Beatrice20rc0_ReadEmbeddingSetterParameters(
-          embedding_setter_,
-          reinterpret_cast<const char*>(
-              (d / "embedding_setter.bin").u8string().c_str()))) {
-    return static_cast<ErrorCode>(err);
+
+  // 次回以降の読み込みのためにキャッシュを書き出しておく。
+  // key-value モーフィングの sph_avg 用に並べ替えて正規化したブロックは、
+  // 書き出す分を 1 つずつ作るだけで保持はしない
+  constexpr auto kChannels = BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS;
+  AlignedVector<float, 64> key_value_block(n_speakers * kChannels);
+  AlignedVector<float, 64> normalized_key_value_block(n_speakers * kChannels);
+  const auto make_key_value_block = [&](const int i) -> void {
+    for (int j = 0; j < n_speakers; ++j) {
+      std::copy_n(key_value_speaker_embeddings_f32.data() +
+                      (j * BEATRICE_20RC0_KV_LENGTH + i) * kChannels,
+                  kChannels, key_value_block.data() + j * kChannels);
+    }
+  };
+  const auto scope =
+      StageTimings::Scope(load_timings, "speaker embeddings: write cache");
+  SpeakerEmbeddingCache::Write(
+      speaker_embeddings_file, n_speakers, codebooks_f32.data(),
+      additive_speaker_embeddings.data(), formant_shift_embeddings.data(),
+      key_value_speaker_embeddings_f32.data(),
+      [&](const int i) -> const float* {
+        make_key_value_block(i);
+        return key_value_block.data();
+      },
+      [&](const int i) -> const float* {
+        make_key_value_block(i);
+        SphericalAverage<float, kChannels>::NormalizeVectors(
+            n_speakers, key_value_block.data(),
+            normalized_key_value_block.data());
+        return normalized_key_value_block.data();
+      });
+
+  codebooks.Assign(storage, std::move(codebooks_f32), n_speakers,
+                   BEATRICE_20RC0_CODEBOOK_SIZE,
+                   BEATRICE_20RC0_PHONE_CHANNELS);
+  key_value_speaker_embeddings.Assign(
+      storage, std::move(key_value_speaker_embeddings_f32), n_speakers,
+      BEATRICE_20RC0_KV_LENGTH, kChannels);
+  return ErrorCode::kSuccess;
+}
+
+void ProcessorCore2::SharedModel::LoadSpeakerEmbeddingsFromCache(
+    std::shared_ptr<const SpeakerEmbeddingCache> cache,
+    const SpeakerTableStorage storage) {
+  n_speakers = cache->GetNSpeakers();
+  // additive と formant shift は小さいのでコピーする
+  additive_speaker_embeddings.assign(
+      cache->GetAdditiveSpeakerEmbeddings(),
+      cache->GetAdditiveSpeakerEmbeddings() +
+          n_speakers * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
+  formant_shift_embeddings.assign(
+      cache->GetFormantShiftEmbeddings(),
+      cache->GetFormantShiftEmbeddings() +
+          9 * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
+  // 大きいテーブルはマップした領域をそのまま参照する
+  if (storage == SpeakerTableStorage::kFloat32) {
+    codebooks.AssignView(cache->GetCodebooks(), n_speakers,
+                         BEATRICE_20RC0_CODEBOOK_SIZE,
+                         BEATRICE_20RC0_PHONE_CHANNELS, cache->GetFile());
+    key_value_speaker_embeddings.AssignView(
+        cache->GetKeyValueSpeakerEmbeddings(), n_speakers,
+        BEATRICE_20RC0_KV_LENGTH, BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
+        cache->GetFile());
+  } else {
+    codebooks.Assign(storage, cache->GetCodebooks(), n_speakers,
+                     BEATRICE_20RC0_CODEBOOK_SIZE,
+                     BEATRICE_20RC0_PHONE_CHANNELS);
+    key_value_speaker_embeddings.Assign(
+        storage, cache->GetKeyValueSpeakerEmbeddings(), n_speakers,
+        BEATRICE_20RC0_KV_LENGTH,
+        BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS);
   }
+  speaker_embedding_cache = std::move(cache);
+}
 
-  // 話者埋め込みを読み込む
-  if (const auto err = Beatrice20rc0_ReadNSpeakers(
-          reinterpret_cast<const char*>(
-              (d / "speaker_embeddings.bin").u8string().c_str()),
-          &n_speakers_)) {
-    return static_cast<ErrorCode>(err);
+// キャッシュのブロックは float32 なので、他の形式が指定されている場合は
+// 使わずに key_value_speaker_embeddings から取り出す
+auto ProcessorCore2::SharedModel::HasKeyValueBlocks() const -> bool {
+  return speaker_embedding_cache &&
+         key_value_speaker_embeddings.IsDirectlyAccessible();
+}
+
+auto ProcessorCore2::SharedModel::GetKeyValueBlock(const int kv_index) const
+    -> const float* {
+  assert(HasKeyValueBlocks());
+  return speaker_embedding_cache->GetKeyValueBlock(kv_index);
+}
+
+auto ProcessorCore2::SharedModel::GetNormalizedKeyValueBlock(
+    const int kv_index) const -> const float* {
+  assert(HasKeyValueBlocks());
+  return speaker_embedding_cache->GetNormalizedKeyValueBlock(kv_index);
+}
+
+void ProcessorCore2::GetMemoryFootprint(MemoryFootprint& footprint) const {
+  footprint.Add("processor core", sizeof(*this));
+  footprint.Add("resampler", any_freq_in_out_.GetMemoryUsage());
+  if (shared_analyses_) {
+    footprint.Add("shared analyses", sizeof(SharedAnalyses));
   }
-  // ここで (n_speakers_ + 1) なのは、末尾にモーフィング結果を格納するため
-  codebooks_.resize((n_speakers_ + 1) * (BEATRICE_20RC0_CODEBOOK_SIZE *
-                                         BEATRICE_20RC0_PHONE_CHANNELS));
-  additive_speaker_embeddings_.resize(
-      (n_speakers_ + 1) * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
-  formant_shift_embeddings_.resize(9 *
-                                   BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
-  key_value_speaker_embeddings_.resize(
-      (n_speakers_ + 1) * (BEATRICE_20RC0_KV_LENGTH *
-                           BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS));
-  if (const auto err = Beatrice20rc0_ReadSpeakerEmbeddings(
-          reinterpret_cast<const char*>(
-              (d / "speaker_embeddings.bin").u8string().c_str()),
-          codebooks_.data(), additive_speaker_embeddings_.data(),
-          formant_shift_embeddings_.data(),
-          key_value_speaker_embeddings_.data())) {
-    return static_cast<ErrorCode>(err);
+  if (analysis_cache_) {
+    footprint.Add("analysis cache", analysis_cache_->GetMemoryUsage());
+  }
+  footprint.Add("morphing buffers",
+                MemoryFootprint::SizeOf(target_codebook_) +
+                    MemoryFootprint::SizeOf(
+                        target_key_value_speaker_embedding_) +
+                    MemoryFootprint::SizeOf(morphed_codebook_) +
+                    MemoryFootprint::SizeOf(
+                        morphed_additive_speaker_embedding_) +
+                    MemoryFootprint::SizeOf(
+                        morphed_key_value_speaker_embedding_) +
+                    MemoryFootprint::SizeOf(lottery_codebooks_));
+  auto spherical_average_bytes = sph_avg_a_.GetMemoryUsage();
+  for (const auto& sph_avg : sph_avgs_k_) {
+    spherical_average_bytes += sph_avg.GetMemoryUsage();
   }
+  footprint.Add("spherical average", spherical_average_bytes);
+  if (!model_) {
+    return;
+  }
+  // 以下は同じモデルを使う他のインスタンスと共有している
+  const auto d = model_file_.parent_path();
+  footprint.Add("network weights",
+                MemoryFootprint::FileSizeOf(d / "phone_extractor.bin") +
+                    MemoryFootprint::FileSizeOf(d / "pitch_estimator.bin") +
+                    MemoryFootprint::FileSizeOf(d / "waveform_generator.bin") +
+                    MemoryFootprint::FileSizeOf(d / "embedding_setter.bin"),
+                true);
+  // キャッシュをマップした領域を直接参照している場合は、その分は数えない
+  if (const auto& cache = model_->speaker_embedding_cache) {
+    footprint.Add("speaker embedding cache (mapped)",
+                  cache->GetFile()->GetSize(), true);
+  }
+  if (!model_->speaker_embedding_cache ||
+      !model_->codebooks.IsDirectlyAccessible()) {
+    footprint.Add("codebooks", model_->codebooks.GetBytes().size(), true);
+    footprint.Add("key-value speaker embeddings",
+                  model_->key_value_speaker_embeddings.GetBytes().size(),
+                  true);
+  }
+  footprint.Add("speaker embeddings",
+                MemoryFootprint::SizeOf(model_->additive_speaker_embeddings) +
+                    MemoryFootprint::SizeOf(model_->formant_shift_embeddings),
+                true);
+}
+
+auto ProcessorCore2::LoadModel(const ModelConfig& /*config*/,
+                               const std::filesystem::path& new_model_file)
+    -> ErrorCode {
+  // IsLoaded() が false を返すようにする
+  model_file_.clear();
+  is_ready_to_set_speaker_ = false;
+  // 前のモデルの解析結果を保存して閉じる
+  analysis_cache_.reset();
 
-  // モーフィング結果格納用の領域はファイルからの読み込み時に初期化されないので念の為ここで初期化しておく
-  std::fill_n(codebooks_.data() + n_speakers_ * (BEATRICE_20RC0_CODEBOOK_SIZE *
-                                                 BEATRICE_20RC0_PHONE_CHANNELS),
-              BEATRICE_20RC0_CODEBOOK_SIZE * BEATRICE_20RC0_PHONE_CHANNELS,
-              0.0f);
-  std::fill_n(additive_speaker_embeddings_.data() +
-                  n_speakers_ * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
-              BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS, 0.0f);
-  std::fill_n(
-      key_value_speaker_embeddings_.data() +
-          n_speakers_ * (BEATRICE_20RC0_KV_LENGTH *
-                         BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS),
-      BEATRICE_20RC0_KV_LENGTH * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
-      0.0f);
+  // 重みと話者テーブルは同じモデルを使う他のインスタンスと共有する
+  const auto d = new_model_file.parent_path();
+  auto new_model = std::shared_ptr<const SharedModel>();
+  if (const auto err = ModelRegistry::Acquire<SharedModel>(
+          d, std::to_string(static_cast<int>(speaker_table_storage_)),
+          [this, &d](SharedModel& model) -> ErrorCode {
+            return model.Load(d, speaker_table_storage_);
+          },
+          new_model);
+      err != ErrorCode::kSuccess) {
+    return err;
+  }
+  n_speakers_ = new_model->n_speakers;
 
 #if 0
   // codebook モーフィング用に sph_avg を初期化する
@@ -371,39 +906,77 @@ auto ProcessorCore2::LoadModel(const ModelConfig& /*config*/,
                                     BEATRICE_20RC0_PHONE_CHANNELS);
   for (int i = 0; i < BEATRICE_20RC0_CODEBOOK_SIZE; ++i) {
     for (int j = 0; j < n_speakers_; ++j) {
-      std::copy_n(codebooks_.data() + (j * BEATRICE_20RC0_CODEBOOK_SIZE + i) *
-                                          BEATRICE_20RC0_PHONE_CHANNELS,
-                  BEATRICE_20RC0_PHONE_CHANNELS,
-                  codebook_block.data() + j * BEATRICE_20RC0_PHONE_CHANNELS);
+      new_model->codebooks.ExpandRows(
+          j * BEATRICE_20RC0_CODEBOOK_SIZE + i, 1,
+          codebook_block.data() + j * BEATRICE_20RC0_PHONE_CHANNELS);
     }
     sph_avgs_c_[i].Initialize(n_speakers_, BEATRICE_20RC0_PHONE_CHANNELS,
                               codebook_block.data(), kSphAvgMaxNSpeakers);
   }
 #endif
 
-  // additive_speaker_embeddings モーフィング用の sph_avg を初期化する
-  sph_avg_a_.Initialize(n_speakers_,
-                        BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
-                        additive_speaker_embeddings_.data(),
-                        std::min(n_speakers_, kSphAvgMaxNSpeakers));
+  {
+    const auto scope = StageTimings::Scope(load_timings_, "morphing");
+    // additive_speaker_embeddings モーフィング用の sph_avg を初期化する
+    sph_avg_a_.Initialize(n_speakers_,
+                          BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
+                          new_model->additive_speaker_embeddings.data(),
+                          std::min(n_speakers_, kSphAvgMaxNSpeakers));
 
-  // key-value モーフィング用に sph_avg を初期化する
-  std::vector<float> key_value_block(
-      n_speakers_ * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS);
-  for (int i = 0; i < BEATRICE_20RC0_KV_LENGTH; ++i) {
-    for (int j = 0; j < n_speakers_; ++j) {
-      std::copy_n(key_value_speaker_embeddings_.data() +
-                      (j * BEATRICE_20RC0_KV_LENGTH + i) *
-                          BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
-                  BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
-                  key_value_block.data() +
-                      j * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS);
-    }
-    sph_avgs_k_[i].Initialize(
-        n_speakers_, BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
-        key_value_block.data(), std::min(n_speakers_, kSphAvgMaxNSpeakers));
+    // key-value モーフィング用の sph_avg は、キャッシュのブロックがあれば
+    // それを参照し、無ければ選ばれた話者の行だけを共有のテーブルから取り出す。
+    // 行ごとに独立しているので並列に初期化する。
+    ThreadPool::Acquire()->ParallelFor(
+        BEATRICE_20RC0_KV_LENGTH, [this, &new_model](const int i) {
+          constexpr auto kChannels =
+              BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS;
+          const auto n_points = std::min(n_speakers_, kSphAvgMaxNSpeakers);
+          if (new_model->HasKeyValueBlocks()) {
+            sph_avgs_k_[i].InitializeWithNormalizedVectors(
+                n_speakers_, kChannels, new_model->GetKeyValueBlock(i),
+                new_model->GetNormalizedKeyValueBlock(i), n_points);
+            return;
+          }
+          sph_avgs_k_[i].InitializeWithVectorGetter(
+              n_speakers_, kChannels,
+              [table = &new_model->key_value_speaker_embeddings, i](
+                  const std::size_t speaker, float* const dst) -> void {
+                table->ExpandRows(
+                    static_cast<int>(speaker) * BEATRICE_20RC0_KV_LENGTH + i,
+                    1, dst);
+              },
+              n_points);
+        });
+  }
+  model_ = std::move(new_model);
+
+  // モーフィング結果格納用の領域を初期化しておく
+  constexpr auto kCodebookSize =
+      BEATRICE_20RC0_CODEBOOK_SIZE * BEATRICE_20RC0_PHONE_CHANNELS;
+  constexpr auto kKeyValueSpeakerEmbeddingSize =
+      BEATRICE_20RC0_KV_LENGTH * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS;
+  morphed_codebook_.assign(kCodebookSize, 0.0f);
+  morphed_additive_speaker_embedding_.assign(
+      BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS, 0.0f);
+  morphed_key_value_speaker_embedding_.assign(kKeyValueSpeakerEmbeddingSize,
+                                              0.0f);
+
+  if (model_->codebooks.IsDirectlyAccessible()) {
+    target_codebook_ = {};
+    lottery_codebooks_ = {};
+  } else {
+    target_codebook_.resize(kCodebookSize);
+    lottery_codebooks_.resize((kSphAvgMaxNSpeakers + 1) * kCodebookSize);
+  }
+  lottery_codebook_speakers_.fill(-1);
+  if (model_->key_value_speaker_embeddings.IsDirectlyAccessible()) {
+    target_key_value_speaker_embedding_ = {};
+  } else {
+    target_key_value_speaker_embedding_.resize(kKeyValueSpeakerEmbeddingSize);
   }
   speaker_morphing_state_counter_ = std::numeric_limits<int>::max();
+  deferred_tasks_.Cancel(morph_additive_speaker_embedding_task_);
+  deferred_tasks_.Cancel(morph_key_value_speaker_embedding_task_);
 
   is_ready_to_set_speaker_ = true;
 
@@ -414,6 +987,7 @@ auto ProcessorCore2::LoadModel(const ModelConfig& /*config*/,
   while (SetKeyValueSpeakerEmbedding());
 
   model_file_ = new_model_file;
+  UpdateAnalysisCache();
 
   return ApplySpeakerMorphingWeights();
 }
@@ -428,6 +1002,54 @@ auto ProcessorCore2::SetSampleRate(const double new_sample_rate) -> ErrorCode {
   return ErrorCode::kSuccess;
 }
 
+auto ProcessorCore2::SetOfflineRendering(const bool offline) -> ErrorCode {
+  frame_pipeline_.SetEnabled(offline);
+  // 書き出しの結果が処理時間に依存しないよう、重い処理も毎フレーム終わらせる
+  deferred_tasks_.SetUnlimited(offline);
+  // 書き出しの結果が毎回同じになるよう、抽選の乱数を固定の値で初期化する
+  if (offline) {
+    speaker_morphing_codebook_lottery_engine_.seed(std::mt19937::default_seed);
+  }
+  // 書き出しを終えた時点で解析結果を保存する
+  UpdateAnalysisCache();
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorCore2::SetLoadLeveling(const LoadLevelingMode mode)
+    -> ErrorCode {
+  load_leveling_mode_ = mode;
+  return ErrorCode::kSuccess;
+}
+
+void ProcessorCore2::ApplyPerformanceProfile(
+    const PerformanceProfile& profile) {
+  parallel_analysis_.SetEnabled(profile.IsParallelAnalysisRecommended());
+}
+
+auto ProcessorCore2::SetQualityLevel(const int level) -> ErrorCode {
+  // 負荷の割に音質への影響が小さいものから順に省く
+  struct Settings {
+    int max_vq_num_neighbors;
+    int sph_avg_max_n_updates;
+    // key_value_speaker_embeddings のモーフィングを待たせてよいフレーム数
+    int morph_max_wait_frames;
+  };
+  static constexpr auto kSettings =
+      std::array<Settings, QualityController::kMaxLevel + 1>{{
+          {8, kSphAvgMaxNUpdates, 1},
+          {4, kSphAvgMaxNUpdates, 2},
+          {2, 2, 4},
+          {0, 1, 8},
+      }};
+  const auto& settings =
+      kSettings[std::clamp(level, 0, QualityController::kMaxLevel)];
+  max_vq_num_neighbors_ = settings.max_vq_num_neighbors;
+  sph_avg_max_n_updates_ = settings.sph_avg_max_n_updates;
+  deferred_tasks_.SetMaxWaitFrames(morph_key_value_speaker_embedding_task_,
+                                   settings.morph_max_wait_frames);
+  return SetVQNumNeighbors(vq_num_neighbors_);
+}
+
 auto ProcessorCore2::SetTargetSpeaker(const int new_target_speaker_id)
     -> ErrorCode {
   if (!is_ready_to_set_speaker_) {
@@ -436,47 +1058,73 @@ auto ProcessorCore2::SetTargetSpeaker(const int new_target_speaker_id)
   if (new_target_speaker_id < 0 || n_speakers_ + 1 <= new_target_speaker_id) {
     return ErrorCode::kSpeakerIDOutOfRange;
   }
-  assert(static_cast<int>(codebooks_.size()) ==
-         (n_speakers_ + 1) *
-             (BEATRICE_20RC0_CODEBOOK_SIZE * BEATRICE_20RC0_PHONE_CHANNELS));
-  assert(static_cast<int>(additive_speaker_embeddings_.size()) ==
-         (n_speakers_ + 1) * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
-  assert(static_cast<int>(key_value_speaker_embeddings_.size()) ==
-         (n_speakers_ + 1) * (BEATRICE_20RC0_KV_LENGTH *
-                              BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS));
+  ReplaySkippedHops();
+  assert(model_->codebooks.GetNSpeakers() == n_speakers_);
+  assert(static_cast<int>(model_->additive_speaker_embeddings.size()) ==
+         n_speakers_ * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
+  assert(model_->key_value_speaker_embeddings.GetNSpeakers() == n_speakers_);
+  // モーフィング結果は共有のテーブルとは別に持っている
+  const auto is_morphing = new_target_speaker_id == n_speakers_;
   Beatrice20rc0_SetCodebook(
-      phone_context_, codebooks_.data() + new_target_speaker_id *
-                                              (BEATRICE_20RC0_CODEBOOK_SIZE *
-                                               BEATRICE_20RC0_PHONE_CHANNELS));
+      contexts_->phone,
+      is_morphing ? morphed_codebook_.data()
+                  : model_->codebooks.GetSpeaker(new_target_speaker_id,
+                                                 target_codebook_.data()));
+  // key-value speaker embedding を登録済みの EmbeddingContext がキャッシュにあれば、
+  // 登録処理の代わりに交換する
+  const auto* const previous_embedding_context = contexts_->embedding;
+  if (is_morphing) {
+    Beatrice20rc0_RegisterKeyValueSpeakerEmbedding(
+        model_->embedding_setter, morphed_key_value_speaker_embedding_.data(),
+        contexts_->embedding);
+    contexts_->embedding_speaker = -1;
+  } else if (contexts_->embedding_speaker != new_target_speaker_id &&
+             !embedding_context_cache_.Exchange(
+                 new_target_speaker_id, contexts_->embedding,
+                 contexts_->embedding_speaker)) {
+    Beatrice20rc0_RegisterKeyValueSpeakerEmbedding(
+        model_->embedding_setter,
+        model_->key_value_speaker_embeddings.GetSpeaker(
+            new_target_speaker_id, target_key_value_speaker_embedding_.data()),
+        contexts_->embedding);
+    contexts_->embedding_speaker = new_target_speaker_id;
+  }
   Beatrice20rc0_SetAdditiveSpeakerEmbedding(
-      embedding_setter_,
-      additive_speaker_embeddings_.data() +
-          new_target_speaker_id * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
-      embedding_context_, waveform_context_);
-  Beatrice20rc0_RegisterKeyValueSpeakerEmbedding(
-      embedding_setter_,
-      key_value_speaker_embeddings_.data() +
-          new_target_speaker_id *
-              (BEATRICE_20RC0_KV_LENGTH *
-               BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS),
-      embedding_context_);
+      model_->embedding_setter,
+      is_morphing ? morphed_additive_speaker_embedding_.data()
+                  : model_->additive_speaker_embeddings.data() +
+                        new_target_speaker_id *
+                            BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
+      contexts_->embedding, contexts_->waveform);
   target_speaker_ = new_target_speaker_id;
   key_value_speaker_embedding_set_count_ = 0;
+  deferred_tasks_.Schedule(set_key_value_speaker_embedding_task_);
+  if (contexts_->embedding != previous_embedding_context) {
+    // 交換した EmbeddingContext にはフォルマントシフトが設定されていない
+    return SetFormantShift(formant_shift_);
+  }
+  context_pool_.SetConfig(GetContextConfig());
   return ErrorCode::kSuccess;
 }
 
 auto ProcessorCore2::SetFormantShift(const double new_formant_shift)
     -> ErrorCode {
   formant_shift_ = std::clamp(new_formant_shift, -2.0, 2.0);
+  if (!model_) {
+    return ErrorCode::kSuccess;
+  }
   const auto index = static_cast<int>(std::round(formant_shift_ * 2.0 + 4.0));
   assert(0 <= index && index < 9);
-  assert(static_cast<int>(formant_shift_embeddings_.size()) ==
+  assert(static_cast<int>(model_->formant_shift_embeddings.size()) ==
          9 * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
   Beatrice20rc0_SetFormantShiftEmbedding(
-      embedding_setter_,
-      formant_shift_embeddings_.data() +
+      model_->embedding_setter,
+      model_->formant_shift_embeddings.data() +
           index * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
-      embedding_context_, waveform_context_);
+      contexts_->embedding, contexts_->waveform);
+  if (is_ready_to_set_speaker_) {
+    context_pool_.SetConfig(GetContextConfig());
+  }
   return ErrorCode::kSuccess;
 }
 
@@ -523,14 +1171,87 @@ auto ProcessorCore2::ApplySpeakerMorphingWeights() -> ErrorCode {
   for (auto i = 0; i < n_weights; ++i) {
     speaker_morphing_weights_pruned_[indices[i]] = weights[indices[i]];
   }
+  UpdateLotteryCodebooks();
+  // モーフィングで重みを持つ話者の EmbeddingContext を先に用意しておく
+  auto wanted_speakers = std::array<int, EmbeddingContextCache::kNSlots>();
+  wanted_speakers.fill(-1);
+  for (auto i = 0;
+       i < std::min(n_weights, EmbeddingContextCache::kNSlots) &&
+       speaker_morphing_weights_pruned_[indices[i]] > 0.0f;
+       ++i) {
+    wanted_speakers[i] = indices[i];
+  }
+  embedding_context_cache_.SetWantedSpeakers(wanted_speakers.data(),
+                                             EmbeddingContextCache::kNSlots);
 
   // ここでsph_avg_a_などの重みを更新(sph_avg_.SetWeights())してしまうと、
   // モデル読み込み時に一気にkMaxNSpeakersの数だけ重みが設定されるため処理が重くなるので、
   // フラグだけ立てて次のフレームから更新するようにする。
   speaker_morphing_state_counter_ = 0;
+  deferred_tasks_.Schedule(morph_additive_speaker_embedding_task_);
+  deferred_tasks_.Schedule(morph_key_value_speaker_embedding_task_);
   return ErrorCode::kSuccess;
 }
 
+void ProcessorCore2::UpdateLotteryCodebooks() {
+  if (model_->codebooks.IsDirectlyAccessible()) {
+    return;
+  }
+  // 抽選対象 (重みの大きい方から kSphAvgMaxNSpeakers 人) の codebook を展開する。
+  // 既に展開済みの話者はそのまま残し、入れ替わった話者の分だけ展開し直す。
+  const auto n_candidates = std::min(n_speakers_, kSphAvgMaxNSpeakers);
+  const auto* const candidates_begin =
+      speaker_morphing_weights_argsort_indices_.data();
+  const auto* const candidates_end = candidates_begin + n_candidates;
+  auto is_candidate = std::array<bool, kSphAvgMaxNSpeakers>{};
+  for (auto slot = 0; slot < kSphAvgMaxNSpeakers; ++slot) {
+    const auto it = std::find(candidates_begin, candidates_end,
+                              lottery_codebook_speakers_[slot]);
+    if (it == candidates_end) {
+      lottery_codebook_speakers_[slot] = -1;
+    } else {
+      is_candidate[it - candidates_begin] = true;
+    }
+  }
+  auto slot = 0;
+  for (auto i = 0; i < n_candidates; ++i) {
+    if (is_candidate[i]) {
+      continue;
+    }
+    while (lottery_codebook_speakers_[slot] != -1) {
+      ++slot;
+    }
+    const auto speaker = candidates_begin[i];
+    model_->codebooks.ExpandRows(
+        speaker * BEATRICE_20RC0_CODEBOOK_SIZE, BEATRICE_20RC0_CODEBOOK_SIZE,
+        lottery_codebooks_.data() + slot * (BEATRICE_20RC0_CODEBOOK_SIZE *
+                                            BEATRICE_20RC0_PHONE_CHANNELS));
+    lottery_codebook_speakers_[slot] = speaker;
+  }
+}
+
+auto ProcessorCore2::GetLotteryCodebook(const int speaker) -> const float* {
+  if (model_->codebooks.IsDirectlyAccessible()) {
+    return model_->codebooks.GetSpeaker(speaker, nullptr);
+  }
+  constexpr auto kCodebookSize =
+      BEATRICE_20RC0_CODEBOOK_SIZE * BEATRICE_20RC0_PHONE_CHANNELS;
+  for (auto slot = 0; slot < kSphAvgMaxNSpeakers; ++slot) {
+    if (lottery_codebook_speakers_[slot] == speaker) {
+      return lottery_codebooks_.data() + slot * kCodebookSize;
+    }
+  }
+  // 重みが全て 0 の場合など、抽選対象外の話者が選ばれた場合はその都度展開する
+  auto* const spare =
+      lottery_codebooks_.data() + kSphAvgMaxNSpeakers * kCodebookSize;
+  if (lottery_codebook_speakers_[kSphAvgMaxNSpeakers] != speaker) {
+    model_->codebooks.ExpandRows(speaker * BEATRICE_20RC0_CODEBOOK_SIZE,
+                          BEATRICE_20RC0_CODEBOOK_SIZE, spare);
+    lottery_codebook_speakers_[kSphAvgMaxNSpeakers] = speaker;
+  }
+  return spare;
+}
+
 auto ProcessorCore2::SetAverageSourcePitch(const double new_average_pitch)
     -> ErrorCode {
   average_source_pitch_ = std::clamp(new_average_pitch, 0.0, 128.0);
@@ -560,9 +1281,10 @@ auto ProcessorCore2::SetPitchCorrectionType(const int new_pitch_correction_type)
 
 auto ProcessorCore2::SetMinSourcePitch(const double new_min_source_pitch)
     -> ErrorCode {
+  ReplaySkippedHops();
   min_source_pitch_ = std::clamp(new_min_source_pitch, 0.0, 128.0);
   Beatrice20rc0_SetMinQuantizedPitch(
-      pitch_context_,
+      contexts_->pitch,
       std::clamp(
           static_cast<int>(std::round((min_source_pitch_ - 33.0) *
                                       (BEATRICE_PITCH_BINS_PER_OCTAVE / 12.0))),
@@ -572,9 +1294,10 @@ auto ProcessorCore2::SetMinSourcePitch(const double new_min_source_pitch)
 
 auto ProcessorCore2::SetMaxSourcePitch(const double new_max_source_pitch)
     -> ErrorCode {
+  ReplaySkippedHops();
   max_source_pitch_ = std::clamp(new_max_source_pitch, 0.0, 128.0);
   Beatrice20rc0_SetMaxQuantizedPitch(
-      pitch_context_,
+      contexts_->pitch,
       std::clamp(
           static_cast<int>(std::round((max_source_pitch_ - 33.0) *
                                       (BEATRICE_PITCH_BINS_PER_OCTAVE / 12.0))),
@@ -584,8 +1307,10 @@ auto ProcessorCore2::SetMaxSourcePitch(const double new_max_source_pitch)
 
 auto ProcessorCore2::SetVQNumNeighbors(const int new_vq_num_neighbors)
     -> ErrorCode {
+  ReplaySkippedHops();
   vq_num_neighbors_ = std::clamp(new_vq_num_neighbors, 0, 8);
-  Beatrice20rc0_SetVQNumNeighbors(phone_context_, vq_num_neighbors_);
+  Beatrice20rc0_SetVQNumNeighbors(
+      contexts_->phone, std::min(vq_num_neighbors_, max_vq_num_neighbors_));
   return ErrorCode::kSuccess;
 }
 
@@ -4,19 +4,33 @@
 #define BEATRICE_COMMON_PROCESSOR_CORE_2_H_
 
 #include <array>
+#include <cstdint>
 #include <filesystem>
 #include <limits>
+#include <memory>
+#include <optional>
 #include <random>
+#include <vector>
 
 #include "beatricelib/beatrice.h"
 
 // Beatrice
+#include "common/analysis_cache.h"
+#include "common/context_pool.h"
+#include "common/embedding_context_cache.h"
 #include "common/error.h"
+#include "common/frame_pipeline.h"
 #include "common/gain.h"
+#include "common/memory_residency.h"
 #include "common/model_config.h"
+#include "common/parallel_analysis.h"
+#include "common/performance_profile.h"
 #include "common/processor_core.h"
 #include "common/resample.h"
+#include "common/speaker_embedding_cache.h"
+#include "common/speaker_table.h"
 #include "common/spherical_average.h"
+#include "common/stage_timings.h"
 
 namespace beatrice::common {
 
@@ -25,39 +39,35 @@ class ProcessorCore2 : public ProcessorCoreBase {
  public:
   static constexpr int kSphAvgMaxNSpeakers = 8;
 
-  explicit ProcessorCore2(const double sample_rate)
+  explicit ProcessorCore2(const double sample_rate,
+                          const SpeakerTableStorage speaker_table_storage =
+                              SpeakerTableStorage::kFloat32)
       : ProcessorCoreBase(),
+        speaker_table_storage_(speaker_table_storage),
         any_freq_in_out_(sample_rate),
-        phone_extractor_(Beatrice20rc0_CreatePhoneExtractor()),
-        pitch_estimator_(Beatrice20rc0_CreatePitchEstimator()),
-        waveform_generator_(Beatrice20rc0_CreateWaveformGenerator()),
-        embedding_setter_(Beatrice20rc0_CreateEmbeddingSetter()),
         gain_(),
-        phone_context_(Beatrice20rc0_CreatePhoneContext1()),
-        pitch_context_(Beatrice20rc0_CreatePitchContext1()),
-        waveform_context_(Beatrice20rc0_CreateWaveformContext1()),
-        embedding_context_(Beatrice20rc0_CreateEmbeddingContext()),
+        contexts_(std::make_unique<Contexts>()),
         input_gain_context_(sample_rate),
         output_gain_context_(sample_rate),
         speaker_morphing_weights_{0.0f},
         speaker_morphing_weights_pruned_{0.0f},
         speaker_morphing_weights_argsort_indices_{0},
+        lottery_codebook_speakers_{},
 #if 0
         sph_avgs_c_(),
 #else
         speaker_morphing_codebook_lottery_engine_(std::random_device{}()),
 #endif
-        sph_avgs_k_() {
-  }
-  ~ProcessorCore2() override {
-    Beatrice20rc0_DestroyPhoneExtractor(phone_extractor_);
-    Beatrice20rc0_DestroyPitchEstimator(pitch_estimator_);
-    Beatrice20rc0_DestroyWaveformGenerator(waveform_generator_);
-    Beatrice20rc0_DestroyEmbeddingSetter(embedding_setter_);
-    Beatrice20rc0_DestroyPhoneContext1(phone_context_);
-    Beatrice20rc0_DestroyPitchContext1(pitch_context_);
-    Beatrice20rc0_DestroyWaveformContext1(waveform_context_);
-    Beatrice20rc0_DestroyEmbeddingContext(embedding_context_);
+        sph_avgs_k_(),
+        embedding_context_cache_(
+            [this](Beatrice20rc0_EmbeddingContext* const embedding_context,
+                   const int speaker) {
+              RegisterKeyValueSpeakerEmbedding(embedding_context, speaker);
+            }),
+        context_pool_([this](Contexts& contexts, const std::uint64_t config) {
+          PrepareContexts(contexts, config);
+        }) {
+    AddDeferredTasks();
   }
   [[nodiscard]] auto GetVersion() const -> int override;
   auto Process(const float* input, float* output, int n_samples)
@@ -65,7 +75,17 @@ class ProcessorCore2 : public ProcessorCoreBase {
   auto ResetContext() -> ErrorCode override;
   auto LoadModel(const ModelConfig& /*config*/,
                  const std::filesystem::path& /*file*/) -> ErrorCode override;
+  void GetMemoryFootprint(MemoryFootprint& footprint) const override;
+  auto MeasureStageCosts(
+      int n_frames,
+      std::array<double, PerformanceProfile::kNStages>& stage_seconds)
+      -> ErrorCode override;
   auto SetSampleRate(double /*sample_rate*/) -> ErrorCode override;
+  auto SetOfflineRendering(bool /*offline*/) -> ErrorCode override;
+  auto SetLoadLeveling(LoadLevelingMode /*mode*/) -> ErrorCode override;
+  void ApplyPerformanceProfile(const PerformanceProfile& profile) override;
+  auto FollowAnalysis(ProcessorCoreBase& source) -> bool override;
+  auto SetQualityLevel(int /*level*/) -> ErrorCode override;
   auto SetTargetSpeaker(int /*target_speaker*/) -> ErrorCode override;
   auto SetFormantShift(double /*formant_shift*/) -> ErrorCode override;
   auto SetPitchShift(double /*pitch_shift*/) -> ErrorCode override;
@@ -85,10 +105,97 @@ class ProcessorCore2 : public ProcessorCoreBase {
   auto SetSpeakerMorphingWeights(
       const std::array<float, kMaxNSpeakers>& /*weights*/)
       -> ErrorCode override;
+  [[nodiscard]] auto GetLoadTimings() const
+      -> std::vector<StageTimings::Stage> override;
 
  private:
   static constexpr int kSphAvgMaxNUpdates = 4;
   static constexpr int kSphAvgMaxNState = 4;
+  // key_value_speaker_embeddings のモーフィングで、1 ステップで計算する数
+  static constexpr int kKeyValueMorphingChunkSize = 32;
+
+  // モデルのうち読み込み後に変更されない部分。
+  // ModelRegistry を介して、同じモデルを使うインスタンス間で共有される。
+  struct SharedModel {
+    SharedModel();
+    SharedModel(const SharedModel&) = delete;
+    auto operator=(const SharedModel&) -> SharedModel& = delete;
+    ~SharedModel();
+    auto Load(const std::filesystem::path& directory,
+              SpeakerTableStorage storage) -> ErrorCode;
+    // キャッシュにある sph_avgs_k_ 用に並べ替えた key-value speaker embedding
+    // を、そのまま参照できるか。できない場合は key_value_speaker_embeddings
+    // から必要な行だけを取り出す
+    [[nodiscard]] auto HasKeyValueBlocks() const -> bool;
+    [[nodiscard]] auto GetKeyValueBlock(int kv_index) const -> const float*;
+    [[nodiscard]] auto GetNormalizedKeyValueBlock(int kv_index) const
+        -> const float*;
+
+    Beatrice20rc0_PhoneExtractor* phone_extractor;
+    Beatrice20rc0_PitchEstimator* pitch_estimator;
+    Beatrice20rc0_WaveformGenerator* waveform_generator;
+    Beatrice20rc0_EmbeddingSetter* embedding_setter;
+    int n_speakers = 0;
+    SpeakerTable codebooks;
+    AlignedVector<float, 64> additive_speaker_embeddings;
+    AlignedVector<float, 64> formant_shift_embeddings;
+    SpeakerTable key_value_speaker_embeddings;
+    // キャッシュから読み込んだ場合、上記の一部や key-value block はこれを参照する
+    std::shared_ptr<const SpeakerEmbeddingCache> speaker_embedding_cache;
+    // 読み込みの各段階にかかった時間
+    StageTimings load_timings;
+    // 上記のテーブルを常駐させておくためのもの
+    MemoryResidency residency;
+
+   private:
+    auto ReadSpeakerEmbeddings(const std::filesystem::path& file,
+                               SpeakerTableStorage storage) -> ErrorCode;
+    void LoadSpeakerEmbeddingsFromCache(
+        std::shared_ptr<const SpeakerEmbeddingCache> cache,
+        SpeakerTableStorage storage);
+    void MakeResident();
+  };
+
+  // ResetContext() で作り直される状態
+  struct Contexts {
+    Contexts()
+        : phone(Beatrice20rc0_CreatePhoneContext1()),
+          pitch(Beatrice20rc0_CreatePitchContext1()),
+          waveform(Beatrice20rc0_CreateWaveformContext1()),
+          embedding(Beatrice20rc0_CreateEmbeddingContext()) {}
+    Contexts(const Contexts&) = delete;
+    auto operator=(const Contexts&) -> Contexts& = delete;
+    ~Contexts() {
+      Beatrice20rc0_DestroyPhoneContext1(phone);
+      Beatrice20rc0_DestroyPitchContext1(pitch);
+      Beatrice20rc0_DestroyWaveformContext1(waveform);
+      Beatrice20rc0_DestroyEmbeddingContext(embedding);
+    }
+
+    Beatrice20rc0_PhoneContext1* phone;
+    Beatrice20rc0_PitchContext1* pitch;
+    Beatrice20rc0_WaveformContext1* waveform;
+    Beatrice20rc0_EmbeddingContext* embedding;
+    // embedding に key-value speaker embedding を登録済みの話者。
+    // モーフィング中など、話者に対応しない場合は -1
+    int embedding_speaker = -1;
+  };
+
+  // Process1() の前半の解析結果
+  struct Analysis {
+    std::array<float, BEATRICE_20RC0_PHONE_CHANNELS> phone;
+    int quantized_pitch;
+    std::array<float, 4> pitch_feature;
+  };
+
+  // Fan-Out で他のインスタンスに渡す、1 回の Process() 分の解析結果。
+  // ピッチシフトなどを適用する前の値を記録する
+  struct SharedAnalyses {
+    // ProcessorProxy は 1 ホップ程度ずつ Process() を呼ぶので、数ホップで足りる
+    static constexpr int kCapacity = 8;
+    std::array<Analysis, kCapacity> analyses;
+    int n_analyses = 0;
+  };
 
   class ConvertWithModelBlockSize {
    public:
@@ -97,8 +204,36 @@ class ProcessorCore2 : public ProcessorCoreBase {
                     ProcessorCore2& processor_core) const {
       processor_core.Process1(input, output);
     }
+    [[nodiscard]] auto IsBatchProcessing(
+        const ProcessorCore2& processor_core) const -> bool {
+      return processor_core.frame_pipeline_.IsEnabled();
+    }
+    void ProcessBatch(const float* const input, float* const output,
+                      const int n_blocks,
+                      ProcessorCore2& processor_core) const {
+      processor_core.ProcessBatch(input, output, n_blocks);
+    }
+    [[nodiscard]] auto IsLoadLeveling(
+        const ProcessorCore2& processor_core) const -> bool {
+      return processor_core.load_leveling_mode_ !=
+                 LoadLevelingMode::kDisabled &&
+             !processor_core.frame_pipeline_.IsEnabled();
+    }
+    [[nodiscard]] auto IsSpreadingStages(
+        const ProcessorCore2& processor_core) const -> bool {
+      return processor_core.load_leveling_mode_ == LoadLevelingMode::kSpread;
+    }
+    [[nodiscard]] auto GetNStages(
+        const ProcessorCore2& /*processor_core*/) const -> int {
+      return kNStages;
+    }
+    void RunStage(const int stage, const float* const input,
+                  float* const output, ProcessorCore2& processor_core) const {
+      processor_core.RunStage(stage, input, output);
+    }
   };
 
+  SpeakerTableStorage speaker_table_storage_;
   std::filesystem::path model_file_;
   int target_speaker_ = 0;
   double formant_shift_ = 0.0;
@@ -111,34 +246,62 @@ class ProcessorCore2 : public ProcessorCoreBase {
   double min_source_pitch_ = 33.125;
   double max_source_pitch_ = 80.875;
   int vq_num_neighbors_ = 0;
+  // SetQualityLevel() で決まる上限
+  int max_vq_num_neighbors_ = 8;
+  int sph_avg_max_n_updates_ = kSphAvgMaxNUpdates;
 
   resampler::AnyFreqInOut<ConvertWithModelBlockSize> any_freq_in_out_;
 
   // モデル
-  Beatrice20rc0_PhoneExtractor* phone_extractor_;
-  Beatrice20rc0_PitchEstimator* pitch_estimator_;
-  Beatrice20rc0_WaveformGenerator* waveform_generator_;
-  Beatrice20rc0_EmbeddingSetter* embedding_setter_;
-  AlignedVector<float, 64> codebooks_;
-  AlignedVector<float, 64> additive_speaker_embeddings_;
-  AlignedVector<float, 64> formant_shift_embeddings_;
-  AlignedVector<float, 64> key_value_speaker_embeddings_;
+  std::shared_ptr<const SharedModel> model_;
+  // モデルの読み込みのうち、インスタンスごとに行う段階にかかった時間
+  StageTimings load_timings_;
+  // codebooks などが float で保持されていない場合に、
+  // 目標話者の分を展開しておく領域
+  AlignedVector<float, 64> target_codebook_;
+  AlignedVector<float, 64> target_key_value_speaker_embedding_;
+  // モーフィング結果
+  AlignedVector<float, 64> morphed_codebook_;
+  AlignedVector<float, 64> morphed_additive_speaker_embedding_;
+  AlignedVector<float, 64> morphed_key_value_speaker_embedding_;
   Gain gain_;
   // 状態
-  Beatrice20rc0_PhoneContext1* phone_context_;
-  Beatrice20rc0_PitchContext1* pitch_context_;
-  Beatrice20rc0_WaveformContext1* waveform_context_;
-  Beatrice20rc0_EmbeddingContext* embedding_context_;
+  std::unique_ptr<Contexts> contexts_;
   Gain::Context input_gain_context_;
   Gain::Context output_gain_context_;
+  // 音素抽出とピッチ推定の片方を、共有のワーカーで並列に実行する
+  ParallelAnalysis parallel_analysis_;
+  // オフラインでの書き出し時に、複数フレームをパイプライン化して処理する
+  FramePipeline frame_pipeline_;
+  std::vector<Analysis> analyses_;
+  // 負荷の平準化の仕方。オフラインでの書き出し中は平準化しない
+  LoadLevelingMode load_leveling_mode_ = LoadLevelingMode::kDisabled;
+  // 負荷の平準化のため、段階に分けて処理中のフレームの解析結果
+  Analysis staged_analysis_;
   int key_value_speaker_embedding_set_count_ = 0;
   bool is_ready_to_set_speaker_ = false;
+  // Fan-Out で解析結果を渡す側であれば、その記録先
+  std::unique_ptr<SharedAnalyses> shared_analyses_;
+  // Fan-Out で解析結果を受け取る側であれば、その渡し元
+  const ProcessorCore2* analysis_source_ = nullptr;
+  // 今回の Process() で analysis_source_ から受け取った数
+  int n_shared_analyses_read_ = 0;
+  // オフラインでの書き出しで、解析結果を保存しておき再利用するためのもの
+  std::unique_ptr<AnalysisCache> analysis_cache_;
 
   // モデルマージ
   std::array<float, kMaxNSpeakers> speaker_morphing_weights_;
   std::array<float, kMaxNSpeakers> speaker_morphing_weights_pruned_;
   std::array<int, kMaxNSpeakers> speaker_morphing_weights_argsort_indices_;
   int speaker_morphing_state_counter_ = std::numeric_limits<int>::max();
+  DeferredTaskScheduler::TaskId morph_additive_speaker_embedding_task_ = -1;
+  DeferredTaskScheduler::TaskId morph_key_value_speaker_embedding_task_ = -1;
+  DeferredTaskScheduler::TaskId set_key_value_speaker_embedding_task_ = -1;
+  // codebooks が float で保持されていない場合に、
+  // モーフィングで codebook を抽選する対象の話者の分を展開しておく領域。
+  // 末尾の 1 枠は抽選対象外の話者を一時的に展開するのに使う。
+  AlignedVector<float, 64> lottery_codebooks_;
+  std::array<int, kSphAvgMaxNSpeakers + 1> lottery_codebook_speakers_;
 #if 0
   std::array<SphericalAverage<float>, BEATRICE_20RC0_CODEBOOK_SIZE> sph_avgs_c_;
 #elif 1
@@ -151,9 +314,45 @@ class ProcessorCore2 : public ProcessorCoreBase {
       BEATRICE_20RC0_KV_LENGTH>
       sph_avgs_k_;
 
+  // 話者ごとに key-value speaker embedding を登録済みの EmbeddingContext
+  EmbeddingContextCache embedding_context_cache_;
+  // ResetContext() で差し替える予備のコンテキスト。
+  // 目標話者とフォルマントシフトの設定まで済ませた状態で用意される。
+  // バックグラウンドスレッドの処理が終わってから他のメンバが破棄されるよう、
+  // 最後に宣言する。
+  ContextPool<Contexts> context_pool_;
+
   auto IsLoaded() -> bool { return !model_file_.empty(); }
   auto ApplySpeakerMorphingWeights() -> ErrorCode;
+  void UpdateLotteryCodebooks();
+  auto GetLotteryCodebook(int speaker) -> const float*;
+  void ProcessBatch(const float* input, float* output, int n_blocks);
   void Process1(const float* input, float* output);
+  // Process1() を、フレーム間で独立に進められる解析と合成に分けたもの
+  void Analyze1(const float* input, Analysis& analysis);
+  void Synthesize1(Analysis& analysis, float* output);
+  // Fan-Out で、渡す側は analysis を記録し、受け取る側は analysis を
+  // 渡し元の解析結果で置き換える
+  void ShareAnalysis(Analysis& analysis);
+  [[nodiscard]] auto GetAnalysisSettings() const
+      -> std::optional<std::uint64_t>;
+  void ReplaySkippedHops();
+  void UpdateAnalysisCache();
+  // Process1() を、ピッチ推定、音素抽出、合成の段階に分けたもの
+  static constexpr int kNStages = 3;
+  void RunStage(int stage, const float* input, float* output);
+  void EstimatePitch1(const float* input, Analysis& analysis);
+  void ExtractPhone1(const float* input, Analysis& analysis);
+  // deferred_tasks_ で数フレームに分けて行う処理
+  void AddDeferredTasks();
+  auto MorphAdditiveSpeakerEmbedding() -> DeferredTaskScheduler::Status;
+  auto MorphKeyValueSpeakerEmbedding() -> DeferredTaskScheduler::Status;
+  // context_pool_ の予備に渡す設定
+  [[nodiscard]] auto GetContextConfig() const -> std::uint64_t;
+  // バックグラウンドスレッドから呼ばれる。model_ 以外のメンバは参照しない
+  void PrepareContexts(Contexts& contexts, std::uint64_t config) const;
+  void RegisterKeyValueSpeakerEmbedding(
+      Beatrice20rc0_EmbeddingContext* embedding_context, int speaker) const;
 
   // Key-value speaker embedding を 1 ブロック設定する。
   // 既に全ブロック設定済みであれば何も処理を行わず false を返す。
@@ -161,8 +360,8 @@ class ProcessorCore2 : public ProcessorCoreBase {
   auto SetKeyValueSpeakerEmbedding() -> bool {
     if (key_value_speaker_embedding_set_count_ < BEATRICE_20RC0_N_BLOCKS) {
       Beatrice20rc0_SetKeyValueSpeakerEmbedding(
-          embedding_setter_, key_value_speaker_embedding_set_count_++,
-          embedding_context_, waveform_context_);
+          model_->embedding_setter, key_value_speaker_embedding_set_count_++,
+          contexts_->embedding, contexts_->waveform);
       return true;
     }
     return false;
@@ -2,19 +2,30 @@
 
 #include "common/processor_proxy.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <istream>
 #include <memory>
 #include <ostream>
 #include <string>
 #include <variant>
 
+#include "beatricelib/beatrice.h"
+
+// Beatrice
 #include "common/error.h"
 #include "common/parameter_schema.h"
 #include "common/parameter_state.h"
 
 namespace beatrice::common {
 
+namespace {
+// Dual Mono や Fan-Out で、チャンネルを切り替えながら処理する単位
+constexpr auto kInterleaveSeconds =
+    static_cast<double>(BEATRICE_IN_HOP_LENGTH) / BEATRICE_IN_SAMPLE_RATE;
+}  // namespace
+
 auto ProcessorProxy::GetParameter(const ParameterID param_id) const -> const
     auto& {
   return parameter_state_.GetValue(param_id);
@@ -70,4 +81,149 @@ auto ProcessorProxy::GetParameterState() const -> const ParameterState& {
   return parameter_state_;
 }
 
+auto ProcessorProxy::SetChannelMode(const int channel_mode) -> ErrorCode {
+  channel_mode_ = channel_mode;
+  return UpdateChannelLayout(ParameterID::kChannelMode);
+}
+
+auto ProcessorProxy::SetNFanOutVoices(const int n_voices) -> ErrorCode {
+  n_fan_out_voices_ = std::clamp(n_voices, 2, kMaxNVoices);
+  return UpdateChannelLayout(ParameterID::kFanOutVoices);
+}
+
+auto ProcessorProxy::SetMultiChannelAllowed(const bool allowed) -> ErrorCode {
+  multi_channel_allowed_ = allowed;
+  // 減らすだけなら読み込みを伴わないので、読み込みを遅らせている場合も
+  // すぐに反映する
+  if (!allowed) {
+    return UpdateChannelCores();
+  }
+  return UpdateChannelLayout(ParameterID::kChannelMode);
+}
+
+auto ProcessorProxy::UpdateChannelLayout(const ParameterID param_id)
+    -> ErrorCode {
+  if (GetNRequiredCores() == GetNChannels() &&
+      (GetNChannels() == 1 || IsFanOutRequired() == fan_out_)) {
+    return ErrorCode::kSuccess;
+  }
+  if (model_loading_deferred_) {
+    model_load_requested_ = true;
+    return ErrorCode::kSuccess;
+  }
+  if (const auto err = UpdateChannelCores(); err != ErrorCode::kSuccess) {
+    return err;
+  }
+  if (GetNChannels() == 1) {
+    return ErrorCode::kSuccess;
+  }
+  // 新しく用意したコアに現在の設定を反映する
+  return SyncAllParameters(param_id);
+}
+
+auto ProcessorProxy::Process(float* const* const buffers, int n_channels,
+                             const int n_samples) -> ErrorCode {
+  n_channels = std::min(n_channels, GetNChannels());
+  if (n_channels <= 1) {
+    return core_->Process(buffers[0], buffers[0], n_samples);
+  }
+  // 共有している重みがキャッシュに残っているうちに他のチャンネルも
+  // 進めるよう、1 ホップずつ順に処理する。
+  // Fan-Out では 1 つ目のコアが解析した結果を、続けて他のコアが使う
+  const auto fan_out = IsFanOut();
+  const auto n_interleave =
+      std::max(1, static_cast<int>(sample_rate_ * kInterleaveSeconds));
+  auto error_code = ErrorCode::kSuccess;
+  for (auto offset = 0; offset < n_samples; offset += n_interleave) {
+    const auto n = std::min(n_interleave, n_samples - offset);
+    if (fan_out) {
+      for (auto channel = 1; channel < n_channels; ++channel) {
+        std::memcpy(buffers[channel] + offset, buffers[0] + offset,
+                    sizeof(float) * n);
+      }
+    }
+    for (auto channel = 0; channel < n_channels; ++channel) {
+      auto* const buffer = buffers[channel] + offset;
+      if (const auto err = GetChannelCore(channel)->Process(buffer, buffer, n);
+          err != ErrorCode::kSuccess) {
+        error_code = err;
+      }
+    }
+  }
+  return error_code;
+}
+
+auto ProcessorProxy::IsFanOutRequired() const -> bool {
+  return channel_mode_ == 2 && multi_channel_allowed_ &&
+         !loaded_model_file_.empty();
+}
+
+auto ProcessorProxy::GetNRequiredCores() const -> int {
+  if (loaded_model_file_.empty() || !multi_channel_allowed_) {
+    return 1;
+  }
+  switch (channel_mode_) {
+    case 1:
+      return kMaxNChannels;
+    case 2:
+      return n_fan_out_voices_;
+    default:
+      return 1;
+  }
+}
+
+auto ProcessorProxy::UpdateChannelCores() -> ErrorCode {
+  const auto n_cores = GetNRequiredCores();
+  // Dual Mono と Fan-Out ではコアの使い方が異なるので、切り替えたら作り直す
+  if (const auto fan_out = IsFanOutRequired(); fan_out != fan_out_) {
+    for (auto& core : extra_cores_) {
+      core.reset();
+    }
+    fan_out_ = fan_out;
+  }
+  if (const auto err = core_->SetLoadLeveling(GetCoreLoadLevelingMode());
+      err != ErrorCode::kSuccess) {
+    return err;
+  }
+  for (auto i = 0; i < kMaxNVoices - 1; ++i) {
+    auto& extra_core = extra_cores_[i];
+    if (n_cores <= i + 1) {
+      extra_core.reset();
+      continue;
+    }
+    if (extra_core) {
+      continue;
+    }
+    // 重みは ModelRegistry を介して core_ と共有されるので、
+    // 増えるのはコンテキストなどのインスタンスごとの部分のみ
+    auto core = std::unique_ptr<ProcessorCoreBase>();
+    if (const auto err = CreateCore(loaded_model_file_, sample_rate_,
+                                    loaded_speaker_table_storage_, core);
+        err != ErrorCode::kSuccess) {
+      return err;
+    }
+    if (const auto err = core->SetOfflineRendering(offline_rendering_);
+        err != ErrorCode::kSuccess) {
+      return err;
+    }
+    if (const auto err = core->SetQualityLevel(quality_level_);
+        err != ErrorCode::kSuccess) {
+      return err;
+    }
+    if (const auto err = core->SetLoadLeveling(GetCoreLoadLevelingMode());
+        err != ErrorCode::kSuccess) {
+      return err;
+    }
+    if (performance_profile_) {
+      core->ApplyPerformanceProfile(*performance_profile_);
+    }
+    // 解析結果を共有できないバージョンのモデルでは、各コアが自身で解析する
+    if (fan_out_) {
+      [[maybe_unused]] const auto is_following = core->FollowAnalysis(*core_);
+    }
+    extra_core = std::move(core);
+  }
+  return ErrorCode::kSuccess;
+}
+
 }  // namespace beatrice::common
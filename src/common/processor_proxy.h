@@ -3,25 +3,43 @@
 #ifndef BEATRICE_COMMON_PROCESSOR_PROXY_H_
 #define BEATRICE_COMMON_PROCESSOR_PROXY_H_
 
+#include <algorithm>
+#include <array>
+#include <filesystem>
 #include <memory>
+#include <optional>
 #include <stdexcept>
+#include <utility>
 
 #include "common/error.h"
+#include "common/load_leveling.h"
+#include "common/memory_footprint.h"
 #include "common/model_config.h"
+#include "common/model_config_cache.h"
+#include "common/model_container.h"
 #include "common/parameter_schema.h"
 #include "common/parameter_state.h"
+#include "common/performance_profile.h"
 #include "common/processor_core.h"
 #include "common/processor_core_0.h"
 #include "common/processor_core_1.h"
 #include "common/processor_core_2.h"
+#include "common/speaker_table.h"
+#include "common/standby_cores.h"
 
 namespace beatrice::common {
 
 // 異なるバージョンの ProcessorCore を、
 // また異なる種類のパラメータの変更を統一的に扱うためのクラス。
 // パラメータの変更は kSchema で定められた ID を介して行う。
+// Channel Mode が Dual Mono の場合は、2 チャンネル目を独立に変換するコアも持つ。
+// Fan-Out の場合は、1 つ目のコアの解析結果から別の声を合成するコアを持つ。
 class ProcessorProxy {
  public:
+  static constexpr int kMaxNChannels = 2;
+  // Fan-Out で同時に合成する声の最大数
+  static constexpr int kMaxNVoices = 4;
+
   explicit ProcessorProxy(const ParameterSchema& schema) : sample_rate_() {
     parameter_state_.SetDefaultValues(schema);
     core_ = std::make_unique<ProcessorCoreUnloaded>();
@@ -31,10 +49,78 @@ class ProcessorProxy {
     auto error_code = SyncAllParameters();
     assert(error_code == ErrorCode::kSuccess);
   }
+  // 別スレッドで新しいモデルを用意するためのコンストラクタ。
+  // parameter_state に含まれるモデルもこの中で読み込まれる。
+  // 切り替えた先のモデルが standby_cores に待機していれば、それを使う。
+  // multi_channel_allowed は SetMultiChannelAllowed() を参照
+  ProcessorProxy(const ParameterState& parameter_state,
+                 const double sample_rate, const SpeakerTableStorage storage,
+                 std::shared_ptr<StandbyCores> standby_cores = nullptr,
+                 const bool multi_channel_allowed = true)
+      : sample_rate_(sample_rate),
+        speaker_table_storage_(storage),
+        parameter_state_(parameter_state),
+        core_(std::make_unique<ProcessorCoreUnloaded>()),
+        standby_cores_(std::move(standby_cores)) {
+    multi_channel_allowed_ = multi_channel_allowed;
+    [[maybe_unused]] const auto error_code = SyncAllParameters();
+  }
+  ProcessorProxy(const ProcessorProxy&) = delete;
+  auto operator=(const ProcessorProxy&) -> ProcessorProxy& = delete;
+  // 読み込み済みのモデルは standby_cores に待機させる
+  ~ProcessorProxy() { RetireCore(); }
   [[nodiscard]] auto GetSampleRate() const -> double { return sample_rate_; }
   auto SetSampleRate(const double new_sample_rate) -> ErrorCode {
     sample_rate_ = new_sample_rate;
-    return core_->SetSampleRate(sample_rate_);
+    const auto error_code = ForEachCore([this](ProcessorCoreBase& core) {
+      return core.SetSampleRate(sample_rate_);
+    });
+    // 計測結果はサンプリング周波数ごとに保存されている
+    LoadPerformanceProfile(loaded_model_file_);
+    return error_code;
+  }
+  // オフラインでの書き出し中は、複数フレームをまとめてパイプライン化して処理する
+  auto SetOfflineRendering(const bool offline) -> ErrorCode {
+    offline_rendering_ = offline;
+    return ForEachCore([this](ProcessorCoreBase& core) {
+      return core.SetOfflineRendering(offline_rendering_);
+    });
+  }
+  [[nodiscard]] auto IsOfflineRendering() const -> bool {
+    return offline_rendering_;
+  }
+  // 増えた遅延をホストに報告できない場合は false にして、負荷を平準化しない。
+  // 許可されていれば、リアルタイム処理での Process() の遅延は、
+  // 構成によらず GetLoadLevelingLatency() の分増える
+  auto SetLoadLevelingAllowed(const bool allowed) -> ErrorCode {
+    load_leveling_allowed_ = allowed;
+    return ForEachCore([this](ProcessorCoreBase& core) {
+      return core.SetLoadLeveling(GetCoreLoadLevelingMode());
+    });
+  }
+  // 処理負荷に応じて QualityController が決めたレベルを設定する
+  auto SetQualityLevel(const int level) -> ErrorCode {
+    quality_level_ = level;
+    return ForEachCore([this](ProcessorCoreBase& core) {
+      return core.SetQualityLevel(quality_level_);
+    });
+  }
+  [[nodiscard]] auto GetQualityLevel() const -> int { return quality_level_; }
+  // 次に読み込むモデルから有効になる
+  void SetSpeakerTableStorage(const SpeakerTableStorage storage) {
+    speaker_table_storage_ = storage;
+  }
+  [[nodiscard]] auto GetSpeakerTableStorage() const -> SpeakerTableStorage {
+    return speaker_table_storage_;
+  }
+  // true にすると、LoadModel() はモデルを読み込まずに要求を記録するだけになる。
+  // 記録された要求は TakeModelLoadRequest() で取り出し、
+  // 呼び出し側が別スレッドで読み込む。
+  void SetModelLoadingDeferred(const bool deferred) {
+    model_loading_deferred_ = deferred;
+  }
+  auto TakeModelLoadRequest() -> bool {
+    return std::exchange(model_load_requested_, false);
   }
   [[nodiscard]] auto GetParameter(ParameterID param_id) const -> const auto&;
   template <typename T>
@@ -43,73 +129,272 @@ class ProcessorProxy {
     return SyncParameter(param_id);
   }
   auto LoadModel(const std::filesystem::path& file) -> ErrorCode {
-    auto error_code = ErrorCode::kSuccess;
+    if (model_loading_deferred_) {
+      model_load_requested_ = true;
+      return ErrorCode::kSuccess;
+    }
+    // 読み込み済みのものは、また使われるかもしれないので待機させておく
+    RetireCore();
+    performance_profile_.reset();
     if (file.empty()) {
-      goto fail;
+      core_ = std::make_unique<ProcessorCoreUnloaded>();
+      return ErrorCode::kSuccess;
+    }
+    if (standby_cores_ &&
+        standby_cores_->Take(file, speaker_table_storage_, core_)) {
+      // 待機中のものは別のサンプリング周波数で使われていたかもしれない
+      if (const auto err = core_->SetSampleRate(sample_rate_);
+          err != ErrorCode::kSuccess) {
+        core_ = std::make_unique<ProcessorCoreUnloaded>();
+        return err;
+      }
+      [[maybe_unused]] const auto error_code = core_->ResetContext();
+    } else if (const auto err = CreateCore(file, sample_rate_,
+                                           speaker_table_storage_, core_);
+               err != ErrorCode::kSuccess) {
+      core_ = std::make_unique<ProcessorCoreUnloaded>();
+      return err;
+    }
+    if (const auto err = core_->SetOfflineRendering(offline_rendering_);
+        err != ErrorCode::kSuccess) {
+      core_ = std::make_unique<ProcessorCoreUnloaded>();
+      return err;
     }
+    if (const auto err = core_->SetQualityLevel(quality_level_);
+        err != ErrorCode::kSuccess) {
+      core_ = std::make_unique<ProcessorCoreUnloaded>();
+      return err;
+    }
+    loaded_model_file_ = file;
+    loaded_speaker_table_storage_ = speaker_table_storage_;
+    // 2 チャンネル目や 2 つ目以降の声を用意できなくても、1 つ目は使える
+    const auto channel_error_code = UpdateChannelCores();
+    LoadPerformanceProfile(file);
+    const auto error_code = SyncAllParameters(ParameterID::kModel);
+    return channel_error_code != ErrorCode::kSuccess ? channel_error_code
+                                                     : error_code;
+  }
+  // 0 で入力をモノラルにまとめて変換し、1 で 2 チャンネルを独立に変換する。
+  // 2 で入力をモノラルにまとめて解析し、SetNFanOutVoices() の数の声を合成する。
+  // 2 つ目以降のコアの用意はモデルの読み込みと同様に重いので、
+  // SetModelLoadingDeferred(true) の場合は読み込みの要求として記録する
+  auto SetChannelMode(int channel_mode) -> ErrorCode;
+  // Fan-Out で合成する声の数。2 以上 kMaxNVoices 以下
+  auto SetNFanOutVoices(int n_voices) -> ErrorCode;
+  // 1 チャンネル分しか Process() に渡さない経路 (非同期モードやエンジン) では
+  // false にして、Channel Mode によらず 2 つ目以降のコアを用意しない。
+  // SetChannelMode() と同様に、読み込みの要求として記録されることがある
+  auto SetMultiChannelAllowed(bool allowed) -> ErrorCode;
+  [[nodiscard]] auto IsMultiChannelAllowed() const -> bool {
+    return multi_channel_allowed_;
+  }
+  // 独立に変換できるチャンネル、または Fan-Out で合成する声の数
+  [[nodiscard]] auto GetNChannels() const -> int {
+    return 1 + static_cast<int>(std::count_if(
+                   extra_cores_.begin(), extra_cores_.end(),
+                   [](const auto& core) { return core != nullptr; }));
+  }
+  // Process() で buffers[0] の入力から全ての声を合成する場合に true
+  [[nodiscard]] auto IsFanOut() const -> bool {
+    return fan_out_ && extra_cores_[0];
+  }
+  // file のモデルを読み込んだ ProcessorCore を作る
+  static auto CreateCore(const std::filesystem::path& file,
+                         const double sample_rate,
+                         const SpeakerTableStorage storage,
+                         std::unique_ptr<ProcessorCoreBase>& core)
+      -> ErrorCode {
     if (!std::filesystem::exists(file)) {
-      error_code = ErrorCode::kFileOpenError;
-      goto fail;
+      return ErrorCode::kFileOpenError;
     }
     try {
-      const auto toml_data = toml::parse(file);
-      const auto model_config = toml::get<ModelConfig>(toml_data);
-      switch (model_config.model.VersionInt()) {
+      // TOML の解析結果は Controller や Editor と共有する
+      auto model_config = std::shared_ptr<const ModelConfig>();
+      if (const auto err = ModelConfigCache::Get(file, model_config);
+          err != ErrorCode::kSuccess) {
+        return err;
+      }
+      // コンテナの場合は、展開したディレクトリ形式のモデルを読み込む
+      auto model_file = file;
+      if (ModelContainer::IsContainer(file)) {
+        auto error_code = ErrorCode::kSuccess;
+        const auto container = ModelContainer::Open(file, error_code);
+        if (!container) {
+          return error_code;
+        }
+        if (const auto err = container->Extract(model_file);
+            err != ErrorCode::kSuccess) {
+          return err;
+        }
+      }
+      switch (model_config->model.VersionInt()) {
         case 0:
-          core_ = std::make_unique<ProcessorCore0>(sample_rate_);
+          core = std::make_unique<ProcessorCore0>(sample_rate);
           break;
         case 1:
-          core_ = std::make_unique<ProcessorCore1>(sample_rate_);
+          core = std::make_unique<ProcessorCore1>(sample_rate);
           break;
         case 2:
-          core_ = std::make_unique<ProcessorCore2>(sample_rate_);
+          core = std::make_unique<ProcessorCore2>(sample_rate, storage);
           break;
         default:
-          error_code = ErrorCode::kInvalidModelConfig;
-          goto fail;
+          return ErrorCode::kInvalidModelConfig;
       }
-      if (const auto err = core_->LoadModel(model_config, file);
-          err != ErrorCode::kSuccess) {
-        error_code = err;
-        goto fail;
-      }
-    } catch (const toml::file_io_error&) {
-      error_code = ErrorCode::kFileOpenError;
-      goto fail;
-    } catch (const toml::syntax_error&) {
-      error_code = ErrorCode::kTOMLSyntaxError;
-      goto fail;
-    } catch (const toml::type_error&) {
-      error_code = ErrorCode::kInvalidModelConfig;
-      goto fail;
-    } catch (const std::invalid_argument&) {
-      error_code = ErrorCode::kInvalidModelConfig;
-      goto fail;
-    } catch (const std::out_of_range&) {
-      error_code = ErrorCode::kInvalidModelConfig;
-      goto fail;
+      return core->LoadModel(*model_config, model_file);
     } catch (const std::exception&) {
-      error_code = ErrorCode::kUnknownError;
-      goto fail;
+      return ErrorCode::kUnknownError;
     }
-    return SyncAllParameters(ParameterID::kModel);
-
-  fail:
-    core_ = std::make_unique<ProcessorCoreUnloaded>();
-    return error_code;
+  }
+  // 読み込んだモデルを切り替える時に、前のものを待機させる先
+  void SetStandbyCores(std::shared_ptr<StandbyCores> standby_cores) {
+    standby_cores_ = std::move(standby_cores);
+  }
+  [[nodiscard]] auto GetStandbyCores() const
+      -> const std::shared_ptr<StandbyCores>& {
+    return standby_cores_;
+  }
+  // 読み込まれていない場合は空のパスを返す
+  [[nodiscard]] auto GetLoadedModelFile() const
+      -> const std::filesystem::path& {
+    return loaded_model_file_;
+  }
+  // 読み込んだモデルを、このマシンとサンプリング周波数で処理した時間。
+  // まだ計測されていなければ空
+  [[nodiscard]] auto GetPerformanceProfile() const
+      -> const std::optional<PerformanceProfile>& {
+    return performance_profile_;
   }
   auto Read(std::istream& is) -> ErrorCode;
   auto Write(std::ostream& os) const -> ErrorCode;
   [[nodiscard]] auto GetParameterState() const -> const ParameterState&;
+  // 使っているメモリの量を構成要素ごとに集計する
+  [[nodiscard]] auto GetMemoryFootprint() const -> MemoryFootprint {
+    auto footprint = MemoryFootprint();
+    footprint.Add("parameter state", parameter_state_.GetMemoryUsage());
+    core_->GetMemoryFootprint(footprint);
+    for (const auto& core : extra_cores_) {
+      if (core) {
+        core->GetMemoryFootprint(footprint);
+      }
+    }
+    if (standby_cores_) {
+      standby_cores_->GetMemoryFootprint(footprint);
+    }
+    return footprint;
+  }
   [[nodiscard]] auto GetCore() const
       -> const std::unique_ptr<ProcessorCoreBase>& {
     return core_;
   }
+  // channel 番目のチャンネル、または Fan-Out の声を変換するコア。
+  // 無ければ nullptr
+  [[nodiscard]] auto GetChannelCore(const int channel) const
+      -> ProcessorCoreBase* {
+    if (channel == 0) {
+      return core_.get();
+    }
+    if (channel < 0 || kMaxNVoices <= channel) {
+      return nullptr;
+    }
+    return extra_cores_[channel - 1].get();
+  }
+  // 全てのチャンネルのコアに f を適用する。
+  // 失敗したものがあれば、最後に失敗したもののエラーを返す
+  template <typename F>
+  auto ForEachCore(F&& f) -> ErrorCode {
+    auto error_code = f(*core_);
+    for (const auto& core : extra_cores_) {
+      if (!core) {
+        continue;
+      }
+      if (const auto err = f(*core); err != ErrorCode::kSuccess) {
+        error_code = err;
+      }
+    }
+    return error_code;
+  }
+  auto ResetContext() -> ErrorCode {
+    return ForEachCore(
+        [](ProcessorCoreBase& core) { return core.ResetContext(); });
+  }
+  // buffers の先頭 n_channels 個のチャンネルを、それぞれのコアで in-place で
+  // 変換する。n_channels は GetNChannels() 以下であること。
+  // IsFanOut() の場合は buffers[0] の入力から合成した声を各チャンネルに書き込む
+  auto Process(float* const* buffers, int n_channels, int n_samples)
+      -> ErrorCode;
 
  private:
   double sample_rate_;
+  bool offline_rendering_ = false;
+  bool load_leveling_allowed_ = true;
+  bool multi_channel_allowed_ = true;
+  int quality_level_ = 0;
+  SpeakerTableStorage speaker_table_storage_ = SpeakerTableStorage::kFloat32;
+  bool model_loading_deferred_ = false;
+  bool model_load_requested_ = false;
+  // SetChannelMode() と SetNFanOutVoices() で設定された値
+  int channel_mode_ = 0;
+  int n_fan_out_voices_ = 2;
   ParameterState parameter_state_;
   std::unique_ptr<ProcessorCoreBase> core_;
+  // Dual Mono の場合の 2 チャンネル目と、Fan-Out の場合の 2 つ目以降の声。
+  // 重みは ModelRegistry を介して core_ と共有される。
+  // Fan-Out では core_ の解析結果を参照するので、core_ より先に破棄する
+  std::array<std::unique_ptr<ProcessorCoreBase>, kMaxNVoices - 1>
+      extra_cores_;
+  // extra_cores_ が Fan-Out 用に用意されたものであれば true
+  bool fan_out_ = false;
+  std::shared_ptr<StandbyCores> standby_cores_;
+  std::filesystem::path loaded_model_file_;
+  SpeakerTableStorage loaded_speaker_table_storage_ =
+      SpeakerTableStorage::kFloat32;
+  std::optional<PerformanceProfile> performance_profile_;
+
+  // Fan-Out では、渡し元と受け取る側でホップを処理する呼び出しがずれると
+  // 解析結果を受け渡せないので、遅延を揃えるだけにする
+  [[nodiscard]] auto GetCoreLoadLevelingMode() const -> LoadLevelingMode {
+    if (!load_leveling_allowed_ || !IsLoadLevelingEnabled()) {
+      return LoadLevelingMode::kDisabled;
+    }
+    return fan_out_ ? LoadLevelingMode::kDelayOnly : LoadLevelingMode::kSpread;
+  }
+
+  // 読み込み済みの core_ を standby_cores_ に移す
+  void RetireCore() {
+    for (auto& core : extra_cores_) {
+      core.reset();
+    }
+    if (standby_cores_ && !loaded_model_file_.empty()) {
+      standby_cores_->Put(loaded_model_file_, loaded_speaker_table_storage_,
+                          std::move(core_));
+    }
+    loaded_model_file_.clear();
+  }
+
+  // file のモデルの計測結果が保存されていれば読み込み、core_ に反映する
+  void LoadPerformanceProfile(const std::filesystem::path& file) {
+    performance_profile_.reset();
+    auto profile = PerformanceProfile();
+    if (!file.empty() &&
+        PerformanceProfile::Load(file, sample_rate_, profile)) {
+      performance_profile_ = profile;
+      core_->ApplyPerformanceProfile(profile);
+      for (const auto& core : extra_cores_) {
+        if (core) {
+          core->ApplyPerformanceProfile(profile);
+        }
+      }
+    }
+  }
+
+  // Channel Mode と Fan-Out Voices から決まる、必要なコアの数
+  [[nodiscard]] auto GetNRequiredCores() const -> int;
+  [[nodiscard]] auto IsFanOutRequired() const -> bool;
+  // Channel Mode の変更などで必要になったコアを用意するか、
+  // SetModelLoadingDeferred(true) の場合は読み込みの要求として記録する
+  auto UpdateChannelLayout(ParameterID param_id) -> ErrorCode;
+  // Channel Mode と読み込んだモデルに合わせて、extra_cores_ を用意または破棄する
+  auto UpdateChannelCores() -> ErrorCode;
 
   // parameter_state_ の値を core_ に反映させる。
   // 原則として state と core は同期されており、
@@ -0,0 +1,155 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/quality_controller.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+namespace beatrice::common {
+
+namespace {
+
+// 負荷を評価する区間の長さ [s]
+constexpr auto kWindowSeconds = 0.5;
+// 区間の平均か最大の負荷がこれを超えたら品質を下げる
+constexpr auto kHighMeanLoad = 0.7;
+constexpr auto kHighPeakLoad = 0.9;
+// 区間の平均と最大の負荷が両方これを下回る区間が続いたら品質を上げる
+constexpr auto kLowMeanLoad = 0.35;
+constexpr auto kLowPeakLoad = 0.55;
+// 1 回の呼び出しで締め切りを超えた場合は、区間の終わりを待たずに下げる。
+// ただし、変更の効果が現れるまでの間に続けて下げすぎないよう間隔を空ける
+constexpr auto kOverrunLoad = 1.0;
+constexpr auto kMinChangeIntervalSeconds = 0.25;
+// 品質を上げてからこの時間以内に下げることになった場合は、
+// 次に上げるまでに必要な余裕のある区間の数を倍にする
+constexpr auto kBackoffSeconds = 5.0;
+constexpr auto kMaxCalmWindows = 64;
+
+}  // namespace
+
+void QualityController::Reset() {
+  if (level_ != 0) {
+    ChangeLevel(0, 0.0, 0.0);
+  }
+  window_audio_seconds_ = 0.0;
+  window_processing_seconds_ = 0.0;
+  window_peak_load_ = 0.0;
+  n_calm_windows_ = 0;
+  n_required_calm_windows_ = kMinCalmWindows;
+}
+
+void QualityController::SetLevel(const int level) {
+  const auto new_level = std::clamp(level, 0, kMaxLevel);
+  if (new_level != level_) {
+    // 実測した負荷による変更ではないので、上げ下げの間隔は調整しない
+    AddLog(new_level, 0.0, 0.0);
+    level_ = new_level;
+    last_change_time_ = time_;
+  }
+  window_audio_seconds_ = 0.0;
+  window_processing_seconds_ = 0.0;
+  window_peak_load_ = 0.0;
+  n_calm_windows_ = 0;
+}
+
+auto QualityController::Measure(const double processing_seconds,
+                                const double audio_seconds) -> bool {
+  if (audio_seconds <= 0.0) {
+    return false;
+  }
+  time_ += audio_seconds;
+  const auto load = processing_seconds / audio_seconds;
+  window_audio_seconds_ += audio_seconds;
+  window_processing_seconds_ += processing_seconds;
+  window_peak_load_ = std::max(window_peak_load_, load);
+  const auto can_change =
+      time_ - last_change_time_ >= kMinChangeIntervalSeconds;
+  if (load > kOverrunLoad && level_ < kMaxLevel && can_change) {
+    ChangeLevel(level_ + 1,
+                window_processing_seconds_ / window_audio_seconds_,
+                window_peak_load_);
+    return true;
+  }
+  if (window_audio_seconds_ < kWindowSeconds) {
+    return false;
+  }
+  const auto mean_load = window_processing_seconds_ / window_audio_seconds_;
+  const auto peak_load = window_peak_load_;
+  window_audio_seconds_ = 0.0;
+  window_processing_seconds_ = 0.0;
+  window_peak_load_ = 0.0;
+  if (mean_load > kHighMeanLoad || peak_load > kHighPeakLoad) {
+    n_calm_windows_ = 0;
+    if (level_ < kMaxLevel && can_change) {
+      ChangeLevel(level_ + 1, mean_load, peak_load);
+      return true;
+    }
+    return false;
+  }
+  if (mean_load >= kLowMeanLoad || peak_load >= kLowPeakLoad) {
+    n_calm_windows_ = 0;
+    return false;
+  }
+  if (++n_calm_windows_ < n_required_calm_windows_ || level_ == 0) {
+    return false;
+  }
+  ChangeLevel(level_ - 1, mean_load, peak_load);
+  return true;
+}
+
+void QualityController::ChangeLevel(const int level, const double mean_load,
+                                    const double peak_load) {
+  if (level > level_) {
+    // 品質を上げた直後に下げる場合は、上げたのが早すぎた
+    n_required_calm_windows_ =
+        time_ - last_improve_time_ < kBackoffSeconds
+            ? std::min(n_required_calm_windows_ * 2, kMaxCalmWindows)
+            : kMinCalmWindows;
+  } else {
+    last_improve_time_ = time_;
+  }
+  AddLog(level, mean_load, peak_load);
+  level_ = level;
+  last_change_time_ = time_;
+  n_calm_windows_ = 0;
+}
+
+void QualityController::AddLog(const int level, const double mean_load,
+                               const double peak_load) {
+  log_[n_adjustments_ % kLogCapacity] = {.time = time_,
+                                         .from = level_,
+                                         .to = level,
+                                         .mean_load = mean_load,
+                                         .peak_load = peak_load};
+  ++n_adjustments_;
+}
+
+auto QualityController::GetReport() const -> std::string {
+  auto text = std::string();
+  auto line = std::array<char, 96>();
+  std::snprintf(line.data(), line.size(),
+                "level: %d (0 = full quality, %d = lowest)\n", level_,
+                kMaxLevel);
+  text += line.data();
+  if (n_adjustments_ == 0) {
+    text += "no adjustments\n";
+    return text;
+  }
+  // 新しい順
+  const auto n = std::min(n_adjustments_, kLogCapacity);
+  for (auto i = std::size_t{0}; i < n; ++i) {
+    const auto& adjustment = log_[(n_adjustments_ - 1 - i) % kLogCapacity];
+    std::snprintf(line.data(), line.size(),
+                  "%10.1f s  %d -> %d  mean load %3.0f%%  peak load %3.0f%%\n",
+                  adjustment.time, adjustment.from, adjustment.to,
+                  adjustment.mean_load * 100.0, adjustment.peak_load * 100.0);
+    text += line.data();
+  }
+  return text;
+}
+
+}  // namespace beatrice::common
@@ -0,0 +1,71 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_QUALITY_CONTROLLER_H_
+#define BEATRICE_COMMON_QUALITY_CONTROLLER_H_
+
+#include <array>
+#include <cstddef>
+#include <string>
+
+namespace beatrice::common {
+
+// リアルタイム処理で、処理時間が音声の長さに対して足りなくなってきた場合に、
+// 品質を段階的に下げて負荷を減らすためのクラス。
+// レベル 0 が最高品質で、各レベルで何を省くかは ProcessorCore 側で決める。
+// 品質を上げる条件と下げる条件の間に幅を持たせ、さらに上げた直後に下げることになった
+// 場合は次に上げるまでの時間を延ばすことで、レベルが振動しないようにする。
+class QualityController {
+ public:
+  static constexpr int kMaxLevel = 3;
+
+  // レベルの変更の記録
+  struct Adjustment {
+    // 処理した音声の長さの累計で表した時刻 [s]
+    double time;
+    int from;
+    int to;
+    // 変更の判断に使った区間の平均と最大の負荷 (処理時間 / 音声の長さ)
+    double mean_load;
+    double peak_load;
+  };
+
+  QualityController() = default;
+
+  // レベルを 0 に戻し、計測中の区間を捨てる。記録は残す
+  void Reset();
+  // 計測済みの処理時間から決めたレベルで始める。計測中の区間は捨てる
+  void SetLevel(int level);
+  // 以下 2 つはオーディオスレッドから呼ぶ。メモリの確保は行わない。
+  // audio_seconds の長さの音声の処理に processing_seconds かかったことを記録し、
+  // レベルを変更した場合は true を返す
+  auto Measure(double processing_seconds, double audio_seconds) -> bool;
+  [[nodiscard]] auto GetLevel() const -> int { return level_; }
+  // 現在のレベルと、最近の変更の記録を人が読める形式で返す
+  [[nodiscard]] auto GetReport() const -> std::string;
+
+ private:
+  static constexpr std::size_t kLogCapacity = 16;
+  static constexpr int kMinCalmWindows = 4;
+
+  int level_ = 0;
+  double time_ = 0.0;
+  double last_change_time_ = 0.0;
+  double last_improve_time_ = -1e9;
+  // 計測中の区間
+  double window_audio_seconds_ = 0.0;
+  double window_processing_seconds_ = 0.0;
+  double window_peak_load_ = 0.0;
+  // 余裕のある区間が連続した数と、品質を上げるのに必要な数
+  int n_calm_windows_ = 0;
+  int n_required_calm_windows_ = kMinCalmWindows;
+  // 直近 kLogCapacity 個の変更を循環させて保持する
+  std::array<Adjustment, kLogCapacity> log_ = {};
+  std::size_t n_adjustments_ = 0;
+
+  void ChangeLevel(int level, double mean_load, double peak_load);
+  void AddLog(int level, double mean_load, double peak_load);
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_QUALITY_CONTROLLER_H_
@@ -0,0 +1,203 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/realtime_worker_pool.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
+
+namespace beatrice::common {
+
+namespace {
+
+// キューが空の時に、futex で待機する前に確認し直す回数
+constexpr auto kMaxSpins = 256;
+
+auto GetNWorkers() -> int {
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  if (const auto* const value = std::getenv("BEATRICE_ASYNC_WORKERS")) {
+    const auto* const end = value + std::strlen(value);
+    auto n_workers = 0;
+    const auto [ptr, ec] = std::from_chars(value, end, n_workers);
+    if (ec == std::errc() && ptr == end && n_workers > 0) {
+      return n_workers;
+    }
+  }
+  return std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+}
+
+// 権限が無いなどで失敗した場合は通常の優先度のまま動かす
+void SetRealtimePriority([[maybe_unused]] std::thread& thread) {
+#if defined(_WIN32)
+  SetThreadPriority(thread.native_handle(), THREAD_PRIORITY_TIME_CRITICAL);
+#elif defined(__APPLE__)
+  // macOS ではスレッド自身から設定する
+#else
+  auto param = sched_param();
+  param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+  pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param);
+#endif
+}
+
+}  // namespace
+
+RealtimeWorkerPool::RealtimeWorkerPool(const int n_threads) {
+  for (auto i = std::size_t{0}; i < kQueueCapacity; ++i) {
+    queue_[i].sequence.store(i, std::memory_order_relaxed);
+    queue_[i].job = nullptr;
+  }
+  threads_.reserve(n_threads);
+  for (auto i = 0; i < n_threads; ++i) {
+    threads_.emplace_back([this] { Work(); });
+    SetRealtimePriority(threads_.back());
+  }
+}
+
+RealtimeWorkerPool::~RealtimeWorkerPool() {
+  exiting_.store(true, std::memory_order_release);
+  epoch_.fetch_add(1, std::memory_order_release);
+  epoch_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+auto RealtimeWorkerPool::Acquire() -> std::shared_ptr<RealtimeWorkerPool> {
+  // プラグインのアンロード時の破棄順序の問題を避けるため、意図的に解放しない
+  static auto* const mtx = new std::mutex();
+  static auto* const shared = new std::weak_ptr<RealtimeWorkerPool>();
+  const auto lock = std::lock_guard<std::mutex>(*mtx);
+  if (auto pool = shared->lock()) {
+    return pool;
+  }
+  auto pool = std::make_shared<RealtimeWorkerPool>(GetNWorkers());
+  *shared = pool;
+  return pool;
+}
+
+void RealtimeWorkerPool::Schedule(Job& job) {
+  auto state = job.state_.load(std::memory_order_acquire);
+  while (true) {
+    if (state == Job::kQueued || state == Job::kRunningAgain) {
+      return;
+    }
+    const auto next = state == Job::kIdle ? Job::kQueued : Job::kRunningAgain;
+    if (job.state_.compare_exchange_weak(state, next,
+                                         std::memory_order_acq_rel)) {
+      break;
+    }
+  }
+  if (state != Job::kIdle) {
+    // 実行中のワーカーがもう一度実行する
+    return;
+  }
+  if (!TryPush(&job)) {
+    // 上限を超えた分は実行されない。次の依頼で改めて積む
+    job.state_.store(Job::kIdle, std::memory_order_release);
+    job.state_.notify_all();
+    return;
+  }
+  epoch_.fetch_add(1, std::memory_order_release);
+  epoch_.notify_one();
+}
+
+void RealtimeWorkerPool::Wait(Job& job) {
+  for (auto state = job.state_.load(std::memory_order_acquire);
+       state != Job::kIdle;
+       state = job.state_.load(std::memory_order_acquire)) {
+    job.state_.wait(state, std::memory_order_acquire);
+  }
+}
+
+// 有界の MPMC キュー (Dmitry Vyukov の方式)
+auto RealtimeWorkerPool::TryPush(Job* const job) -> bool {
+  auto position = enqueue_position_.load(std::memory_order_relaxed);
+  while (true) {
+    auto& cell = queue_[position % kQueueCapacity];
+    const auto sequence = cell.sequence.load(std::memory_order_acquire);
+    if (sequence == position) {
+      if (enqueue_position_.compare_exchange_weak(position, position + 1,
+                                                  std::memory_order_relaxed)) {
+        cell.job = job;
+        cell.sequence.store(position + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (sequence < position) {
+      return false;
+    } else {
+      position = enqueue_position_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+auto RealtimeWorkerPool::TryPop() -> Job* {
+  auto position = dequeue_position_.load(std::memory_order_relaxed);
+  while (true) {
+    auto& cell = queue_[position % kQueueCapacity];
+    const auto sequence = cell.sequence.load(std::memory_order_acquire);
+    if (sequence == position + 1) {
+      if (dequeue_position_.compare_exchange_weak(position, position + 1,
+                                                  std::memory_order_relaxed)) {
+        auto* const job = cell.job;
+        cell.sequence.store(position + kQueueCapacity,
+                            std::memory_order_release);
+        return job;
+      }
+    } else if (sequence < position + 1) {
+      return nullptr;
+    } else {
+      position = dequeue_position_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void RealtimeWorkerPool::RunJob(Job& job) {
+  while (true) {
+    job.state_.store(Job::kRunning, std::memory_order_relaxed);
+    job.Run();
+    auto expected = static_cast<int>(Job::kRunning);
+    if (job.state_.compare_exchange_strong(expected, Job::kIdle,
+                                           std::memory_order_acq_rel)) {
+      break;
+    }
+    // 実行中に依頼された分は、このワーカーが続けて実行する
+  }
+  job.state_.notify_all();
+}
+
+void RealtimeWorkerPool::Work() {
+#if defined(__APPLE__)
+  pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0);
+#endif
+  while (!exiting_.load(std::memory_order_acquire)) {
+    const auto epoch = epoch_.load(std::memory_order_acquire);
+    auto* job = TryPop();
+    for (auto i = 0; !job && i < kMaxSpins; ++i) {
+      std::this_thread::yield();
+      job = TryPop();
+    }
+    if (job) {
+      RunJob(*job);
+      continue;
+    }
+    epoch_.wait(epoch, std::memory_order_acquire);
+  }
+}
+
+}  // namespace beatrice::common
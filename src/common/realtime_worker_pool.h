@@ -0,0 +1,88 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_REALTIME_WORKER_POOL_H_
+#define BEATRICE_COMMON_REALTIME_WORKER_POOL_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+namespace beatrice::common {
+
+// オーディオスレッドから依頼された処理を、プロセス内の全インスタンスで共有する
+// リアルタイム優先度のワーカースレッドで実行するスレッドプール。
+// ワーカーは全て 1 つのロックフリーなキューから取り出すので、
+// どのインスタンスの処理も空いているワーカーに振り分けられる。
+// スレッド数は環境変数 BEATRICE_ASYNC_WORKERS で指定でき、
+// 既定値は論理コア数 - 1。
+class RealtimeWorkerPool {
+ public:
+  // 実行を依頼する処理。同じ Job が複数のワーカーで同時に実行されることはない
+  class Job {
+   public:
+    Job() = default;
+    Job(const Job&) = delete;
+    auto operator=(const Job&) -> Job& = delete;
+    virtual void Run() = 0;
+
+   protected:
+    ~Job() = default;
+
+   private:
+    friend class RealtimeWorkerPool;
+    enum State : int {
+      kIdle,
+      kQueued,
+      kRunning,
+      // 実行中に再び依頼された
+      kRunningAgain,
+    };
+    std::atomic<int> state_ = kIdle;
+  };
+
+  explicit RealtimeWorkerPool(int n_threads);
+  RealtimeWorkerPool(const RealtimeWorkerPool&) = delete;
+  auto operator=(const RealtimeWorkerPool&) -> RealtimeWorkerPool& = delete;
+  ~RealtimeWorkerPool();
+
+  // プロセス内で共有するプールを返す。
+  // 全ての参照が無くなった時点でスレッドも終了する。
+  static auto Acquire() -> std::shared_ptr<RealtimeWorkerPool>;
+
+  // job の実行を依頼する。既に実行待ちであれば何もせず、
+  // 実行中であれば終わった後にもう一度実行する。
+  // ロックもメモリ確保も行わないので、オーディオスレッドから呼んでよい。
+  void Schedule(Job& job);
+  // job が実行待ちでも実行中でもなくなるまで待つ。
+  // 待っている間に Schedule() が呼ばれないようにしておくこと
+  void Wait(Job& job);
+
+ private:
+  // 同時に実行待ちにできる Job の数の上限
+  static constexpr std::size_t kQueueCapacity = 1024;
+  struct Cell {
+    std::atomic<std::size_t> sequence;
+    Job* job;
+  };
+
+  std::array<Cell, kQueueCapacity> queue_;
+  alignas(64) std::atomic<std::size_t> enqueue_position_ = 0;
+  alignas(64) std::atomic<std::size_t> dequeue_position_ = 0;
+  // 依頼がある度に増やし、待機中のワーカーを起こす
+  alignas(64) std::atomic<std::uint32_t> epoch_ = 0;
+  std::atomic<bool> exiting_ = false;
+  std::vector<std::thread> threads_;
+
+  auto TryPush(Job* job) -> bool;
+  auto TryPop() -> Job*;
+  static void RunJob(Job& job);
+  void Work();
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_REALTIME_WORKER_POOL_H_
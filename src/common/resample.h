@@ -4,8 +4,10 @@
 #define BEATRICE_COMMON_RESAMPLE_H_
 
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
+#include <cstddef>
 #include <cstring>
 #include <memory>
 #include <numbers>  // NOLINT(build/include_order)
@@ -70,6 +72,11 @@ class Buffer {
     assert(-siz_ <= idx && idx < 0);
     return *(data_.end() + idx);
   }
+
+  // ヒープ上に確保している量 [bytes]
+  [[nodiscard]] auto GetMemoryUsage() const -> std::size_t {
+    return data_.capacity() * sizeof(float);
+  }
 };
 
 // Downsample と Upsample は必ず交互に呼ぶこと
@@ -100,6 +107,14 @@ class DownUpSamplerImpl {
 
   [[nodiscard]] auto IsReady() const -> bool { return ready_; }
 
+  // ヒープ上に確保している量 [bytes]
+  [[nodiscard]] auto GetMemoryUsage() const -> std::size_t {
+    return (filter_coef_down_.capacity() + filter_coef_up_.capacity()) *
+               sizeof(float) +
+           sample_buffer_high_.GetMemoryUsage() +
+           sample_buffer_low_.GetMemoryUsage();
+  }
+
   void ResampleIn(const std::vector<float>& input, std::vector<float>& output) {
     if (!IsReady()) {
       output.resize(0);
@@ -324,25 +339,146 @@ class ConvertStreamFunctionFrequency {
   [[nodiscard]] auto GetTargetFrequency() const -> double {
     return target_frequency_;
   }
+
+  // ヒープ上に確保している量 [bytes]
+  [[nodiscard]] auto GetMemoryUsage() const -> std::size_t {
+    return down_up_sampler_.GetMemoryUsage() +
+           (buf_io_.capacity() + buf_work_.capacity()) * sizeof(float) +
+           function_.GetMemoryUsage();
+  }
 };
 
 // n サンプル受け取って n サンプルを返す関数をラップして、
-// 任意のサンプル数受け取って同じ長さを返すオブジェクトにする
+// 任意のサンプル数受け取って同じ長さを返すオブジェクトにする。
+// 関数が ProcessBatch() に対応していて IsBatchProcessing() が true を返す場合は、
+// 1 回の呼び出しで揃うブロックをまとめて ProcessBatch() に渡す。
+// 関数が段階に分けた処理に対応していて IsLoadLeveling() が true を返す場合は、
+// 遅延を 1 ブロック分増やす代わりに、1 ブロックの処理を複数回の呼び出しに
+// 均等に分散させる。IsSpreadingStages() が false の場合は、遅延だけを増やし、
+// 全ての段階を入力が揃った呼び出しで行う
 template <int n, class Func>
 class ConvertStreamFunctionBlockSize {
   alignas(64) std::array<float, n> buffer_;
   Func function_;
   int idx_buffer_ = 0;
+  std::vector<float> batch_input_;
+  std::vector<float> batch_output_;
+  // 負荷の平準化用。
+  // 入力が揃ったブロックは次のブロックの入力が揃うまでの間に段階的に処理し、
+  // その次のブロックの入力が揃うまでの間に出力する
+  alignas(64) std::array<float, n> leveled_output_;
+  bool leveling_ = false;
+  bool has_pending_stages_ = false;
+  int next_stage_ = 0;
+
+  template <class... Context>
+  void FinishStages(Context&... context) {
+    const auto n_stages = function_.GetNStages(context...);
+    for (; next_stage_ < n_stages; ++next_stage_) {
+      function_.RunStage(next_stage_, context...);
+    }
+  }
+
+  template <class... Context>
+  void ProcessLeveled(const float* const input, float* const output,
+                      const int n_io, Context&... context) {
+    for (auto idx_io = 0; idx_io < n_io;) {
+      const auto n_samples_process = std::min(n - idx_buffer_, n_io - idx_io);
+      std::memcpy(&output[idx_io], &leveled_output_[idx_buffer_],
+                  sizeof(float) * n_samples_process);
+      std::memcpy(&buffer_[idx_buffer_], &input[idx_io],
+                  sizeof(float) * n_samples_process);
+      idx_buffer_ += n_samples_process;
+      idx_io += n_samples_process;
+      if (idx_buffer_ == n) {
+        idx_buffer_ = 0;
+        // 前のブロックの出力が必要になったので、残っている段階を全て済ませる
+        if (has_pending_stages_) {
+          FinishStages(context...);
+          function_.EndStages(std::to_address(leveled_output_.begin()),
+                              context...);
+        } else {
+          leveled_output_.fill(0.0f);
+        }
+        function_.BeginStages(std::to_address(buffer_.begin()), context...);
+        has_pending_stages_ = true;
+        next_stage_ = 0;
+        if (!function_.IsSpreadingStages(context...)) {
+          FinishStages(context...);
+        }
+      }
+    }
+    if (!has_pending_stages_) {
+      return;
+    }
+    // 次のブロックの入力が溜まった割合に比例して段階を進めることで、
+    // 1 ブロック分の入力が来るまでに全ての段階が終わるようにする
+    const auto n_stages = function_.GetNStages(context...);
+    const auto n_due_stages = (n_stages * idx_buffer_ + n - 1) / n;
+    for (; next_stage_ < n_due_stages; ++next_stage_) {
+      function_.RunStage(next_stage_, context...);
+    }
+  }
+
+  template <class... Context>
+  void ProcessBatch(const float* const input, float* const output,
+                    const int n_io, const int n_blocks, Context&... context) {
+    batch_input_.resize(n_blocks * n);
+    batch_output_.resize(n_blocks * n);
+    // 最初のブロックは buffer_ に溜まっている入力の続き
+    const auto n_head = n - idx_buffer_;
+    std::memcpy(batch_input_.data(), buffer_.data(),
+                sizeof(float) * idx_buffer_);
+    std::memcpy(&batch_input_[idx_buffer_], input, sizeof(float) * n_head);
+    std::memcpy(&batch_input_[n], &input[n_head],
+                sizeof(float) * (n_blocks - 1) * n);
+    // 前回処理した分の残りを出力する
+    std::memcpy(output, &buffer_[idx_buffer_], sizeof(float) * n_head);
+    function_.ProcessBatch(batch_input_.data(), batch_output_.data(), n_blocks,
+                           context...);
+    const auto n_tail = idx_buffer_ + n_io - n_blocks * n;
+    std::memcpy(&output[n_head], batch_output_.data(),
+                sizeof(float) * (n_io - n_head));
+    // 最後のブロックの出力の残りは次回に出力する
+    std::memcpy(buffer_.data(), &input[n_io - n_tail], sizeof(float) * n_tail);
+    std::memcpy(&buffer_[n_tail], &batch_output_[(n_blocks - 1) * n + n_tail],
+                sizeof(float) * (n - n_tail));
+    idx_buffer_ = n_tail;
+  }
 
  public:
   explicit ConvertStreamFunctionBlockSize(Func function)
-      : buffer_(), function_(function) {}
+      : buffer_(), function_(function), leveled_output_() {}
 
   // input != output でなければならない
   template <class... Context>
   auto operator()(const float* const input, float* const output, const int n_io,
                   Context&&... context) {
     assert(input != output);
+    if constexpr (requires { function_.IsLoadLeveling(context...); }) {
+      const auto leveling = function_.IsLoadLeveling(context...);
+      if (leveling != leveling_) {
+        // バッファの使い方が異なるので、切り替え時は空の状態から始める
+        leveling_ = leveling;
+        buffer_.fill(0.0f);
+        leveled_output_.fill(0.0f);
+        idx_buffer_ = 0;
+        has_pending_stages_ = false;
+      }
+      if (leveling) {
+        ProcessLeveled(input, output, n_io, context...);
+        return;
+      }
+    }
+    if constexpr (requires {
+                    function_.ProcessBatch(input, output, n_io, context...);
+                  }) {
+      if (const auto n_blocks = (idx_buffer_ + n_io) / n;
+          n_blocks >= 2 && function_.IsBatchProcessing(context...)) {
+        ProcessBatch(input, output, n_io, n_blocks, context...);
+        return;
+      }
+    }
     for (auto idx_io = 0; idx_io < n_io;) {
       const auto n_samples_process = std::min(n - idx_buffer_, n_io - idx_io);
       std::memcpy(&output[idx_io], &buffer_[idx_buffer_],
@@ -361,6 +497,13 @@ class ConvertStreamFunctionBlockSize {
       }
     }
   }
+
+  // ヒープ上に確保している量 [bytes]
+  [[nodiscard]] auto GetMemoryUsage() const -> std::size_t {
+    return (batch_input_.capacity() + batch_output_.capacity()) *
+               sizeof(float) +
+           function_.GetMemoryUsage();
+  }
 };
 
 // 2n サンプル受け取って 3n サンプル返す関数をラップして、
@@ -370,10 +513,15 @@ class ConvertStreamFunctionBlockSize {
 template <int n, class Func>
 class ConvertStreamFunctionFrom2In3OutTo6InOut {
   Func function_;
+  std::vector<float> batch_input_;
+  std::vector<float> batch_output_;
+  // 段階に分けて処理中のブロック
+  alignas(64) std::array<float, 2 * n> stage_input_;
+  alignas(64) std::array<float, 3 * n> stage_output_;
 
  public:
   explicit ConvertStreamFunctionFrom2In3OutTo6InOut(Func function)
-      : function_(function) {}
+      : function_(function), stage_input_(), stage_output_() {}
 
   // input == output であってもよい
   template <class... Context>
@@ -392,6 +540,73 @@ class ConvertStreamFunctionFrom2In3OutTo6InOut {
       output[i * 2] = function_out[i];
     }
   }
+
+  template <class... Context>
+  [[nodiscard]] auto IsBatchProcessing(Context&... context) const -> bool {
+    return function_.IsBatchProcessing(context...);
+  }
+
+  // 以下は 1 ブロックの処理を段階に分けて行う場合に使う。
+  // BeginStages() で入力を渡し、RunStage() を 0 から GetNStages() - 1 まで
+  // 順に呼んだ後、EndStages() で出力を受け取る
+  template <class... Context>
+  [[nodiscard]] auto IsLoadLeveling(Context&... context) const -> bool {
+    return function_.IsLoadLeveling(context...);
+  }
+  template <class... Context>
+  [[nodiscard]] auto IsSpreadingStages(Context&... context) const -> bool {
+    return function_.IsSpreadingStages(context...);
+  }
+  template <class... Context>
+  [[nodiscard]] auto GetNStages(Context&... context) const -> int {
+    return function_.GetNStages(context...);
+  }
+  template <class... Context>
+  void BeginStages(const float* const input, Context&... /*context*/) {
+    for (auto i = 0; i < 2 * n; ++i) {
+      stage_input_[i] = input[(i + 1) * 3 - 1];
+    }
+  }
+  template <class... Context>
+  void RunStage(const int stage, Context&... context) {
+    function_.RunStage(stage, std::to_address(stage_input_.begin()),
+                       std::to_address(stage_output_.begin()), context...);
+  }
+  template <class... Context>
+  void EndStages(float* const output, Context&... /*context*/) {
+    std::memset(output, 0, 6 * n * sizeof(float));
+    for (auto i = 0; i < 3 * n; ++i) {
+      output[i * 2] = stage_output_[i];
+    }
+  }
+
+  // 6n サンプルずつ n_blocks ブロック分を処理する。
+  // 関数にはそれぞれ 2n サンプルと 3n サンプルずつ詰めて渡す
+  template <class... Context>
+    requires requires(Func& function, Context&... context) {
+      function.ProcessBatch(static_cast<const float*>(nullptr),
+                            static_cast<float*>(nullptr), 0, context...);
+    }
+  void ProcessBatch(const float* const input, float* const output,
+                    const int n_blocks, Context&... context) {
+    batch_input_.resize(n_blocks * 2 * n);
+    batch_output_.resize(n_blocks * 3 * n);
+    for (auto i = 0; i < n_blocks * 2 * n; ++i) {
+      batch_input_[i] = input[(i + 1) * 3 - 1];
+    }
+    function_.ProcessBatch(batch_input_.data(), batch_output_.data(), n_blocks,
+                           context...);
+    std::memset(output, 0, n_blocks * 6 * n * sizeof(float));
+    for (auto i = 0; i < n_blocks * 3 * n; ++i) {
+      output[i * 2] = batch_output_[i];
+    }
+  }
+
+  // ヒープ上に確保している量 [bytes]
+  [[nodiscard]] auto GetMemoryUsage() const -> std::size_t {
+    return (batch_input_.capacity() + batch_output_.capacity()) *
+           sizeof(float);
+  }
 };
 
 // ↑ 3 つの組み合わせ
@@ -435,6 +650,13 @@ class AnyFreqInOut {
   }
 
   [[nodiscard]] auto IsReady() const -> bool { return process_.IsReady(); }
+
+  // ヒープ上に確保している量 [bytes]。
+  // ブロックサイズの変換用のバッファはこのオブジェクト自体に含まれるが、
+  // まとめて処理する場合のバッファはヒープ上に確保される
+  [[nodiscard]] auto GetMemoryUsage() const -> std::size_t {
+    return process_.GetMemoryUsage();
+  }
 };
 
 }  // namespace beatrice::resampler
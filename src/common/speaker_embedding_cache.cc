@@ -0,0 +1,297 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/speaker_embedding_cache.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <memory>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "beatricelib/beatrice.h"
+
+// Beatrice
+#include "common/cache_directory.h"
+#include "common/hasher.h"
+#include "common/mapped_file.h"
+#include "common/model_config.h"
+
+namespace beatrice::common {
+
+namespace {
+
+constexpr auto kMagic =
+    std::array<char, 8>{'B', 'T', 'R', 'S', 'P', 'K', 'C', 0};
+// レイアウトを変えた場合はこれを上げる
+constexpr std::uint32_t kFormatVersion = 1;
+constexpr std::size_t kAlignment = 64;
+
+constexpr auto kCodebookSize =
+    BEATRICE_20RC0_CODEBOOK_SIZE * BEATRICE_20RC0_PHONE_CHANNELS;
+constexpr auto kKeyValueSpeakerEmbeddingSize =
+    BEATRICE_20RC0_KV_LENGTH * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS;
+
+struct CacheHeader {
+  std::array<char, 8> magic;
+  std::uint32_t format_version;
+  std::uint32_t n_speakers;
+  // 定数が変わったライブラリで古いキャッシュを使わないようにする
+  std::array<std::uint32_t, 6> shape;
+  std::uint64_t source_size;
+  std::int64_t source_mtime;
+  std::uint64_t source_hash;
+  std::array<std::uint64_t, 6> section_offsets;
+  std::uint64_t file_size;
+};
+
+constexpr auto kShape = std::array<std::uint32_t, 6>{
+    BEATRICE_20RC0_CODEBOOK_SIZE,
+    BEATRICE_20RC0_PHONE_CHANNELS,
+    BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
+    BEATRICE_20RC0_KV_LENGTH,
+    BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
+    sizeof(float),
+};
+
+auto AlignUp(const std::uint64_t n) -> std::uint64_t {
+  return (n + (kAlignment - 1)) & ~static_cast<std::uint64_t>(kAlignment - 1);
+}
+
+// 各セクションの要素数
+auto GetSectionSizes(const int n_speakers) -> std::array<std::uint64_t, 6> {
+  const auto n = static_cast<std::uint64_t>(n_speakers);
+  return {
+      n * kCodebookSize,
+      n * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
+      9 * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
+      n * kKeyValueSpeakerEmbeddingSize,
+      n * kKeyValueSpeakerEmbeddingSize,
+      n * kKeyValueSpeakerEmbeddingSize,
+  };
+}
+
+auto GetSectionOffsets(const int n_speakers) -> std::array<std::uint64_t, 7> {
+  const auto sizes = GetSectionSizes(n_speakers);
+  auto offsets = std::array<std::uint64_t, 7>{};
+  offsets[0] = AlignUp(sizeof(CacheHeader));
+  for (auto i = 0; i < 6; ++i) {
+    offsets[i + 1] = AlignUp(offsets[i] + sizes[i] * sizeof(float));
+  }
+  return offsets;
+}
+
+auto HashFile(const std::filesystem::path& file, std::uint64_t& hash) -> bool {
+  auto ifs = std::ifstream(file, std::ios::binary);
+  if (!ifs) {
+    return false;
+  }
+  auto hasher = Hasher();
+  auto buffer = std::vector<char>(1 << 20);
+  while (ifs) {
+    ifs.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    const auto n = static_cast<std::size_t>(ifs.gcount());
+    if (n == 0) {
+      break;
+    }
+    hasher.Update(reinterpret_cast<const std::byte*>(buffer.data()), n);
+  }
+  if (ifs.bad()) {
+    return false;
+  }
+  hash = hasher.Get();
+  return true;
+}
+
+auto GetLastWriteTime(const std::filesystem::path& file) -> std::int64_t {
+  auto ec = std::error_code();
+  const auto time = std::filesystem::last_write_time(file, ec);
+  if (ec) {
+    return 0;
+  }
+  return static_cast<std::int64_t>(time.time_since_epoch().count());
+}
+
+// キャッシュディレクトリが得られない場合は空のパスを返す
+auto GetCachePath(const std::filesystem::path& speaker_embeddings_file)
+    -> std::filesystem::path {
+  const auto dir = GetCacheDirectory();
+  if (dir.empty()) {
+    return {};
+  }
+  auto ec = std::error_code();
+  auto source = std::filesystem::weakly_canonical(speaker_embeddings_file, ec);
+  if (ec) {
+    source = speaker_embeddings_file;
+  }
+  const auto source_u8 = source.u8string();
+  auto hasher = Hasher();
+  hasher.Update(reinterpret_cast<const std::byte*>(source_u8.data()),
+                source_u8.size());
+  return dir / (hasher.GetHex() + ".spkcache");
+}
+
+}  // namespace
+
+auto SpeakerEmbeddingCache::Open(
+    const std::filesystem::path& speaker_embeddings_file)
+    -> std::shared_ptr<const SpeakerEmbeddingCache> {
+  const auto cache_path = GetCachePath(speaker_embeddings_file);
+  if (cache_path.empty()) {
+    return nullptr;
+  }
+  auto file = MappedFile::Open(cache_path);
+  if (!file || file->GetSize() < sizeof(CacheHeader)) {
+    return nullptr;
+  }
+  auto header = CacheHeader();
+  std::memcpy(&header, file->GetData(), sizeof(CacheHeader));
+  if (header.magic != kMagic || header.format_version != kFormatVersion ||
+      header.shape != kShape || header.file_size != file->GetSize() ||
+      header.n_speakers == 0 ||
+      header.n_speakers > static_cast<std::uint32_t>(kMaxNSpeakers)) {
+    return nullptr;
+  }
+  const auto offsets = GetSectionOffsets(static_cast<int>(header.n_speakers));
+  if (offsets[6] != header.file_size ||
+      !std::equal(header.section_offsets.begin(),
+                  header.section_offsets.end(), offsets.begin())) {
+    return nullptr;
+  }
+
+  // 元ファイルとの対応を確認する
+  auto ec = std::error_code();
+  const auto source_size =
+      std::filesystem::file_size(speaker_embeddings_file, ec);
+  if (ec || source_size != header.source_size) {
+    return nullptr;
+  }
+  if (GetLastWriteTime(speaker_embeddings_file) != header.source_mtime) {
+    // 更新日時だけが変わった場合 (コピーし直した場合など) は内容を比較する
+    auto source_hash = std::uint64_t{0};
+    if (!HashFile(speaker_embeddings_file, source_hash) ||
+        source_hash != header.source_hash) {
+      return nullptr;
+    }
+  }
+
+  auto cache =
+      std::shared_ptr<SpeakerEmbeddingCache>(new SpeakerEmbeddingCache());
+  cache->file_ = std::move(file);
+  cache->n_speakers_ = static_cast<int>(header.n_speakers);
+  std::copy_n(offsets.begin(), kNSections, cache->section_offsets_.begin());
+  return cache;
+}
+
+void SpeakerEmbeddingCache::Write(
+    const std::filesystem::path& speaker_embeddings_file, const int n_speakers,
+    const float* const codebooks,
+    const float* const additive_speaker_embeddings,
+    const float* const formant_shift_embeddings,
+    const float* const key_value_speaker_embeddings,
+    const KeyValueBlockGetter& get_key_value_block,
+    const KeyValueBlockGetter& get_normalized_key_value_block) {
+  const auto cache_path = GetCachePath(speaker_embeddings_file);
+  if (cache_path.empty() || n_speakers <= 0) {
+    return;
+  }
+  auto ec = std::error_code();
+  std::filesystem::create_directories(cache_path.parent_path(), ec);
+  if (ec) {
+    return;
+  }
+
+  // 他のインスタンスが同時に書き出していても壊れないよう、
+  // 一時ファイルに書き出してから置き換える
+  auto tmp_path = cache_path;
+  tmp_path += "." + std::to_string(std::random_device{}()) + ".tmp";
+  try {
+    const auto offsets = GetSectionOffsets(n_speakers);
+    auto header = CacheHeader{};
+    header.magic = kMagic;
+    header.format_version = kFormatVersion;
+    header.n_speakers = static_cast<std::uint32_t>(n_speakers);
+    header.shape = kShape;
+    header.source_size = std::filesystem::file_size(speaker_embeddings_file);
+    header.source_mtime = GetLastWriteTime(speaker_embeddings_file);
+    if (!HashFile(speaker_embeddings_file, header.source_hash)) {
+      return;
+    }
+    std::copy_n(offsets.begin(), kNSections, header.section_offsets.begin());
+    header.file_size = offsets[6];
+
+    auto ofs = std::ofstream(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!ofs) {
+      return;
+    }
+    auto position = std::uint64_t{0};
+    const auto write = [&ofs, &position](const void* const data,
+                                         const std::uint64_t size) -> void {
+      ofs.write(static_cast<const char*>(data),
+                static_cast<std::streamsize>(size));
+      position += size;
+    };
+    const auto pad_to = [&write,
+                         &position](const std::uint64_t offset) -> void {
+      static constexpr auto kZeros = std::array<char, kAlignment>{};
+      while (position < offset) {
+        write(kZeros.data(), std::min<std::uint64_t>(offset - position,
+                                                     kZeros.size()));
+      }
+    };
+    const auto sizes = GetSectionSizes(n_speakers);
+    write(&header, sizeof(header));
+    const auto sections = std::array<const float*, 4>{
+        codebooks, additive_speaker_embeddings, formant_shift_embeddings,
+        key_value_speaker_embeddings};
+    for (auto i = 0; i < 4; ++i) {
+      pad_to(offsets[i]);
+      write(sections[i], sizes[i] * sizeof(float));
+    }
+    const auto block_size = sizeof(float) * n_speakers *
+                            BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS;
+    pad_to(offsets[4]);
+    for (auto i = 0; i < BEATRICE_20RC0_KV_LENGTH; ++i) {
+      write(get_key_value_block(i), block_size);
+    }
+    pad_to(offsets[5]);
+    for (auto i = 0; i < BEATRICE_20RC0_KV_LENGTH; ++i) {
+      write(get_normalized_key_value_block(i), block_size);
+    }
+    pad_to(offsets[6]);
+    ofs.close();
+    if (!ofs) {
+      std::filesystem::remove(tmp_path, ec);
+      return;
+    }
+    std::filesystem::rename(tmp_path, cache_path, ec);
+    if (ec) {
+      std::filesystem::remove(tmp_path, ec);
+    }
+  } catch (const std::exception&) {
+    std::filesystem::remove(tmp_path, ec);
+  }
+}
+
+auto SpeakerEmbeddingCache::GetKeyValueBlock(const int kv_index) const
+    -> const float* {
+  return GetSection(4) + static_cast<std::size_t>(kv_index) * n_speakers_ *
+                             BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS;
+}
+
+auto SpeakerEmbeddingCache::GetNormalizedKeyValueBlock(const int kv_index) const
+    -> const float* {
+  return GetSection(5) + static_cast<std::size_t>(kv_index) * n_speakers_ *
+                             BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS;
+}
+
+}  // namespace beatrice::common
@@ -0,0 +1,84 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_SPEAKER_EMBEDDING_CACHE_H_
+#define BEATRICE_COMMON_SPEAKER_EMBEDDING_CACHE_H_
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+
+// Beatrice
+#include "common/mapped_file.h"
+
+namespace beatrice::common {
+
+// 2.0.0-rc.0 の speaker_embeddings.bin を読み込んで並べ替え・正規化した結果を
+// キャッシュディレクトリに保存しておき、次回以降はそれを読み取り専用でマップして使う。
+// キャッシュは元ファイルのパスから決まる名前で保存され、
+// 元ファイルのサイズ・更新日時・内容のハッシュが一致する場合のみ使われる。
+//
+// 含まれるテーブル:
+// - codebooks: n_speakers * CODEBOOK_SIZE * PHONE_CHANNELS
+// - additive speaker embeddings: n_speakers * HIDDEN_CHANNELS
+// - formant shift embeddings: 9 * HIDDEN_CHANNELS
+// - key-value speaker embeddings: n_speakers * KV_LENGTH * KV_CHANNELS
+// - key-value blocks: KV_LENGTH * n_speakers * KV_CHANNELS
+//   (key-value speaker embeddings を sph_avg 用に並べ替えたもの)
+// - normalized key-value blocks: 上記を sph_avg で正規化したもの
+class SpeakerEmbeddingCache {
+ public:
+  // key-value block を kv_index ごとに返す関数
+  using KeyValueBlockGetter = std::function<const float*(int /*kv_index*/)>;
+
+  // 有効なキャッシュがあれば開く。無ければ nullptr を返す。
+  static auto Open(const std::filesystem::path& speaker_embeddings_file)
+      -> std::shared_ptr<const SpeakerEmbeddingCache>;
+  // キャッシュを書き出す。失敗しても読み込み自体には影響しないので、結果は返さない。
+  static void Write(const std::filesystem::path& speaker_embeddings_file,
+                    int n_speakers, const float* codebooks,
+                    const float* additive_speaker_embeddings,
+                    const float* formant_shift_embeddings,
+                    const float* key_value_speaker_embeddings,
+                    const KeyValueBlockGetter& get_key_value_block,
+                    const KeyValueBlockGetter& get_normalized_key_value_block);
+
+  [[nodiscard]] auto GetNSpeakers() const -> int { return n_speakers_; }
+  [[nodiscard]] auto GetCodebooks() const -> const float* {
+    return GetSection(0);
+  }
+  [[nodiscard]] auto GetAdditiveSpeakerEmbeddings() const -> const float* {
+    return GetSection(1);
+  }
+  [[nodiscard]] auto GetFormantShiftEmbeddings() const -> const float* {
+    return GetSection(2);
+  }
+  [[nodiscard]] auto GetKeyValueSpeakerEmbeddings() const -> const float* {
+    return GetSection(3);
+  }
+  [[nodiscard]] auto GetKeyValueBlock(int kv_index) const -> const float*;
+  [[nodiscard]] auto GetNormalizedKeyValueBlock(int kv_index) const
+      -> const float*;
+  // マップしたファイル。テーブルを参照している間はこれを保持しておく
+  [[nodiscard]] auto GetFile() const
+      -> const std::shared_ptr<const MappedFile>& {
+    return file_;
+  }
+
+ private:
+  static constexpr int kNSections = 6;
+
+  std::shared_ptr<const MappedFile> file_;
+  int n_speakers_ = 0;
+  std::array<std::uint64_t, kNSections> section_offsets_ = {};
+
+  [[nodiscard]] auto GetSection(const int i) const -> const float* {
+    return reinterpret_cast<const float*>(file_->GetData() +
+                                          section_offsets_[i]);
+  }
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_SPEAKER_EMBEDDING_CACHE_H_
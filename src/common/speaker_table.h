@@ -0,0 +1,267 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_SPEAKER_TABLE_H_
+#define BEATRICE_COMMON_SPEAKER_TABLE_H_
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "common/spherical_average.h"
+
+namespace beatrice::common {
+
+// 話者ごとのテーブルをメモリ上でどの形式で保持するか
+enum class SpeakerTableStorage : std::uint8_t {
+  kFloat32 = 0,
+  kFloat16,
+  // 行ごとのスケールを持つ int8
+  kInt8,
+};
+
+inline auto FloatToHalf(const float value) -> std::uint16_t {
+  const auto bits = std::bit_cast<std::uint32_t>(value);
+  const auto sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000U);
+  const auto exponent = static_cast<int>((bits >> 23) & 0xffU);
+  auto mantissa = bits & 0x7fffffU;
+  if (exponent == 0xff) {
+    // inf, nan
+    return sign | 0x7c00U | (mantissa != 0 ? 0x200U : 0U);
+  }
+  const auto half_exponent = exponent - 127 + 15;
+  if (half_exponent >= 0x1f) {
+    return sign | 0x7c00U;
+  }
+  if (half_exponent <= 0) {
+    // 非正規化数または 0
+    if (half_exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000U;
+    const auto shift = static_cast<std::uint32_t>(14 - half_exponent);
+    auto half_mantissa = mantissa >> shift;
+    const auto remainder = mantissa & ((1U << shift) - 1U);
+    const auto halfway = 1U << (shift - 1U);
+    if (remainder > halfway || (remainder == halfway && (half_mantissa & 1U))) {
+      ++half_mantissa;
+    }
+    return sign | static_cast<std::uint16_t>(half_mantissa);
+  }
+  auto half = static_cast<std::uint32_t>(half_exponent << 10) |
+              (mantissa >> 13);
+  const auto remainder = mantissa & 0x1fffU;
+  if (remainder > 0x1000U || (remainder == 0x1000U && (half & 1U))) {
+    // 繰り上がりで指数部が溢れた場合も inf として正しく表現される
+    ++half;
+  }
+  return sign | static_cast<std::uint16_t>(half);
+}
+
+inline auto HalfToFloat(const std::uint16_t value) -> float {
+  const auto sign = static_cast<std::uint32_t>(value & 0x8000U) << 16;
+  const auto exponent = (value >> 10) & 0x1fU;
+  auto mantissa = static_cast<std::uint32_t>(value & 0x3ffU);
+  if (exponent == 0) {
+    if (mantissa == 0) {
+      return std::bit_cast<float>(sign);
+    }
+    // 非正規化数
+    const auto magnitude = std::ldexp(static_cast<float>(mantissa), -24);
+    return sign != 0 ? -magnitude : magnitude;
+  }
+  if (exponent == 0x1f) {
+    return std::bit_cast<float>(sign | 0x7f800000U | (mantissa << 13));
+  }
+  return std::bit_cast<float>(sign | ((exponent + 127 - 15) << 23) |
+                              (mantissa << 13));
+}
+
+// codebook や key-value speaker embedding のように、
+// 話者ごとに (rows_per_speaker * row_size) 個の float を持つテーブルを
+// 指定された形式で保持する。
+// 推論で必要になるのは一度に高々数話者分なので、使う話者の分だけを
+// 呼び出し側が用意したバッファに float で展開して使う。
+class SpeakerTable {
+ public:
+  SpeakerTable() = default;
+
+  void Assign(const SpeakerTableStorage storage, const float* const src,
+              const int n_speakers, const int rows_per_speaker,
+              const int row_size) {
+    Clear();
+    storage_ = storage;
+    n_speakers_ = n_speakers;
+    rows_per_speaker_ = rows_per_speaker;
+    row_size_ = row_size;
+    const auto n_rows = static_cast<std::size_t>(n_speakers) * rows_per_speaker;
+    const auto n_elements = n_rows * row_size;
+    switch (storage_) {
+      case SpeakerTableStorage::kFloat32:
+        f32_.assign(src, src + n_elements);
+        break;
+      case SpeakerTableStorage::kFloat16:
+        f16_.resize(n_elements);
+        for (std::size_t i = 0; i < n_elements; ++i) {
+          f16_[i] = FloatToHalf(src[i]);
+        }
+        break;
+      case SpeakerTableStorage::kInt8:
+        i8_.resize(n_elements);
+        scales_.resize(n_rows);
+        for (std::size_t r = 0; r < n_rows; ++r) {
+          const auto* const row = src + r * row_size;
+          auto max_abs = 0.0f;
+          for (auto i = 0; i < row_size; ++i) {
+            max_abs = std::max(max_abs, std::abs(row[i]));
+          }
+          const auto scale = max_abs / 127.0f;
+          const auto inv_scale = scale > 0.0f ? 1.0f / scale : 0.0f;
+          scales_[r] = scale;
+          for (auto i = 0; i < row_size; ++i) {
+            i8_[r * row_size + i] = static_cast<std::int8_t>(std::clamp(
+                std::round(row[i] * inv_scale), -127.0f, 127.0f));
+          }
+        }
+        break;
+    }
+  }
+
+  // kFloat32 の場合はコピーせずに受け取る
+  void Assign(const SpeakerTableStorage storage, AlignedVector<float, 64>&& src,
+              const int n_speakers, const int rows_per_speaker,
+              const int row_size) {
+    assert(src.size() == static_cast<std::size_t>(n_speakers) *
+                             rows_per_speaker * row_size);
+    if (storage != SpeakerTableStorage::kFloat32) {
+      Assign(storage, src.data(), n_speakers, rows_per_speaker, row_size);
+      return;
+    }
+    Clear();
+    storage_ = storage;
+    n_speakers_ = n_speakers;
+    rows_per_speaker_ = rows_per_speaker;
+    row_size_ = row_size;
+    f32_ = std::move(src);
+  }
+
+  // float32 のデータをコピーせずに参照する。
+  // owner はデータを保持するオブジェクトで、このテーブルが参照している間保持される。
+  void AssignView(const float* const src, const int n_speakers,
+                  const int rows_per_speaker, const int row_size,
+                  std::shared_ptr<const void> owner) {
+    Clear();
+    storage_ = SpeakerTableStorage::kFloat32;
+    n_speakers_ = n_speakers;
+    rows_per_speaker_ = rows_per_speaker;
+    row_size_ = row_size;
+    view_ = src;
+    view_owner_ = std::move(owner);
+  }
+
+  void Clear() {
+    n_speakers_ = 0;
+    view_ = nullptr;
+    view_owner_ = nullptr;
+    f32_ = {};
+    f16_ = {};
+    i8_ = {};
+    scales_ = {};
+  }
+
+  [[nodiscard]] auto GetStorage() const -> SpeakerTableStorage {
+    return storage_;
+  }
+  [[nodiscard]] auto GetNSpeakers() const -> int { return n_speakers_; }
+  [[nodiscard]] auto GetSpeakerSize() const -> int {
+    return rows_per_speaker_ * row_size_;
+  }
+  // AssignView() で外部のデータを参照しているか
+  [[nodiscard]] auto IsView() const -> bool { return view_ != nullptr; }
+  // 保持しているデータの領域。行ごとのスケールは含まない
+  [[nodiscard]] auto GetBytes() const -> std::span<const std::byte> {
+    const auto n_elements = static_cast<std::size_t>(n_speakers_) *
+                            rows_per_speaker_ * row_size_;
+    switch (storage_) {
+      case SpeakerTableStorage::kFloat32:
+        return std::as_bytes(std::span(GetFloat32Data(), n_elements));
+      case SpeakerTableStorage::kFloat16:
+        return std::as_bytes(std::span(f16_.data(), n_elements));
+      case SpeakerTableStorage::kInt8:
+        return std::as_bytes(std::span(i8_.data(), n_elements));
+    }
+    return {};
+  }
+  // 展開用のバッファが不要な形式か
+  [[nodiscard]] auto IsDirectlyAccessible() const -> bool {
+    return storage_ == SpeakerTableStorage::kFloat32;
+  }
+
+  // speaker の値を float で得る。
+  // kFloat32 の場合は内部のデータを直接指すポインタを返し、
+  // そうでない場合は staging (GetSpeakerSize() 要素) に展開してそれを返す。
+  auto GetSpeaker(const int speaker, float* const staging) const
+      -> const float* {
+    assert(0 <= speaker && speaker < n_speakers_);
+    if (IsDirectlyAccessible()) {
+      return GetFloat32Data() +
+             static_cast<std::size_t>(speaker) * GetSpeakerSize();
+    }
+    ExpandRows(speaker * rows_per_speaker_, rows_per_speaker_, staging);
+    return staging;
+  }
+
+  // 全体を通した行番号 first_row から n_rows 行を dst に展開する
+  void ExpandRows(const int first_row, const int n_rows,
+                  float* const dst) const {
+    const auto offset = static_cast<std::size_t>(first_row) * row_size_;
+    const auto n_elements = static_cast<std::size_t>(n_rows) * row_size_;
+    switch (storage_) {
+      case SpeakerTableStorage::kFloat32:
+        std::memcpy(dst, GetFloat32Data() + offset, sizeof(float) * n_elements);
+        break;
+      case SpeakerTableStorage::kFloat16:
+        for (std::size_t i = 0; i < n_elements; ++i) {
+          dst[i] = HalfToFloat(f16_[offset + i]);
+        }
+        break;
+      case SpeakerTableStorage::kInt8:
+        for (auto r = 0; r < n_rows; ++r) {
+          const auto scale = scales_[first_row + r];
+          const auto* const src = i8_.data() + offset + r * row_size_;
+          auto* const row_dst = dst + static_cast<std::size_t>(r) * row_size_;
+          for (auto i = 0; i < row_size_; ++i) {
+            row_dst[i] = static_cast<float>(src[i]) * scale;
+          }
+        }
+        break;
+    }
+  }
+
+ private:
+  [[nodiscard]] auto GetFloat32Data() const -> const float* {
+    return view_ ? view_ : f32_.data();
+  }
+
+  SpeakerTableStorage storage_ = SpeakerTableStorage::kFloat32;
+  int n_speakers_ = 0;
+  int rows_per_speaker_ = 0;
+  int row_size_ = 0;
+  const float* view_ = nullptr;
+  std::shared_ptr<const void> view_owner_;
+  AlignedVector<float, 64> f32_;
+  AlignedVector<std::uint16_t, 64> f16_;
+  AlignedVector<std::int8_t, 64> i8_;
+  std::vector<float> scales_;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_SPEAKER_TABLE_H_
@@ -7,9 +7,11 @@
 #include <cassert>
 #include <cmath>
 #include <cstddef>
+#include <functional>
 #include <limits>
 #include <memory>
 #include <new>
+#include <utility>
 #include <vector>
 
 /**
@@ -163,6 +165,91 @@ class SphericalAverage {
     for (size_t n = 0; n < N_all_; n++) {
       NormalizeVector(M, &p_[n * M]);
     }
+    p_data_ = p_.data();
+    p_raw_data_ = p_raw_.data();
+    get_vector_ = nullptr;
+  }
+
+  // Initialize() と同じだが、正規化前後のベクトルをコピーせずに参照する。
+  // normalized_vectors は NormalizeVectors() で作ったものである必要があり、
+  // どちらのベクトルもこのオブジェクトを使い終わるまで有効でなければならない。
+  auto InitializeWithNormalizedVectors(size_t num_point_all, size_t num_feature,
+                                       const T* unnormalized_vectors,
+                                       const T* normalized_vectors,
+                                       size_t num_point_limit = 0,
+                                       size_t num_memory = 2) -> void {
+    Initialize(0, num_feature, nullptr, 0, num_memory);
+    N_all_ = num_point_all;
+    if (num_point_limit == 0 || num_point_limit > num_point_all) {
+      N_lim_ = num_point_all;
+    } else {
+      N_lim_ = num_point_limit;
+    }
+    assert(N_lim_ <= num_feature);
+    indices_.resize(N_lim_);
+    w_.resize(N_lim_);
+    v_.resize(N_lim_);
+    p_data_ = normalized_vectors;
+    p_raw_data_ = unnormalized_vectors;
+  }
+
+  // index 番目の正規化前のベクトル (M 要素) を dst に書き出す関数
+  using VectorGetter = std::function<void(size_t /*index*/, T* /*dst*/)>;
+
+  // Initialize() と同じだが、全体のベクトルを保持しない。
+  // SetWeights() で選ばれた num_point_limit 個だけを get_vector で取り出し、
+  // その場で正規化する。get_vector はオーディオスレッドから呼ばれる。
+  auto InitializeWithVectorGetter(size_t num_point_all, size_t num_feature,
+                                  VectorGetter get_vector,
+                                  size_t num_point_limit = 0,
+                                  size_t num_memory = 2) -> void {
+    Initialize(0, num_feature, nullptr, 0, num_memory);
+    N_all_ = num_point_all;
+    if (num_point_limit == 0 || num_point_limit > num_point_all) {
+      N_lim_ = num_point_all;
+    } else {
+      N_lim_ = num_point_limit;
+    }
+    assert(N_lim_ <= num_feature);
+    indices_.resize(N_lim_);
+    w_.resize(N_lim_);
+    v_.resize(N_lim_);
+    p_.resize(N_lim_ * M);
+    p_raw_.resize(N_lim_ * M);
+    p_data_ = nullptr;
+    p_raw_data_ = nullptr;
+    get_vector_ = std::move(get_vector);
+  }
+
+  // ヒープ上に確保している量 [bytes]。
+  // InitializeWithNormalizedVectors() で参照している領域は含まない
+  [[nodiscard]] auto GetMemoryUsage() const -> size_t {
+    return indices_.capacity() * sizeof(size_t) +
+           (w_.capacity() + p_.capacity() + p_raw_.capacity() + q_.capacity() +
+            v_.capacity() + g_.capacity() + d_.capacity() + s_.capacity() +
+            t_.capacity() + r_.capacity() + a_.capacity()) *
+               sizeof(T);
+  }
+
+  // InitializeWithNormalizedVectors() に渡す正規化済みのベクトルを作る
+  static auto NormalizeVectors(size_t num_point_all,
+                               const T* unnormalized_vectors,
+                               T* normalized_vectors) -> void {
+    std::copy_n(unnormalized_vectors, num_point_all * M, normalized_vectors);
+    for (size_t n = 0; n < num_point_all; n++) {
+      NormalizeVector(M, normalized_vectors + n * M);
+    }
+  }
+
+  // 正規化前のベクトル (size = N_all * M)。
+  // InitializeWithVectorGetter() で初期化した場合は nullptr
+  [[nodiscard]] auto GetUnnormalizedVectors() const -> const T* {
+    return p_raw_data_;
+  }
+  // 正規化済みのベクトル (size = N_all * M)。
+  // InitializeWithVectorGetter() で初期化した場合は nullptr
+  [[nodiscard]] auto GetNormalizedVectors() const -> const T* {
+    return p_data_;
   }
 
   auto SetWeights(size_t num_point, const T* weights,
@@ -196,10 +283,18 @@ class SphericalAverage {
         }
       }
     }
+    if (get_vector_) {
+      // 選ばれたベクトルだけを取り出して正規化する
+      for (size_t n = 0; n < N_; n++) {
+        get_vector_(indices_[n], &p_raw_[n * M]);
+        std::copy_n(&p_raw_[n * M], M, &p_[n * M]);
+        NormalizeVector(M, &p_[n * M]);
+      }
+    }
     if (N_ > 0 && NormalizeWeight(N_, w_.data())) {
-      MulC(M, w_[0], &p_[indices_[0] * M], q_.data());
+      MulC(M, w_[0], GetPoint(0), q_.data());
       for (size_t n = 1; n < N_; n++) {
-        AddProductC(M, w_[n], &p_[indices_[n] * M], q_.data());
+        AddProductC(M, w_[n], GetPoint(n), q_.data());
       }
       if (!NormalizeVector(M, q_.data())) {
         converged_ = true;
@@ -237,14 +332,23 @@ class SphericalAverage {
   auto GetResult(size_t num_feature, T* aligned_dst_vector) -> void {
     T* __restrict y = std::assume_aligned<64>(aligned_dst_vector);
     assert(M == num_feature);
-    MulC(M, v_[0], &p_raw_[indices_[0] * M], y);
+    MulC(M, v_[0], GetRawPoint(0), y);
     for (size_t n = 1; n < N_; n++) {
-      AddProductC(M, v_[n], &p_raw_[indices_[n] * M], y);
+      AddProductC(M, v_[n], GetRawPoint(n), y);
     }
   }
 
  private:
-  auto Dot(size_t len, const T* x1, const T* x2) -> T {
+  // SetWeights() で選ばれた n 番目の正規化済みのベクトル
+  [[nodiscard]] auto GetPoint(size_t n) const -> const T* {
+    return get_vector_ ? &p_[n * M] : p_data_ + indices_[n] * M;
+  }
+  // SetWeights() で選ばれた n 番目の正規化前のベクトル
+  [[nodiscard]] auto GetRawPoint(size_t n) const -> const T* {
+    return get_vector_ ? &p_raw_[n * M] : p_raw_data_ + indices_[n] * M;
+  }
+
+  static auto Dot(size_t len, const T* x1, const T* x2) -> T {
     const T* __restrict xx1 = std::assume_aligned<64>(x1);
     const T* __restrict xx2 = std::assume_aligned<64>(x2);
     T y = static_cast<T>(0.0);
@@ -254,7 +358,7 @@ class SphericalAverage {
     return y;
   }
 
-  auto MulC(size_t len, T a, T* x) -> void {
+  static auto MulC(size_t len, T a, T* x) -> void {
     T* __restrict xx = std::assume_aligned<64>(x);
     for (size_t l = 0; l < len; l++) {
       xx[l] *= a;
@@ -287,7 +391,7 @@ class SphericalAverage {
     return y;
   }
 
-  auto NormalizeVector(size_t len, T* x) -> bool {
+  static auto NormalizeVector(size_t len, T* x) -> bool {
     const T* __restrict xx = std::assume_aligned<64>(x);
     T norm = sqrt(Dot(len, x, x));
     if (norm > static_cast<T>(0.0)) {
@@ -343,7 +447,7 @@ class SphericalAverage {
     std::memset(g_.data(), 0, sizeof(T) * M);
 
     for (size_t n = 0; n < N_; n++) {
-      T cos_th = Dot(M, &p_[indices_[n] * M], q_.data());
+      T cos_th = Dot(M, GetPoint(n), q_.data());
       // Clamp to [-1, 1] to guard against floating-point overshoot
       cos_th = std::clamp(cos_th, static_cast<T>(-1), static_cast<T>(1));
       T theta = acos(cos_th);
@@ -354,7 +458,7 @@ class SphericalAverage {
       // a_n = -2 * w_n * theta / sin(theta) = -2 * v_n
       // (using v_n already computed via the stable Sinc path above)
       T a_n = -static_cast<T>(2.0) * v_[n];
-      AddProductC(M, a_n, &p_[indices_[n] * M], g_.data());
+      AddProductC(M, a_n, GetPoint(n), g_.data());
     }
 
     T inv_sum_w_c_s =
@@ -430,6 +534,11 @@ class SphericalAverage {
   AlignedVector<T, 64> w_;       // size = N_lim
   AlignedVector<T, 64> p_;       // size = N_all * M
   AlignedVector<T, 64> p_raw_;   // size = N_all * M
+  // p_, p_raw_ または外部から与えられた領域を指す
+  const T* p_data_ = nullptr;
+  const T* p_raw_data_ = nullptr;
+  // 設定されている場合、p_, p_raw_ は選ばれたベクトルだけを保持する
+  VectorGetter get_vector_;
   AlignedVector<T, 64> q_;       // size = M
   AlignedVector<T, 64> v_;       // size = N_lim
   AlignedVector<T, 64> g_;       // size = M
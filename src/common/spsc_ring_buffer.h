@@ -0,0 +1,80 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_SPSC_RING_BUFFER_H_
+#define BEATRICE_COMMON_SPSC_RING_BUFFER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <vector>
+
+namespace beatrice::common {
+
+// 1 つのスレッドが書き込み、別の 1 つのスレッドが読み出すリングバッファ。
+// Write() と Read() はロックもメモリ確保も行わないので、
+// オーディオスレッドから呼んでよい。
+template <typename T>
+class SpscRingBuffer {
+ public:
+  SpscRingBuffer() = default;
+  SpscRingBuffer(const SpscRingBuffer&) = delete;
+  auto operator=(const SpscRingBuffer&) -> SpscRingBuffer& = delete;
+
+  // 空にして、min_capacity 個以上を保持できるようにする。
+  // 読み書きするスレッドが両方とも止まっている時に呼ぶ
+  void Reset(const std::size_t min_capacity) {
+    buffer_.assign(std::bit_ceil(std::max<std::size_t>(min_capacity, 1)), T());
+    mask_ = buffer_.size() - 1;
+    write_index_.store(0, std::memory_order_relaxed);
+    read_index_.store(0, std::memory_order_relaxed);
+  }
+  // 書き込む側から呼ぶ
+  [[nodiscard]] auto GetWritable() const -> std::size_t {
+    return buffer_.size() - (write_index_.load(std::memory_order_relaxed) -
+                             read_index_.load(std::memory_order_acquire));
+  }
+  // 読み出す側から呼ぶ
+  [[nodiscard]] auto GetReadable() const -> std::size_t {
+    return write_index_.load(std::memory_order_acquire) -
+           read_index_.load(std::memory_order_relaxed);
+  }
+  // n 個全てを書き込めない場合は何もせずに false を返す
+  auto Write(const T* const data, const std::size_t n) -> bool {
+    if (GetWritable() < n) {
+      return false;
+    }
+    const auto index = write_index_.load(std::memory_order_relaxed);
+    for (auto i = std::size_t{0}; i < n; ++i) {
+      buffer_[(index + i) & mask_] = data[i];
+    }
+    write_index_.store(index + n, std::memory_order_release);
+    return true;
+  }
+  // n 個全てを読み出せない場合は何もせずに false を返す。
+  // data が nullptr の場合は読み捨てる
+  auto Read(T* const data, const std::size_t n) -> bool {
+    if (GetReadable() < n) {
+      return false;
+    }
+    const auto index = read_index_.load(std::memory_order_relaxed);
+    if (data) {
+      for (auto i = std::size_t{0}; i < n; ++i) {
+        data[i] = buffer_[(index + i) & mask_];
+      }
+    }
+    read_index_.store(index + n, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  std::vector<T> buffer_;
+  std::size_t mask_ = 0;
+  // 単調に増加させ、mask_ で剰余を取って使う
+  alignas(64) std::atomic<std::size_t> write_index_ = 0;
+  alignas(64) std::atomic<std::size_t> read_index_ = 0;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_SPSC_RING_BUFFER_H_
@@ -0,0 +1,83 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_STAGE_TIMINGS_H_
+#define BEATRICE_COMMON_STAGE_TIMINGS_H_
+
+#include <array>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdio>
+#include <mutex>   // NOLINT(build/c++11)
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace beatrice::common {
+
+// モデルの読み込みなどで、各段階にかかった時間を記録する。
+// 複数のスレッドから記録してよい。
+class StageTimings {
+ public:
+  struct Stage {
+    std::string name;
+    double seconds;
+  };
+
+  // 生成されてから破棄されるまでの時間を記録する
+  class Scope {
+   public:
+    Scope(StageTimings& timings, std::string name)
+        : timings_(timings),
+          name_(std::move(name)),
+          start_(std::chrono::steady_clock::now()) {}
+    Scope(const Scope&) = delete;
+    auto operator=(const Scope&) -> Scope& = delete;
+    ~Scope() {
+      timings_.Add(std::move(name_),
+                   std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start_)
+                       .count());
+    }
+
+   private:
+    StageTimings& timings_;
+    std::string name_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  StageTimings() = default;
+  StageTimings(const StageTimings&) = delete;
+  auto operator=(const StageTimings&) -> StageTimings& = delete;
+
+  void Add(std::string name, const double seconds) {
+    const auto lock = std::lock_guard<std::mutex>(mtx_);
+    stages_.push_back({.name = std::move(name), .seconds = seconds});
+  }
+  // 記録された順に返す
+  [[nodiscard]] auto GetStages() const -> std::vector<Stage> {
+    const auto lock = std::lock_guard<std::mutex>(mtx_);
+    return stages_;
+  }
+  // レポート用に 1 行に 1 段階ずつ並べる。空であれば空文字列を返す
+  static auto ToString(const std::vector<Stage>& stages) -> std::string {
+    auto text = std::string();
+    if (stages.empty()) {
+      return text;
+    }
+    text += "model load timings:\n";
+    auto line = std::array<char, 96>();
+    for (const auto& stage : stages) {
+      std::snprintf(line.data(), line.size(), "%10.1f ms  %s\n",
+                    stage.seconds * 1000.0, stage.name.c_str());
+      text += line.data();
+    }
+    return text;
+  }
+
+ private:
+  mutable std::mutex mtx_;
+  std::vector<Stage> stages_;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_STAGE_TIMINGS_H_
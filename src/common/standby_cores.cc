@@ -0,0 +1,337 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/standby_cores.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+// Beatrice
+#include "common/cache_directory.h"
+#include "common/error.h"
+#include "common/memory_footprint.h"
+#include "common/model_container.h"
+#include "common/processor_proxy.h"
+
+namespace beatrice::common {
+
+namespace {
+
+constexpr auto kDefaultMaxCores = 1;
+constexpr auto kDefaultMinAvailableMB = 1024;
+// 待機中のものがある間に空きメモリを確認する間隔
+constexpr auto kMemoryCheckInterval = std::chrono::seconds(5);
+
+auto GetEnvironmentInt(const char* const name, const int default_value)
+    -> int {
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  const auto* const value = std::getenv(name);
+  if (!value) {
+    return default_value;
+  }
+  const auto* const end = value + std::strlen(value);
+  auto result = 0;
+  const auto [ptr, ec] = std::from_chars(value, end, result);
+  return ec == std::errc() && ptr == end && result >= 0 ? result
+                                                        : default_value;
+}
+
+// 利用可能な物理メモリの量 [bytes]。得られない場合は std::nullopt
+auto GetAvailableMemory() -> std::optional<std::uint64_t> {
+#if defined(_WIN32)
+  auto status = MEMORYSTATUSEX();
+  status.dwLength = sizeof(status);
+  if (!GlobalMemoryStatusEx(&status)) {
+    return std::nullopt;
+  }
+  return status.ullAvailPhys;
+#elif defined(__APPLE__)
+  auto info = vm_statistics64_data_t();
+  auto count = mach_msg_type_number_t{HOST_VM_INFO64_COUNT};
+  if (host_statistics64(mach_host_self(), HOST_VM_INFO64,
+                        reinterpret_cast<host_info64_t>(&info),
+                        &count) != KERN_SUCCESS) {
+    return std::nullopt;
+  }
+  // 非アクティブなページはすぐに再利用できるので含める
+  return (static_cast<std::uint64_t>(info.free_count) + info.inactive_count) *
+         vm_page_size;
+#else
+  auto ifs = std::ifstream("/proc/meminfo");
+  auto line = std::string();
+  while (std::getline(ifs, line)) {
+    constexpr auto kField = std::string_view("MemAvailable:");
+    if (!line.starts_with(kField)) {
+      continue;
+    }
+    auto iss = std::istringstream(line.substr(kField.size()));
+    auto kilobytes = std::uint64_t{0};
+    if (iss >> kilobytes) {
+      return kilobytes * 1024;
+    }
+    break;
+  }
+  return std::nullopt;
+#endif
+}
+
+// ディレクトリ形式のモデルは、ディレクトリ内のいずれかのファイルが
+// 更新されていれば別のモデルとして扱う
+auto GetLastWriteTime(const std::filesystem::path& file) -> std::int64_t {
+  auto ec = std::error_code();
+  if (ModelContainer::IsContainer(file)) {
+    const auto time = std::filesystem::last_write_time(file, ec);
+    return ec ? 0 : time.time_since_epoch().count();
+  }
+  auto last_write_time = std::int64_t{0};
+  for (auto it = std::filesystem::directory_iterator(file.parent_path(), ec);
+       !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    auto entry_ec = std::error_code();
+    if (!it->is_regular_file(entry_ec)) {
+      continue;
+    }
+    const auto time = it->last_write_time(entry_ec);
+    if (!entry_ec) {
+      last_write_time = std::max<std::int64_t>(last_write_time,
+                                               time.time_since_epoch().count());
+    }
+  }
+  return last_write_time;
+}
+
+}  // namespace
+
+StandbyCores::StandbyCores()
+    : max_cores_(
+          GetEnvironmentInt("BEATRICE_STANDBY_MODELS", kDefaultMaxCores)),
+      min_available_memory_(
+          static_cast<std::uint64_t>(
+              GetEnvironmentInt("BEATRICE_STANDBY_MIN_AVAILABLE_MB",
+                                kDefaultMinAvailableMB))
+          << 20) {}
+
+StandbyCores::~StandbyCores() {
+  {
+    const auto lock = std::lock_guard<std::mutex>(mtx_);
+    exiting_ = true;
+  }
+  cv_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+auto StandbyCores::Acquire() -> std::shared_ptr<StandbyCores> {
+  // プラグインのアンロード時の破棄順序の問題を避けるため、意図的に解放しない
+  static auto* const mtx = new std::mutex();
+  static auto* const shared = new std::weak_ptr<StandbyCores>();
+  const auto lock = std::lock_guard<std::mutex>(*mtx);
+  if (auto standby_cores = shared->lock()) {
+    return standby_cores;
+  }
+  auto standby_cores = std::shared_ptr<StandbyCores>(new StandbyCores());
+  *shared = standby_cores;
+  return standby_cores;
+}
+
+auto StandbyCores::MakeKey(const std::filesystem::path& file,
+                           const SpeakerTableStorage storage) -> Key {
+  auto ec = std::error_code();
+  auto canonical = std::filesystem::weakly_canonical(file, ec);
+  if (ec) {
+    canonical = file;
+  }
+  return {.file = canonical.u8string(),
+          .last_write_time = GetLastWriteTime(canonical),
+          .storage = storage};
+}
+
+void StandbyCores::Put(const std::filesystem::path& file,
+                       const SpeakerTableStorage storage,
+                       std::unique_ptr<ProcessorCoreBase> core) {
+  if (max_cores_ <= 0 || !core) {
+    return;
+  }
+  auto key = MakeKey(file, storage);
+  // 破棄はロックの外で行う
+  auto dropped = std::vector<std::unique_ptr<ProcessorCoreBase>>();
+  auto lock = std::unique_lock<std::mutex>(mtx_);
+  // 同じファイルの古いものは置き換える
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->key.file == key.file && it->key.storage == key.storage) {
+      dropped.push_back(std::move(it->core));
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  entries_.push_front({.key = std::move(key), .core = std::move(core)});
+  Trim(dropped);
+  // 待機させている間は空きメモリを定期的に確認する
+  if (!entries_.empty()) {
+    StartThread();
+    lock.unlock();
+    cv_.notify_one();
+  }
+}
+
+auto StandbyCores::Take(const std::filesystem::path& file,
+                        const SpeakerTableStorage storage,
+                        std::unique_ptr<ProcessorCoreBase>& core) -> bool {
+  if (max_cores_ <= 0) {
+    return false;
+  }
+  const auto key = MakeKey(file, storage);
+  // 破棄はロックの外で行う
+  auto dropped = std::vector<std::unique_ptr<ProcessorCoreBase>>();
+  const auto lock = std::lock_guard<std::mutex>(mtx_);
+  const auto it = std::ranges::find(entries_, key, &Entry::key);
+  const auto found = it != entries_.end();
+  if (found) {
+    core = std::move(it->core);
+    entries_.erase(it);
+  }
+  // 前回の確認から空きメモリが減っているかもしれないので確認し直す
+  Trim(dropped);
+  return found;
+}
+
+void StandbyCores::GetMemoryFootprint(MemoryFootprint& footprint) {
+  const auto lock = std::lock_guard<std::mutex>(mtx_);
+  for (const auto& entry : entries_) {
+    auto core_footprint = MemoryFootprint();
+    entry.core->GetMemoryFootprint(core_footprint);
+    // 共有している部分は使用中のものと重複し得るので含めない
+    footprint.Add("standby cores", core_footprint.GetTotal(false), true);
+  }
+}
+
+void StandbyCores::Prefetch(const double sample_rate,
+                            const SpeakerTableStorage storage,
+                            const std::filesystem::path& exclude) {
+  if (max_cores_ <= 0) {
+    return;
+  }
+  auto files = GetPathsFromEnvironment("BEATRICE_PREFETCH_MODELS");
+  if (!exclude.empty()) {
+    const auto excluded = MakeKey(exclude, storage).file;
+    std::erase_if(files, [&](const std::filesystem::path& file) {
+      return MakeKey(file, storage).file == excluded;
+    });
+  }
+  if (files.empty()) {
+    return;
+  }
+  {
+    const auto lock = std::lock_guard<std::mutex>(mtx_);
+    // 設定が変わった場合に備え、古い要求は破棄する
+    prefetch_requests_.clear();
+    prefetch_requests_.push_back({.files = std::move(files),
+                                  .sample_rate = sample_rate,
+                                  .storage = storage});
+    StartThread();
+  }
+  cv_.notify_one();
+}
+
+void StandbyCores::StartThread() {
+  if (!thread_.joinable()) {
+    thread_ = std::thread([this] { Run(); });
+  }
+}
+
+void StandbyCores::Trim(
+    std::vector<std::unique_ptr<ProcessorCoreBase>>& dropped) {
+  // 空きメモリが足りない場合は、待機中のものを全て手放す
+  const auto n_cores =
+      HasEnoughMemory() ? static_cast<std::size_t>(max_cores_) : 0;
+  while (entries_.size() > n_cores) {
+    dropped.push_back(std::move(entries_.back().core));
+    entries_.pop_back();
+  }
+}
+
+auto StandbyCores::HasEnoughMemory() const -> bool {
+  const auto available = GetAvailableMemory();
+  // 分からない場合は個数の上限だけで制限する
+  return !available || *available >= min_available_memory_;
+}
+
+void StandbyCores::Run() {
+  auto lock = std::unique_lock<std::mutex>(mtx_);
+  const auto has_request = [this] {
+    return exiting_ || !prefetch_requests_.empty();
+  };
+  while (true) {
+    if (entries_.empty()) {
+      cv_.wait(lock, [&] { return has_request() || !entries_.empty(); });
+    } else if (!cv_.wait_for(lock, kMemoryCheckInterval, has_request)) {
+      // 待機中のものがある間は、空きメモリが減っていないか定期的に確認する
+      auto dropped = std::vector<std::unique_ptr<ProcessorCoreBase>>();
+      Trim(dropped);
+      lock.unlock();
+      dropped.clear();
+      lock.lock();
+      continue;
+    }
+    if (exiting_) {
+      return;
+    }
+    if (prefetch_requests_.empty()) {
+      continue;
+    }
+    const auto request = std::move(prefetch_requests_.front());
+    prefetch_requests_.erase(prefetch_requests_.begin());
+    for (const auto& file : request.files) {
+      if (exiting_ || !prefetch_requests_.empty() ||
+          std::cmp_greater_equal(entries_.size(), max_cores_)) {
+        break;
+      }
+      lock.unlock();
+      const auto key = MakeKey(file, request.storage);
+      lock.lock();
+      if (std::ranges::find(entries_, key, &Entry::key) != entries_.end()) {
+        continue;
+      }
+      lock.unlock();
+      if (!HasEnoughMemory()) {
+        lock.lock();
+        break;
+      }
+      auto core = std::unique_ptr<ProcessorCoreBase>();
+      if (ProcessorProxy::CreateCore(file, request.sample_rate,
+                                     request.storage,
+                                     core) == ErrorCode::kSuccess) {
+        Put(file, request.storage, std::move(core));
+      }
+      lock.lock();
+    }
+  }
+}
+
+}  // namespace beatrice::common
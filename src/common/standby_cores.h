@@ -0,0 +1,97 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_STANDBY_CORES_H_
+#define BEATRICE_COMMON_STANDBY_CORES_H_
+
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+// Beatrice
+#include "common/memory_footprint.h"
+#include "common/processor_core.h"
+#include "common/speaker_table.h"
+
+namespace beatrice::common {
+
+// 読み込み済みの ProcessorCore を待機させておき、
+// 同じモデルに切り替える時に読み込み直さずに使えるようにするクラス。
+// 使い終わったコアの他に、環境変数 BEATRICE_PREFETCH_MODELS
+// (パスの区切りは OS の PATH と同じ) のモデルを別スレッドで先読みしておく。
+// 待機させる数は環境変数 BEATRICE_STANDBY_MODELS (既定値 1、0 で無効) で、
+// 空きメモリの下限は BEATRICE_STANDBY_MIN_AVAILABLE_MB (既定値 1024) で指定する。
+// 待機中のものがある間は別スレッドで定期的に空きメモリを確認し、
+// 下限を下回っていれば待機中のものを破棄する。
+class StandbyCores {
+ public:
+  StandbyCores(const StandbyCores&) = delete;
+  auto operator=(const StandbyCores&) -> StandbyCores& = delete;
+  ~StandbyCores();
+
+  // 使っているものがあればそれを返す。プロセス内の全インスタンスで共有される
+  static auto Acquire() -> std::shared_ptr<StandbyCores>;
+
+  // 使い終わったコアを待機させる。上限を超えた分は古いものから破棄する
+  void Put(const std::filesystem::path& file, SpeakerTableStorage storage,
+           std::unique_ptr<ProcessorCoreBase> core);
+  // file のモデルを読み込んだコアが待機していれば、core に移して true を返す。
+  // 待機中のコアは別の設定で使われていたものなので、パラメータは設定し直すこと。
+  // 空きメモリが足りなければ、残りの待機中のものは破棄する
+  auto Take(const std::filesystem::path& file, SpeakerTableStorage storage,
+            std::unique_ptr<ProcessorCoreBase>& core) -> bool;
+  // 待機中のコアが使っているメモリの量を footprint に加える。
+  // プロセス内で共有されているので shared として数える
+  void GetMemoryFootprint(MemoryFootprint& footprint);
+  // 先読みするモデルのうち、待機していないものを別スレッドで読み込む。
+  // exclude は使用中のモデル
+  void Prefetch(double sample_rate, SpeakerTableStorage storage,
+                const std::filesystem::path& exclude);
+
+ private:
+  struct Key {
+    std::u8string file;
+    std::int64_t last_write_time;
+    SpeakerTableStorage storage;
+
+    auto operator==(const Key& rhs) const -> bool = default;
+  };
+  struct Entry {
+    Key key;
+    std::unique_ptr<ProcessorCoreBase> core;
+  };
+  struct PrefetchRequest {
+    std::vector<std::filesystem::path> files;
+    double sample_rate;
+    SpeakerTableStorage storage;
+  };
+
+  const int max_cores_;
+  const std::uint64_t min_available_memory_;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  // 新しいものが先頭
+  std::list<Entry> entries_;
+  std::vector<PrefetchRequest> prefetch_requests_;
+  bool exiting_ = false;
+  std::thread thread_;
+
+  StandbyCores();
+  static auto MakeKey(const std::filesystem::path& file,
+                      SpeakerTableStorage storage) -> Key;
+  // mtx_ を取得した状態で呼ぶ。破棄するものは dropped に移す
+  void Trim(std::vector<std::unique_ptr<ProcessorCoreBase>>& dropped);
+  [[nodiscard]] auto HasEnoughMemory() const -> bool;
+  // mtx_ を取得した状態で呼ぶ。スレッドが無ければ開始する
+  void StartThread();
+  void Run();
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_STANDBY_CORES_H_
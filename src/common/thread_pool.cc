@@ -0,0 +1,109 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "common/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <functional>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+
+namespace beatrice::common {
+
+ThreadPool::ThreadPool(const int n_threads) {
+  threads_.reserve(std::max(n_threads, 1));
+  for (auto i = 0; i < std::max(n_threads, 1); ++i) {
+    threads_.emplace_back([this] { Run(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    const auto lock = std::lock_guard<std::mutex>(mtx_);
+    exiting_ = true;
+  }
+  cv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+auto ThreadPool::Acquire() -> std::shared_ptr<ThreadPool> {
+  // プラグインのアンロード時の破棄順序の問題を避けるため、意図的に解放しない
+  static auto* const mtx = new std::mutex();
+  static auto* const shared = new std::weak_ptr<ThreadPool>();
+  const auto lock = std::lock_guard<std::mutex>(*mtx);
+  if (auto pool = shared->lock()) {
+    return pool;
+  }
+  auto pool = std::make_shared<ThreadPool>(
+      static_cast<int>(std::thread::hardware_concurrency()));
+  *shared = pool;
+  return pool;
+}
+
+void ThreadPool::ParallelFor(const int n, const std::function<void(int)>& f) {
+  if (n <= 0) {
+    return;
+  }
+  struct State {
+    std::atomic<int> next = 0;
+    std::mutex mtx;
+    std::condition_variable cv;
+    int n_done = 0;
+  };
+  // 呼び出し元が先に全て処理し終えた後に動き出したタスクも state を参照するので、
+  // 共有しておく。f はまだ処理されていないインデックスがある間しか参照されない。
+  const auto state = std::make_shared<State>();
+  const auto work = [state, n, &f] {
+    auto n_processed = 0;
+    for (auto i = state->next.fetch_add(1); i < n;
+         i = state->next.fetch_add(1)) {
+      f(i);
+      ++n_processed;
+    }
+    if (n_processed > 0) {
+      const auto lock = std::lock_guard<std::mutex>(state->mtx);
+      state->n_done += n_processed;
+      if (state->n_done == n) {
+        state->cv.notify_all();
+      }
+    }
+  };
+  const auto n_helpers = std::min(GetNThreads(), n - 1);
+  for (auto i = 0; i < n_helpers; ++i) {
+    Enqueue(work);
+  }
+  work();
+  auto lock = std::unique_lock<std::mutex>(state->mtx);
+  state->cv.wait(lock, [&state, n] { return state->n_done == n; });
+}
+
+void ThreadPool::Enqueue(std::function<void()> task) {
+  {
+    const auto lock = std::lock_guard<std::mutex>(mtx_);
+    tasks_.push_back(std::move(task));
+  }
+  cv_.notify_one();
+}
+
+void ThreadPool::Run() {
+  while (true) {
+    auto task = std::function<void()>();
+    {
+      auto lock = std::unique_lock<std::mutex>(mtx_);
+      cv_.wait(lock, [this] { return exiting_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+}  // namespace beatrice::common
@@ -0,0 +1,60 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_THREAD_POOL_H_
+#define BEATRICE_COMMON_THREAD_POOL_H_
+
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <deque>
+#include <functional>
+#include <future>  // NOLINT(build/c++11)
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace beatrice::common {
+
+// モデルの読み込みなど、オーディオスレッド以外の重い処理を並列化するための
+// スレッドプール。
+class ThreadPool {
+ public:
+  explicit ThreadPool(int n_threads);
+  ThreadPool(const ThreadPool&) = delete;
+  auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+  ~ThreadPool();
+
+  // プロセス内で共有するスレッドプールを返す。
+  // 全ての参照が無くなった時点でスレッドも終了する。
+  static auto Acquire() -> std::shared_ptr<ThreadPool>;
+
+  [[nodiscard]] auto GetNThreads() const -> int {
+    return static_cast<int>(threads_.size());
+  }
+  template <typename F>
+  auto Submit(F&& f) -> std::future<std::invoke_result_t<F>> {
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(
+        std::forward<F>(f));
+    auto future = task->get_future();
+    Enqueue([task] { (*task)(); });
+    return future;
+  }
+  // f(0), ..., f(n - 1) を並列に実行し、全て終わるまで待つ。
+  // 呼び出し元のスレッドも処理に加わるので、プールのタスクの中から呼んでもよい。
+  void ParallelFor(int n, const std::function<void(int)>& f);
+
+ private:
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  bool exiting_ = false;
+  std::vector<std::thread> threads_;
+
+  void Enqueue(std::function<void()> task);
+  void Run();
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_THREAD_POOL_H_
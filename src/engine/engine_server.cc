@@ -0,0 +1,274 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#include "engine/engine_server.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <cstring>
+#include <ios>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+// Beatrice
+#include "common/engine_channel.h"
+#include "common/parameter_schema.h"
+#include "common/processor_proxy.h"
+#include "common/standby_cores.h"
+
+namespace beatrice::engine {
+
+namespace {
+
+using common::EngineChannel;
+
+// 接続が無い状態がこれだけ続いたら終了する
+constexpr auto kIdleTimeout = std::chrono::seconds(30);
+constexpr auto kAcceptInterval = std::chrono::milliseconds(1000);
+// 入力が無くても、この間隔で切断されていないかを確認する
+constexpr auto kPollInterval = std::chrono::milliseconds(100);
+// 接続直後に共有メモリの名前が送られてくるまで待つ時間
+constexpr auto kHandshakeTimeout = timeval{.tv_sec = 5, .tv_usec = 0};
+constexpr std::uint32_t kMaxNameLength = 255;
+
+// プラグインが終了したか、ソケットを閉じた
+auto IsDisconnected(const int socket_fd) -> bool {
+  auto fds = pollfd{.fd = socket_fd, .events = POLLIN, .revents = 0};
+  if (poll(&fds, 1, 0) <= 0) {
+    return false;
+  }
+  if (fds.revents & (POLLHUP | POLLERR)) {
+    return true;
+  }
+  auto byte = char();
+  return recv(socket_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
+
+auto ReceiveAll(const int fd, void* const data, const std::size_t size)
+    -> bool {
+  return recv(fd, data, size, MSG_WAITALL) == static_cast<ssize_t>(size);
+}
+
+// プラグインから送られた名前の共有メモリを開く。失敗した場合は nullptr
+auto OpenChannel(const int socket_fd) -> EngineChannel* {
+  setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &kHandshakeTimeout,
+             sizeof(kHandshakeTimeout));
+  auto size = std::uint32_t();
+  if (!ReceiveAll(socket_fd, &size, sizeof(size)) || size == 0 ||
+      size > kMaxNameLength) {
+    return nullptr;
+  }
+  auto name = std::string(size, '\0');
+  if (!ReceiveAll(socket_fd, name.data(), size)) {
+    return nullptr;
+  }
+  const auto fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st = {};
+  if (fstat(fd, &st) != 0 ||
+      static_cast<std::size_t>(st.st_size) != sizeof(EngineChannel)) {
+    close(fd);
+    return nullptr;
+  }
+  auto* const memory = mmap(nullptr, sizeof(EngineChannel),
+                            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    return nullptr;
+  }
+  auto* const channel = static_cast<EngineChannel*>(memory);
+  if (channel->magic != EngineChannel::kMagic ||
+      channel->version != EngineChannel::kVersion) {
+    // 異なるバージョンのプラグインには、プロセス内で処理させる
+    channel->state.store(EngineChannel::kRejected, std::memory_order_release);
+    common::FutexWake(channel->state);
+    munmap(memory, sizeof(EngineChannel));
+    return nullptr;
+  }
+  return channel;
+}
+
+// ホストのオーディオスレッドと同様に扱われるよう、優先度を上げる。
+// 権限が無い場合はそのまま
+void RaiseThreadPriority() {
+  auto param = sched_param();
+  param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+  pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+}
+
+}  // namespace
+
+EngineServer::~EngineServer() {
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    unlink(common::GetEngineSocketPath().c_str());
+  }
+  for (auto& session : sessions_) {
+    session->thread.join();
+  }
+  if (lock_fd_ >= 0) {
+    close(lock_fd_);
+  }
+}
+
+auto EngineServer::Listen() -> bool {
+  const auto path = common::GetEngineSocketPath();
+  auto address = sockaddr_un();
+  address.sun_family = AF_UNIX;
+  if (path.empty() || path.native().size() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.native().size() + 1);
+  // 同時に起動されたエンジンのうち 1 つだけが待ち受ける
+  const auto lock_path = path.native() + ".lock";
+  lock_fd_ = open(lock_path.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0600);
+  if (lock_fd_ < 0 || flock(lock_fd_, LOCK_EX | LOCK_NB) != 0) {
+    return false;
+  }
+  // 異常終了したエンジンのソケットが残っていれば消す
+  unlink(path.c_str());
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    return false;
+  }
+  if (bind(listen_fd_, reinterpret_cast<const sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(listen_fd_, SOMAXCONN) != 0) {
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  }
+  return true;
+}
+
+void EngineServer::Run() {
+  auto idle_since = std::chrono::steady_clock::now();
+  while (true) {
+    ReapSessions();
+    auto fds = pollfd{.fd = listen_fd_, .events = POLLIN, .revents = 0};
+    if (poll(&fds, 1, static_cast<int>(kAcceptInterval.count())) > 0) {
+      if (const auto fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+          fd >= 0) {
+        auto& session = sessions_.emplace_back(std::make_unique<Session>());
+        session->socket_fd = fd;
+        session->thread =
+            std::thread([raw = session.get()] { Serve(*raw); });
+      }
+      continue;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (!sessions_.empty()) {
+      idle_since = now;
+    } else if (now - idle_since >= kIdleTimeout) {
+      return;
+    }
+  }
+}
+
+void EngineServer::ReapSessions() {
+  for (auto it = sessions_.begin(); it != sessions_.end();) {
+    if ((*it)->finished.load(std::memory_order_acquire)) {
+      (*it)->thread.join();
+      it = sessions_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void EngineServer::Serve(Session& session) {
+  if (auto* const channel = OpenChannel(session.socket_fd)) {
+    RaiseThreadPriority();
+    Serve(session.socket_fd, *channel);
+    munmap(channel, sizeof(EngineChannel));
+  }
+  close(session.socket_fd);
+  session.finished.store(true, std::memory_order_release);
+}
+
+void EngineServer::Serve(const int socket_fd, EngineChannel& channel) {
+  auto proxy = std::make_unique<common::ProcessorProxy>(common::kSchema);
+  // 設定を変える度に同じモデルを読み込み直さずに済むよう、待機させておく
+  proxy->SetStandbyCores(common::StandbyCores::Acquire());
+  // クライアントはエンジンの遅延にこれを含めていない
+  [[maybe_unused]] const auto leveling_error_code =
+      proxy->SetLoadLevelingAllowed(false);
+  // 音声は 1 チャンネル分しか受け渡さない
+  [[maybe_unused]] const auto channel_error_code =
+      proxy->SetMultiChannelAllowed(false);
+  auto buffer = std::vector<float>(EngineChannel::kAudioCapacity);
+  auto state = std::string();
+  channel.state.store(EngineChannel::kReady, std::memory_order_release);
+  common::FutexWake(channel.state);
+  while (!IsDisconnected(socket_fd)) {
+    const auto sequence =
+        channel.input_sequence.load(std::memory_order_acquire);
+    // 状態全体。長さと内容はまとめて書き込まれている
+    auto size = std::uint32_t();
+    while (channel.states.Read(reinterpret_cast<char*>(&size), sizeof(size))) {
+      state.resize(size);
+      channel.states.Read(state.data(), size);
+      auto iss = std::istringstream(state, std::ios::binary);
+      [[maybe_unused]] const auto error_code = proxy->Read(iss);
+    }
+    auto change = common::EngineParameterChange();
+    while (channel.parameters.Read(&change, 1)) {
+      const auto param_id = static_cast<common::ParameterID>(change.param_id);
+      [[maybe_unused]] const auto error_code =
+          change.is_int
+              ? proxy->SetParameter(param_id, static_cast<int>(change.value))
+              : proxy->SetParameter(param_id, change.value);
+    }
+    auto block = common::EngineBlock();
+    while (channel.blocks.Read(&block, 1)) {
+      const auto n_samples = std::clamp(
+          block.n_samples, 0, static_cast<int>(buffer.size()));
+      if (block.sample_rate != proxy->GetSampleRate()) {
+        [[maybe_unused]] const auto error_code =
+            proxy->SetSampleRate(block.sample_rate);
+      }
+      if (block.offline != proxy->IsOfflineRendering()) {
+        [[maybe_unused]] const auto error_code =
+            proxy->SetOfflineRendering(block.offline);
+      }
+      if (block.silent || !channel.input.Read(buffer.data(), n_samples)) {
+        std::fill_n(buffer.begin(), n_samples, 0.0f);
+      } else {
+        [[maybe_unused]] const auto error_code =
+            proxy->GetCore()->Process(buffer.data(), buffer.data(), n_samples);
+      }
+      if (!channel.output.Write(buffer.data(), n_samples)) {
+        channel.output_dropped.fetch_add(n_samples,
+                                         std::memory_order_release);
+      }
+      const auto result =
+          common::EngineResult{.n_samples = n_samples,
+                               .sent_ns = block.sent_ns,
+                               .done_ns = common::GetMonotonicNanoseconds()};
+      channel.results.Write(&result, 1);
+      channel.output_sequence.fetch_add(1, std::memory_order_release);
+      common::FutexWake(channel.output_sequence);
+    }
+    common::FutexWait(channel.input_sequence, sequence, kPollInterval);
+  }
+}
+
+}  // namespace beatrice::engine
@@ -0,0 +1,49 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+#ifndef BEATRICE_ENGINE_ENGINE_SERVER_H_
+#define BEATRICE_ENGINE_ENGINE_SERVER_H_
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <thread>  // NOLINT(build/c++11)
+
+// Beatrice
+#include "common/engine_channel.h"
+
+namespace beatrice::engine {
+
+// プラグインのインスタンスからの接続を受け付け、インスタンスごとのスレッドで
+// 推論を行う。同じモデルの重みは ModelRegistry を介して全ての接続で共有される。
+// 接続が 1 つも無い状態がしばらく続いたら終了する。
+class EngineServer {
+ public:
+  EngineServer() = default;
+  EngineServer(const EngineServer&) = delete;
+  auto operator=(const EngineServer&) -> EngineServer& = delete;
+  ~EngineServer();
+
+  // 待ち受けを始める。他のエンジンが既に起動している場合は false を返す
+  auto Listen() -> bool;
+  // 終了するまで接続を受け付ける
+  void Run();
+
+ private:
+  struct Session {
+    int socket_fd;
+    std::atomic<bool> finished = false;
+    std::thread thread;
+  };
+
+  int lock_fd_ = -1;
+  int listen_fd_ = -1;
+  std::list<std::unique_ptr<Session>> sessions_;
+
+  void ReapSessions();
+  static void Serve(Session& session);
+  static void Serve(int socket_fd, common::EngineChannel& channel);
+};
+
+}  // namespace beatrice::engine
+
+#endif  // BEATRICE_ENGINE_ENGINE_SERVER_H_
@@ -0,0 +1,24 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+// プラグインから起動される推論エンジン。
+// 起動したプラグインを待たせないよう、すぐに子プロセスとして切り離して
+// 親プロセスは終了する。
+
+#include <unistd.h>
+
+// Beatrice
+#include "engine/engine_server.h"
+
+auto main() -> int {
+  if (const auto pid = fork(); pid != 0) {
+    return pid < 0 ? 1 : 0;
+  }
+  setsid();
+  auto server = beatrice::engine::EngineServer();
+  if (!server.Listen()) {
+    // 他のエンジンが既に起動している
+    return 0;
+  }
+  server.Run();
+  return 0;
+}
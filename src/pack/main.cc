@@ -0,0 +1,49 @@
+// Copyright (c) 2024-2026 Project Beatrice and Contributors
+
+// ディレクトリ形式のモデルを、1 つのファイルにまとめたコンテナ形式に変換する。
+//   beatrice-pack <beatrice_model.toml またはそのディレクトリ> [<出力先>]
+// 出力先を省略した場合は、モデルのディレクトリ名に拡張子を付けて隣に作る。
+
+#include <filesystem>
+#include <iostream>
+#include <system_error>
+
+// Beatrice
+#include "common/error.h"
+#include "common/model_container.h"
+
+auto main(const int argc, const char* const argv[]) -> int {
+  using beatrice::common::ErrorCode;
+  using beatrice::common::ModelContainer;
+
+  if (argc < 2 || argc > 3) {
+    std::cerr << "usage: beatrice-pack <beatrice_model.toml> [<output"
+              << ModelContainer::kExtension << ">]\n";
+    return 2;
+  }
+  auto ec = std::error_code();
+  auto model_file = std::filesystem::absolute(argv[1], ec);
+  if (ec) {
+    std::cerr << "invalid path: " << argv[1] << '\n';
+    return 1;
+  }
+  if (std::filesystem::is_directory(model_file, ec)) {
+    model_file /= "beatrice_model.toml";
+  }
+  auto container_file = std::filesystem::path();
+  if (argc == 3) {
+    container_file = argv[2];
+  } else {
+    container_file = model_file.parent_path();
+    container_file += ModelContainer::kExtension;
+  }
+
+  if (const auto error_code = ModelContainer::Pack(model_file, container_file);
+      error_code != ErrorCode::kSuccess) {
+    std::cerr << "failed to pack " << model_file.string()
+              << " (error code " << static_cast<int>(error_code) << ")\n";
+    return 1;
+  }
+  std::cout << container_file.string() << '\n';
+  return 0;
+}
@@ -13,6 +13,8 @@
 
 #include "vst3sdk/pluginterfaces/base/fplatform.h"
 #include "vst3sdk/pluginterfaces/base/funknown.h"
+#include "vst3sdk/pluginterfaces/base/smartpointer.h"
+#include "vst3sdk/pluginterfaces/vst/ivstmessage.h"
 #include "vst3sdk/pluginterfaces/vst/ivstunits.h"
 #include "vst3sdk/public.sdk/source/vst/utility/stringconvert.h"
 #include "vst3sdk/public.sdk/source/vst/vsteditcontroller.h"
@@ -198,4 +200,50 @@ void Controller::SetStringParameter(const ParamID vst_param_id,
   }
 }
 
+void Controller::RequestMemoryFootprint() {
+  if (const auto msg = Steinberg::owned(allocateMessage())) {
+    msg->setMessageID("get_memory_footprint");
+    sendMessage(msg);
+  }
+}
+
+void Controller::RequestQualityReport() {
+  if (const auto msg = Steinberg::owned(allocateMessage())) {
+    msg->setMessageID("get_quality_report");
+    sendMessage(msg);
+  }
+}
+
+auto PLUGIN_API Controller::notify(Steinberg::Vst::IMessage* const message)
+    -> tresult {
+  if (std::strcmp(message->getMessageID(), "memory_footprint") == 0) {
+    const void* data;
+    Steinberg::uint32 siz;
+    if (message->getAttributes()->getBinary("data", data, siz) !=
+        kResultTrue) {
+      return kResultFalse;
+    }
+    const auto report =
+        std::string(static_cast<const char*>(data), siz);
+    for (auto&& editor : editors_) {
+      editor->ShowMemoryFootprint(report);
+    }
+    return kResultTrue;
+  }
+  if (std::strcmp(message->getMessageID(), "quality_report") == 0) {
+    const void* data;
+    Steinberg::uint32 siz;
+    if (message->getAttributes()->getBinary("data", data, siz) !=
+        kResultTrue) {
+      return kResultFalse;
+    }
+    const auto report = std::string(static_cast<const char*>(data), siz);
+    for (auto&& editor : editors_) {
+      editor->ShowQualityReport(report);
+    }
+    return kResultTrue;
+  }
+  return EditController::notify(message);
+}
+
 }  // namespace beatrice::vst
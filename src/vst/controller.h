@@ -44,11 +44,21 @@ class Controller : public Steinberg::Vst::EditController {
   auto PLUGIN_API setParamNormalized(ParamID param_id, ParamValue value)
       -> tresult SMTG_OVERRIDE;
 
+  // from ComponentBase
+  auto PLUGIN_API notify(Steinberg::Vst::IMessage* message)
+      -> tresult SMTG_OVERRIDE;
+
  private:
   common::ControllerCore core_;
   std::vector<Editor*> editors_;
 
   void SetStringParameter(ParamID, const std::u8string&);
+  // Processor が使っているメモリの量を問い合わせる。
+  // 結果は Editor::ShowMemoryFootprint() に渡される
+  void RequestMemoryFootprint();
+  // 処理負荷に応じた品質の調整状況を問い合わせる。
+  // 結果は Editor::ShowQualityReport() に渡される
+  void RequestQualityReport();
   friend Editor;
 };
 
@@ -12,6 +12,7 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "vst3sdk/vstgui4/vstgui/lib/cbitmap.h"
 #include "vst3sdk/vstgui4/vstgui/lib/ccolor.h"
@@ -21,6 +22,7 @@
 #include "vst3sdk/vstgui4/vstgui/lib/cfont.h"
 #include "vst3sdk/vstgui4/vstgui/lib/cgraphicspath.h"
 #include "vst3sdk/vstgui4/vstgui/lib/clinestyle.h"
+#include "vst3sdk/vstgui4/vstgui/lib/controls/coptionmenu.h"
 #include "vst3sdk/vstgui4/vstgui/lib/controls/cparamdisplay.h"
 #include "vst3sdk/vstgui4/vstgui/lib/controls/cslider.h"
 #include "vst3sdk/vstgui4/vstgui/lib/controls/ctextlabel.h"
@@ -416,21 +418,38 @@ class FileSelector : public CTextLabel {
   explicit FileSelector(const CRect& size, const UTF8String& text = "")
       : CTextLabel(size, text) {}
 
+  // 索引済みのモデルの一覧から選べるようにする
+  struct LibraryEntry {
+    std::string title;
+    std::filesystem::path file;
+  };
+  using GetLibrary = std::function<std::vector<LibraryEntry>()>;
+
+  void SetLibrary(GetLibrary get_library) {
+    get_library_ = std::move(get_library);
+  }
+  // 右クリックされた時に呼ばれる
+  void SetContextAction(std::function<void()> context_action) {
+    context_action_ = std::move(context_action);
+  }
+
   auto onMouseDown(CPoint& where, const CButtonState& buttons)
       -> CMouseEventResult override {
     if (buttons.isLeftButton()) {
-      auto* const selector =
-          CNewFileSelector::create(getFrame(), CNewFileSelector::kSelectFile);
-      if (selector) {
-        selector->addFileExtension(CFileExtension("TOML", "toml"));
-        selector->run(
-            [self = VSTGUI::shared(this)](CNewFileSelector* sender) -> void {
-              self->notify(sender, CNewFileSelector::kSelectEndMessage);
-            });
-        selector->forget();
+      // 一覧が空ならファイルダイアログを直接開く
+      if (auto entries = get_library_ ? get_library_()
+                                      : std::vector<LibraryEntry>();
+          !entries.empty()) {
+        ShowLibraryMenu(where, std::move(entries));
+      } else {
+        OpenFileDialog();
       }
       return VSTGUI::kMouseEventHandled;
     }
+    if (buttons.isRightButton() && context_action_) {
+      context_action_();
+      return VSTGUI::kMouseEventHandled;
+    }
     return CTextLabel::onMouseDown(where, buttons);
   }
 
@@ -468,6 +487,62 @@ class FileSelector : public CTextLabel {
 
  private:
   std::filesystem::path file_;
+  GetLibrary get_library_;
+  std::function<void()> context_action_;
+
+  void OpenFileDialog() {
+    auto* const selector =
+        CNewFileSelector::create(getFrame(), CNewFileSelector::kSelectFile);
+    if (selector) {
+      selector->addFileExtension(CFileExtension("TOML", "toml"));
+      selector->addFileExtension(
+          CFileExtension("Beatrice Model Container", "beatrice"));
+      selector->run(
+          [self = VSTGUI::shared(this)](CNewFileSelector* sender) -> void {
+            self->notify(sender, CNewFileSelector::kSelectEndMessage);
+          });
+      selector->forget();
+    }
+  }
+
+  void ShowLibraryMenu(const CPoint& point, std::vector<LibraryEntry> entries) {
+    auto* const frame = getFrame();
+    if (!frame) {
+      return;
+    }
+    auto menu = VSTGUI::owned(new VSTGUI::COptionMenu());
+    const auto n_entries = static_cast<int32_t>(entries.size());
+    for (auto i = 0; i < n_entries; ++i) {
+      auto* const item = new VSTGUI::CMenuItem(entries[i].title.c_str(), i);
+      item->setChecked(entries[i].file == file_);
+      menu->addEntry(item);
+    }
+    menu->addSeparator();
+    const auto browse_tag = n_entries;
+    menu->addEntry(new VSTGUI::CMenuItem("Browse...", browse_tag));
+    const auto frame_point = translateToGlobal(point);
+    menu->popup(frame, frame_point,
+                [self = VSTGUI::shared(this), entries = std::move(entries),
+                 browse_tag](VSTGUI::COptionMenu* popup) -> void {
+                  if (!self->isAttached() || !popup ||
+                      popup->getLastResult() < 0) {
+                    return;
+                  }
+                  const auto* const item =
+                      popup->getEntry(popup->getLastResult());
+                  if (!item) {
+                    return;
+                  }
+                  const auto tag = item->getTag();
+                  if (tag == browse_tag) {
+                    self->OpenFileDialog();
+                  } else if (tag >= 0 && tag < browse_tag) {
+                    self->SetPath(entries[tag].file);
+                    // Editor に通知
+                    self->valueChanged();
+                  }
+                });
+  }
 };
 
 }  // namespace beatrice::vst
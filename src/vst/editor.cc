@@ -6,21 +6,20 @@
 #include <array>
 #include <cassert>
 #include <cmath>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <exception>
 #include <filesystem>
-#include <fstream>
-#include <ios>
+#include <map>
 #include <memory>
-#include <optional>
 #include <string>
+#include <string_view>
 #include <system_error>
 #include <variant>
 #include <vector>
 
 #include "beatricelib/beatrice.h"
-#include "toml11/single_include/toml.hpp"
 #include "vst3sdk/pluginterfaces/base/fplatform.h"
 #include "vst3sdk/pluginterfaces/base/fstrdefs.h"
 #include "vst3sdk/pluginterfaces/base/ftypes.h"
@@ -44,7 +43,11 @@
 
 // Beatrice
 #include "common/error.h"
+#include "common/memory_footprint.h"
 #include "common/model_config.h"
+#include "common/model_config_cache.h"
+#include "common/model_container.h"
+#include "common/model_library.h"
 #include "common/parameter_schema.h"
 #include "common/voice_morph_parameter.h"
 #include "common/voice_morph_state.h"
@@ -228,6 +231,59 @@ auto MakeRoundedBitmap(CBitmap* const source, const int width, const int height,
   return bitmap;
 }
 
+// portrait の画像を読み込む。
+// container があればコンテナの name の画像を、無ければ directory 以下のファイルを読む
+auto LoadPortraitBitmap(const common::ModelContainer* const container,
+                        const std::filesystem::path& directory,
+                        const std::string_view prefix,
+                        const std::u8string& path) -> SharedPointer<CBitmap> {
+  auto platform_bitmap = VSTGUI::PlatformBitmapPtr();
+  if (container) {
+    auto name = std::string(prefix);
+    name.append(path.begin(), path.end());
+    const auto data = container->Find(name);
+    if (data.empty()) {
+      return nullptr;
+    }
+    platform_bitmap = getPlatformFactory().createBitmapFromMemory(
+        data.data(), static_cast<uint32_t>(data.size()));
+  } else {
+    const auto portrait_file = directory / path;
+    auto portrait_error = std::error_code{};
+    if (!std::filesystem::is_regular_file(portrait_file, portrait_error)) {
+      return nullptr;
+    }
+    platform_bitmap = getPlatformFactory().createBitmapFromPath(
+        reinterpret_cast<const char*>(portrait_file.u8string().c_str()));
+  }
+  if (!platform_bitmap) {
+    return nullptr;
+  }
+  return VSTGUI::owned(new CBitmap(platform_bitmap));
+}
+
+auto GetLibraryEntries(const common::ModelLibrary& library)
+    -> std::vector<FileSelector::LibraryEntry> {
+  auto entries = std::vector<FileSelector::LibraryEntry>();
+  const auto models = library.GetModels();
+  if (!models) {
+    return entries;
+  }
+  entries.reserve(models->size());
+  for (const auto& model : *models) {
+    // 同名のモデルを区別できるよう、ディレクトリ名かファイル名を添える
+    const auto location =
+        (common::ModelContainer::IsContainer(model.file)
+             ? model.file.filename()
+             : model.file.parent_path().filename())
+            .u8string();
+    auto title = std::string(model.name.begin(), model.name.end());
+    title += " (" + std::string(location.begin(), location.end()) + ")";
+    entries.push_back({.title = std::move(title), .file = model.file});
+  }
+  return entries;
+}
+
 }  // namespace
 
 Editor::Editor(void* const controller)
@@ -303,6 +359,7 @@ auto PLUGIN_API Editor::open(void* const parent,
   const auto surface_noise = SurfaceNoiseParams{};
   const auto surface_noise_maps =
       std::make_shared<SurfaceNoiseMaps>(surface_noise);
+  surface_noise_maps_ = surface_noise_maps;
   const auto frame_surface =
       VSTGUI::owned(new SurfaceBitmap(frame_texture, surface_noise_maps));
   const auto header_surface = VSTGUI::owned(
@@ -447,6 +504,15 @@ auto PLUGIN_API Editor::open(void* const parent,
   model_panel->addView(model_selector);
   register_control(static_cast<ParamID>(ParameterID::kModel), model_selector);
   model_name_label_ = model_selector;
+  // モデルの一覧はファイルシステムを走査せず索引から作る
+  model_library_ = common::ModelLibrary::Acquire();
+  model_library_->Rescan();
+  model_selector->SetLibrary(
+      [library = model_library_] { return GetLibraryEntries(*library); });
+  // 右クリックでメモリの使用量を表示する
+  model_selector->SetContextAction([beatrice_controller] {
+    beatrice_controller->RequestMemoryFootprint();
+  });
 
   // タブ
   auto* const tabs =
@@ -468,9 +534,15 @@ auto PLUGIN_API Editor::open(void* const parent,
   };
   add_tab(0, CRect(528, 0, 640, 52), "MAIN");
   add_tab(1, CRect(640, 0, 752, 52), "TUNING");
-  make_label(tabs, CRect(1070, 15, 1252, 37),
-             (UTF8String("Ver. ") + FULL_VERSION_STR).data(), font_small_,
-             CColor(0x77, 0x74, 0x70), CHoriTxtAlign::kRightText);
+  // クリックで処理負荷に応じた品質の調整状況を表示する
+  auto* const version_label = new ActionLabel(
+      CRect(1070, 15, 1252, 37), UTF8String("Ver. ") + FULL_VERSION_STR,
+      [beatrice_controller] { beatrice_controller->RequestQualityReport(); });
+  version_label->setBackColor(kTransparentCColor);
+  version_label->setFont(font_small_);
+  version_label->setFontColor(CColor(0x77, 0x74, 0x70));
+  version_label->setHoriAlign(CHoriTxtAlign::kRightText);
+  tabs->addView(version_label);
 
   // ページコンテナ
   auto* const main_page = new SurfacePanel(
@@ -632,6 +704,49 @@ auto PLUGIN_API Editor::open(void* const parent,
                   static_cast<ParamID>(ParameterID::kPitchCorrectionType),
                   CRect(28, 236, 292, 264));
 
+  // Dual Mono の場合の 2 チャンネル目の設定
+  auto* const channel_panel = add_panel(tuning_page, CRect(352, 16, 672, 364));
+  add_title(channel_panel, CRect(0, 12, 320, 34), "CHANNELS");
+  make_label(channel_panel, CRect(28, 50, 292, 68), "Channel Mode",
+             font_small_, CColor(0xb8, 0xb5, 0xaf));
+  add_option_menu(channel_panel,
+                  static_cast<ParamID>(ParameterID::kChannelMode),
+                  CRect(28, 74, 292, 102));
+  make_label(channel_panel, CRect(28, 120, 292, 138), "Voice 2", font_small_,
+             CColor(0xb8, 0xb5, 0xaf));
+  add_option_menu(channel_panel,
+                  static_cast<ParamID>(ParameterID::kSecondVoice),
+                  CRect(28, 144, 292, 172));
+  add_slider(channel_panel,
+             static_cast<ParamID>(ParameterID::kSecondPitchShift),
+             CRect(28, 196, 292, 239), 2, 1.0f, 0.125f);
+  add_slider(channel_panel,
+             static_cast<ParamID>(ParameterID::kSecondFormantShift),
+             CRect(28, 264, 292, 307), 2, 1.0f, 0.5f);
+
+  // Fan-Out の場合の声の数と 3 つ目以降の声の設定。
+  // 2 つ目の声には CHANNELS の Voice 2 などを使う
+  auto* const fan_out_panel = add_panel(tuning_page, CRect(688, 16, 1008, 564));
+  add_title(fan_out_panel, CRect(0, 12, 320, 34), "FAN-OUT");
+  make_label(fan_out_panel, CRect(28, 50, 292, 68), "Fan-Out Voices",
+             font_small_, CColor(0xb8, 0xb5, 0xaf));
+  add_option_menu(fan_out_panel,
+                  static_cast<ParamID>(ParameterID::kFanOutVoices),
+                  CRect(28, 74, 292, 102));
+  for (auto i = 0; i < 2; ++i) {
+    const auto top = 120 + 210 * i;
+    const auto base = static_cast<int>(ParameterID::kThirdVoice) + 3 * i;
+    make_label(fan_out_panel, CRect(28, top, 292, top + 18),
+               i == 0 ? "Voice 3" : "Voice 4", font_small_,
+               CColor(0xb8, 0xb5, 0xaf));
+    add_option_menu(fan_out_panel, static_cast<ParamID>(base),
+                    CRect(28, top + 24, 292, top + 52));
+    add_slider(fan_out_panel, static_cast<ParamID>(base + 2),
+               CRect(28, top + 76, 292, top + 119), 2, 1.0f, 0.125f);
+    add_slider(fan_out_panel, static_cast<ParamID>(base + 1),
+               CRect(28, top + 144, 292, top + 187), 2, 1.0f, 0.5f);
+  }
+
   // Voice 選択メニュー
   voice_menu_overlay_ = new VoiceMenuOverlayView(
       CRect(0, 0, kWindowWidth, kWindowHeight), panel_surface, font_,
@@ -672,7 +787,7 @@ auto PLUGIN_API Editor::open(void* const parent,
     valueChanged(model_control);
   }
   if (HasEnvironmentVariable("BEATRICE_SCREENSHOT_VOICE_MORPH") &&
-      model_config_.has_value() && common::GetVoiceCount(*model_config_) > 1) {
+      model_config_ && common::GetVoiceCount(*model_config_) > 1) {
     auto* const voice_control = static_cast<COptionMenu*>(
         controls_.at(static_cast<ParamID>(ParameterID::kVoice)));
     voice_control->setValue(voice_control->getMax());
@@ -708,6 +823,8 @@ void PLUGIN_API Editor::close() {
     page_tabs_ = {};
     tab_indicator_ = nullptr;
     voice_morph_state_ = {};
+    model_library_.reset();
+    surface_noise_maps_.reset();
   }
 }
 
@@ -773,7 +890,7 @@ void Editor::SetPortraitDescriptionMode(const bool morphing) {
 
 void Editor::SetVoiceSelectorDisplay(const int voice_id) {
   if (voice_selector_) {
-    voice_selector_->SetDisplay(model_config_, portrait_menu_thumbnails_,
+    voice_selector_->SetDisplay(model_config_.get(), portrait_menu_thumbnails_,
                                 voice_id);
   }
 }
@@ -785,8 +902,8 @@ void Editor::ToggleVoiceMenu() {
   }
   const auto selected_voice_id =
       static_cast<int>(std::round(voice_control->getValue()));
-  voice_menu_overlay_->ToggleMenu(model_config_, portrait_menu_thumbnails_,
-                                  selected_voice_id);
+  voice_menu_overlay_->ToggleMenu(model_config_.get(),
+                                  portrait_menu_thumbnails_, selected_voice_id);
 }
 
 void Editor::HideVoiceMenu() {
@@ -802,7 +919,8 @@ void Editor::RebuildVoiceMenu() {
   }
   const auto selected_voice_id =
       static_cast<int>(std::round(voice_control->getValue()));
-  voice_menu_overlay_->RebuildMenu(model_config_, portrait_menu_thumbnails_,
+  voice_menu_overlay_->RebuildMenu(model_config_.get(),
+                                   portrait_menu_thumbnails_,
                                    selected_voice_id);
 }
 
@@ -834,6 +952,46 @@ void Editor::ShowDescriptionPopup(const char* const title,
   }
 }
 
+void Editor::ShowMemoryFootprint(const std::string& processor_report) {
+  if (!frame) {
+    return;
+  }
+  auto footprint = common::MemoryFootprint();
+  if (surface_noise_maps_) {
+    footprint.Add("surface noise maps", surface_noise_maps_->GetMemoryUsage());
+  }
+  // 画素あたり 4 バイトとして見積もる
+  const auto add_bitmaps =
+      [&footprint](const char* const component,
+                   const std::map<std::u8string, SharedPointer<CBitmap>>&
+                       bitmaps) {
+        auto bytes = std::size_t{0};
+        for (const auto& [path, bitmap] : bitmaps) {
+          if (bitmap) {
+            bytes += static_cast<std::size_t>(bitmap->getWidth() *
+                                              bitmap->getHeight() * 4.0);
+          }
+        }
+        footprint.Add(component, bytes);
+      };
+  add_bitmaps("portraits", portraits_);
+  add_bitmaps("portrait thumbnails", portrait_menu_thumbnails_);
+  add_bitmaps("portrait thumbnails", portrait_marker_thumbnails_);
+  const auto text =
+      "Processor:\n" + processor_report + "\nEditor:\n" + footprint.ToString();
+  ShowDescriptionPopup("MEMORY USAGE", std::u8string(text.begin(), text.end()),
+                       CRect(220, 224, 864, 701));
+}
+
+void Editor::ShowQualityReport(const std::string& report) {
+  if (!frame) {
+    return;
+  }
+  ShowDescriptionPopup("PROCESSING LOAD",
+                       std::u8string(report.begin(), report.end()),
+                       CRect(220, 224, 864, 701));
+}
+
 void Editor::HideDescriptionPopup() {
   if (description_popup_) {
     description_popup_->Hide();
@@ -842,7 +1000,7 @@ void Editor::HideDescriptionPopup() {
 
 void Editor::ApplyVoiceMorphState(const common::VoiceMorphState& state) {
   voice_morph_state_ = state;
-  if (model_config_.has_value()) {
+  if (model_config_) {
     const auto voice_count = common::GetVoiceCount(*model_config_);
     assert(voice_count > 0);
     if (voice_count > 0) {
@@ -901,7 +1059,7 @@ void Editor::SyncValue(const ParamID param_id, const float plain_value) {
   if (param_id == static_cast<ParamID>(ParameterID::kVoice)) {
     const auto voice_id = static_cast<int>(std::round(plain_value));
     control->setValue(plain_value);
-    if (!model_config_.has_value()) {
+    if (!model_config_) {
       portrait_view_->setBackground(nullptr);
       portrait_view_->setVisible(false);
       unloaded_logo_view_->setVisible(true);
@@ -961,7 +1119,7 @@ void Editor::SyncStringValue(const ParamID param_id,
 // 現在読み込まれているモデルをもとに
 // min_source_pitch, max_source_pitch の範囲を更新する。
 void Editor::SyncSourcePitchRange() {
-  if (!model_config_.has_value() || model_config_->model.VersionInt() < 0) {
+  if (!model_config_ || model_config_->model.VersionInt() < 0) {
     return;
   }
   auto* const min_source_pitch_slider = static_cast<Slider*>(
@@ -991,7 +1149,7 @@ void Editor::SyncSourcePitchRange() {
 // 現在読み込まれているモデルをもとに
 // パラメータの有効/無効を更新する。
 void Editor::SyncParameterAvailability() {
-  if (!model_config_.has_value() || model_config_->model.VersionInt() < 0) {
+  if (!model_config_ || model_config_->model.VersionInt() < 0) {
     return;
   }
   auto* const vq_num_neighbors_slider = static_cast<Slider*>(
@@ -1025,7 +1183,7 @@ void Editor::SyncModelDescription() {
   if (morph_pad_view_) {
     morph_pad_view_->setVisible(false);
   }
-  model_config_ = std::nullopt;
+  model_config_ = nullptr;
   SetVoiceSelectorDisplay(-1);
   RebuildVoiceMenu();
   portraits_.clear();
@@ -1038,12 +1196,11 @@ void Editor::SyncModelDescription() {
     // 初期状態
     return;
   }
-  auto file_error = std::error_code{};
-  auto stream = std::ifstream{};
-  if (std::filesystem::is_regular_file(file, file_error)) {
-    stream.open(file, std::ios::binary);
-  }
-  if (!stream.is_open()) {
+  // TOML の解析結果は Controller や Processor と共有する
+  auto parse_error_message = std::string();
+  const auto read_error =
+      common::ModelConfigCache::Get(file, model_config_, &parse_error_message);
+  if (read_error == common::ErrorCode::kFileOpenError) {
     // ファイルが移動して読み込めない場合の分岐だが、
     // モデルを読み込んだ後に GUI を閉じモデルファイルを移動して
     // 再び GUI を開いた場合などには
@@ -1054,16 +1211,31 @@ void Editor::SyncModelDescription() {
         u8"issue. Please reload a valid model.");
     return;
   }
+  if (read_error != common::ErrorCode::kSuccess) {
+    model_selector->setText("<failed to load>");
+    SetModelDescriptionText(
+        u8"Error:\n" + std::u8string(parse_error_message.begin(),
+                                     parse_error_message.end()));
+    return;
+  }
+  // コンテナの場合は portrait をコンテナから読む
+  auto container = std::shared_ptr<const common::ModelContainer>();
+  if (common::ModelContainer::IsContainer(file)) {
+    auto container_error = common::ErrorCode::kSuccess;
+    container = common::ModelContainer::Open(file, container_error);
+  }
   try {
-    const auto source_path = file.u8string();
-    const auto source_name = std::string(
-        reinterpret_cast<const char*>(source_path.data()), source_path.size());
-    const auto toml_data = toml::parse(stream, source_name);
-    model_config_ = toml::get<common::ModelConfig>(toml_data);
     if (model_config_->model.VersionInt() == -1) {
       SetModelDescriptionText(u8"Error: Unknown model version.");
       return;
     }
+    // 同じ場所にある他のモデルも一覧に出るようにする
+    if (model_library_) {
+      model_library_->AddDirectory(
+          common::ModelContainer::IsContainer(file)
+              ? file.parent_path()
+              : file.parent_path().parent_path());
+    }
     model_selector->setText(
         reinterpret_cast<const char*>(model_config_->model.name.c_str()));
     const auto voice_count = common::GetVoiceCount(*model_config_);
@@ -1078,23 +1250,27 @@ void Editor::SyncModelDescription() {
         if (portraits_.contains(voice.portrait.path)) {
           goto load_portrait_succeeded;
         }
-        const auto portrait_file = file.parent_path() / voice.portrait.path;
-        auto portrait_error = std::error_code{};
-        if (!std::filesystem::is_regular_file(portrait_file, portrait_error)) {
+        const auto original_bitmap = LoadPortraitBitmap(
+            container.get(), file.parent_path(),
+            common::ModelContainer::kPortraitPrefix, voice.portrait.path);
+        if (!original_bitmap) {
           goto load_portrait_failed;
         }
-        const auto platform_bitmap = getPlatformFactory().createBitmapFromPath(
-            reinterpret_cast<const char*>(portrait_file.u8string().c_str()));
-        if (!platform_bitmap) {
-          goto load_portrait_failed;
+        // コンテナに縮小済みの画像があれば、サムネイルはそれから作る
+        auto thumbnail_source = SharedPointer<CBitmap>();
+        if (container) {
+          thumbnail_source = LoadPortraitBitmap(
+              container.get(), {}, common::ModelContainer::kThumbnailPrefix,
+              voice.portrait.path);
+        }
+        if (!thumbnail_source) {
+          thumbnail_source = original_bitmap;
         }
-        const auto original_bitmap =
-            VSTGUI::owned(new CBitmap(platform_bitmap));
         auto rounded_portrait = MakeRoundedBitmap(
             original_bitmap.get(), kPortraitWidth, kPortraitHeight, 4.0);
-        auto menu_thumbnail = ScaleBitmap(original_bitmap.get(), 42, 42);
+        auto menu_thumbnail = ScaleBitmap(thumbnail_source.get(), 42, 42);
         auto circular_thumbnail =
-            MakeRoundedBitmap(original_bitmap.get(), 58, 58, 29.0);
+            MakeRoundedBitmap(thumbnail_source.get(), 58, 58, 29.0);
         if (!rounded_portrait || !menu_thumbnail || !circular_thumbnail) {
           goto load_portrait_failed;
         }
@@ -1243,7 +1419,8 @@ void Editor::valueChanged(CControl* const pControl) {
     auto error_code = str_param->ControllerSetValue(core, file);
     if (error_code == common::ErrorCode::kFileOpenError ||
         error_code == common::ErrorCode::kTOMLSyntaxError ||
-        error_code == common::ErrorCode::kInvalidModelConfig) {
+        error_code == common::ErrorCode::kInvalidModelConfig ||
+        error_code == common::ErrorCode::kInvalidModelContainer) {
       // Controller とは別に Editor::SyncModelDescription でも改めて
       // ファイルを読み込もうとして失敗するので、ここではエラー処理しない
       error_code = common::ErrorCode::kSuccess;
@@ -1304,7 +1481,7 @@ void Editor::endEdit(const Steinberg::int32 index) {
 }
 
 void Editor::UpdateVoiceMorphingDescription() {
-  if (!model_config_.has_value() || !morph_pad_view_ ||
+  if (!model_config_ || !morph_pad_view_ ||
       !morph_pad_view_->isVisible()) {
     return;
   }
@@ -6,7 +6,6 @@
 #include <array>
 #include <map>
 #include <memory>
-#include <optional>
 #include <string>
 
 #include "vst3sdk/pluginterfaces/base/fplatform.h"
@@ -18,6 +17,7 @@
 
 // Beatrice
 #include "common/model_config.h"
+#include "common/model_library.h"
 #include "common/voice_morph_state.h"
 #include "vst/controls.h"
 
@@ -31,6 +31,7 @@ class DescriptionPopupView;
 class MorphFalloffSlider;
 class MorphPadController;
 class MorphPadView;
+class SurfaceNoiseMaps;
 class VoiceMenuOverlayView;
 class VoiceSelectorView;
 
@@ -53,6 +54,10 @@ class Editor : public Steinberg::Vst::VSTGUIEditor, public IControlListener {
   void SyncValue(ParamID param_id, float plain_value);
   void SyncStringValue(ParamID param_id, const std::u8string& value);
   void valueChanged(CControl* pControl) SMTG_OVERRIDE;
+  // Processor から返されたメモリ使用量に Editor の分を加えて表示する
+  void ShowMemoryFootprint(const std::string& processor_report);
+  // Processor から返された品質の調整状況を表示する
+  void ShowQualityReport(const std::string& report);
   // auto notify(CBaseObject* sender,
   //                       const char* message) -> CMessageResult SMTG_OVERRIDE;
 
@@ -84,7 +89,9 @@ class Editor : public Steinberg::Vst::VSTGUIEditor, public IControlListener {
   std::map<ParamID, CControl*> controls_;
   CFontRef font_, font_bold_, font_description_, font_small_;
   CFontRef font_heading_, font_strong_;
-  std::optional<common::ModelConfig> model_config_;
+  std::shared_ptr<const common::ModelConfig> model_config_;
+  std::shared_ptr<common::ModelLibrary> model_library_;
+  std::shared_ptr<const SurfaceNoiseMaps> surface_noise_maps_;
 
   // Portrait / morph
   CView* portrait_view_ = nullptr;
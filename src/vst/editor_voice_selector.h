@@ -6,7 +6,6 @@
 #include <algorithm>
 #include <functional>
 #include <map>
-#include <optional>
 #include <string>
 #include <utility>
 
@@ -78,7 +77,7 @@ class VoiceSelectorView final : public CViewContainer {
     return CViewContainer::onMouseDown(where, buttons);
   }
 
-  void SetDisplay(const std::optional<common::ModelConfig>& model_config,
+  void SetDisplay(const common::ModelConfig* const model_config,
                   const ThumbnailMap& thumbnails, const int voice_id) {
     if (!name_ || !portrait_ || !morph_icon_) {
       return;
@@ -89,7 +88,7 @@ class VoiceSelectorView final : public CViewContainer {
     portrait_->setVisible(false);
     morph_icon_->setVisible(false);
 
-    if (!model_config.has_value()) {
+    if (!model_config) {
       name_->setText("");
       SetDisplayDirty();
       return;
@@ -169,7 +168,7 @@ class VoiceMenuOverlayView final : public CViewContainer {
     setVisible(false);
   }
 
-  void ToggleMenu(const std::optional<common::ModelConfig>& model_config,
+  void ToggleMenu(const common::ModelConfig* const model_config,
                   const ThumbnailMap& thumbnails, const int selected_voice_id) {
     if (isVisible()) {
       HideMenu();
@@ -185,7 +184,7 @@ class VoiceMenuOverlayView final : public CViewContainer {
     setVisible(false);
   }
 
-  void RebuildMenu(const std::optional<common::ModelConfig>& model_config,
+  void RebuildMenu(const common::ModelConfig* const model_config,
                    const ThumbnailMap& thumbnails,
                    const int selected_voice_id) {
     static_cast<void>(BuildMenu(model_config, thumbnails, selected_voice_id));
@@ -194,14 +193,14 @@ class VoiceMenuOverlayView final : public CViewContainer {
   [[nodiscard]] auto IsMenuVisible() const -> bool { return isVisible(); }
 
  private:
-  auto BuildMenu(const std::optional<common::ModelConfig>& model_config,
+  auto BuildMenu(const common::ModelConfig* const model_config,
                  const ThumbnailMap& thumbnails, const int selected_voice_id)
       -> bool {
     if (!menu_panel_ || !menu_scroll_) {
       return false;
     }
     menu_scroll_->removeAll(true);
-    if (!model_config.has_value()) {
+    if (!model_config) {
       HideMenu();
       return false;
     }
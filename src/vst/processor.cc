@@ -2,17 +2,32 @@
 
 #include "vst/processor.h"
 
+#include <algorithm>
+#include <array>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <future>  // NOLINT(build/c++11)
 #include <memory>
 #include <mutex>  // NOLINT(build/c++11)
 #include <string>
+#include <string_view>
+#include <variant>
 
+#include "vst3sdk/pluginterfaces/base/smartpointer.h"
 #include "vst3sdk/pluginterfaces/vst/ivstparameterchanges.h"
 #include "vst3sdk/pluginterfaces/vst/vstspeaker.h"
 
 // Beatrice
 #include "common/error.h"
+#include "common/load_leveling.h"
 #include "common/parameter_schema.h"
+#include "common/realtime_worker_pool.h"
+#include "common/speaker_table.h"
+#include "common/stage_timings.h"
+#include "common/standby_cores.h"
 #include "vst/parameter.h"
 
 #ifdef BEATRICE_ONLY_FOR_LINTER_DO_NOT_COMPILE_WITH_THIS
@@ -29,8 +44,157 @@ using Steinberg::kResultTrue;
 // NOLINTNEXTLINE(readability-identifier-naming)
 namespace SpeakerArr = Steinberg::Vst::SpeakerArr;
 
+namespace {
+// 環境変数 BEATRICE_SPEAKER_TABLE_STORAGE で話者テーブルの保持形式を指定する。
+// "float16" または "int8" を指定するとメモリ使用量が減る代わりに精度が落ちる。
+auto GetSpeakerTableStorageFromEnvironment() -> common::SpeakerTableStorage {
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  const auto* const value = std::getenv("BEATRICE_SPEAKER_TABLE_STORAGE");
+  if (!value) {
+    return common::SpeakerTableStorage::kFloat32;
+  }
+  const auto name = std::string_view(value);
+  if (name == "float16") {
+    return common::SpeakerTableStorage::kFloat16;
+  }
+  if (name == "int8") {
+    return common::SpeakerTableStorage::kInt8;
+  }
+  return common::SpeakerTableStorage::kFloat32;
+}
+
+// 環境変数 BEATRICE_ASYNC_PROCESSING=1 で、リアルタイム処理を非同期で行う。
+// =0 で常に同期で行い、指定が無い場合は読み込んだモデルの計測結果に従う
+auto IsAsyncProcessingEnabled(const common::ProcessorProxy& proxy) -> bool {
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  const auto* const value = std::getenv("BEATRICE_ASYNC_PROCESSING");
+  if (value && std::string_view(value) == "1") {
+    return true;
+  }
+  if (value && std::string_view(value) == "0") {
+    return false;
+  }
+  const auto& profile = proxy.GetPerformanceProfile();
+  return profile && profile->IsAsyncProcessingRecommended();
+}
+
+// バッファの中で複数回同じパラメータの変更があった場合は、最後の値のみを f に渡す
+template <typename F>
+void ForEachParameterChange(Steinberg::Vst::ProcessData& data, F&& f) {
+  if (data.inputParameterChanges == nullptr) {
+    return;
+  }
+  const auto n_parameter_changed =
+      data.inputParameterChanges->getParameterCount();
+  for (auto index = 0; index < n_parameter_changed; ++index) {
+    auto* const param_queue =
+        data.inputParameterChanges->getParameterData(index);
+    if (param_queue == nullptr) {
+      continue;
+    }
+    Steinberg::Vst::ParamValue value;
+    int sample_offset;
+    const auto n_points = param_queue->getPointCount();
+    if (n_points <= 0) {
+      continue;
+    }
+    if (param_queue->getPoint(n_points - 1, sample_offset, value) !=
+        kResultTrue) {
+      continue;
+    }
+    f(param_queue->getParameterId(), value);
+  }
+}
+
+auto HasProcessableBuses(const Steinberg::Vst::ProcessData& data) -> bool {
+  if (data.numInputs == 0 || data.numOutputs == 0 || data.numSamples == 0) {
+    return false;
+  }
+  // double は処理しない
+  if (data.symbolicSampleSize == Steinberg::Vst::kSample64) {
+    return false;
+  }
+  // チャンネル数を確認
+  return data.inputs[0].numChannels >= 1 && data.outputs[0].numChannels >= 1;
+}
+
+// 出力バス 0 のチャンネル 0 に入力をコピーし、そのポインタを返す
+auto MixDownToOutput(Steinberg::Vst::ProcessData& data) -> float* {
+  const float* const in0 = data.inputs[0].channelBuffers32[0];
+  float* const out0 = data.outputs[0].channelBuffers32[0];
+  std::memmove(out0, in0, data.numSamples * sizeof(float));
+  if (data.inputs[0].numChannels >= 2) {
+    auto* const in1 = data.inputs[0].channelBuffers32[1];
+    for (auto i = 0; i < data.numSamples; ++i) {
+      out0[i] += in1[i];
+      out0[i] *= 0.5;
+    }
+  }
+  return out0;
+}
+
+// Dual Mono で独立に変換するチャンネル数。入出力ともにステレオの場合のみ 2
+auto GetNIndependentChannels(const Steinberg::Vst::ProcessData& data,
+                             const int n_processor_channels) -> int {
+  if (n_processor_channels < 2 || data.inputs[0].numChannels < 2 ||
+      data.outputs[0].numChannels < 2) {
+    return 1;
+  }
+  return 2;
+}
+
+// 入力の各チャンネルを出力バス 0 の同じチャンネルにコピーする
+void CopyToOutputChannels(Steinberg::Vst::ProcessData& data,
+                          const int n_channels) {
+  for (auto ch = 0; ch < n_channels; ++ch) {
+    std::memmove(data.outputs[0].channelBuffers32[ch],
+                 data.inputs[0].channelBuffers32[ch],
+                 data.numSamples * sizeof(float));
+  }
+}
+
+// 出力がステレオなら複製する
+void CopyToOtherOutputChannels(Steinberg::Vst::ProcessData& data,
+                               const int bus = 0) {
+  if (data.outputs[bus].numChannels >= 2) {
+    const auto* const out0 = data.outputs[bus].channelBuffers32[0];
+    auto* const out1 = data.outputs[bus].channelBuffers32[1];
+    std::memcpy(out1, out0, data.numSamples * sizeof(float));
+  }
+}
+
+// Fan-Out 以外では使わない、2 つ目以降の出力バスを無音にする
+void ClearAuxOutputs(Steinberg::Vst::ProcessData& data) {
+  for (auto bus = 1; bus < data.numOutputs; ++bus) {
+    for (auto ch = 0; ch < data.outputs[bus].numChannels; ++ch) {
+      std::memset(data.outputs[bus].channelBuffers32[ch], 0,
+                  data.numSamples * sizeof(float));
+    }
+    data.outputs[bus].silenceFlags =
+        (1ULL << data.outputs[bus].numChannels) - 1;
+  }
+}
+
+auto IsSilent(const float* const buffer, const int n_samples) -> bool {
+  return std::all_of(buffer, buffer + n_samples,
+                     [](const float x) { return x == 0.0F; });
+}
+}  // namespace
+
 // コンストラクタ
-Processor::Processor() : vc_core_(common::kSchema) {
+Processor::Processor()
+    : vc_core_(std::make_unique<common::ProcessorProxy>(common::kSchema)) {
+  vc_core_->SetSpeakerTableStorage(GetSpeakerTableStorageFromEnvironment());
+  // 切り替え前のモデルを待機させておき、戻す時に読み込み直さずに済ませる
+  vc_core_->SetStandbyCores(common::StandbyCores::Acquire());
+  // 読み込み中に process() が止まらないよう、モデルは別スレッドで読み込む
+  vc_core_->SetModelLoadingDeferred(true);
+  // 接続できなければプロセス内で処理する
+  if (common::EngineClient::IsEnabled()) {
+    engine_connection_pool_ = common::ThreadPool::Acquire();
+    engine_connection_ = engine_connection_pool_->Submit(
+        [] { return common::EngineClient::Connect(); });
+  }
   // 対応するコントローラクラスを設定する
   setControllerClass(kControllerUID);
 }
@@ -47,6 +211,14 @@ auto PLUGIN_API Processor::initialize(FUnknown* const context) -> tresult {
   // In/Out バスの生成
   addAudioInput(STR16("AudioInput"), SpeakerArr::kMono);
   addAudioOutput(STR16("AudioOutput"), SpeakerArr::kMono);
+  // Fan-Out の 2 つ目以降の声。ホストで有効にした場合のみ使われる
+  static constexpr auto kVoiceBusNames =
+      std::array<const Steinberg::Vst::TChar*,
+                 common::ProcessorProxy::kMaxNVoices - 1>{
+          STR16("Voice 2"), STR16("Voice 3"), STR16("Voice 4")};
+  for (const auto* const name : kVoiceBusNames) {
+    addAudioOutput(name, SpeakerArr::kMono, Steinberg::Vst::kAux, 0);
+  }
 
   return kResultTrue;
 }
@@ -59,10 +231,15 @@ auto PLUGIN_API Processor::setBusArrangements(SpeakerArrangement* const inputs,
                                               const int32 numIns,
                                               SpeakerArrangement* const outputs,
                                               const int32 numOuts) -> tresult {
-  // 入力バス・出力バスの数はいずれも 1
-  if (numIns == 1 && numOuts == 1 &&
-      (inputs[0] == SpeakerArr::kMono || inputs[0] == SpeakerArr::kStereo) &&
-      (outputs[0] == SpeakerArr::kMono || outputs[0] == SpeakerArr::kStereo)) {
+  // 入力バスの数は 1、出力バスの数は Fan-Out の声の分まで
+  const auto is_mono_or_stereo = [](const SpeakerArrangement arrangement) {
+    return arrangement == SpeakerArr::kMono ||
+           arrangement == SpeakerArr::kStereo;
+  };
+  if (numIns == 1 && 1 <= numOuts &&
+      numOuts <= common::ProcessorProxy::kMaxNVoices &&
+      is_mono_or_stereo(inputs[0]) &&
+      std::all_of(outputs, outputs + numOuts, is_mono_or_stereo)) {
     return AudioEffect::setBusArrangements(inputs, numIns, outputs, numOuts);
   }
 
@@ -80,52 +257,124 @@ auto PLUGIN_API Processor::setupProcessing(ProcessSetup& setup) -> tresult {
   if (setup.symbolicSampleSize == Steinberg::Vst::kSample64) {
     return kResultFalse;
   }
-  const auto error_code = vc_core_.SetSampleRate(setup.sampleRate);
+  const auto error_code = vc_core_->SetSampleRate(setup.sampleRate);
   assert(error_code == common::ErrorCode::kSuccess);
+  // リアルタイムでない書き出しでは、複数スレッドでパイプライン化して処理する
+  [[maybe_unused]] const auto offline_error_code =
+      vc_core_->SetOfflineRendering(setup.processMode !=
+                                    Steinberg::Vst::kRealtime);
+  // 読み込み直しで用意されるものも、バックグラウンドスレッドで同じ処理モードにする
+  loader_.SetOfflineRendering(vc_core_->IsOfflineRendering());
+  crossfade_buffer_.resize(static_cast<std::size_t>(setup.maxSamplesPerBlock) *
+                           common::ProcessorProxy::kMaxNVoices);
+  voice_buffer_.resize(static_cast<std::size_t>(setup.maxSamplesPerBlock) *
+                       (common::ProcessorProxy::kMaxNVoices - 1));
+  max_block_size_ = setup.maxSamplesPerBlock;
+  AdoptEngineConnection();
+  // 書き出しは常に最高品質で行う。
+  // リアルタイム処理は、計測済みのモデルであれば余裕のある品質から始める
+  if (setup.processMode != Steinberg::Vst::kRealtime) {
+    quality_controller_.Reset();
+  } else if (const auto& profile = vc_core_->GetPerformanceProfile()) {
+    quality_controller_.SetLevel(profile->GetRecommendedQualityLevel());
+  }
+  [[maybe_unused]] const auto quality_error_code =
+      vc_core_->SetQualityLevel(quality_controller_.GetLevel());
+  // 負荷の平準化はリアルタイム処理でのみ行う。
+  // 遅延は途中で変えられないので、読み込むモデルやその構成によらず一定にする
+  load_leveling_latency_ =
+      setup.processMode == Steinberg::Vst::kRealtime &&
+              common::IsLoadLevelingEnabled()
+          ? common::GetLoadLevelingLatency(setup.sampleRate)
+          : 0;
+  // 非同期モードは、リアルタイム処理でのみ使う。
+  // エンジンで推論する場合は、それ自体が非同期なので使わない
+  async_stream_.reset();
+  if (engine_) {
+    engine_->SetMaxBlockSize(setup.maxSamplesPerBlock);
+    engine_sample_rate_ = vc_core_->GetSampleRate();
+    engine_offline_rendering_ = vc_core_->IsOfflineRendering();
+  } else if (setup.processMode == Steinberg::Vst::kRealtime &&
+             IsAsyncProcessingEnabled(*vc_core_)) {
+    async_stream_ = std::make_unique<common::AsyncAudioStream>(
+        async_handler_, common::RealtimeWorkerPool::Acquire(),
+        setup.maxSamplesPerBlock);
+  }
+  // 非同期モードやエンジンでは 1 チャンネル分しか変換しないので、
+  // Channel Mode によらず 2 つ目以降のコアは用意しない
+  loader_.SetMultiChannelAllowed(!engine_ && !async_stream_);
+  [[maybe_unused]] const auto channel_error_code =
+      vc_core_->SetMultiChannelAllowed(!engine_ && !async_stream_);
+  vc_core_->GetStandbyCores()->Prefetch(setup.sampleRate,
+                                        vc_core_->GetSpeakerTableStorage(),
+                                        vc_core_->GetLoadedModelFile());
+  // 読み込み中のモデルは古いサンプリング周波数で用意されているので、やり直す。
+  // 2 つ目以降のコアを用意し直す必要がある場合も、読み込みとして要求する
+  if (vc_core_->TakeModelLoadRequest() || model_load_pending_) {
+    RequestModelLoad();
+  }
   return AudioEffect::setupProcessing(setup);
 }
 
 auto PLUGIN_API Processor::setActive(const TBool state) -> tresult {
   if (state) {
     // メモリの確保など
+    std::lock_guard<std::mutex> lock(mtx_);
+    AdoptEngineConnection();
   } else {
     // メモリの解放など
+    // ワーカースレッドで処理中のものがあれば、終わるのを待つ
+    if (async_stream_) {
+      async_stream_->Reset();
+    }
     std::lock_guard<std::mutex> lock(mtx_);
-    const auto error_code = vc_core_.GetCore()->ResetContext();
+    const auto error_code = vc_core_->ResetContext();
     assert(error_code == common::ErrorCode::kSuccess);
   }
   return AudioEffect::setActive(state);
 }
 
+// エンジンへの接続が済んでいれば、以降はエンジンで推論する。
+// 処理の経路と遅延が変わるので、オーディオスレッドが止まっている
+// setupProcessing() と setActive(true) でのみ、mtx_ を取得した状態で呼ぶ
+void Processor::AdoptEngineConnection() {
+  if (engine_ || !engine_connection_.valid() ||
+      engine_connection_.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready) {
+    return;
+  }
+  engine_ = engine_connection_.get();
+  engine_connection_pool_.reset();
+  if (!engine_) {
+    return;
+  }
+  async_stream_.reset();
+  loader_.SetMultiChannelAllowed(false);
+  [[maybe_unused]] const auto channel_error_code =
+      vc_core_->SetMultiChannelAllowed(false);
+  engine_->SetMaxBlockSize(std::max(max_block_size_, 1));
+  engine_->SendState(vc_core_->GetParameterState());
+  engine_sample_rate_ = vc_core_->GetSampleRate();
+  engine_offline_rendering_ = vc_core_->IsOfflineRendering();
+}
+
 // TODO(bug): tail を設定する
 
 // メイン処理
 auto PLUGIN_API Processor::process(ProcessData& data) -> tresult {
-  // パラメータの変更があった場合
-  if (data.inputParameterChanges != nullptr) {
-    const auto n_parameter_changed =
-        data.inputParameterChanges->getParameterCount();
-    for (auto index = 0; index < n_parameter_changed; ++index) {
-      // バッファの中で複数回同じパラメータの変更があることが考慮される
-      auto* const param_queue =
-          data.inputParameterChanges->getParameterData(index);
-      if (param_queue == nullptr) {
-        continue;
-      }
-      ParamValue value;
-      int sample_offset;
-      const auto n_points = param_queue->getPointCount();
-      if (n_points <= 0) {
-        continue;
-      }
-      if (param_queue->getPoint(n_points - 1, sample_offset, value) !=
-          kResultTrue) {
-        continue;
-      }
-      unreflected_params_[param_queue->getParameterId()] = value;
-    }
+  if (engine_) {
+    return ProcessEngine(data);
+  }
+  if (async_stream_) {
+    return ProcessAsync(data);
   }
 
+  // パラメータの変更があった場合
+  ForEachParameterChange(
+      data, [this](const ParamID id, const ParamValue value) {
+        unreflected_params_.Push(id, value);
+      });
+
   std::unique_lock<std::mutex> lock(mtx_, std::try_to_lock);
   // ファイルの読み込み中はパラメータ変更の処理を先送りにし、
   // 無音を出力する
@@ -140,93 +389,266 @@ auto PLUGIN_API Processor::process(ProcessData& data) -> tresult {
     return kResultTrue;
   }
 
-  for (const auto [vst_param_id, value] : unreflected_params_) {
-    const auto param_id = static_cast<common::ParameterID>(vst_param_id);
-    const auto& param = common::kSchema.GetParameter(param_id);
-    if (const auto* const num_param =
-            std::get_if<common::NumberParameter>(&param)) {
-      const auto denormalized_value = Denormalize(*num_param, value);
-      const auto error_code =
-          vc_core_.SetParameter(param_id, denormalized_value);
-      assert(error_code == common::ErrorCode::kSuccess);
-      assert(denormalized_value ==
-             std::get<double>(vc_core_.GetParameterState().GetValue(param_id)));
-    } else if (const auto* const list_param =
-                   std::get_if<common::ListParameter>(&param)) {
-      const auto denormalized_value = Denormalize(*list_param, value);
-      const auto error_code =
-          vc_core_.SetParameter(param_id, denormalized_value);
-      assert(error_code == common::ErrorCode::kSuccess);
-    }
-  }
-  unreflected_params_.clear();
-
-  if (data.numInputs == 0 || data.numOutputs == 0 || data.numSamples == 0) {
-    // 何もしない
-    return kResultOk;
-  }
+  ApplyUnreflectedParameters();
+  AdoptLoadedProcessor();
 
-  // double は処理しない
-  if (data.symbolicSampleSize == Steinberg::Vst::kSample64) {
+  if (!HasProcessableBuses(data)) {
     return kResultOk;
   }
-
-  // チャンネル数を確認
-  if (data.inputs[0].numChannels < 1) {
+  if (vc_core_->IsFanOut()) {
+    ProcessVoices(data);
     return kResultOk;
   }
-  if (data.outputs[0].numChannels < 1) {
+  ClearAuxOutputs(data);
+  if (const auto n_channels =
+          GetNIndependentChannels(data, vc_core_->GetNChannels());
+      n_channels >= 2) {
+    ProcessChannels(data, n_channels);
     return kResultOk;
   }
-
-  // 出力バス 0 のチャンネル 0 に入力をコピー
-  const float* const in0 = data.inputs[0].channelBuffers32[0];
-  float* const out0 = data.outputs[0].channelBuffers32[0];
-  std::memmove(out0, in0, data.numSamples * sizeof(float));
-  if (data.inputs[0].numChannels >= 2) {
-    auto* const in1 = data.inputs[0].channelBuffers32[1];
-    for (auto i = 0; i < data.numSamples; ++i) {
-      out0[i] += in1[i];
-      out0[i] *= 0.5;
-    }
-  }
+  float* const out0 = MixDownToOutput(data);
 
   // サイレンスフラグの確認
   if (data.inputs[0].silenceFlags) {
     data.outputs[0].silenceFlags = data.inputs[0].silenceFlags;
-    if (in0 != out0) {
+    if (data.inputs[0].channelBuffers32[0] != out0) {
       std::memset(out0, 0, data.numSamples * sizeof(float));
     }
     return kResultOk;
   }
 
   // 無音チェック
-  auto sil = true;
-  for (auto i = 0; i < data.numSamples; ++i) {
-    if (out0[i] != 0.0F) {
-      sil = false;
-      break;
-    }
-  }
   // TODO(bug): 遅延させる
-  if (sil) {
+  if (IsSilent(out0, data.numSamples)) {
     data.outputs[0].silenceFlags = 1U;
   } else {
-    // VC
-    [[maybe_unused]] const auto error_code =
-        vc_core_.GetCore()->Process(out0, out0, data.numSamples);
-    // TODO(bug): error_code に基づいてサイレンスフラグを立てる
+    auto buffers = std::array<float*, 1>{out0};
+    Convert(buffers.data(), 1, data.numSamples);
+  }
+
+  CopyToOtherOutputChannels(data);
+
+  return kResultOk;
+}
+
+// Dual Mono (Channel Mode) の場合に、各チャンネルを別々の設定で変換する。
+// mtx_ を取得した状態で呼ぶ
+void Processor::ProcessChannels(ProcessData& data, const int n_channels) {
+  CopyToOutputChannels(data, n_channels);
+  auto buffers = std::array<float*, common::ProcessorProxy::kMaxNChannels>();
+  auto silent = true;
+  for (auto ch = 0; ch < n_channels; ++ch) {
+    buffers[ch] = data.outputs[0].channelBuffers32[ch];
+    silent = silent && IsSilent(buffers[ch], data.numSamples);
+  }
+  if (silent) {
+    data.outputs[0].silenceFlags = (1ULL << n_channels) - 1;
+    return;
   }
+  Convert(buffers.data(), n_channels, data.numSamples);
+}
+
+// Fan-Out (Channel Mode) の場合に、モノラルにまとめた入力を 1 回だけ解析し、
+// 各声を出力バス 0 から順に書き込む。
+// ホストが有効にしていないバスの声も、状態を揃えるため voice_buffer_ に合成する。
+// mtx_ を取得した状態で呼ぶ
+void Processor::ProcessVoices(ProcessData& data) {
+  const auto n_voices = vc_core_->GetNChannels();
+  const auto use_voice_buffer =
+      static_cast<std::size_t>(data.numSamples) * (n_voices - 1) <=
+      voice_buffer_.size();
+  auto buffers = std::array<float*, common::ProcessorProxy::kMaxNVoices>();
+  buffers[0] = MixDownToOutput(data);
+  for (auto voice = 1; voice < n_voices; ++voice) {
+    if (voice < data.numOutputs && data.outputs[voice].numChannels >= 1) {
+      buffers[voice] = data.outputs[voice].channelBuffers32[0];
+    } else if (use_voice_buffer) {
+      buffers[voice] = voice_buffer_.data() + (voice - 1) * data.numSamples;
+    } else {
+      // setupProcessing() より大きいブロックが来た
+      ClearAuxOutputs(data);
+      return;
+    }
+  }
+  if (data.inputs[0].silenceFlags || IsSilent(buffers[0], data.numSamples)) {
+    std::memset(buffers[0], 0, data.numSamples * sizeof(float));
+    data.outputs[0].silenceFlags = (1ULL << data.outputs[0].numChannels) - 1;
+    ClearAuxOutputs(data);
+    return;
+  }
+  Convert(buffers.data(), n_voices, data.numSamples);
+  for (auto bus = 0; bus < data.numOutputs; ++bus) {
+    data.outputs[bus].silenceFlags = 0;
+    if (bus < n_voices) {
+      CopyToOtherOutputChannels(data, bus);
+    } else {
+      for (auto ch = 0; ch < data.outputs[bus].numChannels; ++ch) {
+        std::memset(data.outputs[bus].channelBuffers32[ch], 0,
+                    data.numSamples * sizeof(float));
+      }
+    }
+  }
+}
 
-  // 出力がステレオなら複製する
-  if (data.outputs[0].numChannels >= 2) {
-    auto* const out1 = data.outputs[0].channelBuffers32[1];
-    memcpy(out1, out0, data.numSamples * sizeof(float));
+// 非同期モード (環境変数 BEATRICE_ASYNC_PROCESSING=1 か、計測結果で勧められた
+// 場合) のリアルタイム処理。
+// 変換はプロセス内で共有するワーカースレッドで行い、出力は 1 ブロック分遅れる。
+// ワーカー側では mtx_ を取得して同期モードと同じ処理を行う
+auto Processor::ProcessAsync(ProcessData& data) -> tresult {
+  ForEachParameterChange(
+      data, [this](const ParamID id, const ParamValue value) {
+        async_stream_->PushParameterChange(id, value);
+      });
+  if (!HasProcessableBuses(data)) {
+    return kResultOk;
   }
+  ClearAuxOutputs(data);
+  float* const out0 = MixDownToOutput(data);
+  async_stream_->Process(out0, data.numSamples,
+                         data.inputs[0].silenceFlags != 0);
+  CopyToOtherOutputChannels(data);
+  return kResultOk;
+}
 
+// 別プロセスのエンジン (環境変数 BEATRICE_ENGINE=1) で推論する場合の処理。
+// パラメータは vc_core_ に反映した上でエンジンにも送り、音声は共有メモリ経由で
+// 受け渡す。出力は最大ブロックサイズ分遅れる
+auto Processor::ProcessEngine(ProcessData& data) -> tresult {
+  ForEachParameterChange(
+      data, [this](const ParamID id, const ParamValue value) {
+        unreflected_params_.Push(id, value);
+      });
+  // vc_core_ は他のスレッドから変更されるので、ロックを取れた時にだけ読む
+  if (std::unique_lock<std::mutex> lock(mtx_, std::try_to_lock);
+      lock.owns_lock()) {
+    ApplyUnreflectedParameters();
+    engine_sample_rate_ = vc_core_->GetSampleRate();
+    engine_offline_rendering_ = vc_core_->IsOfflineRendering();
+  }
+  if (!HasProcessableBuses(data)) {
+    return kResultOk;
+  }
+  ClearAuxOutputs(data);
+  float* const out0 = MixDownToOutput(data);
+  engine_->Process(out0, data.numSamples, data.inputs[0].silenceFlags != 0,
+                   engine_sample_rate_, engine_offline_rendering_);
+  CopyToOtherOutputChannels(data);
   return kResultOk;
 }
 
+auto PLUGIN_API Processor::getLatencySamples() -> uint32 {
+  std::lock_guard<std::mutex> lock(mtx_);
+  // エンジンで推論する場合は、vc_core_ で処理しない
+  if (engine_) {
+    return static_cast<uint32>(engine_->GetLatency());
+  }
+  const auto async_latency = async_stream_ ? async_stream_->GetLatency() : 0;
+  return static_cast<uint32>(async_latency + load_leveling_latency_);
+}
+
+void Processor::AsyncHandler::OnParameterChange(const std::uint32_t id,
+                                                const double value) {
+  processor_.unreflected_params_.Push(id, value);
+}
+
+void Processor::AsyncHandler::ProcessBlock(float* const buffer,
+                                           const int n_samples,
+                                           const bool silent) {
+  std::unique_lock<std::mutex> lock(processor_.mtx_, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    std::memset(buffer, 0, n_samples * sizeof(float));
+    return;
+  }
+  processor_.ApplyUnreflectedParameters();
+  processor_.AdoptLoadedProcessor();
+  if (n_samples == 0 || silent || IsSilent(buffer, n_samples)) {
+    return;
+  }
+  auto buffers = std::array<float*, 1>{buffer};
+  processor_.Convert(buffers.data(), 1, n_samples);
+}
+
+// mtx_ を取得した状態で呼ぶ
+void Processor::ApplyUnreflectedParameters() {
+  unreflected_params_.Drain([this](const std::uint32_t vst_param_id,
+                                   const double value) {
+    const auto param_id = static_cast<common::ParameterID>(vst_param_id);
+    // ID の範囲の間の欠番は、GetParameter() が例外を投げるので捨てる
+    if (!common::kSchema.Contains(param_id)) {
+      return;
+    }
+    const auto& param = common::kSchema.GetParameter(param_id);
+    if (const auto* const num_param =
+            std::get_if<common::NumberParameter>(&param)) {
+      const auto denormalized_value = Denormalize(*num_param, value);
+      const auto error_code =
+          vc_core_->SetParameter(param_id, denormalized_value);
+      assert(error_code == common::ErrorCode::kSuccess);
+      assert(denormalized_value == std::get<double>(
+                                       vc_core_->GetParameterState().GetValue(
+                                           param_id)));
+    } else if (const auto* const list_param =
+                   std::get_if<common::ListParameter>(&param)) {
+      const auto denormalized_value = Denormalize(*list_param, value);
+      const auto error_code =
+          vc_core_->SetParameter(param_id, denormalized_value);
+      assert(error_code == common::ErrorCode::kSuccess);
+    }
+    MarkParameterChanged(param_id);
+  });
+  // Channel Mode の変更で 2 チャンネル目のコアの用意や破棄が必要になった
+  if (vc_core_->TakeModelLoadRequest()) {
+    RequestModelReload();
+  }
+}
+
+// mtx_ を取得した状態で呼ぶ
+void Processor::Convert(float* const* const buffers, const int n_channels,
+                        const int n_samples) {
+  // 差し替え直後のブロックでは、差し替え前のモデルの出力からクロスフェードする。
+  // Channel Mode の切り替えでチャンネル数や使い方が変わった場合は行わない
+  auto* const previous = loader_.GetPrevious();
+  const auto crossfade =
+      previous != nullptr && previous->GetNChannels() >= n_channels &&
+      previous->IsFanOut() == vc_core_->IsFanOut() &&
+      static_cast<std::size_t>(n_samples) * n_channels <=
+          crossfade_buffer_.size();
+  auto crossfade_buffers =
+      std::array<float*, common::ProcessorProxy::kMaxNVoices>();
+  if (crossfade) {
+    for (auto ch = 0; ch < n_channels; ++ch) {
+      crossfade_buffers[ch] = crossfade_buffer_.data() + ch * n_samples;
+      std::memcpy(crossfade_buffers[ch], buffers[ch],
+                  n_samples * sizeof(float));
+    }
+    [[maybe_unused]] const auto previous_error_code =
+        previous->Process(crossfade_buffers.data(), n_channels, n_samples);
+  }
+  const auto start = std::chrono::steady_clock::now();
+  [[maybe_unused]] const auto error_code =
+      vc_core_->Process(buffers, n_channels, n_samples);
+  // TODO(bug): error_code に基づいてサイレンスフラグを立てる
+  if (!vc_core_->IsOfflineRendering() &&
+      quality_controller_.Measure(
+          std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                        start)
+              .count(),
+          n_samples / vc_core_->GetSampleRate())) {
+    [[maybe_unused]] const auto quality_error_code =
+        vc_core_->SetQualityLevel(quality_controller_.GetLevel());
+  }
+  if (crossfade) {
+    for (auto ch = 0; ch < n_channels; ++ch) {
+      for (auto i = 0; i < n_samples; ++i) {
+        const auto t =
+            static_cast<float>(i + 1) / static_cast<float>(n_samples);
+        buffers[ch][i] =
+            buffers[ch][i] * t + crossfade_buffers[ch][i] * (1.0F - t);
+      }
+    }
+  }
+}
+
 // プロジェクトやプリセットをロードした時に呼ばれる。
 // kResultFalse を返した場合、StudioRack などでは
 // Controller::setComponentState が呼ばれなくなるため注意が必要。
@@ -245,14 +667,18 @@ auto PLUGIN_API Processor::setState(IBStream* const state) -> tresult {
   // Controller 側の状態との整合性を維持するため、
   // Controller 側や Host から送られた設定値は、たとえ不正なものでも
   // なるべくそのまま保持する。
-  [[maybe_unused]] const auto error_code = vc_core_.Read(iss);
+  [[maybe_unused]] const auto error_code = vc_core_->Read(iss);
+  if (engine_) {
+    engine_->SendState(vc_core_->GetParameterState());
+  }
+  RequestModelLoadIfNeeded();
   return kResultTrue;
 }
 
 auto PLUGIN_API Processor::getState(IBStream* const state) -> tresult {
   std::lock_guard<std::mutex> lock(mtx_);
   auto oss = std::ostringstream(std::ios::binary);
-  if (vc_core_.Write(oss) != common::ErrorCode::kSuccess) {
+  if (vc_core_->Write(oss) != common::ErrorCode::kSuccess) {
     return kResultFalse;
   }
   auto state_string = oss.str();
@@ -293,10 +719,150 @@ auto PLUGIN_API Processor::notify(IMessage* const message) -> tresult {
     // Controller 側や Host から送られた設定値は、たとえ不正なものでも
     // なるべくそのまま保持する。
     [[maybe_unused]] const auto error_code =
-        vc_core_.SetParameter(param_id, value);
+        vc_core_->SetParameter(param_id, value);
+    MarkParameterChanged(param_id);
+    RequestModelLoadIfNeeded();
+    return kResultTrue;
+  }
+  if (std::strcmp(message_id, "get_memory_footprint") == 0) {
+    auto report = std::string();
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      report = vc_core_->GetMemoryFootprint().ToString();
+    }
+    // Controller に返す
+    if (const auto reply = Steinberg::owned(allocateMessage())) {
+      reply->setMessageID("memory_footprint");
+      reply->getAttributes()->setBinary("data", report.data(),
+                                        static_cast<uint32>(report.size()));
+      sendMessage(reply);
+    }
+    return kResultTrue;
+  }
+  if (std::strcmp(message_id, "get_quality_report") == 0) {
+    auto report = std::string();
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      report = quality_controller_.GetReport();
+      report += common::StageTimings::ToString(
+          vc_core_->GetCore()->GetLoadTimings());
+      if (engine_) {
+        report += engine_->GetReport();
+      }
+    }
+    if (const auto reply = Steinberg::owned(allocateMessage())) {
+      reply->setMessageID("quality_report");
+      reply->getAttributes()->setBinary("data", report.data(),
+                                        static_cast<uint32>(report.size()));
+      sendMessage(reply);
+    }
     return kResultTrue;
   }
   return AudioEffect::notify(message);
 }
 
+// mtx_ を取得した状態で呼ぶ
+void Processor::MarkParameterChanged(const common::ParameterID param_id) {
+  if (engine_) {
+    // 文字列のパラメータはオーディオスレッドからは変更されないので、
+    // 状態全体を送ってよい
+    const auto& value = vc_core_->GetParameterState().GetValue(param_id);
+    if (std::holds_alternative<std::unique_ptr<std::u8string>>(value)) {
+      engine_->SendState(vc_core_->GetParameterState());
+    } else {
+      engine_->PushParameterChange(param_id, value);
+    }
+    return;
+  }
+  const auto index = static_cast<int>(param_id);
+  if (model_load_pending_ && index >= 0 &&
+      index < static_cast<int>(params_changed_during_load_.size())) {
+    params_changed_during_load_.set(index);
+  }
+}
+
+// mtx_ を取得した状態で呼ぶ
+void Processor::RequestModelLoad() {
+  // エンジンは送られた状態から自身で読み込む
+  if (engine_) {
+    return;
+  }
+  loader_.Request(vc_core_->GetParameterState(), vc_core_->GetSampleRate(),
+                  vc_core_->IsOfflineRendering(),
+                  vc_core_->IsMultiChannelAllowed(),
+                  vc_core_->GetSpeakerTableStorage(),
+                  vc_core_->GetStandbyCores());
+  model_load_pending_ = true;
+  params_changed_during_load_.reset();
+}
+
+// オーディオスレッドから mtx_ を取得した状態で呼ぶ。
+// 直前の読み込み要求を元に、別スレッドで Channel Mode と Fan-Out Voices だけを
+// 変えて読み込み直す
+void Processor::RequestModelReload() {
+  if (engine_) {
+    return;
+  }
+  for (const auto param_id : {common::ParameterID::kChannelMode,
+                              common::ParameterID::kFanOutVoices}) {
+    loader_.RequestReload(
+        param_id,
+        std::get<int>(vc_core_->GetParameterState().GetValue(param_id)));
+  }
+  model_load_pending_ = true;
+  // 直前の要求より後に変更されたものも含めて、全てのパラメータを引き継ぐ
+  params_changed_during_load_.set();
+}
+
+// mtx_ を取得した状態で呼ぶ
+void Processor::RequestModelLoadIfNeeded() {
+  if (vc_core_->TakeModelLoadRequest()) {
+    RequestModelLoad();
+  }
+}
+
+// オーディオスレッドから mtx_ を取得した状態で呼ぶ
+void Processor::AdoptLoadedProcessor() {
+  // 前のブロックで差し替えた古い方は、別スレッドで破棄させる
+  loader_.RetirePrevious();
+  if (!model_load_pending_ || !loader_.Adopt(vc_core_)) {
+    return;
+  }
+  model_load_pending_ = false;
+  // 処理モードは要求時のものでバックグラウンドスレッドが設定済み。
+  // 要求後に setupProcessing() で変わった場合は、要求し直されている
+  assert(vc_core_->IsOfflineRendering() ==
+         loader_.GetPrevious()->IsOfflineRendering());
+  // 計測済みのモデルであれば、負荷を実測する前に余裕のある品質にしておく
+  if (const auto& profile = vc_core_->GetPerformanceProfile();
+      profile && !vc_core_->IsOfflineRendering()) {
+    quality_controller_.SetLevel(profile->GetRecommendedQualityLevel());
+  }
+  [[maybe_unused]] const auto quality_error_code =
+      vc_core_->SetQualityLevel(quality_controller_.GetLevel());
+  // 読み込み中に変更されたパラメータを新しい方にも反映する
+  const auto& previous_state = loader_.GetPrevious()->GetParameterState();
+  for (auto i = 0; i < static_cast<int>(params_changed_during_load_.size());
+       ++i) {
+    if (!params_changed_during_load_.test(i)) {
+      continue;
+    }
+    const auto param_id = static_cast<common::ParameterID>(i);
+    // RequestModelReload() は欠番のビットも立てるが、GetValue() は
+    // 例外を投げるので飛ばす
+    if (!common::kSchema.Contains(param_id)) {
+      continue;
+    }
+    const auto& value = previous_state.GetValue(param_id);
+    if (const auto* const int_value = std::get_if<int>(&value)) {
+      [[maybe_unused]] const auto error_code =
+          vc_core_->SetParameter(param_id, *int_value);
+    } else if (const auto* const double_value = std::get_if<double>(&value)) {
+      [[maybe_unused]] const auto error_code =
+          vc_core_->SetParameter(param_id, *double_value);
+    }
+  }
+  params_changed_during_load_.reset();
+}
+
 }  // namespace beatrice::vst
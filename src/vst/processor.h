@@ -3,8 +3,13 @@
 #ifndef BEATRICE_VST_PROCESSOR_H_
 #define BEATRICE_VST_PROCESSOR_H_
 
-#include <map>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <future>  // NOLINT(build/c++11)
+#include <memory>
 #include <mutex>  // NOLINT(build/c++11)
+#include <vector>
 
 #include "vst3sdk/pluginterfaces/base/ibstream.h"
 #include "vst3sdk/pluginterfaces/vst/ivstaudioprocessor.h"
@@ -12,7 +17,14 @@
 #include "vst3sdk/public.sdk/source/vst/vstaudioeffect.h"
 
 // Beatrice
+#include "common/async_audio_stream.h"
+#include "common/async_processor_loader.h"
+#include "common/engine_client.h"
+#include "common/parameter_inbox.h"
+#include "common/parameter_schema.h"
 #include "common/processor_proxy.h"
+#include "common/quality_controller.h"
+#include "common/thread_pool.h"
 
 namespace beatrice::vst {
 
@@ -41,6 +53,7 @@ class Processor : public Steinberg::Vst::AudioEffect {
   auto PLUGIN_API setupProcessing(ProcessSetup& setup) -> tresult SMTG_OVERRIDE;
   auto PLUGIN_API setActive(TBool state) -> tresult SMTG_OVERRIDE;
   auto PLUGIN_API process(ProcessData& data) -> tresult SMTG_OVERRIDE;
+  auto PLUGIN_API getLatencySamples() -> uint32 SMTG_OVERRIDE;
 
   auto PLUGIN_API setState(IBStream* state) -> tresult SMTG_OVERRIDE;
   auto PLUGIN_API getState(IBStream* state) -> tresult SMTG_OVERRIDE;
@@ -54,9 +67,67 @@ class Processor : public Steinberg::Vst::AudioEffect {
 
  private:
   std::mutex mtx_;
-  common::ProcessorProxy vc_core_;
-  // メモリ確保が挟まるのが望ましくないが……
-  std::map<ParamID, ParamValue> unreflected_params_;
+  std::unique_ptr<common::ProcessorProxy> vc_core_;
+  // ホストから受け取り、まだ vc_core_ に反映していない数値パラメータの変更。
+  // 文字列のパラメータは notify() で mtx_ を取得して直接反映する
+  common::ParameterInbox<static_cast<std::size_t>(common::ParameterID::kEnd)>
+      unreflected_params_;
+  // モデルは別スレッドで読み込み、process() で差し替える
+  common::AsyncProcessorLoader loader_;
+  bool model_load_pending_ = false;
+  // 読み込み要求の後に変更されたパラメータ。差し替え時に新しい方へ反映する
+  std::bitset<static_cast<std::size_t>(common::ParameterID::kEnd)>
+      params_changed_during_load_;
+  // 差し替え時のクロスフェードに使う
+  std::vector<float> crossfade_buffer_;
+  // Fan-Out で、ホストが有効にしていない出力バスの声を書き込む先
+  std::vector<float> voice_buffer_;
+  // 負荷の平準化によって増える遅延 [samples]。エンジンで推論する場合は含めない
+  int load_leveling_latency_ = 0;
+  // リアルタイム処理で間に合わなくなってきたら品質を下げる
+  common::QualityController quality_controller_;
+
+  // 非同期モードで、ワーカースレッドから呼ばれる処理
+  class AsyncHandler : public common::AsyncAudioStream::Handler {
+   public:
+    explicit AsyncHandler(Processor& processor) : processor_(processor) {}
+    void OnParameterChange(std::uint32_t id, double value) override;
+    void ProcessBlock(float* buffer, int n_samples, bool silent) override;
+
+   private:
+    Processor& processor_;
+  };
+  AsyncHandler async_handler_{*this};
+  // 非同期モードの場合のみ作られる。
+  // ワーカーの処理が他のメンバを参照しなくなってから破棄されるよう、最後に宣言する
+  std::unique_ptr<common::AsyncAudioStream> async_stream_;
+  // 別プロセスのエンジンで推論する場合のみ作られる
+  std::unique_ptr<common::EngineClient> engine_;
+  // エンジンの起動と接続は数秒かかることがあるので、ホストのスレッドを
+  // 待たせないようスレッドプールで行い、接続できるまではプロセス内で処理する
+  std::shared_ptr<common::ThreadPool> engine_connection_pool_;
+  std::future<std::unique_ptr<common::EngineClient>> engine_connection_;
+  int max_block_size_ = 0;
+  // ProcessEngine() で、最後に mtx_ を取得できた時の vc_core_ の設定。
+  // オーディオスレッドと、それが止まっている時のみ触る
+  double engine_sample_rate_ = 0.0;
+  bool engine_offline_rendering_ = false;
+
+  auto ProcessAsync(ProcessData& data) -> tresult;
+  auto ProcessEngine(ProcessData& data) -> tresult;
+  // unreflected_params_ の変更を vc_core_ に反映する。mtx_ を取得した状態で呼ぶ
+  void ApplyUnreflectedParameters();
+  void ProcessChannels(ProcessData& data, int n_channels);
+  void ProcessVoices(ProcessData& data);
+  // buffers の n_channels 個のチャンネルを in-place で変換する。
+  // mtx_ を取得した状態で呼ぶ
+  void Convert(float* const* buffers, int n_channels, int n_samples);
+  void MarkParameterChanged(common::ParameterID param_id);
+  void RequestModelLoad();
+  void RequestModelReload();
+  void RequestModelLoadIfNeeded();
+  void AdoptLoadedProcessor();
+  void AdoptEngineConnection();
 };
 
 }  // namespace beatrice::vst
@@ -124,6 +124,13 @@ class SurfaceNoiseMaps {
     return dither_b_[index];
   }
 
+  [[nodiscard]] auto GetMemoryUsage() const -> std::size_t {
+    return (low_.capacity() + grain_.capacity() + baked_.capacity() +
+            dither_r_.capacity() + dither_g_.capacity() +
+            dither_b_.capacity()) *
+           sizeof(float);
+  }
+
  private:
   struct AxisSample {
     int index0 = 0;